@@ -0,0 +1,112 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <memory>
+
+#include "heap_object.hpp"
+
+namespace anb {
+
+template <typename AllocatorT>
+struct string;
+template <typename AllocatorT>
+struct list;
+template <typename AllocatorT>
+struct dictionary;
+
+//=====================================================================
+// Allocator requirements
+//
+//   template <template <class> typename HeapObjT>
+//   HeapObjT<A>* alloc();                   construct a heap object
+//
+//   template <template <class> typename HeapObjT>
+//   void dealloc(HeapObjT<A>* ptr);         destroy and release it
+//
+// and optionally, for raw memory:
+//
+//   void* allocate(std::size_t bytes, std::size_t alignment);
+//   void deallocate(void* ptr, std::size_t bytes, std::size_t alignment);
+//
+// Raw allocation is required for tuples. When it's available, the
+// buffers the heap objects allocate on their own (string buffers, spilled
+// list elements, dictionary entries and index tables) come from it too,
+// so an arena or pool owns every byte of the objects it created.
+// Otherwise those buffers come from the global heap.
+//=====================================================================
+template <typename AllocatorT>
+concept heap_allocator = requires(AllocatorT& allocator,
+                                  heap_object<AllocatorT>* heap_ptr) {
+  { allocator.template alloc<string>() } -> std::same_as<string<AllocatorT>*>;
+  { allocator.template alloc<list>() } -> std::same_as<list<AllocatorT>*>;
+  {
+    allocator.template alloc<dictionary>()
+  } -> std::same_as<dictionary<AllocatorT>*>;
+  allocator.template dealloc<heap_object>(heap_ptr);
+};
+
+namespace detail {
+
+template <typename AllocatorT>
+concept raw_allocator = requires(AllocatorT& allocator, void* ptr,
+                                 std::size_t n) {
+  { allocator.allocate(n, n) } -> std::same_as<void*>;
+  allocator.deallocate(ptr, n, n);
+};
+
+//=====================================================================
+// Standard allocator drawing from the raw interface of AllocatorT, used
+// by the containers inside heap objects. Falls back to std::allocator
+// when AllocatorT has no raw interface or when default constructed.
+//=====================================================================
+template <typename T, typename AllocatorT>
+class container_allocator {
+ public:
+  using value_type = T;
+
+  container_allocator() = default;
+
+  container_allocator(AllocatorT& allocator) : allocator_(&allocator) {}
+
+  template <typename U>
+  container_allocator(const container_allocator<U, AllocatorT>& other)
+      : allocator_(other.allocator()) {}
+
+  T* allocate(const std::size_t n) {
+    if constexpr (raw_allocator<AllocatorT>) {
+      if (allocator_ != nullptr) {
+        return static_cast<T*>(allocator_->allocate(n * sizeof(T), alignof(T)));
+      }
+    }
+    return std::allocator<T>{}.allocate(n);
+  }
+
+  void deallocate(T* ptr, const std::size_t n) {
+    if constexpr (raw_allocator<AllocatorT>) {
+      if (allocator_ != nullptr) {
+        allocator_->deallocate(ptr, n * sizeof(T), alignof(T));
+        return;
+      }
+    }
+    std::allocator<T>{}.deallocate(ptr, n);
+  }
+
+  AllocatorT* allocator() const { return allocator_; }
+
+  template <typename U>
+  bool operator==(const container_allocator<U, AllocatorT>& other) const {
+    if constexpr (raw_allocator<AllocatorT>) {
+      return allocator_ == other.allocator();
+    } else {
+      return true;
+    }
+  }
+
+ private:
+  AllocatorT* allocator_ = nullptr;
+};
+
+}  // namespace detail
+
+}  // namespace anb
@@ -0,0 +1,411 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <span>
+#include <stdexcept>
+
+#include "object.hpp"
+
+namespace anb {
+
+//=====================================================================
+// Arithmetic on numeric objects
+//
+// - int32 with int32 stays int32 while the exact result fits, and is
+//   promoted to float64 on overflow (there is no wider integer type in
+//   the nanbox)
+// - Anything with a float64 is computed as double, int32 operands are
+//   converted first
+// - Division always produces a float64
+// - A NaN result, or any non numeric operand, produces the qnan object
+//
+// The list kernels at the bottom work on the nanbox words directly, with
+// branch free loops the compiler can vectorize.
+//=====================================================================
+namespace detail {
+
+inline constexpr std::uint64_t int32_signature =
+    nanbox::fixed_type_int32_value;
+inline constexpr std::uint64_t quiet_nan_bits =
+    nanbox::nan_exponent_mask | nanbox::nan_quiet_mask;
+
+constexpr bool is_int32_bits(const std::uint64_t bits) {
+  return (bits & nanbox::signature_mask) == int32_signature;
+}
+
+constexpr bool is_float64_bits(const std::uint64_t bits) {
+  return (bits & quiet_nan_bits) != quiet_nan_bits;
+}
+
+constexpr std::int32_t int32_from_bits(const std::uint64_t bits) {
+  return static_cast<std::int32_t>(
+      static_cast<std::uint32_t>(bits & nanbox::fixed_type_int32_data_mask));
+}
+
+// Value of an int32 or float64 word as double, garbage for anything else
+constexpr double number_from_bits(const std::uint64_t bits) {
+  return is_int32_bits(bits) ? static_cast<double>(int32_from_bits(bits))
+                             : std::bit_cast<double>(bits);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> number_result(const double value) {
+  // Hardware NaNs may have the sign bit set, which is a heap pointer here
+  return (value != value) ? object<AllocatorT>::make_qnan()
+                          : object<AllocatorT>(value);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> int_result(const std::int64_t value) {
+  if (value < std::numeric_limits<std::int32_t>::min() ||
+      value > std::numeric_limits<std::int32_t>::max()) {
+    return object<AllocatorT>(static_cast<double>(value));
+  }
+  return object<AllocatorT>(static_cast<std::int32_t>(value));
+}
+
+enum class arith_op { add, sub, mul, div };
+
+template <arith_op Op>
+constexpr double apply(const double lhs, const double rhs) {
+  if constexpr (Op == arith_op::add) {
+    return lhs + rhs;
+  } else if constexpr (Op == arith_op::sub) {
+    return lhs - rhs;
+  } else if constexpr (Op == arith_op::mul) {
+    return lhs * rhs;
+  } else {
+    return lhs / rhs;
+  }
+}
+
+template <arith_op Op, typename AllocatorT>
+object<AllocatorT> arith(const object<AllocatorT>& lhs,
+                         const object<AllocatorT>& rhs) {
+  const std::uint64_t lhs_bits = lhs.nanbox_value();
+  const std::uint64_t rhs_bits = rhs.nanbox_value();
+
+  if (is_float64_bits(lhs_bits) && is_float64_bits(rhs_bits)) {
+    return number_result<AllocatorT>(apply<Op>(
+        std::bit_cast<double>(lhs_bits), std::bit_cast<double>(rhs_bits)));
+  }
+
+  const bool lhs_int = is_int32_bits(lhs_bits);
+  const bool rhs_int = is_int32_bits(rhs_bits);
+  if constexpr (Op != arith_op::div) {
+    if (lhs_int && rhs_int) {
+      // Exact in 64 bits for every pair of int32s
+      const std::int64_t lhs_val = int32_from_bits(lhs_bits);
+      const std::int64_t rhs_val = int32_from_bits(rhs_bits);
+      if constexpr (Op == arith_op::add) {
+        return int_result<AllocatorT>(lhs_val + rhs_val);
+      } else if constexpr (Op == arith_op::sub) {
+        return int_result<AllocatorT>(lhs_val - rhs_val);
+      } else {
+        return int_result<AllocatorT>(lhs_val * rhs_val);
+      }
+    }
+  }
+
+  if ((lhs_int || is_float64_bits(lhs_bits)) &&
+      (rhs_int || is_float64_bits(rhs_bits))) {
+    return number_result<AllocatorT>(
+        apply<Op>(number_from_bits(lhs_bits), number_from_bits(rhs_bits)));
+  }
+  return object<AllocatorT>::make_qnan();
+}
+
+}  // namespace detail
+
+template <typename AllocatorT>
+bool is_number(const object<AllocatorT>& obj) {
+  const std::uint64_t bits = obj.nanbox_value();
+  return detail::is_int32_bits(bits) || detail::is_float64_bits(bits);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> add(const object<AllocatorT>& lhs,
+                       const object<AllocatorT>& rhs) {
+  return detail::arith<detail::arith_op::add>(lhs, rhs);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> sub(const object<AllocatorT>& lhs,
+                       const object<AllocatorT>& rhs) {
+  return detail::arith<detail::arith_op::sub>(lhs, rhs);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> mul(const object<AllocatorT>& lhs,
+                       const object<AllocatorT>& rhs) {
+  return detail::arith<detail::arith_op::mul>(lhs, rhs);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> div(const object<AllocatorT>& lhs,
+                       const object<AllocatorT>& rhs) {
+  return detail::arith<detail::arith_op::div>(lhs, rhs);
+}
+
+// Numeric comparison, int32 and float64 compare by value (1 == 1.0), NaNs
+// and non numeric operands are unordered. Use object::compare() for the
+// total order across all types.
+template <typename AllocatorT>
+std::partial_ordering compare_numbers(const object<AllocatorT>& lhs,
+                                      const object<AllocatorT>& rhs) {
+  const std::uint64_t lhs_bits = lhs.nanbox_value();
+  const std::uint64_t rhs_bits = rhs.nanbox_value();
+  if (detail::is_int32_bits(lhs_bits) && detail::is_int32_bits(rhs_bits)) {
+    return detail::int32_from_bits(lhs_bits) <=>
+           detail::int32_from_bits(rhs_bits);
+  }
+  if (!is_number(lhs) || !is_number(rhs)) {
+    return std::partial_ordering::unordered;
+  }
+  return detail::number_from_bits(lhs_bits) <=>
+         detail::number_from_bits(rhs_bits);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> operator+(const object<AllocatorT>& lhs,
+                             const object<AllocatorT>& rhs) {
+  return add(lhs, rhs);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> operator-(const object<AllocatorT>& lhs,
+                             const object<AllocatorT>& rhs) {
+  return sub(lhs, rhs);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> operator*(const object<AllocatorT>& lhs,
+                             const object<AllocatorT>& rhs) {
+  return mul(lhs, rhs);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> operator/(const object<AllocatorT>& lhs,
+                             const object<AllocatorT>& rhs) {
+  return div(lhs, rhs);
+}
+
+//=====================================================================
+// List kernels
+//=====================================================================
+namespace detail {
+
+// Lanes of independent accumulators, so floating point reductions don't
+// serialize on a single register
+inline constexpr std::size_t kernel_lanes = 4;
+
+struct number_scan {
+  bool all_int32 = true;
+  bool all_numeric = true;
+};
+
+template <typename AllocatorT>
+number_scan scan_numbers(const std::span<const object<AllocatorT>> objects) {
+  number_scan result;
+  for (const auto& obj : objects) {
+    const std::uint64_t bits = obj.nanbox_value();
+    const bool is_int = is_int32_bits(bits);
+    result.all_int32 &= is_int;
+    result.all_numeric &= is_int | is_float64_bits(bits);
+  }
+  return result;
+}
+
+template <bool Max, typename AllocatorT>
+object<AllocatorT> extremum(const std::span<const object<AllocatorT>> objects) {
+  if (objects.empty()) {
+    return object<AllocatorT>::make_nothing();
+  }
+  const number_scan scan = scan_numbers(objects);
+  if (!scan.all_numeric) {
+    return object<AllocatorT>::make_qnan();
+  }
+
+  const auto better = [](const auto candidate, const auto current) {
+    return Max ? (candidate > current) : (candidate < current);
+  };
+
+  if (scan.all_int32) {
+    std::int32_t lanes[kernel_lanes];
+    std::fill(std::begin(lanes), std::end(lanes),
+              int32_from_bits(objects[0].nanbox_value()));
+    std::size_t i = 0;
+    for (; i + kernel_lanes <= objects.size(); i += kernel_lanes) {
+      for (std::size_t lane = 0; lane < kernel_lanes; ++lane) {
+        const std::int32_t val =
+            int32_from_bits(objects[i + lane].nanbox_value());
+        lanes[lane] = better(val, lanes[lane]) ? val : lanes[lane];
+      }
+    }
+    for (; i < objects.size(); ++i) {
+      const std::int32_t val = int32_from_bits(objects[i].nanbox_value());
+      lanes[0] = better(val, lanes[0]) ? val : lanes[0];
+    }
+    std::int32_t result = lanes[0];
+    for (const std::int32_t lane : lanes) {
+      result = better(lane, result) ? lane : result;
+    }
+    return object<AllocatorT>(result);
+  }
+
+  double lanes[kernel_lanes];
+  std::fill(std::begin(lanes), std::end(lanes),
+            number_from_bits(objects[0].nanbox_value()));
+  bool has_nan = false;
+  std::size_t i = 0;
+  for (; i + kernel_lanes <= objects.size(); i += kernel_lanes) {
+    for (std::size_t lane = 0; lane < kernel_lanes; ++lane) {
+      const double val = number_from_bits(objects[i + lane].nanbox_value());
+      has_nan |= (val != val);
+      lanes[lane] = better(val, lanes[lane]) ? val : lanes[lane];
+    }
+  }
+  for (; i < objects.size(); ++i) {
+    const double val = number_from_bits(objects[i].nanbox_value());
+    has_nan |= (val != val);
+    lanes[0] = better(val, lanes[0]) ? val : lanes[0];
+  }
+  if (has_nan) {
+    return object<AllocatorT>::make_qnan();
+  }
+  double result = lanes[0];
+  for (const double lane : lanes) {
+    result = better(lane, result) ? lane : result;
+  }
+
+  // Keeps the type of the element that won, an int32 stays an int32
+  for (const auto& obj : objects) {
+    if (number_from_bits(obj.nanbox_value()) == result) {
+      return obj;
+    }
+  }
+  return number_result<AllocatorT>(result);
+}
+
+template <arith_op Op, typename AllocatorT>
+void elementwise(list<AllocatorT>& out, const list<AllocatorT>& lhs,
+                 const list<AllocatorT>& rhs) {
+  if (lhs.objects_.size() != rhs.objects_.size()) {
+    throw std::invalid_argument(
+        "anb::elementwise: operands must have the same size");
+  }
+
+  const std::size_t count = lhs.objects_.size();
+  const std::span<const object<AllocatorT>> lhs_objects(lhs.objects_);
+  const std::span<const object<AllocatorT>> rhs_objects(rhs.objects_);
+
+  const auto is_all_float64 = [](const auto objects) {
+    bool result = true;
+    for (const auto& obj : objects) {
+      result &= is_float64_bits(obj.nanbox_value());
+    }
+    return result;
+  };
+
+  // Computed into a scratch buffer first, out may alias lhs or rhs
+  typename list<AllocatorT>::container_type results(
+      out.objects_.get_allocator());
+  results.resize(count);
+  if (is_all_float64(lhs_objects) && is_all_float64(rhs_objects)) {
+    const object<AllocatorT> qnan = object<AllocatorT>::make_qnan();
+    for (std::size_t i = 0; i < count; ++i) {
+      const double val =
+          apply<Op>(std::bit_cast<double>(lhs_objects[i].nanbox_value()),
+                    std::bit_cast<double>(rhs_objects[i].nanbox_value()));
+      results[i] = (val != val) ? qnan : object<AllocatorT>(val);
+    }
+  } else {
+    for (std::size_t i = 0; i < count; ++i) {
+      results[i] = arith<Op>(lhs_objects[i], rhs_objects[i]);
+    }
+  }
+  out.objects_ = std::move(results);
+}
+
+}  // namespace detail
+
+// Sum of the elements, an int32 when they are all int32 and the sum fits.
+// Floating point sums are accumulated in several lanes, so the rounding
+// may differ from a left to right sum.
+template <typename AllocatorT>
+object<AllocatorT> sum(const list<AllocatorT>& objects) {
+  const std::span<const object<AllocatorT>> elements(objects.objects_);
+  const detail::number_scan scan = detail::scan_numbers(elements);
+  if (!scan.all_numeric) {
+    return object<AllocatorT>::make_qnan();
+  }
+
+  if (scan.all_int32) {
+    // No overflow in 64 bits below 2^32 elements
+    std::int64_t total = 0;
+    for (const auto& obj : elements) {
+      total += detail::int32_from_bits(obj.nanbox_value());
+    }
+    return detail::int_result<AllocatorT>(total);
+  }
+
+  double lanes[detail::kernel_lanes] = {};
+  std::size_t i = 0;
+  for (; i + detail::kernel_lanes <= elements.size();
+       i += detail::kernel_lanes) {
+    for (std::size_t lane = 0; lane < detail::kernel_lanes; ++lane) {
+      lanes[lane] +=
+          detail::number_from_bits(elements[i + lane].nanbox_value());
+    }
+  }
+  for (; i < elements.size(); ++i) {
+    lanes[0] += detail::number_from_bits(elements[i].nanbox_value());
+  }
+  return detail::number_result<AllocatorT>((lanes[0] + lanes[1]) +
+                                           (lanes[2] + lanes[3]));
+}
+
+// Smallest/largest element by numeric value, nothing for an empty list
+template <typename AllocatorT>
+object<AllocatorT> min_of(const list<AllocatorT>& objects) {
+  return detail::extremum<false, AllocatorT>(objects.objects_);
+}
+
+template <typename AllocatorT>
+object<AllocatorT> max_of(const list<AllocatorT>& objects) {
+  return detail::extremum<true, AllocatorT>(objects.objects_);
+}
+
+// out[i] = lhs[i] op rhs[i], out may be one of the operands. Throws
+// std::invalid_argument when lhs and rhs differ in size, out is unchanged.
+template <typename AllocatorT>
+void add(list<AllocatorT>& out, const list<AllocatorT>& lhs,
+         const list<AllocatorT>& rhs) {
+  detail::elementwise<detail::arith_op::add>(out, lhs, rhs);
+}
+
+template <typename AllocatorT>
+void sub(list<AllocatorT>& out, const list<AllocatorT>& lhs,
+         const list<AllocatorT>& rhs) {
+  detail::elementwise<detail::arith_op::sub>(out, lhs, rhs);
+}
+
+template <typename AllocatorT>
+void mul(list<AllocatorT>& out, const list<AllocatorT>& lhs,
+         const list<AllocatorT>& rhs) {
+  detail::elementwise<detail::arith_op::mul>(out, lhs, rhs);
+}
+
+template <typename AllocatorT>
+void div(list<AllocatorT>& out, const list<AllocatorT>& lhs,
+         const list<AllocatorT>& rhs) {
+  detail::elementwise<detail::arith_op::div>(out, lhs, rhs);
+}
+
+}  // namespace anb
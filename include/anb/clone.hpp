@@ -0,0 +1,382 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "object.hpp"
+
+namespace anb {
+
+//=====================================================================
+// Deep clone between allocators
+//
+// Copies an object graph owned by one allocator into another one (of the
+// same or of a different type), e.g. to promote what survived in a
+// scratch arena into a long lived pool:
+//
+//   1. The source graph is measured, and the destination allocator is
+//      asked to preallocate when it provides the optional
+//      `reserve<HeapObjT>(count)` hook
+//   2. Every heap object is recreated with exactly the capacity it needs,
+//      fixed values are copied as raw nanbox words
+//
+// With `deduplicate_shared` set, a heap object referenced from several
+// places is copied once and the copies share it as well, which also makes
+// cyclic graphs clonable (deep_clone() throws std::invalid_argument for
+// cyclic graphs without it). A tuple is only made once all of its
+// elements are, so a cycle closing on a tuple can't be cloned either way
+// and deep_clone() throws std::invalid_argument for it. A cycle leaving
+// through a tuple and closing on a container is fine. The graph is walked
+// with detail::depth_first, so deep nesting doesn't grow the call stack.
+//
+// Tuples need raw allocation (see tuple.hpp), deep_clone() throws
+// std::invalid_argument before copying anything when the graph holds
+// tuples and the destination allocator doesn't provide it. If copying
+// throws part way, the copies made so far are deallocated before the
+// exception propagates.
+//=====================================================================
+struct clone_options {
+  bool deduplicate_shared = false;
+};
+
+struct graph_measure {
+  std::size_t strings = 0;
+  std::size_t lists = 0;
+  std::size_t dictionaries = 0;
+  std::size_t tuples = 0;
+  std::size_t persistent_dictionaries = 0;
+  std::size_t persistent_lists = 0;
+  std::size_t list_elements = 0;
+  std::size_t dictionary_entries = 0;
+  std::size_t tuple_elements = 0;
+  std::size_t persistent_dictionary_entries = 0;
+  std::size_t persistent_list_elements = 0;
+  std::size_t string_bytes = 0;
+  // References closing a cycle, which aren't followed
+  std::size_t cycles = 0;
+  // Those closing a cycle on a tuple, which is only made once all of its
+  // elements are
+  std::size_t tuple_cycles = 0;
+};
+
+namespace detail {
+
+template <typename AllocatorT>
+class measure_visitor {
+ public:
+  struct state_type {};
+
+  measure_visitor(const AllocatorT& allocator, graph_measure& result,
+                  std::unordered_set<const void*>* seen)
+      : allocator_(allocator), result_(result), seen_(seen) {}
+
+  bool enter(const object<AllocatorT>& obj, const node_kind kind,
+             state_type*, state_type&) {
+    if (kind == node_kind::fixed ||
+        (seen_ && !seen_->insert(heap_of(obj)).second)) {
+      return false;
+    }
+
+    switch (kind) {
+      case node_kind::string:
+        ++result_.strings;
+        result_.string_bytes += obj.as_string_heap(allocator_).size();
+        return false;
+      case node_kind::list:
+        ++result_.lists;
+        result_.list_elements += obj.as_list(allocator_).objects_.size();
+        break;
+      case node_kind::dictionary:
+        ++result_.dictionaries;
+        result_.dictionary_entries +=
+            obj.as_dictionary(allocator_).object_dict_.size();
+        break;
+      case node_kind::persistent_dictionary:
+        ++result_.persistent_dictionaries;
+        result_.persistent_dictionary_entries +=
+            obj.as_persistent_dictionary(allocator_).size();
+        break;
+      case node_kind::persistent_list:
+        ++result_.persistent_lists;
+        result_.persistent_list_elements +=
+            obj.as_persistent_list(allocator_).size();
+        break;
+      default:
+        ++result_.tuples;
+        result_.tuple_elements += obj.as_tuple(allocator_).size();
+        break;
+    }
+    return true;
+  }
+
+  void leave(const object<AllocatorT>&, state_type&, state_type*) {}
+
+  void cycle(const object<AllocatorT>& obj, std::size_t, state_type*) {
+    ++result_.cycles;
+    if (kind_of(obj) == node_kind::tuple) {
+      ++result_.tuple_cycles;
+    }
+  }
+
+ private:
+  const AllocatorT& allocator_;
+  graph_measure& result_;
+  std::unordered_set<const void*>* seen_;
+};
+
+template <typename AllocatorT, template <class> typename HeapObjT>
+concept reserving_allocator = requires(AllocatorT& allocator, std::size_t n) {
+  allocator.template reserve<HeapObjT>(n);
+};
+
+template <template <class> typename HeapObjT, typename AllocatorT>
+void reserve_heap(AllocatorT& allocator, const std::size_t count) {
+  if constexpr (reserving_allocator<AllocatorT, HeapObjT>) {
+    if (count > 0) {
+      allocator.template reserve<HeapObjT>(count);
+    }
+  }
+}
+
+// Visits the source graph, every heap object is copied when it's entered
+// (tuples when they're left, they need their elements first) and attached
+// to the copy of its parent
+template <typename DstAllocatorT, typename SrcAllocatorT>
+class graph_cloner {
+ public:
+  struct state_type {
+    node_kind kind = node_kind::list;
+    object<DstAllocatorT> copy = object<DstAllocatorT>::make_nothing();
+    // Tuples: copies of the elements so far
+    std::vector<object<DstAllocatorT>> elements;
+    // Dictionaries and persistent dictionaries: copy of the key whose
+    // value comes next
+    std::optional<object<DstAllocatorT>> key;
+  };
+
+  graph_cloner(DstAllocatorT& dst_allocator,
+               const SrcAllocatorT& src_allocator,
+               const clone_options& options)
+      : dst_allocator_(dst_allocator),
+        src_allocator_(src_allocator),
+        options_(options) {}
+
+  object<DstAllocatorT> clone(const object<SrcAllocatorT>& src) {
+    depth_first(src, *this);
+    return result_;
+  }
+
+  bool enter(const object<SrcAllocatorT>& src, const node_kind kind,
+             state_type* parent, state_type& state) {
+    if (kind == node_kind::fixed) {
+      attach(object<DstAllocatorT>::from_fixed(src), parent);
+      return false;
+    }
+
+    if (options_.deduplicate_shared) {
+      if (const auto it = copies_.find(heap_of(src)); it != copies_.end()) {
+        attach(it->second, parent);
+        return false;
+      }
+    }
+
+    state.kind = kind;
+    switch (kind) {
+      case node_kind::string: {
+        auto copy = object<DstAllocatorT>::make_string_heap(dst_allocator_);
+        remember(src, copy);
+        copy.as_string_heap(dst_allocator_)
+            .set(src.as_string_heap(src_allocator_).view());
+        attach(copy, parent);
+        return false;
+      }
+      case node_kind::tuple:
+        if constexpr (raw_allocator<DstAllocatorT>) {
+          state.elements.reserve(src.as_tuple(src_allocator_).size());
+          return true;
+        } else {
+          // deep_clone() rejects graphs holding tuples before copying them
+          // to an allocator without raw allocation
+          unreachable();
+        }
+      case node_kind::list:
+        state.copy = object<DstAllocatorT>::make_list(dst_allocator_);
+        break;
+      case node_kind::persistent_dictionary:
+        // A trie of its own, built in place
+        state.copy =
+            object<DstAllocatorT>::make_persistent_dictionary(dst_allocator_);
+        break;
+      case node_kind::persistent_list:
+        state.copy =
+            object<DstAllocatorT>::make_persistent_list(dst_allocator_);
+        break;
+      default:
+        state.copy = object<DstAllocatorT>::make_dictionary(dst_allocator_);
+        break;
+    }
+    // Registered before the children so cycles resolve to the copy, and
+    // before anything else can throw so discard() finds it
+    remember(src, state.copy);
+    if (kind == node_kind::list) {
+      state.copy.as_list(dst_allocator_)
+          .objects_.reserve(src.as_list(src_allocator_).objects_.size());
+    } else if (kind == node_kind::dictionary) {
+      state.copy.as_dictionary(dst_allocator_)
+          .object_dict_.reserve(
+              src.as_dictionary(src_allocator_).object_dict_.size());
+    }
+    attach(state.copy, parent);
+    return true;
+  }
+
+  void leave(const object<SrcAllocatorT>& src, state_type& state,
+             state_type* parent) {
+    if constexpr (raw_allocator<DstAllocatorT>) {
+      if (state.kind == node_kind::tuple) {
+        auto copy =
+            object<DstAllocatorT>::make_tuple(dst_allocator_, state.elements);
+        remember(src, copy);
+        attach(copy, parent);
+      }
+    }
+  }
+
+  // Every copy made so far, in the order they were made
+  const std::vector<object<DstAllocatorT>>& copies() const { return made_; }
+
+  void reserve(const std::size_t copies) { made_.reserve(copies); }
+
+  // Deallocates every copy made so far, after cloning threw part way
+  void discard() {
+    for (auto& copy : made_) {
+      copy.dealloc_heap(dst_allocator_);
+    }
+    made_.clear();
+    copies_.clear();
+  }
+
+  // Only reached with deduplicate_shared, deep_clone() rejects cyclic
+  // graphs otherwise, and cycles closing on a tuple
+  void cycle(const object<SrcAllocatorT>& src, std::size_t,
+             state_type* parent) {
+    attach(copies_.at(heap_of(src)), parent);
+  }
+
+ private:
+  void attach(const object<DstAllocatorT>& copy, state_type* parent) {
+    if (parent == nullptr) {
+      result_ = copy;
+      return;
+    }
+    switch (parent->kind) {
+      case node_kind::list:
+        parent->copy.as_list(dst_allocator_).objects_.push_back(copy);
+        break;
+      case node_kind::tuple:
+        parent->elements.push_back(copy);
+        break;
+      case node_kind::persistent_list:
+        parent->copy.as_persistent_list(dst_allocator_).tree_.push_back(copy);
+        break;
+      default:
+        if (!parent->key) {
+          parent->key = copy;
+          break;
+        }
+        if (parent->kind == node_kind::persistent_dictionary) {
+          parent->copy.as_persistent_dictionary(dst_allocator_)
+              .trie_.set(*parent->key, copy);
+        } else {
+          parent->copy.as_dictionary(dst_allocator_)
+              .object_dict_.insert({*parent->key, copy});
+        }
+        parent->key.reset();
+        break;
+    }
+  }
+
+  void remember(const object<SrcAllocatorT>& src,
+                const object<DstAllocatorT>& copy) {
+    try {
+      made_.push_back(copy);
+    } catch (...) {
+      object<DstAllocatorT> untracked = copy;
+      untracked.dealloc_heap(dst_allocator_);
+      throw;
+    }
+    if (options_.deduplicate_shared) {
+      copies_.insert({heap_of(src), copy});
+    }
+  }
+
+  DstAllocatorT& dst_allocator_;
+  const SrcAllocatorT& src_allocator_;
+  const clone_options options_;
+  // Copies of the source heap objects, with deduplicate_shared
+  std::unordered_map<const void*, object<DstAllocatorT>> copies_;
+  std::vector<object<DstAllocatorT>> made_;
+  object<DstAllocatorT> result_ = object<DstAllocatorT>::make_nothing();
+};
+
+}  // namespace detail
+
+template <typename AllocatorT>
+graph_measure measure_graph(const AllocatorT& allocator,
+                            const object<AllocatorT>& obj,
+                            const bool deduplicate_shared = false) {
+  graph_measure result;
+  std::unordered_set<const void*> seen;
+  detail::measure_visitor<AllocatorT> visitor(
+      allocator, result, deduplicate_shared ? &seen : nullptr);
+  detail::depth_first(obj, visitor);
+  return result;
+}
+
+template <typename DstAllocatorT, typename SrcAllocatorT>
+object<DstAllocatorT> deep_clone(DstAllocatorT& dst_allocator,
+                                 const SrcAllocatorT& src_allocator,
+                                 const object<SrcAllocatorT>& src,
+                                 const clone_options& options = {}) {
+  const graph_measure measured =
+      measure_graph(src_allocator, src, options.deduplicate_shared);
+  if (measured.cycles != 0 && !options.deduplicate_shared) {
+    throw std::invalid_argument(
+        "anb::deep_clone: cyclic graphs need deduplicate_shared");
+  }
+  if (measured.tuple_cycles != 0) {
+    throw std::invalid_argument(
+        "anb::deep_clone: a cycle closes on a tuple");
+  }
+  if (measured.tuples != 0 && !detail::raw_allocator<DstAllocatorT>) {
+    throw std::invalid_argument(
+        "anb::deep_clone: tuples need a destination allocator with raw "
+        "allocation");
+  }
+  detail::reserve_heap<string>(dst_allocator, measured.strings);
+  detail::reserve_heap<list>(dst_allocator, measured.lists);
+  detail::reserve_heap<dictionary>(dst_allocator, measured.dictionaries);
+  detail::reserve_heap<persistent_dictionary>(
+      dst_allocator, measured.persistent_dictionaries);
+  detail::reserve_heap<persistent_list>(dst_allocator,
+                                        measured.persistent_lists);
+
+  detail::graph_cloner<DstAllocatorT, SrcAllocatorT> cloner(
+      dst_allocator, src_allocator, options);
+  cloner.reserve(measured.strings + measured.lists + measured.dictionaries +
+                 measured.tuples + measured.persistent_dictionaries +
+                 measured.persistent_lists);
+  try {
+    return cloner.clone(src);
+  } catch (...) {
+    cloner.discard();
+    throw;
+  }
+}
+
+}  // namespace anb
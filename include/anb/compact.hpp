@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+#include "clone.hpp"
+#include "footprint.hpp"
+#include "object.hpp"
+
+namespace anb {
+
+//=====================================================================
+// Compaction of long lived object graphs
+//
+//   std::vector<anb::object<A>> roots = ...;
+//   const anb::compaction_report report = anb::compact(pool, roots);
+//
+// Relocates every heap object reachable from the roots and rewrites the
+// roots to point at the relocated graph:
+//
+//   1. The graph is copied depth first, every object is followed by its
+//      buffers and then by its children (tuples come after their
+//      elements), in the order traversals visit them. Containers get
+//      exactly the capacity they need, strings are flattened and slices
+//      stop sharing the string they were cut from.
+//   2. Heap objects shared between several places, including between
+//      roots, stay shared and cycles are kept.
+//   3. The old heap objects are released.
+//
+// Copies are allocated in traversal order, an allocator handing out
+// blocks in address order (an arena, or a pool after reserve()) lays the
+// graph out contiguously.
+//
+// Defragmenting takes the two allocator overload: the graph moves into a
+// fresh allocator (or arena) of the same type, and the old one can be
+// released as a whole. The single allocator overload copies while the old
+// graph is still live, so the copies land wherever the allocator has free
+// blocks, between the old objects, and peak memory is twice the graph. It
+// only trims what the graph retains needlessly (bytes_reclaimed()), it
+// doesn't defragment the allocator.
+//
+// References into the graph held anywhere but in the roots dangle
+// afterwards. If copying throws, the copies made so far are deallocated
+// and the old graph and the roots are left untouched. A cycle closing on
+// a tuple can't be copied (see clone.hpp), compact() throws
+// std::invalid_argument for it before copying anything.
+//=====================================================================
+struct compaction_report {
+  // Heap objects relocated
+  std::size_t objects = 0;
+  // Retained by the graph, as deep_size() counts them
+  std::size_t bytes_before = 0;
+  std::size_t bytes_after = 0;
+
+  // Spare capacity, unflattened strings and the like the relocated graph
+  // no longer retains. Free space between the blocks of the allocator
+  // isn't counted
+  std::size_t bytes_reclaimed() const {
+    return bytes_before > bytes_after ? bytes_before - bytes_after : 0;
+  }
+};
+
+namespace detail {
+
+// The heap objects of a graph, each once, in depth first order
+template <typename AllocatorT>
+class reachable_visitor {
+ public:
+  struct state_type {};
+
+  bool enter(const object<AllocatorT>& obj, const node_kind kind,
+             state_type*, state_type&) {
+    if (kind == node_kind::fixed || !seen_.insert(heap_of(obj)).second) {
+      return false;
+    }
+    objects_.push_back(obj);
+    return is_container(kind);
+  }
+
+  void leave(const object<AllocatorT>&, state_type&, state_type*) {}
+
+  void cycle(const object<AllocatorT>&, std::size_t, state_type*) {}
+
+  const std::vector<object<AllocatorT>>& objects() const { return objects_; }
+
+ private:
+  std::unordered_set<const void*> seen_;
+  std::vector<object<AllocatorT>> objects_;
+};
+
+template <typename AllocatorT>
+std::size_t retained_bytes(const AllocatorT& allocator,
+                           const std::span<const object<AllocatorT>> roots) {
+  footprint result;
+  footprint_visitor<AllocatorT> visitor(allocator, result);
+  for (const auto& root : roots) {
+    depth_first(root, visitor);
+  }
+  return result.total_bytes();
+}
+
+}  // namespace detail
+
+// The roots don't take part in deduction, so containers of objects
+// convert to the span
+template <typename AllocatorT>
+using roots_span = std::type_identity_t<std::span<object<AllocatorT>>>;
+
+template <typename AllocatorT>
+compaction_report compact(AllocatorT& dst_allocator,
+                          AllocatorT& src_allocator,
+                          const roots_span<AllocatorT> roots) {
+  compaction_report report;
+  report.bytes_before =
+      detail::retained_bytes<AllocatorT>(src_allocator, roots);
+
+  detail::reachable_visitor<AllocatorT> reachable;
+  graph_measure measured;
+  std::unordered_set<const void*> seen;
+  detail::measure_visitor<AllocatorT> measure(src_allocator, measured, &seen);
+  for (const auto& root : roots) {
+    detail::depth_first(root, reachable);
+    detail::depth_first(root, measure);
+  }
+  if (measured.tuple_cycles != 0) {
+    throw std::invalid_argument("anb::compact: a cycle closes on a tuple");
+  }
+  detail::reserve_heap<string>(dst_allocator, measured.strings);
+  detail::reserve_heap<list>(dst_allocator, measured.lists);
+  detail::reserve_heap<dictionary>(dst_allocator, measured.dictionaries);
+  detail::reserve_heap<persistent_dictionary>(
+      dst_allocator, measured.persistent_dictionaries);
+  detail::reserve_heap<persistent_list>(dst_allocator,
+                                        measured.persistent_lists);
+
+  // One cloner for every root keeps what they share shared
+  detail::graph_cloner<AllocatorT, AllocatorT> cloner(
+      dst_allocator, src_allocator,
+      clone_options{.deduplicate_shared = true});
+  std::vector<object<AllocatorT>> relocated;
+  try {
+    relocated.reserve(roots.size());
+    for (const auto& root : roots) {
+      relocated.push_back(cloner.clone(root));
+    }
+  } catch (...) {
+    cloner.discard();
+    throw;
+  }
+
+  for (auto obj : reachable.objects()) {
+    obj.dealloc_heap(src_allocator);
+  }
+  std::copy(relocated.begin(), relocated.end(), roots.begin());
+
+  report.objects = reachable.objects().size();
+  report.bytes_after =
+      detail::retained_bytes<AllocatorT>(dst_allocator, roots);
+  return report;
+}
+
+// Trims the graph within one allocator, without defragmenting it (see
+// above)
+template <typename AllocatorT>
+compaction_report compact(AllocatorT& allocator,
+                          const roots_span<AllocatorT> roots) {
+  return compact(allocator, allocator, roots);
+}
+
+}  // namespace anb
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <concepts>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace anb {
+
+template <typename AllocatorT>
+class object;
+
+namespace detail {
+
+// Values bulk APIs accept as elements: objects, fixed values, and
+// strings of any length (string literals included, they'd otherwise
+// convert to bool)
+template <typename T, typename AllocatorT>
+concept boxable =
+    std::convertible_to<T, std::string_view> ||
+    std::is_constructible_v<anb::object<AllocatorT>, T>;
+
+template <typename AllocatorT, typename T>
+  requires boxable<T, AllocatorT>
+anb::object<AllocatorT> box(AllocatorT& allocator, T&& value) {
+  if constexpr (std::convertible_to<T, std::string_view>) {
+    anb::object<AllocatorT> str;
+    str.assign(allocator, std::string_view(value));
+    return str;
+  } else {
+    return anb::object<AllocatorT>(std::forward<T>(value));
+  }
+}
+
+}  // namespace detail
+
+}  // namespace anb
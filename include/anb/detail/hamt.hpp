@@ -0,0 +1,627 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <unordered_set>
+#include <utility>
+
+#include "../allocator.hpp"
+
+namespace anb {
+
+template <typename AllocatorT>
+class object;
+
+namespace detail {
+
+//=====================================================================
+// Hash array mapped trie
+//
+// The map behind anb::persistent_dictionary. Every level of the trie
+// consumes 5 bits of the key hash (object::hash()), and a node is a
+// single block
+//
+//   [header|datamap|nodemap][entry * entry_count][node* * child_count]
+//
+// where bit i of datamap marks an entry stored inline in slot i, and bit
+// i of nodemap a child node taking the entries whose hashes share slot i
+// so far. Keys with identical hashes end up together in a collision node
+// below the last level, which only holds entries.
+//
+// Nodes are reference counted and never modified while shared. Copying a
+// hamt shares its root, and updating a copy copies the nodes on the path
+// to the key and keeps sharing all the others, so a new version costs
+// O(log n). Nodes only reachable from the trie being updated are changed
+// in place instead, which is what makes batch loads cheap. A child left
+// with a single entry by an erase is folded back into its parent.
+//
+// Keys and values are referenced, like list elements they aren't owned.
+//=====================================================================
+inline constexpr unsigned hamt_level_bits = 5;
+inline constexpr unsigned hamt_hash_bits =
+    std::numeric_limits<std::size_t>::digits;
+// The levels consuming hash bits, and the collision level below them
+inline constexpr std::size_t hamt_max_depth =
+    (hamt_hash_bits + hamt_level_bits - 1) / hamt_level_bits + 1;
+
+template <typename AllocatorT>
+struct hamt_entry {
+  std::size_t hash;
+  anb::object<AllocatorT> key;
+  anb::object<AllocatorT> value;
+};
+
+// Hash a key is filed under. Tests specialize it for an allocator of their
+// own, to force keys into collision nodes (string keys are looked up by
+// the hash of their contents too, and have to keep object::hash())
+template <typename AllocatorT>
+struct hamt_key_hash {
+  static std::size_t of(const anb::object<AllocatorT>& key) {
+    return key.hash();
+  }
+};
+
+template <typename AllocatorT>
+struct hamt_node {
+  using entry = hamt_entry<AllocatorT>;
+
+  mutable std::atomic<std::size_t> references = 1;
+  std::uint32_t datamap = 0;
+  std::uint32_t nodemap = 0;
+  std::uint32_t entry_count = 0;
+  std::uint32_t child_count = 0;
+
+  entry* entries() const {
+    auto* self = const_cast<unsigned char*>(
+        reinterpret_cast<const unsigned char*>(this));
+    return reinterpret_cast<entry*>(self + entries_offset());
+  }
+
+  hamt_node** children() const {
+    return reinterpret_cast<hamt_node**>(entries() + entry_count);
+  }
+
+  static std::size_t block_size(const std::size_t entry_count,
+                                const std::size_t child_count) {
+    return entries_offset() + entry_count * sizeof(entry) +
+           child_count * sizeof(hamt_node*);
+  }
+
+ private:
+  static constexpr std::size_t entries_offset() {
+    return (sizeof(hamt_node) + alignof(entry) - 1) & ~(alignof(entry) - 1);
+  }
+};
+
+template <typename AllocatorT>
+class hamt {
+ public:
+  using entry = hamt_entry<AllocatorT>;
+  using value_type = entry;
+  using node = hamt_node<AllocatorT>;
+
+  // Entries in trie order, which only depends on the key hashes
+  class const_iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = entry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const entry*;
+    using reference = const entry&;
+
+    const_iterator() = default;
+
+    explicit const_iterator(const node* root) {
+      if (root != nullptr) {
+        levels_[depth_++] = {root, 0};
+        advance();
+      }
+    }
+
+    reference operator*() const { return *current_; }
+    pointer operator->() const { return current_; }
+
+    const_iterator& operator++() {
+      advance();
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator previous = *this;
+      advance();
+      return previous;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      return current_ == other.current_;
+    }
+
+   private:
+    struct level {
+      const node* n = nullptr;
+      // Entries first, then children
+      std::uint32_t position = 0;
+    };
+
+    void advance() {
+      while (depth_ > 0) {
+        level& top = levels_[depth_ - 1];
+        if (top.position < top.n->entry_count) {
+          current_ = &top.n->entries()[top.position++];
+          return;
+        }
+        const std::uint32_t child = top.position - top.n->entry_count;
+        if (child < top.n->child_count) {
+          ++top.position;
+          levels_[depth_++] = {top.n->children()[child], 0};
+          continue;
+        }
+        --depth_;
+      }
+      current_ = nullptr;
+    }
+
+    std::array<level, hamt_max_depth> levels_{};
+    std::size_t depth_ = 0;
+    const entry* current_ = nullptr;
+  };
+
+  explicit hamt(AllocatorT& allocator) : allocator_(&allocator) {}
+
+  // Shares the nodes of other
+  hamt(const hamt& other)
+      : allocator_(other.allocator_), root_(other.root_), size_(other.size_) {
+    retain(root_);
+  }
+
+  hamt(hamt&& other) noexcept
+      : allocator_(other.allocator_),
+        root_(std::exchange(other.root_, nullptr)),
+        size_(std::exchange(other.size_, 0)) {}
+
+  hamt& operator=(const hamt& other) {
+    hamt copy(other);
+    swap(copy);
+    return *this;
+  }
+
+  hamt& operator=(hamt&& other) noexcept {
+    hamt moved(std::move(other));
+    swap(moved);
+    return *this;
+  }
+
+  ~hamt() { release(root_); }
+
+  void swap(hamt& other) noexcept {
+    std::swap(allocator_, other.allocator_);
+    std::swap(root_, other.root_);
+    std::swap(size_, other.size_);
+  }
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const_iterator begin() const { return const_iterator(root_); }
+  const_iterator end() const { return const_iterator(); }
+
+  // True when both tries are the same version, or versions that share
+  // their whole structure
+  bool shares_root(const hamt& other) const { return root_ == other.root_; }
+
+  // Entry whose hash is hash and whose key satisfies matches, nullptr
+  // when there is none
+  template <typename PredT>
+  const entry* find_hashed(const std::size_t hash, PredT&& matches) const {
+    const node* n = root_;
+    for (unsigned shift = 0; n != nullptr; shift += hamt_level_bits) {
+      if (shift >= hamt_hash_bits) {
+        for (std::uint32_t i = 0; i < n->entry_count; ++i) {
+          const entry& e = n->entries()[i];
+          if (e.hash == hash && matches(e.key)) {
+            return &e;
+          }
+        }
+        return nullptr;
+      }
+      const std::uint32_t bit = bit_of(hash, shift);
+      if (n->datamap & bit) {
+        const entry& e = n->entries()[index_of(n->datamap, bit)];
+        return (e.hash == hash && matches(e.key)) ? &e : nullptr;
+      }
+      if (!(n->nodemap & bit)) {
+        return nullptr;
+      }
+      n = n->children()[index_of(n->nodemap, bit)];
+    }
+    return nullptr;
+  }
+
+  const entry* find(const anb::object<AllocatorT>& key) const {
+    return find_hashed(hamt_key_hash<AllocatorT>::of(key),
+                       [&key](const anb::object<AllocatorT>& stored) {
+                         return stored == key;
+                       });
+  }
+
+  // Maps key to value, true when key wasn't mapped yet. Nodes shared with
+  // other tries are copied, the others are changed in place
+  bool set(const anb::object<AllocatorT>& key,
+           const anb::object<AllocatorT>& value) {
+    const entry e{hamt_key_hash<AllocatorT>::of(key), key, value};
+    bool added = false;
+    if (root_ == nullptr) {
+      root_ = allocate_node(1, 0);
+      root_->datamap = bit_of(e.hash, 0);
+      std::construct_at(root_->entries(), e);
+      added = true;
+    } else if (is_unique(root_)) {
+      root_ = assoc_unique(root_, 0, e, added);
+    } else if (node* copy = assoc(root_, 0, e, added)) {
+      release(root_);
+      root_ = copy;
+    }
+    size_ += added ? 1 : 0;
+    return added;
+  }
+
+  // True when key was mapped. Copies the path to key
+  bool erase(const anb::object<AllocatorT>& key) {
+    if (root_ == nullptr) {
+      return false;
+    }
+    const auto matches = [&key](const anb::object<AllocatorT>& stored) {
+      return stored == key;
+    };
+    const removal result =
+        dissoc(root_, 0, hamt_key_hash<AllocatorT>::of(key), matches);
+    if (!result.removed) {
+      return false;
+    }
+    release(root_);
+    root_ = result.replacement;
+    --size_;
+    return true;
+  }
+
+  // Bytes of the nodes. With seen, nodes already in it are skipped and
+  // the others are added, so nodes shared between tries count once
+  std::size_t memory_usage(
+      std::unordered_set<const void*>* seen = nullptr) const {
+    return node_bytes(root_, seen);
+  }
+
+  AllocatorT& allocator() const { return *allocator_; }
+
+ private:
+  struct removal {
+    bool removed = false;
+    // The node taking the place of the visited one, nullptr when it's
+    // left empty
+    node* replacement = nullptr;
+  };
+
+  static std::uint32_t bit_of(const std::size_t hash, const unsigned shift) {
+    return std::uint32_t{1} << ((hash >> shift) & 0x1F);
+  }
+
+  static std::uint32_t index_of(const std::uint32_t bitmap,
+                                const std::uint32_t bit) {
+    return static_cast<std::uint32_t>(std::popcount(bitmap & (bit - 1)));
+  }
+
+  static bool same_key(const entry& stored, const entry& e) {
+    return stored.hash == e.hash && stored.key == e.key;
+  }
+
+  static bool is_unique(const node* n) {
+    return n->references.load(std::memory_order_acquire) == 1;
+  }
+
+  static void retain(const node* n) {
+    if (n != nullptr) {
+      n->references.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void release(const node* n) const {
+    if (n != nullptr &&
+        n->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      for (std::uint32_t i = 0; i < n->child_count; ++i) {
+        release(n->children()[i]);
+      }
+      free_node(const_cast<node*>(n));
+    }
+  }
+
+  node* allocate_node(const std::uint32_t entry_count,
+                      const std::uint32_t child_count) const {
+    const std::size_t bytes = node::block_size(entry_count, child_count);
+    void* block = nullptr;
+    if constexpr (raw_allocator<AllocatorT>) {
+      block = allocator_->allocate(bytes, alignof(node));
+    } else {
+      block = ::operator new(bytes, std::align_val_t{alignof(node)});
+    }
+    node* n = ::new (block) node;
+    n->entry_count = entry_count;
+    n->child_count = child_count;
+    return n;
+  }
+
+  // Only the block, the children are released or moved by the caller
+  void free_node(node* n) const {
+    const std::size_t bytes = node::block_size(n->entry_count, n->child_count);
+    std::destroy_n(n->entries(), n->entry_count);
+    n->~node();
+    if constexpr (raw_allocator<AllocatorT>) {
+      allocator_->deallocate(n, bytes, alignof(node));
+    } else {
+      ::operator delete(n, std::align_val_t{alignof(node)});
+    }
+  }
+
+  // Node laid out for datamap and nodemap, taking the entries and children
+  // of n in the slots both have, and added_entry/added_child in the slot
+  // only the new maps have. With share the children taken from n are
+  // retained, otherwise they're moved and n is left for free_node()
+  node* rebuild(const node* n, const std::uint32_t datamap,
+                const std::uint32_t nodemap, const entry* added_entry,
+                node* added_child, const bool share) const {
+    node* copy = allocate_node(
+        static_cast<std::uint32_t>(std::popcount(datamap)),
+        static_cast<std::uint32_t>(std::popcount(nodemap)));
+    copy->datamap = datamap;
+    copy->nodemap = nodemap;
+
+    entry* entries = copy->entries();
+    for (std::uint32_t bits = datamap; bits != 0; bits &= bits - 1) {
+      const std::uint32_t bit = bits & (~bits + 1);
+      std::construct_at(entries++,
+                        (n->datamap & bit)
+                            ? n->entries()[index_of(n->datamap, bit)]
+                            : *added_entry);
+    }
+    node** children = copy->children();
+    for (std::uint32_t bits = nodemap; bits != 0; bits &= bits - 1) {
+      const std::uint32_t bit = bits & (~bits + 1);
+      if (n->nodemap & bit) {
+        *children = n->children()[index_of(n->nodemap, bit)];
+        if (share) {
+          retain(*children);
+        }
+      } else {
+        *children = added_child;
+      }
+      ++children;
+    }
+    return copy;
+  }
+
+  // Collision node with the entries of n but skipped, and appended at
+  // the end when given
+  node* rebuild_collision(const node* n, const std::uint32_t skipped,
+                          const entry* appended) const {
+    const std::uint32_t kept =
+        n->entry_count - (skipped < n->entry_count ? 1 : 0);
+    node* copy = allocate_node(kept + (appended ? 1 : 0), 0);
+    entry* entries = copy->entries();
+    for (std::uint32_t i = 0; i < n->entry_count; ++i) {
+      if (i != skipped) {
+        std::construct_at(entries++, n->entries()[i]);
+      }
+    }
+    if (appended != nullptr) {
+      std::construct_at(entries, *appended);
+    }
+    return copy;
+  }
+
+  // Smallest subtrie holding both a and b, from the level at shift
+  node* merge(const entry& a, const entry& b, const unsigned shift) const {
+    if (shift >= hamt_hash_bits) {
+      node* n = allocate_node(2, 0);
+      std::construct_at(n->entries(), a);
+      std::construct_at(n->entries() + 1, b);
+      return n;
+    }
+    const std::uint32_t a_bit = bit_of(a.hash, shift);
+    const std::uint32_t b_bit = bit_of(b.hash, shift);
+    if (a_bit == b_bit) {
+      node* child = merge(a, b, shift + hamt_level_bits);
+      node* n = allocate_node(0, 1);
+      n->nodemap = a_bit;
+      n->children()[0] = child;
+      return n;
+    }
+    node* n = allocate_node(2, 0);
+    n->datamap = a_bit | b_bit;
+    std::construct_at(n->entries(), a_bit < b_bit ? a : b);
+    std::construct_at(n->entries() + 1, a_bit < b_bit ? b : a);
+    return n;
+  }
+
+  // Copy of n with e set, nullptr when n already maps the key to the
+  // same value. Everything not on the path to the key is shared
+  node* assoc(const node* n, const unsigned shift, const entry& e,
+              bool& added) const {
+    if (shift >= hamt_hash_bits) {
+      for (std::uint32_t i = 0; i < n->entry_count; ++i) {
+        if (same_key(n->entries()[i], e)) {
+          if (n->entries()[i].value.nanbox_value() ==
+              e.value.nanbox_value()) {
+            return nullptr;
+          }
+          node* copy = rebuild_collision(n, n->entry_count, nullptr);
+          copy->entries()[i].value = e.value;
+          return copy;
+        }
+      }
+      added = true;
+      return rebuild_collision(n, n->entry_count, &e);
+    }
+
+    const std::uint32_t bit = bit_of(e.hash, shift);
+    if (n->datamap & bit) {
+      const std::uint32_t i = index_of(n->datamap, bit);
+      const entry& stored = n->entries()[i];
+      if (same_key(stored, e)) {
+        if (stored.value.nanbox_value() == e.value.nanbox_value()) {
+          return nullptr;
+        }
+        node* copy = rebuild(n, n->datamap, n->nodemap, nullptr, nullptr,
+                             true);
+        copy->entries()[i].value = e.value;
+        return copy;
+      }
+      added = true;
+      return rebuild(n, n->datamap & ~bit, n->nodemap | bit, nullptr,
+                     merge(stored, e, shift + hamt_level_bits), true);
+    }
+    if (n->nodemap & bit) {
+      const std::uint32_t i = index_of(n->nodemap, bit);
+      node* child = assoc(n->children()[i], shift + hamt_level_bits, e, added);
+      if (child == nullptr) {
+        return nullptr;
+      }
+      return with_child(n, i, child);
+    }
+    added = true;
+    return rebuild(n, n->datamap | bit, n->nodemap, &e, nullptr, true);
+  }
+
+  // Sets e in n, which is only reachable from this trie. Returns the node
+  // taking the place of n, n itself unless it had to grow
+  node* assoc_unique(node* n, const unsigned shift, const entry& e,
+                     bool& added) {
+    if (shift >= hamt_hash_bits) {
+      for (std::uint32_t i = 0; i < n->entry_count; ++i) {
+        if (same_key(n->entries()[i], e)) {
+          n->entries()[i].value = e.value;
+          return n;
+        }
+      }
+      added = true;
+      node* grown = rebuild_collision(n, n->entry_count, &e);
+      free_node(n);
+      return grown;
+    }
+
+    const std::uint32_t bit = bit_of(e.hash, shift);
+    node* grown = nullptr;
+    if (n->datamap & bit) {
+      entry& stored = n->entries()[index_of(n->datamap, bit)];
+      if (same_key(stored, e)) {
+        stored.value = e.value;
+        return n;
+      }
+      added = true;
+      grown = rebuild(n, n->datamap & ~bit, n->nodemap | bit, nullptr,
+                      merge(stored, e, shift + hamt_level_bits), false);
+    } else if (n->nodemap & bit) {
+      node*& child = n->children()[index_of(n->nodemap, bit)];
+      if (is_unique(child)) {
+        child = assoc_unique(child, shift + hamt_level_bits, e, added);
+      } else if (node* copy =
+                     assoc(child, shift + hamt_level_bits, e, added)) {
+        release(child);
+        child = copy;
+      }
+      return n;
+    } else {
+      added = true;
+      grown = rebuild(n, n->datamap | bit, n->nodemap, &e, nullptr, false);
+    }
+    free_node(n);
+    return grown;
+  }
+
+  // Copy of n with its child i replaced by child
+  node* with_child(const node* n, const std::uint32_t i, node* child) const {
+    node* copy = rebuild(n, n->datamap, n->nodemap, nullptr, nullptr, true);
+    release(copy->children()[i]);
+    copy->children()[i] = child;
+    return copy;
+  }
+
+  template <typename PredT>
+  removal dissoc(const node* n, const unsigned shift, const std::size_t hash,
+                 const PredT& matches) const {
+    if (shift >= hamt_hash_bits) {
+      for (std::uint32_t i = 0; i < n->entry_count; ++i) {
+        const entry& stored = n->entries()[i];
+        if (stored.hash == hash && matches(stored.key)) {
+          return {true, n->entry_count == 1 ? nullptr
+                                            : rebuild_collision(n, i, nullptr)};
+        }
+      }
+      return {};
+    }
+
+    const std::uint32_t bit = bit_of(hash, shift);
+    if (n->datamap & bit) {
+      const entry& stored = n->entries()[index_of(n->datamap, bit)];
+      if (stored.hash != hash || !matches(stored.key)) {
+        return {};
+      }
+      if (n->entry_count == 1 && n->child_count == 0) {
+        return {true, nullptr};
+      }
+      return {true, rebuild(n, n->datamap & ~bit, n->nodemap, nullptr,
+                            nullptr, true)};
+    }
+    if (!(n->nodemap & bit)) {
+      return {};
+    }
+
+    const std::uint32_t i = index_of(n->nodemap, bit);
+    const removal child =
+        dissoc(n->children()[i], shift + hamt_level_bits, hash, matches);
+    if (!child.removed) {
+      return {};
+    }
+    if (child.replacement == nullptr) {
+      if (n->entry_count == 0 && n->child_count == 1) {
+        return {true, nullptr};
+      }
+      return {true, rebuild(n, n->datamap, n->nodemap & ~bit, nullptr,
+                            nullptr, true)};
+    }
+    if (child.replacement->entry_count == 1 &&
+        child.replacement->child_count == 0) {
+      // The lone entry left moves up into n
+      node* copy = rebuild(n, n->datamap | bit, n->nodemap & ~bit,
+                           child.replacement->entries(), nullptr, true);
+      release(child.replacement);
+      return {true, copy};
+    }
+    return {true, with_child(n, i, child.replacement)};
+  }
+
+  static std::size_t node_bytes(const node* n,
+                                std::unordered_set<const void*>* seen) {
+    if (n == nullptr || (seen != nullptr && !seen->insert(n).second)) {
+      return 0;
+    }
+    std::size_t bytes = node::block_size(n->entry_count, n->child_count);
+    for (std::uint32_t i = 0; i < n->child_count; ++i) {
+      bytes += node_bytes(n->children()[i], seen);
+    }
+    return bytes;
+  }
+
+  AllocatorT* allocator_;
+  node* root_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+}  // namespace detail
+
+}  // namespace anb
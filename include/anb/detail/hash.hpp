@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "util.hpp"
+
+namespace anb::detail {
+
+//=====================================================================
+// Hash combiners of the containers
+//
+// Sequences (lists, tuples) are hashed as a polynomial over the mixed
+// element hashes, so permutations hash differently. The polynomial of a
+// sequence can be computed in chunks and joined afterwards, which is how
+// parallel_hash() matches the serial hash.
+//
+// Dictionaries compare equal regardless of their insertion order, so
+// their entries are mixed pairwise (key and value together) and summed.
+//=====================================================================
+inline constexpr std::size_t sequence_hash_base = 0x100000001b3ULL;
+
+struct sequence_hash {
+  std::size_t value = 0;
+  // sequence_hash_base to the power of the number of elements
+  std::size_t scale = 1;
+
+  void add(const std::size_t element_hash) {
+    value = value * sequence_hash_base + magic_hash(element_hash);
+    scale *= sequence_hash_base;
+  }
+
+  // Continues with the elements hashed by other
+  void append(const sequence_hash& other) {
+    value = value * other.scale + other.value;
+    scale *= other.scale;
+  }
+
+  std::size_t finish(const std::size_t seed) const {
+    return magic_hash(magic_hash(seed) * scale + value);
+  }
+};
+
+inline std::size_t entry_hash(const std::size_t key_hash,
+                              const std::size_t value_hash) {
+  return magic_hash(magic_hash(key_hash) * sequence_hash_base + value_hash);
+}
+
+// Sum of entry_hash() over the entries
+inline std::size_t unordered_hash_finish(const std::size_t sum,
+                                         const std::size_t size) {
+  return magic_hash(sum + magic_hash(size));
+}
+
+}  // namespace anb::detail
@@ -0,0 +1,437 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace anb::detail {
+
+//=====================================================================
+// Compact insertion ordered hash map (CPython 3.6+ dict layout)
+//
+//  indices_: [ 2][--][ 0][--][--][ 1][--][--]   <- open addressing table
+//                                                  of 1/2/4/8 byte slots
+//  entries_: [hash|key|value]                    <- dense, in insertion
+//            [hash|key|value]                       order
+//            [hash|key|value]
+//
+// The index table only stores positions into the entries array, so its
+// slot width is picked from the table size: tables of up to 256 slots
+// (170 entries) use one byte slots. Iteration walks the entries array,
+// so it always yields the insertion order.
+//
+// Erasing marks the index slot as a dummy, which probes pass over, and
+// the entry as erased, which iteration skips. The holes are compacted
+// away when the index table is resized or when they outnumber the live
+// entries, so erase is amortized O(1).
+//
+// Both arrays allocate from AllocT, rebound to their element types.
+//=====================================================================
+template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>,
+          typename KeyEqualT = std::equal_to<KeyT>,
+          typename AllocT = std::allocator<std::pair<const KeyT, ValueT>>>
+class ordered_dict {
+ public:
+  using key_type = KeyT;
+  using mapped_type = ValueT;
+  using value_type = std::pair<const KeyT, ValueT>;
+  using size_type = std::size_t;
+  using allocator_type = AllocT;
+
+ private:
+  struct entry {
+    std::size_t hash;
+    value_type kv;
+  };
+
+  template <typename T>
+  using rebind_alloc =
+      typename std::allocator_traits<AllocT>::template rebind_alloc<T>;
+
+  template <bool IsConst>
+  class iterator_base {
+    using dict_ptr =
+        std::conditional_t<IsConst, const ordered_dict*, ordered_dict*>;
+
+   public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = ordered_dict::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference =
+        std::conditional_t<IsConst, const value_type&, value_type&>;
+    using pointer = std::conditional_t<IsConst, const value_type*, value_type*>;
+
+    iterator_base() = default;
+    iterator_base(dict_ptr dict, const std::size_t index)
+        : dict_(dict), index_(index) {}
+
+    operator iterator_base<true>() const {
+      return iterator_base<true>(dict_, index_);
+    }
+
+    reference operator*() const { return dict_->entries_[index_].kv; }
+    pointer operator->() const { return &dict_->entries_[index_].kv; }
+
+    iterator_base& operator++() {
+      index_ = dict_->next_live(index_ + 1);
+      return *this;
+    }
+    iterator_base operator++(int) {
+      iterator_base previous = *this;
+      ++*this;
+      return previous;
+    }
+    iterator_base& operator--() {
+      do {
+        --index_;
+      } while (dict_->is_erased(index_));
+      return *this;
+    }
+    iterator_base operator--(int) {
+      iterator_base previous = *this;
+      --*this;
+      return previous;
+    }
+
+    bool operator==(const iterator_base& other) const {
+      return index_ == other.index_;
+    }
+
+    // Hash of the key, computed when the entry was inserted
+    std::size_t hash() const { return dict_->entries_[index_].hash; }
+
+    // Position of the entry in the entries array, erased entries
+    // included. Stays valid until the dictionary changes
+    std::size_t slot() const { return index_; }
+
+   private:
+    dict_ptr dict_ = nullptr;
+    std::size_t index_ = 0;
+  };
+
+ public:
+  using iterator = iterator_base<false>;
+  using const_iterator = iterator_base<true>;
+
+  ordered_dict() = default;
+
+  explicit ordered_dict(const AllocT& alloc)
+      : entries_(rebind_alloc<entry>(alloc)),
+        erased_(rebind_alloc<std::uint64_t>(alloc)),
+        indices_(rebind_alloc<unsigned char>(alloc)) {}
+
+  allocator_type get_allocator() const {
+    return allocator_type(entries_.get_allocator());
+  }
+
+  iterator begin() { return iterator(this, next_live(0)); }
+  iterator end() { return iterator(this, entries_.size()); }
+  const_iterator begin() const { return const_iterator(this, next_live(0)); }
+  const_iterator end() const { return const_iterator(this, entries_.size()); }
+
+  size_type size() const { return entries_.size() - erased_count_; }
+
+  // Entry at a slot of a live entry, see iterator::slot(). Without erased
+  // entries, slots are the positions in insertion order
+  const_iterator at_slot(const std::size_t slot) const {
+    return const_iterator(this, slot);
+  }
+  bool empty() const { return size() == 0; }
+
+  // Keeps the entries, erased marks and index table capacity for reuse
+  void clear() {
+    entries_.clear();
+    std::fill(erased_.begin(), erased_.end(), 0);
+    erased_count_ = 0;
+    std::fill(indices_.begin(), indices_.end(), 0xFF);
+  }
+
+  void reserve(const size_type count) {
+    if (usable_slots(slot_count()) < count + erased_count_) {
+      compact();
+      rebuild_index(table_size_for(count));
+    }
+    entries_.reserve(count);
+  }
+
+  iterator find(const KeyT& key) {
+    return find_hashed(HashT{}(key), [&key](const KeyT& stored) {
+      return KeyEqualT{}(stored, key);
+    });
+  }
+
+  const_iterator find(const KeyT& key) const {
+    return const_cast<ordered_dict*>(this)->find(key);
+  }
+
+  // Probes with a precomputed hash and a custom key comparison, the hash
+  // must match what HashT produces for the keys that compare equal
+  template <typename PredT>
+  iterator find_hashed(const std::size_t hash, PredT&& equals) {
+    if (empty()) {
+      return end();
+    }
+    const std::size_t index = lookup(hash, equals).second;
+    return (index == empty_index) ? end() : iterator(this, index);
+  }
+
+  template <typename PredT>
+  const_iterator find_hashed(const std::size_t hash, PredT&& equals) const {
+    return const_cast<ordered_dict*>(this)->find_hashed(
+        hash, std::forward<PredT>(equals));
+  }
+
+  bool contains(const KeyT& key) const { return find(key) != end(); }
+  size_type count(const KeyT& key) const { return contains(key) ? 1 : 0; }
+
+  ValueT& at(const KeyT& key) {
+    const auto it = find(key);
+    if (it == end()) {
+      throw std::out_of_range("anb::detail::ordered_dict::at");
+    }
+    return it->second;
+  }
+
+  const ValueT& at(const KeyT& key) const {
+    return const_cast<ordered_dict*>(this)->at(key);
+  }
+
+  std::pair<iterator, bool> insert(value_type kv) {
+    const std::size_t hash = HashT{}(kv.first);
+    if (!empty()) {
+      if (const auto it = find_hashed(hash, [&kv](const KeyT& stored) {
+            return KeyEqualT{}(stored, kv.first);
+          });
+          it != end()) {
+        return {it, false};
+      }
+    }
+    return {append(hash, std::move(kv)), true};
+  }
+
+  std::pair<iterator, bool> insert_or_assign(const KeyT& key, ValueT value) {
+    if (const auto it = find(key); it != end()) {
+      it->second = std::move(value);
+      return {it, false};
+    }
+    return {append(HashT{}(key), value_type{key, std::move(value)}), true};
+  }
+
+  size_type erase(const KeyT& key) {
+    if (empty()) {
+      return 0;
+    }
+    const std::size_t hash = HashT{}(key);
+    auto equals = [&key](const KeyT& stored) {
+      return KeyEqualT{}(stored, key);
+    };
+    const auto [slot, index] = lookup(hash, equals);
+    if (index == empty_index) {
+      return 0;
+    }
+
+    // The slot keeps later keys of the probe sequence reachable, the entry
+    // is reset so it holds on to nothing
+    write_slot(slot, dummy_index);
+    entry& e = entries_[index];
+    std::destroy_at(&e.kv);
+    std::construct_at(&e.kv);
+    if (erased_.size() <= index / 64) {
+      erased_.resize(entries_.capacity() / 64 + 1, 0);
+    }
+    erased_[index / 64] |= std::uint64_t{1} << (index % 64);
+    ++erased_count_;
+
+    if (erased_count_ > size()) {
+      compact();
+      rebuild_index(slot_count());
+    }
+    return 1;
+  }
+
+  // Bytes held by the entries array, erased marks and index table
+  size_type memory_usage() const {
+    return entries_.capacity() * sizeof(entry) +
+           erased_.capacity() * sizeof(std::uint64_t) + indices_.size();
+  }
+
+ private:
+  inline static constexpr std::size_t min_table_size = 8;
+  inline static constexpr std::size_t empty_index = ~std::size_t{0};
+  inline static constexpr std::size_t dummy_index = ~std::size_t{0} - 1;
+
+  static std::size_t usable_slots(const std::size_t table_size) {
+    return (table_size * 2) / 3;
+  }
+
+  static std::size_t table_size_for(const std::size_t count) {
+    std::size_t table_size = min_table_size;
+    while (usable_slots(table_size) < count) {
+      table_size <<= 1;
+    }
+    return table_size;
+  }
+
+  static std::size_t slot_width_for(const std::size_t table_size) {
+    // The two highest patterns of a slot mark it as empty and dummy
+    const std::size_t max_index = usable_slots(table_size);
+    if (max_index < 0xFE) {
+      return 1;
+    } else if (max_index < 0xFFFE) {
+      return 2;
+    } else if (max_index < 0xFFFFFFFE) {
+      return 4;
+    }
+    return 8;
+  }
+
+  bool is_erased(const std::size_t index) const {
+    return index / 64 < erased_.size() &&
+           (erased_[index / 64] >> (index % 64) & 1) != 0;
+  }
+
+  // First live entry at or after index
+  std::size_t next_live(std::size_t index) const {
+    if (erased_count_ != 0) {
+      while (index < entries_.size() && is_erased(index)) {
+        ++index;
+      }
+    }
+    return index;
+  }
+
+  std::size_t slot_count() const {
+    return (slot_width_ == 0) ? 0 : indices_.size() / slot_width_;
+  }
+
+  std::size_t read_slot(const std::size_t slot) const {
+    const unsigned char* p = indices_.data() + slot * slot_width_;
+    switch (slot_width_) {
+      case 1:
+        return (*p >= 0xFE) ? empty_index - (0xFF - *p) : *p;
+      case 2: {
+        std::uint16_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return (v >= 0xFFFE) ? empty_index - (0xFFFF - v) : v;
+      }
+      case 4: {
+        std::uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return (v >= 0xFFFFFFFE) ? empty_index - (0xFFFFFFFF - v) : v;
+      }
+      default: {
+        std::uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return static_cast<std::size_t>(v);
+      }
+    }
+  }
+
+  void write_slot(const std::size_t slot, const std::size_t index) {
+    unsigned char* p = indices_.data() + slot * slot_width_;
+    switch (slot_width_) {
+      case 1:
+        *p = static_cast<std::uint8_t>(index);
+        break;
+      case 2: {
+        const auto v = static_cast<std::uint16_t>(index);
+        std::memcpy(p, &v, sizeof(v));
+        break;
+      }
+      case 4: {
+        const auto v = static_cast<std::uint32_t>(index);
+        std::memcpy(p, &v, sizeof(v));
+        break;
+      }
+      default: {
+        const auto v = static_cast<std::uint64_t>(index);
+        std::memcpy(p, &v, sizeof(v));
+        break;
+      }
+    }
+  }
+
+  // Returns the slot that holds (or would hold) the key and the index of
+  // the matching entry, empty_index when missing. Dummy slots are probed
+  // past but never reused, new keys go to the first empty slot
+  template <typename PredT>
+  std::pair<std::size_t, std::size_t> lookup(const std::size_t hash,
+                                             PredT& equals) const {
+    const std::size_t mask = slot_count() - 1;
+    std::size_t perturb = hash;
+    std::size_t slot = hash & mask;
+    while (true) {
+      const std::size_t index = read_slot(slot);
+      if (index == empty_index) {
+        return {slot, empty_index};
+      }
+      if (index != dummy_index) {
+        const entry& e = entries_[index];
+        if (e.hash == hash && equals(e.kv.first)) {
+          return {slot, index};
+        }
+      }
+      perturb >>= 5;
+      slot = (slot * 5 + perturb + 1) & mask;
+    }
+  }
+
+  std::size_t free_slot(const std::size_t hash) const {
+    auto never = [](const KeyT&) { return false; };
+    return lookup(hash, never).first;
+  }
+
+  iterator append(const std::size_t hash, value_type&& kv) {
+    // Erased entries hold their slots until the table is resized
+    if (usable_slots(slot_count()) <= entries_.size()) {
+      compact();
+      rebuild_index(table_size_for(entries_.size() * 2 + 1));
+    }
+    write_slot(free_slot(hash), entries_.size());
+    entries_.push_back(entry{hash, std::move(kv)});
+    return iterator(this, entries_.size() - 1);
+  }
+
+  // Drops the erased entries, the index table must be rebuilt after
+  void compact() {
+    if (erased_count_ == 0) {
+      return;
+    }
+    std::vector<entry, rebind_alloc<entry>> compacted(
+        entries_.get_allocator());
+    compacted.reserve(entries_.capacity());
+    for (std::size_t i = 0; i < entries_.size(); ++i) {
+      if (!is_erased(i)) {
+        compacted.push_back(std::move(entries_[i]));
+      }
+    }
+    entries_.swap(compacted);
+    std::fill(erased_.begin(), erased_.end(), 0);
+    erased_count_ = 0;
+  }
+
+  void rebuild_index(const std::size_t table_size) {
+    slot_width_ = slot_width_for(table_size);
+    indices_.assign(table_size * slot_width_, 0xFF);
+    for (std::size_t i = 0; i < entries_.size(); ++i) {
+      write_slot(free_slot(entries_[i].hash), i);
+    }
+  }
+
+  std::vector<entry, rebind_alloc<entry>> entries_;
+  // One bit per entry, set once the entry is erased
+  std::vector<std::uint64_t, rebind_alloc<std::uint64_t>> erased_;
+  std::size_t erased_count_ = 0;
+  std::vector<unsigned char, rebind_alloc<unsigned char>> indices_;
+  std::size_t slot_width_ = 0;
+};
+
+}  // namespace anb::detail
@@ -0,0 +1,674 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "../allocator.hpp"
+
+namespace anb {
+
+template <typename AllocatorT>
+class object;
+
+namespace detail {
+
+//=====================================================================
+// Relaxed radix balanced tree
+//
+// The vector behind anb::persistent_list. Leaves hold up to 32 elements
+// and internal nodes up to 32 children, every internal node keeping the
+// cumulative element counts of its children. A node whose children are
+// all full but the last is indexed with 5 bits of the index per level,
+// like a plain radix tree; concatenation and slicing leave partially
+// filled nodes behind, which are marked relaxed and searched through
+// their counts instead. The last elements live in a separate tail leaf,
+// so appends only reach the tree once every 32 elements.
+//
+// Nodes are reference counted and never modified while shared, exactly
+// like the nodes of detail::hamt: copying a tree shares its root and
+// tail, updating a copy copies the path to the updated element. Nodes
+// only reachable from the tree being updated are changed in place.
+//
+// Concatenation merges the right edge of the left tree with the left edge
+// of the right one, level by level. Where the merged level ends up with
+// more than two nodes beyond the minimum its elements need, the nodes
+// from the first non full one onward are repacked, which keeps lookups
+// within a few steps of a radix search.
+//
+// Elements are referenced, like list elements they aren't owned.
+//=====================================================================
+inline constexpr unsigned rrb_bits = 5;
+inline constexpr std::uint32_t rrb_branching = 1u << rrb_bits;
+// Nodes a merged level may have beyond the minimum before repacking
+inline constexpr std::size_t rrb_extra_nodes = 2;
+
+template <typename AllocatorT>
+struct rrb_node {
+  mutable std::atomic<std::size_t> references = 1;
+  std::uint32_t count = 0;
+  std::uint32_t capacity = 0;
+  bool leaf = true;
+  // Internal nodes only: not every child but the last is full
+  bool relaxed = false;
+
+  anb::object<AllocatorT>* elements() const {
+    return reinterpret_cast<anb::object<AllocatorT>*>(data());
+  }
+
+  rrb_node** children() const {
+    return reinterpret_cast<rrb_node**>(data());
+  }
+
+  // Elements in children [0, i], for i < count
+  std::size_t* sizes() const {
+    return reinterpret_cast<std::size_t*>(children() + capacity);
+  }
+
+  std::size_t size() const {
+    if (leaf) {
+      return count;
+    }
+    return (count == 0) ? 0 : sizes()[count - 1];
+  }
+
+  static std::size_t block_size(const bool leaf,
+                                const std::uint32_t capacity) {
+    const std::size_t slot_bytes =
+        leaf ? sizeof(anb::object<AllocatorT>)
+             : sizeof(rrb_node*) + sizeof(std::size_t);
+    return data_offset() + capacity * slot_bytes;
+  }
+
+ private:
+  static constexpr std::size_t data_offset() {
+    return (sizeof(rrb_node) + alignof(std::size_t) - 1) &
+           ~(alignof(std::size_t) - 1);
+  }
+
+  unsigned char* data() const {
+    return const_cast<unsigned char*>(
+               reinterpret_cast<const unsigned char*>(this)) +
+           data_offset();
+  }
+};
+
+template <typename AllocatorT>
+class rrb {
+ public:
+  using node = rrb_node<AllocatorT>;
+  using value_type = anb::object<AllocatorT>;
+
+  // Elements in order, a leaf at a time
+  class const_iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = anb::object<AllocatorT>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+
+    const_iterator() = default;
+
+    const_iterator(const rrb* tree, const std::size_t index)
+        : tree_(tree), index_(index) {
+      load();
+    }
+
+    reference operator*() const { return leaf_[index_ - leaf_first_]; }
+    pointer operator->() const { return &**this; }
+
+    const_iterator& operator++() {
+      if (++index_ == leaf_end_) {
+        load();
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator previous = *this;
+      ++*this;
+      return previous;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      return index_ == other.index_;
+    }
+
+    std::size_t index() const { return index_; }
+
+   private:
+    void load() {
+      if (tree_ != nullptr && index_ < tree_->size()) {
+        const auto span = tree_->locate(index_);
+        leaf_ = span.elements;
+        leaf_first_ = span.first;
+        leaf_end_ = span.first + span.count;
+      }
+    }
+
+    const rrb* tree_ = nullptr;
+    std::size_t index_ = 0;
+    const value_type* leaf_ = nullptr;
+    std::size_t leaf_first_ = 0;
+    std::size_t leaf_end_ = 0;
+  };
+
+  explicit rrb(AllocatorT& allocator) : allocator_(&allocator) {}
+
+  // Shares the nodes of other
+  rrb(const rrb& other)
+      : allocator_(other.allocator_),
+        root_(other.root_),
+        tail_(other.tail_),
+        shift_(other.shift_),
+        size_(other.size_) {
+    retain(root_);
+    retain(tail_);
+  }
+
+  rrb(rrb&& other) noexcept
+      : allocator_(other.allocator_),
+        root_(std::exchange(other.root_, nullptr)),
+        tail_(std::exchange(other.tail_, nullptr)),
+        shift_(std::exchange(other.shift_, 0)),
+        size_(std::exchange(other.size_, 0)) {}
+
+  rrb& operator=(const rrb& other) {
+    rrb copy(other);
+    swap(copy);
+    return *this;
+  }
+
+  rrb& operator=(rrb&& other) noexcept {
+    rrb moved(std::move(other));
+    swap(moved);
+    return *this;
+  }
+
+  ~rrb() {
+    release(root_);
+    release(tail_);
+  }
+
+  void swap(rrb& other) noexcept {
+    std::swap(allocator_, other.allocator_);
+    std::swap(root_, other.root_);
+    std::swap(tail_, other.tail_);
+    std::swap(shift_, other.shift_);
+    std::swap(size_, other.size_);
+  }
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size_); }
+
+  // True when both trees are the same version, or versions that share
+  // their whole structure
+  bool shares_root(const rrb& other) const {
+    return root_ == other.root_ && tail_ == other.tail_;
+  }
+
+  // Unchecked, index < size()
+  const anb::object<AllocatorT>& operator[](const std::size_t index) const {
+    const auto span = locate(index);
+    return span.elements[index - span.first];
+  }
+
+  // Copies the nodes on the path to index that are shared with other
+  // trees, unchecked
+  void set(const std::size_t index, const anb::object<AllocatorT>& value) {
+    const std::size_t tree_size = size_ - tail_count();
+    if (index >= tree_size) {
+      tail_ = editable(tail_);
+      tail_->elements()[index - tree_size] = value;
+      return;
+    }
+    node** slot = &root_;
+    std::size_t local = index;
+    for (unsigned shift = shift_;; shift -= rrb_bits) {
+      *slot = editable(*slot);
+      if ((*slot)->leaf) {
+        (*slot)->elements()[local] = value;
+        return;
+      }
+      slot = &(*slot)->children()[child_index(*slot, shift, local)];
+    }
+  }
+
+  void push_back(const anb::object<AllocatorT>& value) {
+    if (tail_ != nullptr && tail_->count == rrb_branching) {
+      append_leaf(std::exchange(tail_, nullptr));
+    }
+    if (tail_ == nullptr) {
+      tail_ = allocate_node(true, rrb_branching);
+    } else {
+      tail_ = editable(tail_);
+    }
+    std::construct_at(tail_->elements() + tail_->count, value);
+    ++tail_->count;
+    ++size_;
+  }
+
+  // This tree followed by other, sharing the nodes of both
+  rrb concat(const rrb& other) const {
+    rrb result(*this);
+    if (other.root_ == nullptr) {
+      // Short enough to append one by one
+      for (std::uint32_t i = 0; i < other.tail_count(); ++i) {
+        result.push_back(other.tail_->elements()[i]);
+      }
+      return result;
+    }
+    if (result.tail_ != nullptr) {
+      result.append_leaf(std::exchange(result.tail_, nullptr));
+    }
+    if (result.root_ == nullptr) {
+      return other;
+    }
+
+    // Both trees as tall as the taller one
+    node* left = std::exchange(result.root_, nullptr);
+    node* right = other.root_;
+    retain(right);
+    unsigned shift = std::max(result.shift_, other.shift_);
+    for (unsigned s = result.shift_; s < shift; s += rrb_bits) {
+      left = make_internal(s + rrb_bits, &left, 1);
+    }
+    for (unsigned s = other.shift_; s < shift; s += rrb_bits) {
+      right = make_internal(s + rrb_bits, &right, 1);
+    }
+
+    std::vector<node*> merged = merge(left, right, shift);
+    release(left);
+    release(right);
+    if (merged.size() == 1) {
+      result.root_ = merged[0];
+    } else {
+      shift += rrb_bits;
+      result.root_ = make_internal(shift, merged.data(),
+                                   static_cast<std::uint32_t>(merged.size()));
+    }
+    result.shift_ = shift;
+    result.collapse();
+    result.tail_ = other.tail_;
+    retain(result.tail_);
+    result.size_ = size_ + other.size_;
+    return result;
+  }
+
+  // Elements [first, last), sharing the nodes fully inside the range.
+  // Unchecked, first <= last <= size()
+  rrb slice(const std::size_t first, const std::size_t last) const {
+    rrb result(*allocator_);
+    const std::size_t tree_size = size_ - tail_count();
+    if (first < std::min(last, tree_size)) {
+      result.root_ =
+          slice_node(root_, shift_, first, std::min(last, tree_size));
+      result.shift_ = shift_;
+      result.collapse();
+    }
+    const std::size_t tail_first = std::max(first, tree_size);
+    if (tail_first < last) {
+      result.tail_ = allocate_node(true, rrb_branching);
+      std::uninitialized_copy(tail_->elements() + (tail_first - tree_size),
+                              tail_->elements() + (last - tree_size),
+                              result.tail_->elements());
+      result.tail_->count = static_cast<std::uint32_t>(last - tail_first);
+    }
+    result.size_ = last - first;
+    return result;
+  }
+
+  // Bytes of the nodes. With seen, nodes already in it are skipped and
+  // the others are added, so nodes shared between trees count once
+  std::size_t memory_usage(
+      std::unordered_set<const void*>* seen = nullptr) const {
+    return node_bytes(root_, seen) + node_bytes(tail_, seen);
+  }
+
+  AllocatorT& allocator() const { return *allocator_; }
+
+ private:
+  // Leaf holding index
+  struct leaf_span {
+    const anb::object<AllocatorT>* elements;
+    std::size_t first;
+    std::size_t count;
+  };
+
+  leaf_span locate(const std::size_t index) const {
+    const std::size_t tree_size = size_ - tail_count();
+    if (index >= tree_size) {
+      return {tail_->elements(), tree_size, tail_->count};
+    }
+    const node* n = root_;
+    std::size_t local = index;
+    for (unsigned shift = shift_; !n->leaf; shift -= rrb_bits) {
+      n = n->children()[child_index(n, shift, local)];
+    }
+    return {n->elements(), index - local, n->count};
+  }
+
+  std::uint32_t tail_count() const {
+    return (tail_ != nullptr) ? tail_->count : 0;
+  }
+
+  // Child of n at shift holding local, which becomes the index within it
+  static std::uint32_t child_index(const node* n, const unsigned shift,
+                                   std::size_t& local) {
+    auto i = static_cast<std::uint32_t>(local >> shift);
+    if (!n->relaxed) {
+      local -= std::size_t{i} << shift;
+      return i;
+    }
+    // Children hold at most 2^shift elements, so i is a lower bound
+    const std::size_t* sizes = n->sizes();
+    while (sizes[i] <= local) {
+      ++i;
+    }
+    if (i > 0) {
+      local -= sizes[i - 1];
+    }
+    return i;
+  }
+
+  static bool is_unique(const node* n) {
+    return n->references.load(std::memory_order_acquire) == 1;
+  }
+
+  static void retain(const node* n) {
+    if (n != nullptr) {
+      n->references.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void release(const node* n) const {
+    if (n != nullptr &&
+        n->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      if (!n->leaf) {
+        for (std::uint32_t i = 0; i < n->count; ++i) {
+          release(n->children()[i]);
+        }
+      }
+      free_node(const_cast<node*>(n));
+    }
+  }
+
+  node* allocate_node(const bool leaf, const std::uint32_t capacity) const {
+    const std::size_t bytes = node::block_size(leaf, capacity);
+    void* block = nullptr;
+    if constexpr (raw_allocator<AllocatorT>) {
+      block = allocator_->allocate(bytes, alignof(node));
+    } else {
+      block = ::operator new(bytes, std::align_val_t{alignof(node)});
+    }
+    node* n = ::new (block) node;
+    n->leaf = leaf;
+    n->capacity = capacity;
+    return n;
+  }
+
+  // Only the block, the children are released by the caller
+  void free_node(node* n) const {
+    const std::size_t bytes = node::block_size(n->leaf, n->capacity);
+    if (n->leaf) {
+      std::destroy_n(n->elements(), n->count);
+    }
+    n->~node();
+    if constexpr (raw_allocator<AllocatorT>) {
+      allocator_->deallocate(n, bytes, alignof(node));
+    } else {
+      ::operator delete(n, std::align_val_t{alignof(node)});
+    }
+  }
+
+  // n itself when nothing else references it, otherwise a copy taking
+  // its place, which gives up the reference to n
+  node* editable(node* n) const {
+    if (is_unique(n)) {
+      return n;
+    }
+    node* copy = allocate_node(n->leaf, n->capacity);
+    copy->count = n->count;
+    copy->relaxed = n->relaxed;
+    if (n->leaf) {
+      std::uninitialized_copy_n(n->elements(), n->count, copy->elements());
+    } else {
+      for (std::uint32_t i = 0; i < n->count; ++i) {
+        copy->children()[i] = n->children()[i];
+        copy->sizes()[i] = n->sizes()[i];
+        retain(copy->children()[i]);
+      }
+    }
+    release(n);
+    return copy;
+  }
+
+  // Internal node at shift taking the references to children
+  node* make_internal(const unsigned shift, node* const* children,
+                      const std::uint32_t count) const {
+    node* n = allocate_node(false, rrb_branching);
+    for (std::uint32_t i = 0; i < count; ++i) {
+      add_child(n, shift, children[i]);
+    }
+    return n;
+  }
+
+  // Appends child to n, taking the reference
+  static void add_child(node* n, const unsigned shift, node* child) {
+    const std::size_t before = n->size();
+    if (n->count > 0 &&
+        n->children()[n->count - 1]->size() != (std::size_t{1} << shift)) {
+      n->relaxed = true;
+    }
+    n->children()[n->count] = child;
+    n->sizes()[n->count] = before + child->size();
+    ++n->count;
+  }
+
+  // Whether a leaf fits below n at shift without growing the tree
+  static bool has_room(const node* n, const unsigned shift) {
+    if (n->count < rrb_branching) {
+      return true;
+    }
+    return shift > rrb_bits &&
+           has_room(n->children()[n->count - 1], shift - rrb_bits);
+  }
+
+  // Takes the reference to leaf, which goes after the last element
+  void append_leaf(node* leaf) {
+    if (root_ == nullptr) {
+      root_ = leaf;
+      shift_ = 0;
+    } else if (root_->leaf || !has_room(root_, shift_)) {
+      node* children[] = {root_, chain(leaf, shift_)};
+      shift_ += rrb_bits;
+      root_ = make_internal(shift_, children, 2);
+    } else {
+      push_leaf(root_, shift_, leaf);
+    }
+  }
+
+  void push_leaf(node*& slot, const unsigned shift, node* leaf) const {
+    node* n = slot = editable(slot);
+    node* last = n->children()[n->count - 1];
+    if (shift > rrb_bits && has_room(last, shift - rrb_bits)) {
+      push_leaf(n->children()[n->count - 1], shift - rrb_bits, leaf);
+      n->sizes()[n->count - 1] += leaf->count;
+    } else {
+      add_child(n, shift, chain(leaf, shift - rrb_bits));
+    }
+  }
+
+  // Leaf under single child nodes, up to the level at shift
+  node* chain(node* leaf, const unsigned shift) const {
+    node* n = leaf;
+    for (unsigned s = rrb_bits; s <= shift; s += rrb_bits) {
+      n = make_internal(s, &n, 1);
+    }
+    return n;
+  }
+
+  // Root nodes with a single child are replaced by the child
+  void collapse() {
+    while (root_ != nullptr && !root_->leaf && root_->count == 1) {
+      node* child = root_->children()[0];
+      retain(child);
+      release(root_);
+      root_ = child;
+      shift_ -= rrb_bits;
+    }
+  }
+
+  // Nodes at shift holding the elements of left followed by those of
+  // right, which are both at shift. One or two nodes, each referenced
+  // once by the result
+  std::vector<node*> merge(const node* left, const node* right,
+                           const unsigned shift) const {
+    if (shift == 0) {
+      if (left->count + right->count <= rrb_branching) {
+        node* n = allocate_node(true, left->count + right->count);
+        std::uninitialized_copy_n(left->elements(), left->count,
+                                  n->elements());
+        std::uninitialized_copy_n(right->elements(), right->count,
+                                  n->elements() + left->count);
+        n->count = left->count + right->count;
+        return {n};
+      }
+      retain(left);
+      retain(right);
+      return {const_cast<node*>(left), const_cast<node*>(right)};
+    }
+
+    const std::vector<node*> middle =
+        merge(left->children()[left->count - 1], right->children()[0],
+              shift - rrb_bits);
+    std::vector<node*> children;
+    children.reserve(left->count + right->count + middle.size());
+    for (std::uint32_t i = 0; i + 1 < left->count; ++i) {
+      retain(left->children()[i]);
+      children.push_back(left->children()[i]);
+    }
+    children.insert(children.end(), middle.begin(), middle.end());
+    for (std::uint32_t i = 1; i < right->count; ++i) {
+      retain(right->children()[i]);
+      children.push_back(right->children()[i]);
+    }
+    rebalance(children, shift - rrb_bits);
+
+    if (children.size() <= rrb_branching) {
+      return {make_internal(shift, children.data(),
+                            static_cast<std::uint32_t>(children.size()))};
+    }
+    return {make_internal(shift, children.data(), rrb_branching),
+            make_internal(shift, children.data() + rrb_branching,
+                          static_cast<std::uint32_t>(children.size() -
+                                                     rrb_branching))};
+  }
+
+  // Repacks the nodes at shift from the first non full one onward, when
+  // there are more than rrb_extra_nodes beyond what they need
+  void rebalance(std::vector<node*>& nodes, const unsigned shift) const {
+    std::size_t slots = 0;
+    for (const node* n : nodes) {
+      slots += n->count;
+    }
+    const std::size_t needed = (slots + rrb_branching - 1) / rrb_branching;
+    if (nodes.size() <= needed + rrb_extra_nodes) {
+      return;
+    }
+
+    std::size_t first = 0;
+    while (nodes[first]->count == rrb_branching) {
+      ++first;
+    }
+    std::vector<node*> packed(nodes.begin(), nodes.begin() + first);
+    node* current = nullptr;
+    for (std::size_t i = first; i < nodes.size(); ++i) {
+      const node* n = nodes[i];
+      for (std::uint32_t slot = 0; slot < n->count; ++slot) {
+        if (current == nullptr || current->count == rrb_branching) {
+          current = allocate_node(n->leaf, rrb_branching);
+          packed.push_back(current);
+        }
+        if (n->leaf) {
+          std::construct_at(current->elements() + current->count,
+                            n->elements()[slot]);
+          ++current->count;
+        } else {
+          retain(n->children()[slot]);
+          add_child(current, shift, n->children()[slot]);
+        }
+      }
+      release(n);
+    }
+    nodes = std::move(packed);
+  }
+
+  // Node at shift holding elements [first, last) of n
+  node* slice_node(const node* n, const unsigned shift,
+                   const std::size_t first, const std::size_t last) const {
+    if (first == 0 && last == n->size()) {
+      retain(n);
+      return const_cast<node*>(n);
+    }
+    if (n->leaf) {
+      const auto count = static_cast<std::uint32_t>(last - first);
+      node* copy = allocate_node(true, count);
+      std::uninitialized_copy(n->elements() + first, n->elements() + last,
+                              copy->elements());
+      copy->count = count;
+      return copy;
+    }
+
+    node* copy = allocate_node(false, rrb_branching);
+    std::size_t local = first;
+    std::uint32_t i = child_index(n, shift, local);
+    for (std::size_t child_first = first - local; child_first < last; ++i) {
+      const node* child = n->children()[i];
+      const std::size_t child_last = child_first + child->size();
+      add_child(copy, shift,
+                slice_node(child, shift - rrb_bits,
+                           std::max(first, child_first) - child_first,
+                           std::min(last, child_last) - child_first));
+      child_first = child_last;
+    }
+    return copy;
+  }
+
+  static std::size_t node_bytes(const node* n,
+                                std::unordered_set<const void*>* seen) {
+    if (n == nullptr || (seen != nullptr && !seen->insert(n).second)) {
+      return 0;
+    }
+    std::size_t bytes = node::block_size(n->leaf, n->capacity);
+    if (!n->leaf) {
+      for (std::uint32_t i = 0; i < n->count; ++i) {
+        bytes += node_bytes(n->children()[i], seen);
+      }
+    }
+    return bytes;
+  }
+
+  AllocatorT* allocator_;
+  node* root_ = nullptr;
+  // Last elements, in a leaf with room for rrb_branching of them
+  node* tail_ = nullptr;
+  // Bits of the index consumed below the root, 0 for a leaf root
+  unsigned shift_ = 0;
+  std::size_t size_ = 0;
+};
+
+}  // namespace detail
+
+}  // namespace anb
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace anb::detail {
+
+//=====================================================================
+// Vector with N elements of inline storage
+//
+// Elements live inside the object itself until the size exceeds the
+// inline capacity, then they spill over to a buffer from AllocT. Once
+// spilled the vector only goes back to the inline buffer through
+// shrink_to_fit().
+//=====================================================================
+template <typename T, std::size_t N, typename AllocT = std::allocator<T>>
+class small_vector {
+  static_assert(N > 0, "Inline capacity must hold at least one element");
+
+  using alloc_traits = std::allocator_traits<AllocT>;
+
+ public:
+  using value_type = T;
+  using allocator_type = AllocT;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using iterator = T*;
+  using const_iterator = const T*;
+
+  inline static constexpr std::size_t inline_capacity = N;
+
+  small_vector() = default;
+
+  explicit small_vector(const AllocT& alloc) : alloc_(alloc) {}
+
+  small_vector(const small_vector& other)
+      : alloc_(alloc_traits::select_on_container_copy_construction(
+            other.alloc_)) {
+    assign(other.begin(), other.end());
+  }
+
+  small_vector(small_vector&& other) noexcept(
+      std::is_nothrow_move_constructible_v<T>)
+      : alloc_(std::move(other.alloc_)) {
+    steal(other);
+  }
+
+  ~small_vector() { release(); }
+
+  small_vector& operator=(const small_vector& other) {
+    if (this != &other) {
+      assign(other.begin(), other.end());
+    }
+    return *this;
+  }
+
+  small_vector& operator=(small_vector&& other) noexcept(
+      std::is_nothrow_move_constructible_v<T>) {
+    if (this != &other) {
+      release();
+      if constexpr (alloc_traits::propagate_on_container_move_assignment::
+                        value) {
+        alloc_ = std::move(other.alloc_);
+      }
+      if (alloc_ == other.alloc_ || other.is_inline()) {
+        steal(other);
+      } else {
+        assign(std::make_move_iterator(other.begin()),
+               std::make_move_iterator(other.end()));
+        other.clear();
+      }
+    }
+    return *this;
+  }
+
+  allocator_type get_allocator() const { return alloc_; }
+
+  iterator begin() { return data_; }
+  iterator end() { return data_ + size_; }
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+
+  T* data() { return data_; }
+  const T* data() const { return data_; }
+
+  size_type size() const { return size_; }
+  size_type capacity() const { return capacity_; }
+  bool empty() const { return size_ == 0; }
+  bool is_inline() const { return data_ == inline_data(); }
+
+  T& operator[](const size_type i) { return data_[i]; }
+  const T& operator[](const size_type i) const { return data_[i]; }
+
+  T& at(const size_type i) {
+    if (i >= size_) {
+      throw std::out_of_range("anb::detail::small_vector::at");
+    }
+    return data_[i];
+  }
+  const T& at(const size_type i) const {
+    return const_cast<small_vector*>(this)->at(i);
+  }
+
+  T& front() { return data_[0]; }
+  const T& front() const { return data_[0]; }
+  T& back() { return data_[size_ - 1]; }
+  const T& back() const { return data_[size_ - 1]; }
+
+  void reserve(const size_type count) {
+    if (count > capacity_) {
+      reallocate(count);
+    }
+  }
+
+  void shrink_to_fit() {
+    if (!is_inline() && size_ < capacity_) {
+      reallocate(size_);
+    }
+  }
+
+  void clear() {
+    std::destroy(begin(), end());
+    size_ = 0;
+  }
+
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    if (size_ == capacity_) {
+      // Built before growing, args may reference an element of this vector
+      T value(std::forward<Args>(args)...);
+      reallocate(grown_capacity(size_ + 1));
+      return *::new (static_cast<void*>(data_ + size_++)) T(std::move(value));
+    }
+    T* slot = ::new (static_cast<void*>(data_ + size_))
+        T(std::forward<Args>(args)...);
+    ++size_;
+    return *slot;
+  }
+
+  void push_back(const T& value) { emplace_back(value); }
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+
+  void pop_back() {
+    --size_;
+    std::destroy_at(data_ + size_);
+  }
+
+  void resize(const size_type count) { resize_impl(count); }
+  void resize(const size_type count, const T& value) {
+    resize_impl(count, value);
+  }
+
+  template <typename InputIt>
+  void assign(InputIt first, InputIt last) {
+    clear();
+    if constexpr (std::forward_iterator<InputIt>) {
+      reserve(static_cast<size_type>(std::distance(first, last)));
+    }
+    for (; first != last; ++first) {
+      emplace_back(*first);
+    }
+  }
+
+  iterator insert(const_iterator pos, const T& value) {
+    // Copied first, value may live in this vector
+    const T copy(value);
+    return insert(pos, &copy, &copy + 1);
+  }
+
+  template <typename InputIt>
+  iterator insert(const_iterator pos, InputIt first, InputIt last) {
+    const size_type offset = static_cast<size_type>(pos - begin());
+    const size_type old_size = size_;
+    if constexpr (std::forward_iterator<InputIt>) {
+      const auto count = static_cast<size_type>(std::distance(first, last));
+      if (size_ + count > capacity_) {
+        reallocate(grown_capacity(size_ + count));
+      }
+    }
+    // Appended at the back, then rotated into place
+    for (; first != last; ++first) {
+      emplace_back(*first);
+    }
+    std::rotate(begin() + offset, begin() + old_size, end());
+    return begin() + offset;
+  }
+
+  iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    const auto offset = first - begin();
+    iterator dst = begin() + offset;
+    iterator src = begin() + (last - begin());
+    iterator new_end = std::move(src, end(), dst);
+    std::destroy(new_end, end());
+    size_ = static_cast<size_type>(new_end - begin());
+    return begin() + offset;
+  }
+
+ private:
+  T* inline_data() { return reinterpret_cast<T*>(inline_storage_); }
+  const T* inline_data() const {
+    return reinterpret_cast<const T*>(inline_storage_);
+  }
+
+  size_type grown_capacity(const size_type required) const {
+    return std::max(required, capacity_ * 2);
+  }
+
+  template <typename... Args>
+  void resize_impl(const size_type count, const Args&... value) {
+    if (count < size_) {
+      std::destroy(begin() + count, end());
+      size_ = count;
+      return;
+    }
+    reserve(count);
+    while (size_ < count) {
+      ::new (static_cast<void*>(data_ + size_)) T(value...);
+      ++size_;
+    }
+  }
+
+  // Moves the elements into a buffer of exactly new_capacity elements, the
+  // inline buffer when they fit into it
+  void reallocate(const size_type new_capacity) {
+    T* new_data = (new_capacity <= N)
+                      ? inline_data()
+                      : alloc_traits::allocate(alloc_, new_capacity);
+    if (new_data == data_) {
+      return;
+    }
+    std::uninitialized_move(begin(), end(), new_data);
+    std::destroy(begin(), end());
+    if (!is_inline()) {
+      alloc_traits::deallocate(alloc_, data_, capacity_);
+    }
+    data_ = new_data;
+    capacity_ = std::max(new_capacity, N);
+  }
+
+  void release() {
+    clear();
+    if (!is_inline()) {
+      alloc_traits::deallocate(alloc_, data_, capacity_);
+    }
+    data_ = inline_data();
+    capacity_ = N;
+  }
+
+  void steal(small_vector& other) {
+    if (other.is_inline()) {
+      std::uninitialized_move(other.begin(), other.end(), inline_data());
+      size_ = other.size_;
+      other.clear();
+      return;
+    }
+    data_ = std::exchange(other.data_, other.inline_data());
+    size_ = std::exchange(other.size_, 0);
+    capacity_ = std::exchange(other.capacity_, N);
+  }
+
+  T* data_ = inline_data();
+  size_type size_ = 0;
+  size_type capacity_ = N;
+  [[no_unique_address]] AllocT alloc_;
+  alignas(T) unsigned char inline_storage_[N * sizeof(T)];
+};
+
+}  // namespace anb::detail
@@ -0,0 +1,765 @@
+#pragma once
+
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../dictionary.hpp"
+#include "../list.hpp"
+#include "../persistent_dictionary.hpp"
+#include "../persistent_list.hpp"
+#include "../string.hpp"
+#include "../tuple.hpp"
+#include "hash.hpp"
+#include "nanbox.hpp"
+
+namespace anb {
+
+template <typename AllocatorT>
+class object;
+
+namespace detail {
+
+//=====================================================================
+// Traversal of object graphs
+//
+// Deep operations (hash, equality, clone, footprint, heap dumps) walk the
+// graph with an explicit stack instead of recursing, so nesting is only
+// bounded by memory. The heap objects on the current path are tracked:
+// reaching one of them again closes a cycle, which is reported along with
+// its distance (1 for an object containing itself) instead of being
+// entered again. While a heap object's children are visited, the heap
+// objects of the children a few positions ahead are prefetched.
+//
+// depth_first() keeps a VisitorT::state_type next to every entered object
+// on its stack, and calls on its visitor:
+//
+//   bool enter(const object& obj, node_kind kind, state_type* parent,
+//              state_type& state)
+//       for the root (without parent) and every child reached, true to
+//       visit the children of obj, with state
+//   void leave(const object& obj, state_type& state, state_type* parent)
+//       once all children of an entered obj were visited
+//   void cycle(const object& obj, std::size_t distance, state_type* parent)
+//       instead of enter() when obj is on the current path
+//   void key(const object& key, std::size_t hash, state_type& parent)
+//       optional, instead of enter() for dictionary keys, with the hash the
+//       dictionary keeps for them
+//
+// Children are list, persistent list and tuple elements in order,
+// dictionary keys and values interleaved in insertion order, and
+// persistent dictionary keys and values interleaved in trie order.
+//
+// A walk can be given the path of an enclosing walk (parallel.hpp hands
+// the subgraphs of large containers to several threads), which counts
+// for cycles and distances and is handed back as it was.
+//=====================================================================
+enum class node_kind {
+  fixed,
+  string,
+  list,
+  dictionary,
+  tuple,
+  persistent_dictionary,
+  persistent_list
+};
+
+inline constexpr std::size_t prefetch_distance = 4;
+
+inline void prefetch(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(address);
+#else
+  (void)address;
+#endif
+}
+
+// Heap object referenced by obj, nullptr for fixed values and heap nullptr
+template <typename AllocatorT>
+const heap_object<AllocatorT>* heap_of(const object<AllocatorT>& obj) {
+  const std::uint64_t word = obj.nanbox_value();
+  if ((word & nanbox::heap_type_value) != nanbox::heap_type_value) {
+    return nullptr;
+  }
+  return reinterpret_cast<const heap_object<AllocatorT>*>(
+      word & nanbox::heap_type_data_mask);
+}
+
+template <template <class> typename HeapObjT, typename AllocatorT>
+const HeapObjT<AllocatorT>& heap_cast(const object<AllocatorT>& obj) {
+  return *static_cast<const HeapObjT<AllocatorT>*>(heap_of(obj));
+}
+
+// Fixed values (SSO strings and heap nullptr included) have no heap object
+template <typename AllocatorT>
+node_kind kind_of(const object<AllocatorT>& obj) {
+  const heap_object<AllocatorT>* heap = heap_of(obj);
+  if (heap == nullptr) {
+    return node_kind::fixed;
+  }
+  switch (heap->type()) {
+    case heap_object_type::string:
+      return node_kind::string;
+    case heap_object_type::list:
+      return node_kind::list;
+    case heap_object_type::dictionary:
+      return node_kind::dictionary;
+    case heap_object_type::tuple:
+      return node_kind::tuple;
+    case heap_object_type::persistent_dictionary:
+      return node_kind::persistent_dictionary;
+    case heap_object_type::persistent_list:
+      return node_kind::persistent_list;
+  }
+  unreachable();
+}
+
+// Every heap object but strings has children
+constexpr bool is_container(const node_kind kind) {
+  return kind != node_kind::fixed && kind != node_kind::string;
+}
+
+// Dictionaries and persistent dictionaries, whose children are keys and
+// values
+constexpr bool is_keyed(const node_kind kind) {
+  return kind == node_kind::dictionary ||
+         kind == node_kind::persistent_dictionary;
+}
+
+// Lists and persistent lists, which compare and hash alike
+constexpr bool is_sequence(const node_kind kind) {
+  return kind == node_kind::list || kind == node_kind::persistent_list;
+}
+
+// Position among the children of a heap object
+template <typename AllocatorT>
+class child_cursor {
+  using entry_iterator =
+      typename dictionary<AllocatorT>::map_type::const_iterator;
+  using trie_iterator = typename hamt<AllocatorT>::const_iterator;
+  using tree_iterator = typename rrb<AllocatorT>::const_iterator;
+
+ public:
+  child_cursor(const object<AllocatorT>& obj, const node_kind kind) {
+    switch (kind) {
+      case node_kind::list: {
+        const auto& objects = heap_cast<list>(obj).objects_;
+        elements_ = objects.data();
+        count_ = objects.size();
+        break;
+      }
+      case node_kind::tuple: {
+        const auto& elements = heap_cast<tuple>(obj);
+        elements_ = elements.begin();
+        count_ = elements.size();
+        break;
+      }
+      case node_kind::dictionary: {
+        // Entries are walked forward, prefetching a few entries ahead
+        const auto& dict = heap_cast<dictionary>(obj).object_dict_;
+        entries_ = dict.begin();
+        ahead_ = dict.begin();
+        entries_end_ = dict.end();
+        count_ = dict.size() * 2;
+        keyed_ = true;
+        for (std::size_t i = 0; i < prefetch_distance / 2; ++i) {
+          prefetch_ahead();
+        }
+        return;
+      }
+      case node_kind::persistent_list: {
+        // Trees are walked a leaf at a time, without prefetching
+        const auto& tree = heap_cast<persistent_list>(obj).tree_;
+        tree_elements_ = tree.begin();
+        count_ = tree.size();
+        return;
+      }
+      case node_kind::persistent_dictionary: {
+        // Trie iterators keep a stack of nodes, so they live out of line
+        const auto& trie = heap_cast<persistent_dictionary>(obj).trie_;
+        trie_entries_ = std::make_unique<trie_iterator>(trie.begin());
+        count_ = trie.size() * 2;
+        keyed_ = true;
+        return;
+      }
+      default:
+        break;
+    }
+    for (std::size_t i = 0; i < prefetch_distance && i < count_; ++i) {
+      prefetch(heap_of(child(i)));
+    }
+  }
+
+  bool done() const { return index_ == count_; }
+
+  // True when next() returns a dictionary key
+  bool at_key() const { return keyed_ && index_ % 2 == 0; }
+
+  // Hash kept by the dictionary for the key next() returns
+  std::size_t key_hash() const {
+    if (trie_entries_ != nullptr) {
+      return (*trie_entries_)->hash;
+    }
+    return entries_.hash();
+  }
+
+  const object<AllocatorT>& next() {
+    if (trie_entries_ != nullptr) {
+      // Tries are only walked forward, without prefetching
+      const auto& entry = **trie_entries_;
+      if (index_++ % 2 == 0) {
+        return entry.key;
+      }
+      ++*trie_entries_;
+      return entry.value;
+    }
+    if (keyed_) {
+      if (index_++ % 2 == 0) {
+        prefetch_ahead();
+        return entries_->first;
+      }
+      return (entries_++)->second;
+    }
+    if (elements_ == nullptr) {
+      ++index_;
+      return *tree_elements_++;
+    }
+    if (index_ + prefetch_distance < count_) {
+      prefetch(heap_of(child(index_ + prefetch_distance)));
+    }
+    return child(index_++);
+  }
+
+ private:
+  const object<AllocatorT>& child(const std::size_t i) const {
+    return elements_[i];
+  }
+
+  void prefetch_ahead() {
+    if (ahead_ != entries_end_) {
+      prefetch(heap_of(ahead_->first));
+      prefetch(heap_of(ahead_->second));
+      ++ahead_;
+    }
+  }
+
+  const object<AllocatorT>* elements_ = nullptr;
+  entry_iterator entries_{};
+  entry_iterator ahead_{};
+  entry_iterator entries_end_{};
+  std::unique_ptr<trie_iterator> trie_entries_;
+  tree_iterator tree_elements_{};
+  std::size_t index_ = 0;
+  std::size_t count_ = 0;
+  bool keyed_ = false;
+};
+
+// Heap objects on the current path. Shallow paths are scanned linearly,
+// deeper ones are indexed as well
+class traversal_path {
+ public:
+  static constexpr std::size_t scanned_depth = 16;
+
+  // Distance from a child of the deepest object to identity, 0 when
+  // identity isn't on the path
+  std::size_t distance(const void* identity) const {
+    const std::size_t scanned = std::min(identities_.size(), scanned_depth);
+    for (std::size_t i = 0; i < scanned; ++i) {
+      if (identities_[i] == identity) {
+        return identities_.size() - i;
+      }
+    }
+    if (identities_.size() > scanned_depth) {
+      if (const auto it = deep_index_.find(identity); it != deep_index_.end()) {
+        return identities_.size() - it->second;
+      }
+    }
+    return 0;
+  }
+
+  void push(const void* identity) {
+    if (identities_.size() >= scanned_depth) {
+      deep_index_.emplace(identity, identities_.size());
+    }
+    identities_.push_back(identity);
+  }
+
+  void pop() {
+    if (identities_.size() > scanned_depth) {
+      deep_index_.erase(identities_.back());
+    }
+    identities_.pop_back();
+  }
+
+ private:
+  std::vector<const void*> identities_;
+  std::unordered_map<const void*, std::size_t> deep_index_;
+};
+
+template <typename AllocatorT, typename VisitorT>
+void depth_first(const object<AllocatorT>& root, VisitorT& visitor,
+                 traversal_path& path) {
+  using state_type = typename VisitorT::state_type;
+  struct frame {
+    object<AllocatorT> node;
+    child_cursor<AllocatorT> children;
+    state_type state;
+  };
+  std::vector<frame> stack;
+
+  const auto reach = [&](const object<AllocatorT>& obj) {
+    const node_kind kind = kind_of(obj);
+    state_type* parent = stack.empty() ? nullptr : &stack.back().state;
+    // Only containers can lead back to themselves
+    if (is_container(kind)) {
+      if (const std::size_t distance = path.distance(heap_of(obj))) {
+        visitor.cycle(obj, distance, parent);
+        return;
+      }
+    }
+    state_type state{};
+    if (visitor.enter(obj, kind, parent, state)) {
+      path.push(heap_of(obj));
+      stack.push_back({obj, child_cursor<AllocatorT>(obj, kind),
+                       std::move(state)});
+    }
+  };
+
+  reach(root);
+  while (!stack.empty()) {
+    frame& top = stack.back();
+    if (!top.children.done()) {
+      if constexpr (requires(const object<AllocatorT>& key, std::size_t hash,
+                             state_type& state) {
+                      visitor.key(key, hash, state);
+                    }) {
+        if (top.children.at_key()) {
+          const std::size_t hash = top.children.key_hash();
+          visitor.key(top.children.next(), hash, top.state);
+          continue;
+        }
+      }
+      reach(top.children.next());
+      continue;
+    }
+    const std::size_t depth = stack.size();
+    visitor.leave(top.node, top.state,
+                  depth > 1 ? &stack[depth - 2].state : nullptr);
+    stack.pop_back();
+    path.pop();
+  }
+}
+
+template <typename AllocatorT, typename VisitorT>
+void depth_first(const object<AllocatorT>& root, VisitorT& visitor) {
+  traversal_path path;
+  depth_first(root, visitor, path);
+}
+
+// Calls func(child) for every object directly referenced by obj
+template <typename AllocatorT, typename FuncT>
+void for_each_child(const object<AllocatorT>& obj, FuncT&& func) {
+  child_cursor<AllocatorT> children(obj, kind_of(obj));
+  while (!children.done()) {
+    func(children.next());
+  }
+}
+
+//=====================================================================
+// Deep hash
+//
+// Lists and dictionaries are combined as in detail/hash.hpp, persistent
+// lists like lists, persistent dictionaries like dictionaries seeded with
+// the complement of their size (as tuples are told apart from lists).
+// Tuples are combined like lists seeded with the complement of their
+// size, unless they keep their hash (see tuple.hpp). Strings are hashed
+// on their own.
+// Dictionary keys aren't walked, their tables and tries keep their
+// hashes. An object closing a cycle hashes as its distance on the path,
+// consistently with deep_equal().
+//=====================================================================
+template <typename AllocatorT>
+class hash_visitor {
+ public:
+  struct state_type {
+    node_kind kind = node_kind::list;
+    sequence_hash sequence;
+    // Dictionaries: sum of the entry hashes, and the hash of the key whose
+    // value comes next
+    std::size_t sum = 0;
+    std::size_t key_hash = 0;
+    std::size_t count = 0;
+  };
+
+  bool enter(const object<AllocatorT>& obj, const node_kind kind,
+             state_type* parent, state_type& state) {
+    if (is_sequence(kind) || is_keyed(kind)) {
+      state.kind = is_sequence(kind) ? node_kind::list : kind;
+      return true;
+    }
+    if (kind == node_kind::tuple && !heap_cast<tuple>(obj).keeps_hash()) {
+      state.kind = kind;
+      return true;
+    }
+    add(obj.hash(), parent);
+    return false;
+  }
+
+  void leave(const object<AllocatorT>&, const state_type& state,
+             state_type* parent) {
+    std::size_t hash = 0;
+    if (state.kind == node_kind::list) {
+      hash = state.sequence.finish(state.count);
+    } else if (state.kind == node_kind::tuple) {
+      hash = state.sequence.finish(~state.count);
+    } else if (state.kind == node_kind::dictionary) {
+      hash = unordered_hash_finish(state.sum, state.count);
+    } else {
+      hash = unordered_hash_finish(state.sum, ~state.count);
+    }
+    add(hash, parent);
+  }
+
+  void cycle(const object<AllocatorT>&, const std::size_t distance,
+             state_type* parent) {
+    add(magic_hash(~distance), parent);
+  }
+
+  void key(const object<AllocatorT>&, const std::size_t hash,
+           state_type& parent) {
+    parent.key_hash = hash;
+  }
+
+  std::size_t result() const { return result_; }
+
+ private:
+  void add(const std::size_t hash, state_type* parent) {
+    if (parent == nullptr) {
+      result_ = hash;
+    } else if (!is_keyed(parent->kind)) {
+      parent->sequence.add(hash);
+      ++parent->count;
+    } else {
+      parent->sum += entry_hash(parent->key_hash, hash);
+      ++parent->count;
+    }
+  }
+
+  std::size_t result_ = 0;
+};
+
+template <typename AllocatorT>
+std::size_t deep_hash(const object<AllocatorT>& obj, traversal_path& path) {
+  hash_visitor<AllocatorT> visitor;
+  depth_first(obj, visitor, path);
+  return visitor.result();
+}
+
+template <typename AllocatorT>
+std::size_t deep_hash(const object<AllocatorT>& obj) {
+  traversal_path path;
+  return deep_hash(obj, path);
+}
+
+//=====================================================================
+// Deep equality
+//
+// Both graphs are walked in lockstep. Lists, persistent lists and tuples
+// compare their elements in order, a list equalling a persistent list
+// with the same elements. Dictionaries and persistent dictionaries look
+// the keys of lhs up in rhs, and persistent versions sharing their nodes
+// are equal without being walked. Two objects closing a cycle are equal
+// when they do at the same distance, so graphs are equal when their
+// unrolled trees are.
+//=====================================================================
+template <typename AllocatorT>
+std::size_t sequence_size(const object<AllocatorT>& obj, const node_kind kind) {
+  return (kind == node_kind::list) ? heap_cast<list>(obj).objects_.size()
+                                   : heap_cast<persistent_list>(obj).size();
+}
+
+template <typename AllocatorT>
+bool deep_equal(const object<AllocatorT>& lhs, const object<AllocatorT>& rhs,
+                traversal_path& lhs_path, traversal_path& rhs_path) {
+  using map_type = typename dictionary<AllocatorT>::map_type;
+  struct frame {
+    child_cursor<AllocatorT> lhs_children;
+    child_cursor<AllocatorT> rhs_children;
+    // Dictionaries and persistent dictionaries only
+    const map_type* rhs_dict = nullptr;
+    const hamt<AllocatorT>* rhs_trie = nullptr;
+    const object<AllocatorT>* rhs_value = nullptr;
+  };
+  std::vector<frame> stack;
+
+  // Mismatch, the paths are handed back as they were given
+  const auto mismatch = [&] {
+    for (; !stack.empty(); stack.pop_back()) {
+      lhs_path.pop();
+      rhs_path.pop();
+    }
+    return false;
+  };
+
+  // False when lhs and rhs differ, children are compared later on
+  const auto reach = [&](const object<AllocatorT>& lhs_obj,
+                         const object<AllocatorT>& rhs_obj) {
+    if (lhs_obj.nanbox_value() == rhs_obj.nanbox_value()) {
+      return true;
+    }
+    const node_kind kind = kind_of(lhs_obj);
+    const node_kind rhs_kind = kind_of(rhs_obj);
+    if (!is_container(kind) ||
+        (kind != rhs_kind && !(is_sequence(kind) && is_sequence(rhs_kind)))) {
+      // Shallow, containers never equal other types
+      return is_container(kind) ? false : lhs_obj.compare(rhs_obj) == 0;
+    }
+
+    const std::size_t lhs_distance = lhs_path.distance(heap_of(lhs_obj));
+    const std::size_t rhs_distance = rhs_path.distance(heap_of(rhs_obj));
+    if (lhs_distance != 0 || rhs_distance != 0) {
+      return lhs_distance == rhs_distance;
+    }
+
+    // Keys of rhs are looked up, its children aren't walked
+    frame next{child_cursor<AllocatorT>(lhs_obj, kind),
+               child_cursor<AllocatorT>(
+                   rhs_obj, is_keyed(kind) ? node_kind::fixed : rhs_kind)};
+    if (kind == node_kind::persistent_list &&
+        rhs_kind == node_kind::persistent_list &&
+        heap_cast<persistent_list>(lhs_obj).tree_.shares_root(
+            heap_cast<persistent_list>(rhs_obj).tree_)) {
+      return true;
+    }
+    if (is_sequence(kind)) {
+      if (sequence_size(lhs_obj, kind) != sequence_size(rhs_obj, rhs_kind)) {
+        return false;
+      }
+    } else if (kind == node_kind::tuple) {
+      if (heap_cast<tuple>(lhs_obj).size() !=
+          heap_cast<tuple>(rhs_obj).size()) {
+        return false;
+      }
+    } else if (kind == node_kind::dictionary) {
+      next.rhs_dict = &heap_cast<dictionary>(rhs_obj).object_dict_;
+      if (heap_cast<dictionary>(lhs_obj).object_dict_.size() !=
+          next.rhs_dict->size()) {
+        return false;
+      }
+    } else {
+      const auto& lhs_trie = heap_cast<persistent_dictionary>(lhs_obj).trie_;
+      next.rhs_trie = &heap_cast<persistent_dictionary>(rhs_obj).trie_;
+      if (lhs_trie.shares_root(*next.rhs_trie)) {
+        return true;
+      }
+      if (lhs_trie.size() != next.rhs_trie->size()) {
+        return false;
+      }
+    }
+    lhs_path.push(heap_of(lhs_obj));
+    rhs_path.push(heap_of(rhs_obj));
+    stack.push_back(std::move(next));
+    return true;
+  };
+
+  if (!reach(lhs, rhs)) {
+    return false;
+  }
+  while (!stack.empty()) {
+    frame& top = stack.back();
+    if (top.lhs_children.done()) {
+      stack.pop_back();
+      lhs_path.pop();
+      rhs_path.pop();
+      continue;
+    }
+
+    if (top.rhs_dict == nullptr && top.rhs_trie == nullptr) {
+      const object<AllocatorT>& lhs_child = top.lhs_children.next();
+      if (!reach(lhs_child, top.rhs_children.next())) {
+        return mismatch();
+      }
+    } else if (top.lhs_children.at_key() && top.rhs_dict != nullptr) {
+      const auto it = top.rhs_dict->find(top.lhs_children.next());
+      if (it == top.rhs_dict->end()) {
+        return mismatch();
+      }
+      top.rhs_value = &it->second;
+    } else if (top.lhs_children.at_key()) {
+      // Equal keys have equal hashes, the one lhs keeps is reused
+      const std::size_t hash = top.lhs_children.key_hash();
+      const object<AllocatorT>& lhs_key = top.lhs_children.next();
+      const auto* found = top.rhs_trie->find_hashed(
+          hash, [&lhs_key](const object<AllocatorT>& stored) {
+            return stored == lhs_key;
+          });
+      if (found == nullptr) {
+        return mismatch();
+      }
+      top.rhs_value = &found->value;
+    } else {
+      const object<AllocatorT>& lhs_value = top.lhs_children.next();
+      if (!reach(lhs_value, *top.rhs_value)) {
+        return mismatch();
+      }
+    }
+  }
+  return true;
+}
+
+template <typename AllocatorT>
+bool deep_equal(const object<AllocatorT>& lhs, const object<AllocatorT>& rhs) {
+  traversal_path lhs_path;
+  traversal_path rhs_path;
+  return deep_equal(lhs, rhs, lhs_path, rhs_path);
+}
+
+//=====================================================================
+// Deep comparison
+//
+// The total order of object::compare() for containers, walked in
+// lockstep as in deep_equal(). Lists, persistent lists and tuples compare
+// their elements lexicographically, dictionaries and persistent
+// dictionaries their sizes, then their entries sorted by key. An object
+// closing a cycle orders before one that doesn't, and by its distance
+// among those that do, so objects compare equal exactly when deep_equal()
+// holds. Sorting the keys compares them with object::compare(), keys
+// nesting dictionaries with container keys are the only recursion left.
+//=====================================================================
+template <typename AllocatorT>
+std::vector<std::pair<const object<AllocatorT>*, const object<AllocatorT>*>>
+sorted_entries(const object<AllocatorT>& obj, const node_kind kind) {
+  std::vector<std::pair<const object<AllocatorT>*, const object<AllocatorT>*>>
+      entries;
+  if (kind == node_kind::dictionary) {
+    const auto& dict = heap_cast<dictionary>(obj).object_dict_;
+    entries.reserve(dict.size());
+    for (const auto& [key, value] : dict) {
+      entries.emplace_back(&key, &value);
+    }
+  } else {
+    const auto& trie = heap_cast<persistent_dictionary>(obj).trie_;
+    entries.reserve(trie.size());
+    for (const auto& entry : trie) {
+      entries.emplace_back(&entry.key, &entry.value);
+    }
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const auto& lhs_entry, const auto& rhs_entry) {
+              return lhs_entry.first->compare(*rhs_entry.first) < 0;
+            });
+  return entries;
+}
+
+template <typename AllocatorT>
+std::strong_ordering deep_compare(const object<AllocatorT>& lhs,
+                                  const object<AllocatorT>& rhs) {
+  using entries_type = decltype(sorted_entries(lhs, node_kind::dictionary));
+  struct frame {
+    child_cursor<AllocatorT> lhs_children;
+    child_cursor<AllocatorT> rhs_children;
+    // Dictionaries and persistent dictionaries only, keys and values are
+    // compared in turn
+    entries_type lhs_entries{};
+    entries_type rhs_entries{};
+    std::size_t index = 0;
+  };
+  std::vector<frame> stack;
+  traversal_path lhs_path;
+  traversal_path rhs_path;
+
+  // Order of lhs and rhs as far as it's known before their children are
+  // compared
+  const auto reach = [&](const object<AllocatorT>& lhs_obj,
+                         const object<AllocatorT>& rhs_obj) {
+    if (lhs_obj.nanbox_value() == rhs_obj.nanbox_value()) {
+      return std::strong_ordering::equal;
+    }
+    const node_kind kind = kind_of(lhs_obj);
+    const node_kind rhs_kind = kind_of(rhs_obj);
+    if (!is_container(kind) || !is_container(rhs_kind) ||
+        (kind != rhs_kind && !(is_sequence(kind) && is_sequence(rhs_kind)))) {
+      // Shallow, containers of different types are ordered by type
+      return lhs_obj.compare(rhs_obj);
+    }
+
+    const std::size_t lhs_distance = lhs_path.distance(heap_of(lhs_obj));
+    const std::size_t rhs_distance = rhs_path.distance(heap_of(rhs_obj));
+    if (lhs_distance == 0 || rhs_distance == 0) {
+      if (lhs_distance != rhs_distance) {
+        return (lhs_distance == 0) <=> (rhs_distance == 0);
+      }
+    } else {
+      return lhs_distance <=> rhs_distance;
+    }
+
+    if (kind == node_kind::persistent_list &&
+        rhs_kind == node_kind::persistent_list &&
+        heap_cast<persistent_list>(lhs_obj).tree_.shares_root(
+            heap_cast<persistent_list>(rhs_obj).tree_)) {
+      return std::strong_ordering::equal;
+    }
+    frame next{child_cursor<AllocatorT>(
+                   lhs_obj, is_keyed(kind) ? node_kind::fixed : kind),
+               child_cursor<AllocatorT>(
+                   rhs_obj, is_keyed(kind) ? node_kind::fixed : rhs_kind)};
+    if (kind == node_kind::dictionary) {
+      const std::size_t lhs_size =
+          heap_cast<dictionary>(lhs_obj).object_dict_.size();
+      const std::size_t rhs_size =
+          heap_cast<dictionary>(rhs_obj).object_dict_.size();
+      if (lhs_size != rhs_size) {
+        return lhs_size <=> rhs_size;
+      }
+    } else if (kind == node_kind::persistent_dictionary) {
+      const auto& lhs_trie = heap_cast<persistent_dictionary>(lhs_obj).trie_;
+      const auto& rhs_trie = heap_cast<persistent_dictionary>(rhs_obj).trie_;
+      if (lhs_trie.shares_root(rhs_trie)) {
+        return std::strong_ordering::equal;
+      }
+      if (lhs_trie.size() != rhs_trie.size()) {
+        return lhs_trie.size() <=> rhs_trie.size();
+      }
+    }
+    if (is_keyed(kind)) {
+      next.lhs_entries = sorted_entries(lhs_obj, kind);
+      next.rhs_entries = sorted_entries(rhs_obj, rhs_kind);
+    }
+    lhs_path.push(heap_of(lhs_obj));
+    rhs_path.push(heap_of(rhs_obj));
+    stack.push_back(std::move(next));
+    return std::strong_ordering::equal;
+  };
+
+  std::strong_ordering order = reach(lhs, rhs);
+  while (order == 0 && !stack.empty()) {
+    frame& top = stack.back();
+    if (top.index < 2 * top.lhs_entries.size()) {
+      const std::size_t i = top.index++;
+      const auto& lhs_entry = top.lhs_entries[i / 2];
+      const auto& rhs_entry = top.rhs_entries[i / 2];
+      order = (i % 2 == 0) ? reach(*lhs_entry.first, *rhs_entry.first)
+                           : reach(*lhs_entry.second, *rhs_entry.second);
+    } else if (!top.lhs_children.done() && !top.rhs_children.done()) {
+      const object<AllocatorT>& lhs_child = top.lhs_children.next();
+      order = reach(lhs_child, top.rhs_children.next());
+    } else if (top.lhs_children.done() != top.rhs_children.done()) {
+      // The shorter sequence comes first
+      order = top.rhs_children.done() <=> top.lhs_children.done();
+    } else {
+      stack.pop_back();
+      lhs_path.pop();
+      rhs_path.pop();
+    }
+  }
+  return order;
+}
+
+}  // namespace detail
+
+}  // namespace anb
@@ -1,8 +1,19 @@
 #pragma once
 
-#include <unordered_map>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <ranges>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
 
+#include "allocator.hpp"
 #include "heap_object.hpp"
+#include "detail/box.hpp"
+#include "detail/hash.hpp"
+#include "detail/ordered_dict.hpp"
 #include "detail/util.hpp"
 
 namespace anb {
@@ -12,7 +23,18 @@ class object;
 
 template <typename AllocatorT>
 struct dictionary : public heap_object<AllocatorT> {
-  dictionary(AllocatorT& handle) : heap_object<AllocatorT>(handle) {}
+  using map_type = detail::ordered_dict<
+      anb::object<AllocatorT>, anb::object<AllocatorT>,
+      std::hash<anb::object<AllocatorT>>,
+      std::equal_to<anb::object<AllocatorT>>,
+      detail::container_allocator<
+          std::pair<const anb::object<AllocatorT>, anb::object<AllocatorT>>,
+          AllocatorT>>;
+  using iterator = typename map_type::iterator;
+  using const_iterator = typename map_type::const_iterator;
+
+  dictionary(AllocatorT& handle)
+      : heap_object<AllocatorT>(handle), object_dict_(handle) {}
 
   template <template <class, class> typename... ArgPairs>
   void set(
@@ -28,6 +50,50 @@ struct dictionary : public heap_object<AllocatorT> {
      ...);
   }
 
+  // Inserts keys[i] -> values[i], boxing fixed values and strings. Like
+  // set(), keys already present keep their value. Sized ranges reserve
+  // the table once, and have to be of the same size
+  template <std::ranges::input_range KeysT, std::ranges::input_range ValuesT>
+    requires detail::boxable<std::ranges::range_reference_t<KeysT>,
+                             AllocatorT> &&
+             detail::boxable<std::ranges::range_reference_t<ValuesT>,
+                             AllocatorT>
+  void insert_range(KeysT&& keys, ValuesT&& values) {
+    if constexpr (std::ranges::sized_range<KeysT> &&
+                  std::ranges::sized_range<ValuesT>) {
+      if (std::ranges::size(keys) != std::ranges::size(values)) {
+        throw std::invalid_argument(
+            "anb::dictionary::insert_range: keys and values sizes differ");
+      }
+      object_dict_.reserve(object_dict_.size() + std::ranges::size(keys));
+    }
+    auto value_it = std::ranges::begin(values);
+    const auto value_end = std::ranges::end(values);
+    for (auto&& key : keys) {
+      if (value_it == value_end) {
+        throw std::invalid_argument(
+            "anb::dictionary::insert_range: keys and values sizes differ");
+      }
+      insert_boxed(std::forward<decltype(key)>(key), *value_it);
+      ++value_it;
+    }
+    if (value_it != value_end) {
+      throw std::invalid_argument(
+          "anb::dictionary::insert_range: keys and values sizes differ");
+    }
+  }
+
+  // Inserts every (key, value) pair of range
+  template <std::ranges::input_range RangeT>
+  void insert_range(RangeT&& range) {
+    if constexpr (std::ranges::sized_range<RangeT>) {
+      object_dict_.reserve(object_dict_.size() + std::ranges::size(range));
+    }
+    for (auto&& [key, value] : range) {
+      insert_boxed(key, value);
+    }
+  }
+
   void reset() { object_dict_.clear(); }
 
   template <template <class, class> typename... ArgPairs>
@@ -38,27 +104,105 @@ struct dictionary : public heap_object<AllocatorT> {
         ArgPairs<anb::object<AllocatorT>, anb::object<AllocatorT>>>(args)...);
   }
 
+  //===================================================================
+  // Lookups without boxing the key first. Strings are hashed and compared
+  // against the stored SSO and heap string keys in place, so probing with
+  // a string longer than the SSO limit never allocates. Results are the
+  // same as looking up the equivalent anb::object key.
+  const_iterator find(const anb::object<AllocatorT>& key) const {
+    return object_dict_.find(key);
+  }
+
+  const_iterator find(const std::string_view key) const {
+    return object_dict_.find_hashed(
+        anb::object<AllocatorT>::hash_string(key),
+        [key](const anb::object<AllocatorT>& stored) {
+          return stored.string_equals(key);
+        });
+  }
+
+  // Fixed types are boxed for free
+  const_iterator find(const std::int32_t key) const {
+    return find(anb::object<AllocatorT>(key));
+  }
+
+  const_iterator find(const double key) const {
+    return find(anb::object<AllocatorT>(key));
+  }
+
+  // Constrained so string literals don't convert to bool
+  template <std::same_as<bool> BoolT>
+  const_iterator find(const BoolT key) const {
+    return find(anb::object<AllocatorT>(key));
+  }
+
+  template <typename KeyT>
+  bool contains(const KeyT& key) const {
+    return find(key) != object_dict_.end();
+  }
+
+  template <typename KeyT>
+  const anb::object<AllocatorT>& at(const KeyT& key) const {
+    const auto it = find(key);
+    if (it == object_dict_.end()) {
+      throw std::out_of_range("anb::dictionary::at");
+    }
+    return it->second;
+  }
+
+  template <typename KeyT>
+  anb::object<AllocatorT>& at(const KeyT& key) {
+    return const_cast<anb::object<AllocatorT>&>(
+        static_cast<const dictionary&>(*this).at(key));
+  }
+
   heap_object_type type() const override { return heap_object_type::dictionary; }
 
-  std::unordered_map<anb::object<AllocatorT>, anb::object<AllocatorT>>
-      object_dict_;
+ private:
+  // Boxes the value only when key isn't present yet, and string keys only
+  // then too, so no heap string is allocated for an entry that's kept
+  template <typename KeyT, typename ValueT>
+  void insert_boxed(KeyT&& key, ValueT&& value) {
+    anb::object<AllocatorT> boxed_key;
+    if constexpr (std::convertible_to<KeyT, std::string_view>) {
+      const std::string_view str(key);
+      if (contains(str)) {
+        return;
+      }
+      boxed_key = detail::box(this->allocator_handle, str);
+    } else {
+      boxed_key = anb::object<AllocatorT>(std::forward<KeyT>(key));
+    }
+    const auto [it, inserted] =
+        object_dict_.insert({boxed_key, anb::object<AllocatorT>()});
+    if (inserted) {
+      it->second = detail::box(this->allocator_handle,
+                               std::forward<ValueT>(value));
+    }
+  }
+
+ public:
+  map_type object_dict_;
 };
 
 }  // namespace anb
 
-template <typename AllocatorT>
-struct std::hash<
-    std::unordered_map<anb::object<AllocatorT>, anb::object<AllocatorT>>> {
+template <typename AllocatorT, typename HashT, typename KeyEqualT,
+          typename AllocT>
+struct std::hash<anb::detail::ordered_dict<
+    anb::object<AllocatorT>, anb::object<AllocatorT>, HashT, KeyEqualT,
+    AllocT>> {
   std::size_t operator()(
       const AllocatorT& allocator,
-      const std::unordered_map<anb::object<AllocatorT>,
-                               anb::object<AllocatorT>>& objects) const {
-    std::size_t seed = objects.size();
-    for (const auto& [key_obj, val_obj] : objects) {
-      seed ^= anb::detail::magic_hash(key_obj.hash());
-      seed ^= anb::detail::magic_hash(val_obj.hash());
+      const anb::detail::ordered_dict<anb::object<AllocatorT>,
+                                      anb::object<AllocatorT>, HashT,
+                                      KeyEqualT, AllocT>& objects) const {
+    std::size_t sum = 0;
+    for (auto it = objects.begin(); it != objects.end(); ++it) {
+      // Key hashes are kept by the table
+      sum += anb::detail::entry_hash(it.hash(), it->second.hash());
     }
-    return seed;
+    return anb::detail::unordered_hash_finish(sum, objects.size());
   }
 };
 
@@ -66,8 +210,7 @@ template <typename AllocatorT>
 struct std::hash<anb::dictionary<AllocatorT>> {
   std::size_t operator()(const AllocatorT& allocator,
                          const anb::dictionary<AllocatorT>& dict) const {
-    return std::hash<
-        std::unordered_map<anb::object<AllocatorT>, anb::object<AllocatorT>>>{}(
+    return std::hash<typename anb::dictionary<AllocatorT>::map_type>{}(
         allocator, dict.object_dict_);
   }
 };
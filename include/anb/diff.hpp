@@ -0,0 +1,649 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "clone.hpp"
+#include "object.hpp"
+#include "detail/hash.hpp"
+#include "detail/traverse.hpp"
+
+namespace anb {
+
+//=====================================================================
+// Structural diff and patch of object graphs
+//
+//   const anb::merkle_index<A> before(allocator, old_root);
+//   const anb::merkle_index<A> after(allocator, new_root);
+//   const anb::patch<A> changes = anb::diff(before, after);
+//   auto displaced = anb::apply(replica_allocator, replica_root, changes);
+//
+// A merkle_index hashes every subtree of a graph once, as object::hash()
+// does, and arranges the hashes of the children of every list and
+// dictionary in a tree of blocks of merkle_fanout hashes. diff() walks
+// two indexed graphs from their roots and skips the subtrees and blocks
+// of children hashing alike without looking into them, so it only
+// reaches the children that changed and the blocks above them.
+//
+// Lists and dictionaries are diffed child by child, any other object
+// (strings, tuples, persistent containers) is replaced whole, as are
+// objects whose type changed. A list whose length changed keeps its
+// common prefix and suffix and has the middle spliced, finding the
+// suffix costs its length.
+//
+// A patch is a sequence of edits, each reaching the object it changes
+// through a path of dictionary keys and list indexes from the root. It
+// references keys and values of both graphs (like list elements they
+// aren't owned), which have to outlive it. apply() clones what it inserts
+// into the target's allocator, and returns the objects it replaced or
+// removed for the caller to release.
+//
+// Subtrees hashing alike are taken to be equal. An index describes its
+// graph as it was when built, and cyclic graphs can't be indexed
+// (std::invalid_argument).
+//=====================================================================
+inline constexpr std::size_t merkle_fanout = 16;
+
+enum class edit_kind {
+  // The object at path becomes values[0], a new entry for dictionaries
+  assign,
+  // The dictionary entry at path is removed
+  erase,
+  // Elements [index, index + count) of the list at path are replaced by
+  // values
+  splice
+};
+
+template <typename AllocatorT>
+struct patch_edit {
+  edit_kind kind = edit_kind::assign;
+  // Dictionary keys, and list indexes as int32 (double beyond) objects
+  std::vector<object<AllocatorT>> path;
+  std::size_t index = 0;
+  std::size_t count = 0;
+  std::vector<object<AllocatorT>> values;
+};
+
+template <typename AllocatorT>
+struct patch {
+  std::vector<patch_edit<AllocatorT>> edits;
+  // Allocator of the graph the values come from
+  const AllocatorT* allocator = nullptr;
+
+  bool empty() const { return edits.empty(); }
+};
+
+struct diff_stats {
+  // Pairs of subtree or block hashes compared
+  std::size_t hashes_compared = 0;
+  // Dictionary entries reached from the positions of mismatching hashes
+  std::size_t entries_reached = 0;
+};
+
+namespace detail {
+
+struct merkle_node {
+  std::size_t hash = 0;
+  // Lists and dictionaries: level 0 holds the hashes of the elements (of
+  // the entries for dictionaries), level k + 1 those of the blocks of
+  // merkle_fanout hashes of level k, up to at most merkle_fanout of them
+  std::vector<std::vector<std::size_t>> levels;
+  // Dictionaries with erased entries: slot of the entry at every
+  // position, see ordered_dict::at_slot(). Empty when they coincide
+  std::vector<std::size_t> slots;
+};
+
+using merkle_levels = std::vector<std::vector<std::size_t>>;
+
+inline merkle_levels make_merkle_levels(std::vector<std::size_t> hashes) {
+  merkle_levels levels;
+  levels.push_back(std::move(hashes));
+  while (levels.back().size() > merkle_fanout) {
+    const std::vector<std::size_t>& below = levels.back();
+    std::vector<std::size_t> above;
+    above.reserve((below.size() + merkle_fanout - 1) / merkle_fanout);
+    for (std::size_t first = 0; first < below.size();
+         first += merkle_fanout) {
+      const std::size_t last = std::min(first + merkle_fanout, below.size());
+      sequence_hash block;
+      for (std::size_t i = first; i < last; ++i) {
+        block.add(below[i]);
+      }
+      above.push_back(block.finish(last - first));
+    }
+    levels.push_back(std::move(above));
+  }
+  return levels;
+}
+
+template <typename DictT>
+std::vector<std::size_t> entry_slots(const DictT& dict) {
+  if (dict.empty() || std::prev(dict.end()).slot() + 1 == dict.size()) {
+    return {};
+  }
+  std::vector<std::size_t> slots;
+  slots.reserve(dict.size());
+  for (auto it = dict.begin(); it != dict.end(); ++it) {
+    slots.push_back(it.slot());
+  }
+  return slots;
+}
+
+// Hashes like hash_visitor, recording every heap object once. Shared
+// heap objects are hashed the first time they're reached
+template <typename AllocatorT>
+class merkle_visitor {
+ public:
+  struct state_type {
+    node_kind kind = node_kind::list;
+    sequence_hash sequence;
+    std::size_t sum = 0;
+    std::size_t key_hash = 0;
+    std::size_t count = 0;
+    // Lists and dictionaries: hashes of the elements, or of the entries
+    std::vector<std::size_t> children;
+  };
+
+  explicit merkle_visitor(
+      std::unordered_map<const void*, merkle_node>& nodes)
+      : nodes_(nodes) {}
+
+  bool enter(const object<AllocatorT>& obj, const node_kind kind,
+             state_type* parent, state_type& state) {
+    const void* heap = heap_of(obj);
+    if (const auto it = nodes_.find(heap); it != nodes_.end()) {
+      add(it->second.hash, parent);
+      return false;
+    }
+    if (is_sequence(kind) || is_keyed(kind)) {
+      state.kind = kind;
+      return true;
+    }
+    const std::size_t hash = obj.hash();
+    if (heap != nullptr) {
+      nodes_[heap].hash = hash;
+    }
+    add(hash, parent);
+    return false;
+  }
+
+  void leave(const object<AllocatorT>& obj, state_type& state,
+             state_type* parent) {
+    std::size_t hash = 0;
+    if (is_sequence(state.kind)) {
+      hash = state.sequence.finish(state.count);
+    } else if (state.kind == node_kind::dictionary) {
+      hash = unordered_hash_finish(state.sum, state.count);
+    } else {
+      hash = unordered_hash_finish(state.sum, ~state.count);
+    }
+    merkle_node& node = nodes_[heap_of(obj)];
+    node.hash = hash;
+    if (state.kind == node_kind::list ||
+        state.kind == node_kind::dictionary) {
+      node.levels = make_merkle_levels(std::move(state.children));
+    }
+    if (state.kind == node_kind::dictionary) {
+      node.slots = entry_slots(heap_cast<dictionary>(obj).object_dict_);
+    }
+    add(hash, parent);
+  }
+
+  void cycle(const object<AllocatorT>&, std::size_t, state_type*) {
+    throw std::invalid_argument("anb::merkle_index: cyclic graph");
+  }
+
+  void key(const object<AllocatorT>&, const std::size_t hash,
+           state_type& parent) {
+    parent.key_hash = hash;
+  }
+
+ private:
+  void add(const std::size_t hash, state_type* parent) {
+    if (parent == nullptr) {
+      return;
+    }
+    ++parent->count;
+    if (is_keyed(parent->kind)) {
+      const std::size_t entry = entry_hash(parent->key_hash, hash);
+      parent->sum += entry;
+      if (parent->kind == node_kind::dictionary) {
+        parent->children.push_back(entry);
+      }
+    } else {
+      parent->sequence.add(hash);
+      if (parent->kind == node_kind::list) {
+        parent->children.push_back(hash);
+      }
+    }
+  }
+
+  std::unordered_map<const void*, merkle_node>& nodes_;
+};
+
+}  // namespace detail
+
+template <typename AllocatorT>
+class merkle_index {
+ public:
+  merkle_index(const AllocatorT& allocator, const object<AllocatorT>& root)
+      : allocator_(&allocator), root_(root) {
+    detail::merkle_visitor<AllocatorT> visitor(nodes_);
+    detail::depth_first(root, visitor);
+  }
+
+  const object<AllocatorT>& root() const { return root_; }
+  const AllocatorT& allocator() const { return *allocator_; }
+
+  // Equal to obj.hash(), for obj in the indexed graph
+  std::size_t hash(const object<AllocatorT>& obj) const {
+    const void* heap = detail::heap_of(obj);
+    return (heap != nullptr) ? nodes_.at(heap).hash : obj.hash();
+  }
+
+  // Block hashes of a list or dictionary of the indexed graph, see
+  // detail::merkle_node
+  const detail::merkle_levels& levels(
+      const object<AllocatorT>& container) const {
+    return nodes_.at(detail::heap_of(container)).levels;
+  }
+
+  // Entry slots of a dictionary of the indexed graph, see
+  // detail::merkle_node
+  const std::vector<std::size_t>& slots(
+      const object<AllocatorT>& dictionary) const {
+    return nodes_.at(detail::heap_of(dictionary)).slots;
+  }
+
+ private:
+  const AllocatorT* allocator_;
+  object<AllocatorT> root_;
+  std::unordered_map<const void*, detail::merkle_node> nodes_;
+};
+
+namespace detail {
+
+template <typename AllocatorT>
+object<AllocatorT> index_step(const std::size_t index) {
+  if (index <= static_cast<std::size_t>(
+                   std::numeric_limits<std::int32_t>::max())) {
+    return object<AllocatorT>(static_cast<std::int32_t>(index));
+  }
+  return object<AllocatorT>(static_cast<double>(index));
+}
+
+template <typename AllocatorT>
+std::size_t step_index(const object<AllocatorT>& step) {
+  if (step.is_int32() && step.as_int32() >= 0) {
+    return static_cast<std::size_t>(step.as_int32());
+  }
+  if (step.is_float64() && step.as_float64() >= 0) {
+    return static_cast<std::size_t>(step.as_float64());
+  }
+  throw std::invalid_argument("anb::apply: list index expected");
+}
+
+template <typename AllocatorT>
+class differ {
+ public:
+  differ(const merkle_index<AllocatorT>& from,
+         const merkle_index<AllocatorT>& to, diff_stats& stats)
+      : from_(from), to_(to), stats_(stats) {
+    result_.allocator = &to.allocator();
+  }
+
+  patch<AllocatorT> run() {
+    const object<AllocatorT>& lhs = from_.root();
+    const object<AllocatorT>& rhs = to_.root();
+    if (!same(lhs, rhs)) {
+      change({}, lhs, rhs);
+    }
+    // Depth first, the children of a pair are pushed in reverse
+    while (!pending_.empty()) {
+      pair_type next = std::move(pending_.back());
+      pending_.pop_back();
+      const std::size_t first = pending_.size();
+      if (kind_of(next.lhs) == node_kind::list) {
+        diff_lists(next);
+      } else {
+        diff_dictionaries(next);
+      }
+      std::reverse(pending_.begin() + first, pending_.end());
+    }
+    return std::move(result_);
+  }
+
+ private:
+  using path_type = std::vector<object<AllocatorT>>;
+
+  // Lists or dictionaries hashing differently
+  struct pair_type {
+    path_type path;
+    object<AllocatorT> lhs;
+    object<AllocatorT> rhs;
+  };
+
+  bool same(const object<AllocatorT>& lhs, const object<AllocatorT>& rhs) {
+    if (lhs.nanbox_value() == rhs.nanbox_value()) {
+      return true;
+    }
+    ++stats_.hashes_compared;
+    return from_.hash(lhs) == to_.hash(rhs);
+  }
+
+  // lhs, at path, differs from rhs
+  void change(path_type path, const object<AllocatorT>& lhs,
+              const object<AllocatorT>& rhs) {
+    const node_kind kind = kind_of(lhs);
+    if ((kind == node_kind::list || kind == node_kind::dictionary) &&
+        kind == kind_of(rhs)) {
+      pending_.push_back({std::move(path), lhs, rhs});
+      return;
+    }
+    patch_edit<AllocatorT> edit;
+    edit.path = std::move(path);
+    edit.values.push_back(rhs);
+    result_.edits.push_back(std::move(edit));
+  }
+
+  static path_type extend(const path_type& path,
+                          const object<AllocatorT>& step) {
+    path_type extended;
+    extended.reserve(path.size() + 1);
+    extended.assign(path.begin(), path.end());
+    extended.push_back(step);
+    return extended;
+  }
+
+  // Positions whose hashes differ among the leaves of block at level,
+  // in order, stopping once out holds limit of them
+  void mismatches(const merkle_levels& lhs, const merkle_levels& rhs,
+                  const std::size_t size, const std::size_t level,
+                  const std::size_t block, const std::size_t span,
+                  const std::size_t limit, std::vector<std::size_t>& out) {
+    if (out.size() >= limit || block * span >= size) {
+      return;
+    }
+    if (level < lhs.size() && level < rhs.size() &&
+        block < lhs[level].size() && block < rhs[level].size()) {
+      ++stats_.hashes_compared;
+      if (lhs[level][block] == rhs[level][block]) {
+        return;
+      }
+    }
+    if (level == 0) {
+      out.push_back(block);
+      return;
+    }
+    for (std::size_t i = 0; i < merkle_fanout; ++i) {
+      mismatches(lhs, rhs, size, level - 1, block * merkle_fanout + i,
+                 span / merkle_fanout, limit, out);
+    }
+  }
+
+  std::vector<std::size_t> mismatches(
+      const merkle_levels& lhs, const merkle_levels& rhs,
+      const std::size_t size,
+      const std::size_t limit = std::numeric_limits<std::size_t>::max()) {
+    const std::size_t top = std::max(lhs.size(), rhs.size()) - 1;
+    std::size_t span = 1;
+    for (std::size_t level = 0; level < top; ++level) {
+      span *= merkle_fanout;
+    }
+    std::vector<std::size_t> out;
+    for (std::size_t block = 0; block * span < size; ++block) {
+      mismatches(lhs, rhs, size, top, block, span, limit, out);
+    }
+    return out;
+  }
+
+  void diff_lists(const pair_type& pair) {
+    const auto& lhs = heap_cast<list>(pair.lhs).objects_;
+    const auto& rhs = heap_cast<list>(pair.rhs).objects_;
+    const merkle_levels& lhs_levels = from_.levels(pair.lhs);
+    const merkle_levels& rhs_levels = to_.levels(pair.rhs);
+    const std::size_t lhs_size = lhs.size();
+    const std::size_t rhs_size = rhs.size();
+
+    if (lhs_size == rhs_size) {
+      for (const std::size_t i :
+           mismatches(lhs_levels, rhs_levels, lhs_size)) {
+        change(extend(pair.path, index_step<AllocatorT>(i)), lhs[i],
+               rhs[i]);
+      }
+      return;
+    }
+
+    // Common prefix through the blocks, common suffix one by one
+    const std::size_t shorter = std::min(lhs_size, rhs_size);
+    const std::vector<std::size_t> first_mismatch =
+        mismatches(lhs_levels, rhs_levels, std::max(lhs_size, rhs_size), 1);
+    const std::size_t prefix = first_mismatch.front();
+    const std::vector<std::size_t>& lhs_hashes = lhs_levels.front();
+    const std::vector<std::size_t>& rhs_hashes = rhs_levels.front();
+    std::size_t suffix = 0;
+    while (prefix + suffix < shorter) {
+      ++stats_.hashes_compared;
+      if (lhs_hashes[lhs_size - 1 - suffix] !=
+          rhs_hashes[rhs_size - 1 - suffix]) {
+        break;
+      }
+      ++suffix;
+    }
+
+    // The middles are changed pairwise, the rest of the longer one is
+    // spliced in or out
+    const std::size_t paired = shorter - prefix - suffix;
+    for (std::size_t i = prefix; i < prefix + paired; ++i) {
+      ++stats_.hashes_compared;
+      if (lhs_hashes[i] != rhs_hashes[i]) {
+        change(extend(pair.path, index_step<AllocatorT>(i)), lhs[i],
+               rhs[i]);
+      }
+    }
+    patch_edit<AllocatorT> edit;
+    edit.kind = edit_kind::splice;
+    edit.path = pair.path;
+    edit.index = prefix + paired;
+    edit.count = lhs_size - suffix - edit.index;
+    edit.values.assign(rhs.begin() + edit.index,
+                       rhs.begin() + (rhs_size - suffix));
+    result_.edits.push_back(std::move(edit));
+  }
+
+  void diff_dictionaries(const pair_type& pair) {
+    const auto& lhs = heap_cast<dictionary>(pair.lhs).object_dict_;
+    const auto& rhs = heap_cast<dictionary>(pair.rhs).object_dict_;
+    const std::vector<std::size_t> positions =
+        mismatches(from_.levels(pair.lhs), to_.levels(pair.rhs),
+                   std::max(lhs.size(), rhs.size()));
+
+    // An entry of a block hashing alike is in both dictionaries, so every
+    // other key is at a mismatching position on its side. The indexes map
+    // the positions to entry slots, so the entries are reached directly
+    const std::vector<std::size_t>& lhs_slots = from_.slots(pair.lhs);
+    const std::vector<std::size_t>& rhs_slots = to_.slots(pair.rhs);
+    for (const std::size_t i : positions) {
+      if (i < lhs.size()) {
+        const auto lhs_it = lhs.at_slot(slot_at(lhs_slots, i));
+        if (find(rhs, lhs_it) == rhs.end()) {
+          patch_edit<AllocatorT> edit;
+          edit.kind = edit_kind::erase;
+          edit.path = extend(pair.path, lhs_it->first);
+          result_.edits.push_back(std::move(edit));
+        }
+      }
+    }
+    for (const std::size_t i : positions) {
+      if (i < rhs.size()) {
+        const auto rhs_it = rhs.at_slot(slot_at(rhs_slots, i));
+        const auto found = find(lhs, rhs_it);
+        if (found == lhs.end()) {
+          patch_edit<AllocatorT> edit;
+          edit.path = extend(pair.path, rhs_it->first);
+          edit.values.push_back(rhs_it->second);
+          result_.edits.push_back(std::move(edit));
+        } else if (!same(found->second, rhs_it->second)) {
+          change(extend(pair.path, rhs_it->first), found->second,
+                 rhs_it->second);
+        }
+      }
+    }
+  }
+
+  std::size_t slot_at(const std::vector<std::size_t>& slots,
+                      const std::size_t position) {
+    ++stats_.entries_reached;
+    return slots.empty() ? position : slots[position];
+  }
+
+  // Entry of dict with the key of entry
+  template <typename DictT, typename IteratorT>
+  static auto find(const DictT& dict, const IteratorT& entry) {
+    return dict.find_hashed(entry.hash(),
+                            [&entry](const object<AllocatorT>& key) {
+                              return key == entry->first;
+                            });
+  }
+
+  const merkle_index<AllocatorT>& from_;
+  const merkle_index<AllocatorT>& to_;
+  diff_stats& stats_;
+  std::vector<pair_type> pending_;
+  patch<AllocatorT> result_;
+};
+
+}  // namespace detail
+
+// Edits turning the graph indexed by from into the one indexed by to
+template <typename AllocatorT>
+patch<AllocatorT> diff(const merkle_index<AllocatorT>& from,
+                       const merkle_index<AllocatorT>& to,
+                       diff_stats* stats = nullptr) {
+  diff_stats local;
+  return detail::differ<AllocatorT>(from, to, stats ? *stats : local).run();
+}
+
+// Indexes both graphs first, which costs their size
+template <typename AllocatorT>
+patch<AllocatorT> diff(const AllocatorT& allocator,
+                       const object<AllocatorT>& from,
+                       const object<AllocatorT>& to) {
+  return diff(merkle_index<AllocatorT>(allocator, from),
+              merkle_index<AllocatorT>(allocator, to));
+}
+
+// Applies the edits of changes to the graph at root, in order, cloning
+// what they insert into allocator. Returns the objects replaced or
+// removed (keys of erased entries included), root included when it's
+// replaced. Throws std::invalid_argument when an edit doesn't match the
+// graph, leaving the edits before it applied
+template <typename AllocatorT>
+std::vector<object<AllocatorT>> apply(AllocatorT& allocator,
+                                      object<AllocatorT>& root,
+                                      const patch<AllocatorT>& changes) {
+  const auto mismatch = [] {
+    return std::invalid_argument("anb::apply: patch doesn't match graph");
+  };
+  const auto clone = [&](const object<AllocatorT>& value) {
+    return deep_clone(allocator, *changes.allocator, value);
+  };
+  // The object reached through the first length steps of path
+  const auto locate = [&](const std::vector<object<AllocatorT>>& path,
+                          const std::size_t length) {
+    object<AllocatorT> current = root;
+    for (std::size_t i = 0; i < length; ++i) {
+      if (current.is_list(allocator)) {
+        const auto& elements = current.as_list(allocator).objects_;
+        const std::size_t index = detail::step_index(path[i]);
+        if (index >= elements.size()) {
+          throw mismatch();
+        }
+        current = elements[index];
+      } else if (current.is_dictionary(allocator)) {
+        const auto& entries = current.as_dictionary(allocator).object_dict_;
+        const auto it = entries.find(path[i]);
+        if (it == entries.end()) {
+          throw mismatch();
+        }
+        current = it->second;
+      } else {
+        throw mismatch();
+      }
+    }
+    return current;
+  };
+
+  std::vector<object<AllocatorT>> displaced;
+  for (const patch_edit<AllocatorT>& edit : changes.edits) {
+    if (edit.kind == edit_kind::splice) {
+      object<AllocatorT> target = locate(edit.path, edit.path.size());
+      if (!target.is_list(allocator)) {
+        throw mismatch();
+      }
+      auto& elements = target.as_list(allocator).objects_;
+      if (edit.index + edit.count > elements.size()) {
+        throw mismatch();
+      }
+      const auto first = elements.begin() + edit.index;
+      displaced.insert(displaced.end(), first, first + edit.count);
+      elements.erase(first, first + edit.count);
+      std::vector<object<AllocatorT>> inserted;
+      inserted.reserve(edit.values.size());
+      for (const auto& value : edit.values) {
+        inserted.push_back(clone(value));
+      }
+      elements.insert(elements.begin() + edit.index, inserted.begin(),
+                      inserted.end());
+      continue;
+    }
+
+    if (edit.path.empty()) {
+      if (edit.kind == edit_kind::erase) {
+        throw mismatch();
+      }
+      displaced.push_back(root);
+      root = clone(edit.values.front());
+      continue;
+    }
+    object<AllocatorT> parent = locate(edit.path, edit.path.size() - 1);
+    const object<AllocatorT>& step = edit.path.back();
+    if (parent.is_list(allocator) && edit.kind == edit_kind::assign) {
+      auto& elements = parent.as_list(allocator).objects_;
+      const std::size_t index = detail::step_index(step);
+      if (index >= elements.size()) {
+        throw mismatch();
+      }
+      displaced.push_back(elements[index]);
+      elements[index] = clone(edit.values.front());
+    } else if (parent.is_dictionary(allocator)) {
+      auto& entries = parent.as_dictionary(allocator).object_dict_;
+      const auto it = entries.find(step);
+      if (edit.kind == edit_kind::erase) {
+        if (it == entries.end()) {
+          throw mismatch();
+        }
+        displaced.push_back(it->first);
+        displaced.push_back(it->second);
+        entries.erase(step);
+      } else if (it != entries.end()) {
+        displaced.push_back(it->second);
+        it->second = clone(edit.values.front());
+      } else {
+        entries.insert({clone(step), clone(edit.values.front())});
+      }
+    } else {
+      throw mismatch();
+    }
+  }
+  return displaced;
+}
+
+}  // namespace anb
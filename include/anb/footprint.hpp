@@ -0,0 +1,422 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "clone.hpp"
+#include "object.hpp"
+
+namespace anb {
+
+//=====================================================================
+// Memory footprint of object graphs
+//
+// deep_size() walks everything reachable from an object and adds up the
+// bytes it retains, per heap type:
+//
+//   - object bytes, the heap object itself (the whole block for tuples)
+//   - buffer bytes, what the containers inside it allocated on their own:
+//     the buffers of a string, the spilled elements of a list, the entries
+//     and index table of a dictionary, the trie nodes of a persistent
+//     dictionary, the tree nodes of a persistent list
+//
+// Fixed values take no space besides the 8 bytes of their parent slot.
+// Heap objects referenced from several places are counted once, repeated
+// references are reported as shared_references, so cyclic graphs are
+// fine too. Trie and tree nodes shared between versions of persistent
+// dictionaries and lists, and character buffers shared between slices and
+// ropes of strings, are counted once as well, as buffer bytes of the
+// first object reached.
+//=====================================================================
+struct heap_type_footprint {
+  std::size_t count = 0;
+  std::size_t object_bytes = 0;
+  std::size_t buffer_bytes = 0;
+
+  std::size_t bytes() const { return object_bytes + buffer_bytes; }
+};
+
+struct footprint {
+  std::array<heap_type_footprint, 6> by_type{};
+  std::size_t shared_references = 0;
+
+  const heap_type_footprint& operator[](const heap_object_type type) const {
+    return by_type[static_cast<std::size_t>(type)];
+  }
+
+  std::size_t total_bytes() const {
+    std::size_t total = 0;
+    for (const auto& type_footprint : by_type) {
+      total += type_footprint.bytes();
+    }
+    return total;
+  }
+};
+
+namespace detail {
+
+// (object bytes, buffer bytes) of a single heap object, without children.
+// With seen, trie and tree nodes and string buffers already in it aren't
+// counted again
+template <typename AllocatorT>
+std::pair<std::size_t, std::size_t> heap_bytes(
+    const AllocatorT& allocator, const object<AllocatorT>& obj,
+    std::unordered_set<const void*>* seen = nullptr) {
+  if (obj.is_heap_string(allocator)) {
+    return {sizeof(string<AllocatorT>),
+            obj.as_string_heap(allocator).buffer_bytes(seen)};
+  } else if (obj.is_list(allocator)) {
+    const auto& objects = obj.as_list(allocator).objects_;
+    const std::size_t spilled_bytes =
+        objects.capacity() * sizeof(object<AllocatorT>);
+    return {sizeof(list<AllocatorT>), objects.is_inline() ? 0 : spilled_bytes};
+  } else if (obj.is_dictionary(allocator)) {
+    return {sizeof(dictionary<AllocatorT>),
+            obj.as_dictionary(allocator).object_dict_.memory_usage()};
+  } else if (obj.is_tuple(allocator)) {
+    return {tuple<AllocatorT>::block_size(obj.as_tuple(allocator).size()), 0};
+  } else if (obj.is_persistent_dictionary(allocator)) {
+    return {sizeof(persistent_dictionary<AllocatorT>),
+            obj.as_persistent_dictionary(allocator).trie_.memory_usage(seen)};
+  } else if (obj.is_persistent_list(allocator)) {
+    return {sizeof(persistent_list<AllocatorT>),
+            obj.as_persistent_list(allocator).tree_.memory_usage(seen)};
+  }
+  return {0, 0};
+}
+
+template <typename AllocatorT>
+heap_object_type heap_type_of(const AllocatorT& allocator,
+                              const object<AllocatorT>& obj) {
+  if (obj.is_heap_string(allocator)) {
+    return heap_object_type::string;
+  } else if (obj.is_list(allocator)) {
+    return heap_object_type::list;
+  } else if (obj.is_dictionary(allocator)) {
+    return heap_object_type::dictionary;
+  } else if (obj.is_persistent_dictionary(allocator)) {
+    return heap_object_type::persistent_dictionary;
+  } else if (obj.is_persistent_list(allocator)) {
+    return heap_object_type::persistent_list;
+  }
+  return heap_object_type::tuple;
+}
+
+template <typename AllocatorT>
+class footprint_visitor {
+ public:
+  struct state_type {};
+
+  footprint_visitor(const AllocatorT& allocator, footprint& result)
+      : allocator_(allocator), result_(result) {}
+
+  bool enter(const object<AllocatorT>& obj, const node_kind kind,
+             state_type*, state_type&) {
+    if (kind == node_kind::fixed) {
+      return false;
+    }
+    if (!seen_.insert(heap_of(obj)).second) {
+      ++result_.shared_references;
+      return false;
+    }
+
+    const auto [object_bytes, buffer_bytes] =
+        heap_bytes(allocator_, obj, &seen_);
+    auto& type_footprint = result_.by_type[static_cast<std::size_t>(
+        heap_type_of(allocator_, obj))];
+    ++type_footprint.count;
+    type_footprint.object_bytes += object_bytes;
+    type_footprint.buffer_bytes += buffer_bytes;
+    return is_container(kind);
+  }
+
+  void leave(const object<AllocatorT>&, state_type&, state_type*) {}
+
+  void cycle(const object<AllocatorT>&, std::size_t, state_type*) {
+    ++result_.shared_references;
+  }
+
+ private:
+  const AllocatorT& allocator_;
+  footprint& result_;
+  std::unordered_set<const void*> seen_;
+};
+
+}  // namespace detail
+
+template <typename AllocatorT>
+footprint deep_size(const AllocatorT& allocator,
+                    const object<AllocatorT>& obj) {
+  footprint result;
+  detail::footprint_visitor<AllocatorT> visitor(allocator, result);
+  detail::depth_first(obj, visitor);
+  return result;
+}
+
+//=====================================================================
+// Heap dumps
+//
+// write_heap_dump() serializes the graph reachable from a root for offline
+// analysis, every heap object once. All integers are little endian.
+//
+//   header  "ANBD" | u32 version | u64 node count | value root
+//   node    u8 heap_object_type | u64 object bytes | u64 buffer bytes
+//           string:     u64 length | bytes
+//           list, tuple, persistent list:
+//                       u64 count | value * count
+//           dictionary, persistent dictionary:
+//                       u64 count | (value key, value val) * count
+//   value   u8 0 | u64 nanbox word   (fixed values and heap nullptr)
+//           u8 1 | u64 node index
+//
+// Nodes are numbered breadth first from the root, which is node 0 when it
+// is a heap object. read_heap_dump() loads a dump back, and throws
+// std::runtime_error for dumps that are truncated or whose counts don't
+// fit in the rest of the stream (streams that can't seek only grow what
+// they read as the data actually arrives).
+//=====================================================================
+inline constexpr char heap_dump_magic[4] = {'A', 'N', 'B', 'D'};
+inline constexpr std::uint32_t heap_dump_version = 1;
+
+struct heap_dump_value {
+  bool is_node = false;
+  // The nanbox word of a fixed value, or the index of a node
+  std::uint64_t value = 0;
+};
+
+struct heap_dump_node {
+  heap_object_type type = heap_object_type::string;
+  std::uint64_t object_bytes = 0;
+  std::uint64_t buffer_bytes = 0;
+  // Contents of strings
+  std::string bytes;
+  // Elements of lists, tuples and persistent lists, keys and values
+  // interleaved for dictionaries and persistent dictionaries
+  std::vector<heap_dump_value> children;
+};
+
+struct heap_dump {
+  heap_dump_value root;
+  std::vector<heap_dump_node> nodes;
+};
+
+namespace detail {
+
+inline void write_u64(std::ostream& out, const std::uint64_t value) {
+  char bytes[sizeof(value)];
+  for (std::size_t i = 0; i < sizeof(value); ++i) {
+    bytes[i] = static_cast<char>((value >> (i * 8)) & 0xFF);
+  }
+  out.write(bytes, sizeof(bytes));
+}
+
+inline std::uint64_t read_u64(std::istream& in) {
+  unsigned char bytes[sizeof(std::uint64_t)];
+  if (!in.read(reinterpret_cast<char*>(bytes), sizeof(bytes))) {
+    throw std::runtime_error("anb::read_heap_dump: truncated dump");
+  }
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < sizeof(bytes); ++i) {
+    value |= std::uint64_t{bytes[i]} << (i * 8);
+  }
+  return value;
+}
+
+inline std::uint8_t read_u8(std::istream& in) {
+  char byte;
+  if (!in.get(byte)) {
+    throw std::runtime_error("anb::read_heap_dump: truncated dump");
+  }
+  return static_cast<std::uint8_t>(byte);
+}
+
+// Smallest encodings of a value and of a node
+inline constexpr std::uint64_t dump_value_bytes = 1 + 8;
+inline constexpr std::uint64_t dump_node_bytes = 1 + 8 + 8 + 8;
+// Items allocated ahead of reading them, for streams that can't seek
+inline constexpr std::uint64_t dump_read_ahead = std::uint64_t{1} << 16;
+
+// Bytes left in a seekable stream, the maximum for the others
+inline std::uint64_t dump_bytes_left(std::istream& in) {
+  constexpr std::uint64_t unknown = ~std::uint64_t{0};
+  const std::istream::pos_type pos = in.tellg();
+  if (pos == std::istream::pos_type(-1)) {
+    return unknown;
+  }
+  in.seekg(0, std::ios::end);
+  const std::istream::pos_type end = in.tellg();
+  in.seekg(pos);
+  if (end == std::istream::pos_type(-1) || end < pos) {
+    return unknown;
+  }
+  return static_cast<std::uint64_t>(end - pos);
+}
+
+// Count of items taking at least item_bytes each
+inline std::uint64_t read_dump_count(std::istream& in,
+                                     const std::uint64_t bytes_left,
+                                     const std::uint64_t item_bytes) {
+  const std::uint64_t count = read_u64(in);
+  if (count > bytes_left / item_bytes) {
+    throw std::runtime_error("anb::read_heap_dump: count exceeds the dump");
+  }
+  return count;
+}
+
+inline heap_dump_value read_dump_value(std::istream& in,
+                                       const std::uint64_t node_count) {
+  heap_dump_value value;
+  value.is_node = (read_u8(in) != 0);
+  value.value = read_u64(in);
+  if (value.is_node && value.value >= node_count) {
+    throw std::runtime_error("anb::read_heap_dump: unknown node");
+  }
+  return value;
+}
+
+}  // namespace detail
+
+template <typename AllocatorT>
+void write_heap_dump(std::ostream& out, const AllocatorT& allocator,
+                     const object<AllocatorT>& root) {
+  // Numbers every heap object in the order they'll be written
+  std::vector<object<AllocatorT>> nodes;
+  std::unordered_map<const void*, std::uint64_t> node_index;
+  const auto discover = [&](const object<AllocatorT>& obj) {
+    const void* identity = detail::heap_of(obj);
+    if (identity != nullptr &&
+        node_index.emplace(identity, nodes.size()).second) {
+      nodes.push_back(obj);
+    }
+  };
+  discover(root);
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    detail::for_each_child(nodes[i], discover);
+  }
+
+  const auto write_value = [&](const object<AllocatorT>& obj) {
+    const void* identity = detail::heap_of(obj);
+    out.put(identity != nullptr ? 1 : 0);
+    detail::write_u64(out, identity != nullptr ? node_index.at(identity)
+                                               : obj.nanbox_value());
+  };
+
+  out.write(heap_dump_magic, sizeof(heap_dump_magic));
+  for (std::size_t i = 0; i < sizeof(heap_dump_version); ++i) {
+    out.put(static_cast<char>((heap_dump_version >> (i * 8)) & 0xFF));
+  }
+  detail::write_u64(out, nodes.size());
+  write_value(root);
+
+  // Nodes shared between versions count for the first one
+  std::unordered_set<const void*> seen_buffers;
+  for (const auto& node : nodes) {
+    const heap_object_type type = detail::heap_type_of(allocator, node);
+    const auto [object_bytes, buffer_bytes] =
+        detail::heap_bytes(allocator, node, &seen_buffers);
+    out.put(static_cast<char>(type));
+    detail::write_u64(out, object_bytes);
+    detail::write_u64(out, buffer_bytes);
+
+    switch (type) {
+      case heap_object_type::string: {
+        const std::string_view str = node.as_string_heap(allocator).view();
+        detail::write_u64(out, str.size());
+        out.write(str.data(), static_cast<std::streamsize>(str.size()));
+        break;
+      }
+      case heap_object_type::list:
+        detail::write_u64(out, node.as_list(allocator).objects_.size());
+        break;
+      case heap_object_type::dictionary:
+        detail::write_u64(out,
+                          node.as_dictionary(allocator).object_dict_.size());
+        break;
+      case heap_object_type::tuple:
+        detail::write_u64(out, node.as_tuple(allocator).size());
+        break;
+      case heap_object_type::persistent_dictionary:
+        detail::write_u64(out, node.as_persistent_dictionary(allocator).size());
+        break;
+      case heap_object_type::persistent_list:
+        detail::write_u64(out, node.as_persistent_list(allocator).size());
+        break;
+    }
+    detail::for_each_child(node, write_value);
+  }
+}
+
+inline heap_dump read_heap_dump(std::istream& in) {
+  char magic[sizeof(heap_dump_magic)];
+  if (!in.read(magic, sizeof(magic)) ||
+      !std::equal(std::begin(magic), std::end(magic),
+                  std::begin(heap_dump_magic))) {
+    throw std::runtime_error("anb::read_heap_dump: not a heap dump");
+  }
+  std::uint32_t version = 0;
+  for (std::size_t i = 0; i < sizeof(version); ++i) {
+    version |= std::uint32_t{detail::read_u8(in)} << (i * 8);
+  }
+  if (version != heap_dump_version) {
+    throw std::runtime_error("anb::read_heap_dump: unsupported version");
+  }
+
+  const std::uint64_t bytes_left = detail::dump_bytes_left(in);
+  heap_dump dump;
+  const std::uint64_t node_count =
+      detail::read_dump_count(in, bytes_left, detail::dump_node_bytes);
+  dump.root = detail::read_dump_value(in, node_count);
+
+  dump.nodes.reserve(std::min(node_count, detail::dump_read_ahead));
+  while (dump.nodes.size() < node_count) {
+    heap_dump_node& node = dump.nodes.emplace_back();
+    const std::uint8_t type = detail::read_u8(in);
+    if (type >
+        static_cast<std::uint8_t>(heap_object_type::persistent_list)) {
+      throw std::runtime_error("anb::read_heap_dump: unknown heap type");
+    }
+    node.type = static_cast<heap_object_type>(type);
+    node.object_bytes = detail::read_u64(in);
+    node.buffer_bytes = detail::read_u64(in);
+
+    if (node.type == heap_object_type::string) {
+      const std::uint64_t length = detail::read_dump_count(in, bytes_left, 1);
+      while (node.bytes.size() < length) {
+        const std::size_t read = node.bytes.size();
+        const std::size_t chunk = static_cast<std::size_t>(
+            std::min(length - read, detail::dump_read_ahead));
+        node.bytes.resize(read + chunk);
+        if (!in.read(node.bytes.data() + read,
+                     static_cast<std::streamsize>(chunk))) {
+          throw std::runtime_error("anb::read_heap_dump: truncated dump");
+        }
+      }
+      continue;
+    }
+    const bool keyed =
+        (node.type == heap_object_type::dictionary ||
+         node.type == heap_object_type::persistent_dictionary);
+    const std::uint64_t count = detail::read_dump_count(
+        in, bytes_left,
+        keyed ? 2 * detail::dump_value_bytes : detail::dump_value_bytes);
+    const std::uint64_t child_count = keyed ? count * 2 : count;
+    node.children.reserve(std::min(child_count, detail::dump_read_ahead));
+    for (std::uint64_t i = 0; i < child_count; ++i) {
+      node.children.push_back(detail::read_dump_value(in, node_count));
+    }
+  }
+  return dump;
+}
+
+}  // namespace anb
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+#include "object.hpp"
+
+namespace anb {
+
+//=====================================================================
+// Batch hashing
+//
+//   std::vector<std::size_t> hashes(keys.size());
+//   anb::hash_batch(std::span<const anb::object<A>>(keys), hashes);
+//
+// Same results as calling object::hash() on every object. The first pass
+// mixes every nanbox word with no branches, which the compiler vectorizes
+// where 64 bit lanes can be multiplied (e.g. AVX-512), and is the final
+// hash of fixed values. A second pass only revisits strings and heap
+// objects, whose hashes depend on more than their word.
+//=====================================================================
+template <typename AllocatorT>
+void hash_batch(const std::span<const object<AllocatorT>> objects,
+                const std::span<std::size_t> hashes) {
+  if (hashes.size() < objects.size()) {
+    throw std::invalid_argument("anb::hash_batch: output span too small");
+  }
+  const std::size_t count = objects.size();
+  const object<AllocatorT>* data = objects.data();
+  std::size_t* out = hashes.data();
+
+  for (std::size_t i = 0; i < count; ++i) {
+    out[i] = detail::magic_hash(data[i].nanbox_value());
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    const std::uint64_t word = data[i].nanbox_value();
+    const bool is_heap_ptr =
+        ((word & detail::nanbox::heap_type_value) ==
+         detail::nanbox::heap_type_value) &&
+        ((word & detail::nanbox::heap_type_data_mask) != 0);
+    if (is_heap_ptr || data[i].is_sso_string()) {
+      out[i] = data[i].hash();
+    }
+  }
+}
+
+}  // namespace anb
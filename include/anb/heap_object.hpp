@@ -2,7 +2,14 @@
 
 namespace anb {
 
-enum class heap_object_type { string, list, dictionary };
+enum class heap_object_type {
+  string,
+  list,
+  dictionary,
+  tuple,
+  persistent_dictionary,
+  persistent_list
+};
 template <typename AllocatorT> struct heap_object {
   heap_object(AllocatorT &handle) : allocator_handle(handle) {}
   virtual ~heap_object() = default;
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "dictionary.hpp"
+#include "heap_object.hpp"
+#include "list.hpp"
+#include "persistent_dictionary.hpp"
+#include "persistent_list.hpp"
+#include "string.hpp"
+#include "detail/polyfill.hpp"
+
+namespace anb {
+
+//=====================================================================
+// Opt-in instrumentation of anb heaps
+//
+// Two independent pieces:
+//
+//   - instrumented_allocator<InnerT>, a decorator placing the heap
+//     objects into raw memory from the inner allocator and recording live
+//     counts, bytes and size histograms per heap type
+//   - ANB_INSTRUMENT_OP() hooks on hot object operations (alloc_heap,
+//     dealloc_heap, assign and hash), compiled in only when
+//     ANB_INSTRUMENTATION is defined (the ANB_ENABLE_INSTRUMENTATION CMake
+//     option) and expanding to nothing otherwise
+//
+// Counters are per thread: each thread bumps its own buffer with relaxed
+// atomics and no contention, and instrumentation_snapshot() sums every
+// buffer on demand. Buffers of exited threads are folded into a retired
+// total, so nothing recorded is lost.
+//=====================================================================
+enum class instrumented_op { alloc_heap, dealloc_heap, assign, hash };
+inline constexpr std::size_t instrumented_op_count = 4;
+
+// Heap objects by type, tuples and every other variable sized block come
+// from the raw allocate()/deallocate() interface
+enum class instrumented_heap {
+  string,
+  list,
+  dictionary,
+  persistent_dictionary,
+  persistent_list,
+  raw_block
+};
+inline constexpr std::size_t instrumented_heap_count = 6;
+
+// Bucket i counts the allocations of at most 2^i bytes, the last bucket
+// takes everything larger
+inline constexpr std::size_t size_histogram_buckets = 24;
+
+struct heap_stats {
+  std::uint64_t allocations = 0;
+  std::uint64_t deallocations = 0;
+  std::uint64_t allocated_bytes = 0;
+  std::uint64_t deallocated_bytes = 0;
+  std::array<std::uint64_t, size_histogram_buckets> size_histogram{};
+
+  std::int64_t live_count() const {
+    return static_cast<std::int64_t>(allocations - deallocations);
+  }
+  std::int64_t live_bytes() const {
+    return static_cast<std::int64_t>(allocated_bytes - deallocated_bytes);
+  }
+};
+
+struct instrumentation_report {
+  std::array<heap_stats, instrumented_heap_count> heaps{};
+  std::array<std::uint64_t, instrumented_op_count> operations{};
+
+  const heap_stats& heap(const instrumented_heap kind) const {
+    return heaps[static_cast<std::size_t>(kind)];
+  }
+  std::uint64_t operation(const instrumented_op op) const {
+    return operations[static_cast<std::size_t>(op)];
+  }
+};
+
+namespace detail {
+
+inline std::size_t size_bucket(const std::size_t bytes) {
+  const std::size_t bucket = std::bit_width(bytes > 0 ? bytes - 1 : 0);
+  return (bucket < size_histogram_buckets) ? bucket
+                                           : size_histogram_buckets - 1;
+}
+
+// Only ever written by its own thread, the atomics let snapshots read it
+// concurrently
+class thread_counters {
+ public:
+  void record_alloc(const instrumented_heap kind, const std::size_t bytes) {
+    heap_counters& counters = heaps_[static_cast<std::size_t>(kind)];
+    bump(counters.allocations, 1);
+    bump(counters.allocated_bytes, bytes);
+    bump(counters.size_histogram[size_bucket(bytes)], 1);
+  }
+
+  void record_dealloc(const instrumented_heap kind, const std::size_t bytes) {
+    heap_counters& counters = heaps_[static_cast<std::size_t>(kind)];
+    bump(counters.deallocations, 1);
+    bump(counters.deallocated_bytes, bytes);
+  }
+
+  void record_op(const instrumented_op op) {
+    bump(operations_[static_cast<std::size_t>(op)], 1);
+  }
+
+  void add_to(instrumentation_report& report) const {
+    for (std::size_t kind = 0; kind < instrumented_heap_count; ++kind) {
+      const heap_counters& counters = heaps_[kind];
+      heap_stats& stats = report.heaps[kind];
+      stats.allocations += read(counters.allocations);
+      stats.deallocations += read(counters.deallocations);
+      stats.allocated_bytes += read(counters.allocated_bytes);
+      stats.deallocated_bytes += read(counters.deallocated_bytes);
+      for (std::size_t bucket = 0; bucket < size_histogram_buckets;
+           ++bucket) {
+        stats.size_histogram[bucket] += read(counters.size_histogram[bucket]);
+      }
+    }
+    for (std::size_t op = 0; op < instrumented_op_count; ++op) {
+      report.operations[op] += read(operations_[op]);
+    }
+  }
+
+ private:
+  using counter = std::atomic<std::uint64_t>;
+
+  struct heap_counters {
+    counter allocations = 0;
+    counter deallocations = 0;
+    counter allocated_bytes = 0;
+    counter deallocated_bytes = 0;
+    std::array<counter, size_histogram_buckets> size_histogram{};
+  };
+
+  // Single writer, a plain load and store instead of a locked add
+  static void bump(counter& value, const std::uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+  }
+
+  static std::uint64_t read(const counter& value) {
+    return value.load(std::memory_order_relaxed);
+  }
+
+  std::array<heap_counters, instrumented_heap_count> heaps_{};
+  std::array<counter, instrumented_op_count> operations_{};
+};
+
+class counters_registry {
+ public:
+  static counters_registry& instance() {
+    static counters_registry registry;
+    return registry;
+  }
+
+  void attach(const thread_counters* counters) {
+    std::lock_guard lock(mutex_);
+    live_.push_back(counters);
+  }
+
+  void detach(const thread_counters* counters) {
+    std::lock_guard lock(mutex_);
+    counters->add_to(retired_);
+    std::erase(live_, counters);
+  }
+
+  instrumentation_report snapshot() {
+    std::lock_guard lock(mutex_);
+    instrumentation_report report = retired_;
+    for (const thread_counters* counters : live_) {
+      counters->add_to(report);
+    }
+    return report;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<const thread_counters*> live_;
+  instrumentation_report retired_;
+};
+
+// Registers the calling thread's buffer on first use, and retires it when
+// the thread exits
+class thread_counters_handle {
+ public:
+  thread_counters_handle() {
+    counters_registry::instance().attach(&counters_);
+  }
+  ~thread_counters_handle() {
+    counters_registry::instance().detach(&counters_);
+  }
+
+  thread_counters_handle(const thread_counters_handle&) = delete;
+  thread_counters_handle& operator=(const thread_counters_handle&) = delete;
+
+  thread_counters& get() { return counters_; }
+
+ private:
+  thread_counters counters_;
+};
+
+inline thread_counters& local_counters() {
+  // The registry has to outlive every thread's handle
+  counters_registry::instance();
+  thread_local thread_counters_handle handle;
+  return handle.get();
+}
+
+inline void record_op(const instrumented_op op) {
+  local_counters().record_op(op);
+}
+
+}  // namespace detail
+
+#ifdef ANB_INSTRUMENTATION
+#define ANB_INSTRUMENT_OP(op) \
+  ::anb::detail::record_op(::anb::instrumented_op::op)
+#else
+#define ANB_INSTRUMENT_OP(op) \
+  do {                        \
+  } while (false)
+#endif
+
+// Sum of the counters of every thread, including the exited ones
+inline instrumentation_report instrumentation_snapshot() {
+  return detail::counters_registry::instance().snapshot();
+}
+
+//=====================================================================
+// Allocator decorator recording the heap usage of an inner allocator
+//
+// The inner allocator only needs the raw `allocate(bytes, alignment)` and
+// `deallocate(ptr, bytes, alignment)` interface, the heap objects are
+// constructed in place by the decorator. Heap object blocks are accounted
+// per heap type, tuples and the buffers of the containers inside heap
+// objects as raw blocks.
+//=====================================================================
+template <typename InnerT>
+class instrumented_allocator {
+ public:
+  explicit instrumented_allocator(InnerT& inner) : inner_(inner) {}
+
+  template <template <class> typename HeapObjT>
+  HeapObjT<instrumented_allocator>* alloc() {
+    using heap_t = HeapObjT<instrumented_allocator>;
+    void* block = inner_.allocate(sizeof(heap_t), alignof(heap_t));
+    auto* heap_ptr = ::new (block) heap_t(*this);
+    detail::local_counters().record_alloc(kind_of(heap_ptr->type()),
+                                          sizeof(heap_t));
+    return heap_ptr;
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<instrumented_allocator>* obj_ptr) {
+    const heap_object_type type = obj_ptr->type();
+    const auto [bytes, alignment] = heap_layout(type);
+    std::destroy_at(obj_ptr);
+    inner_.deallocate(obj_ptr, bytes, alignment);
+    detail::local_counters().record_dealloc(kind_of(type), bytes);
+  }
+
+  void* allocate(const std::size_t bytes, const std::size_t alignment) {
+    void* block = inner_.allocate(bytes, alignment);
+    detail::local_counters().record_alloc(instrumented_heap::raw_block, bytes);
+    return block;
+  }
+
+  void deallocate(void* ptr, const std::size_t bytes,
+                  const std::size_t alignment) {
+    inner_.deallocate(ptr, bytes, alignment);
+    detail::local_counters().record_dealloc(instrumented_heap::raw_block,
+                                            bytes);
+  }
+
+  InnerT& inner() const { return inner_; }
+
+ private:
+  static instrumented_heap kind_of(const heap_object_type type) {
+    switch (type) {
+      case heap_object_type::string:
+        return instrumented_heap::string;
+      case heap_object_type::list:
+        return instrumented_heap::list;
+      case heap_object_type::dictionary:
+        return instrumented_heap::dictionary;
+      case heap_object_type::persistent_dictionary:
+        return instrumented_heap::persistent_dictionary;
+      case heap_object_type::persistent_list:
+        return instrumented_heap::persistent_list;
+      default:
+        return instrumented_heap::raw_block;
+    }
+  }
+
+  static std::pair<std::size_t, std::size_t> heap_layout(
+      const heap_object_type type) {
+    switch (type) {
+      case heap_object_type::string:
+        return layout_of<string<instrumented_allocator>>();
+      case heap_object_type::list:
+        return layout_of<list<instrumented_allocator>>();
+      case heap_object_type::dictionary:
+        return layout_of<dictionary<instrumented_allocator>>();
+      case heap_object_type::persistent_dictionary:
+        return layout_of<persistent_dictionary<instrumented_allocator>>();
+      case heap_object_type::persistent_list:
+        return layout_of<persistent_list<instrumented_allocator>>();
+      default:
+        // Tuples are released through deallocate()
+        detail::unreachable();
+    }
+  }
+
+  template <typename HeapT>
+  static std::pair<std::size_t, std::size_t> layout_of() {
+    return {sizeof(HeapT), alignof(HeapT)};
+  }
+
+  InnerT& inner_;
+};
+
+}  // namespace anb
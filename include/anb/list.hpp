@@ -1,8 +1,14 @@
 #pragma once
 
-#include <vector>
+#include <cstddef>
+#include <iterator>
+#include <ranges>
 
+#include "allocator.hpp"
 #include "heap_object.hpp"
+#include "detail/box.hpp"
+#include "detail/hash.hpp"
+#include "detail/small_vector.hpp"
 #include "detail/util.hpp"
 
 namespace anb {
@@ -10,9 +16,30 @@ namespace anb {
 template <typename AllocatorT>
 class object;
 
+namespace detail {
+
+// Number of elements a list stores inline, before spilling to a separate
+// buffer. Allocators can override the default with a
+// `static constexpr std::size_t list_inline_capacity` member
+template <typename AllocatorT>
+constexpr std::size_t list_inline_capacity() {
+  if constexpr (requires { AllocatorT::list_inline_capacity; }) {
+    return AllocatorT::list_inline_capacity;
+  } else {
+    return 4;
+  }
+}
+
+}  // namespace detail
+
 template <typename AllocatorT>
 struct list : public heap_object<AllocatorT> {
-  list(AllocatorT& handle) : heap_object<AllocatorT>(handle) {}
+  using container_type = detail::small_vector<
+      anb::object<AllocatorT>, detail::list_inline_capacity<AllocatorT>(),
+      detail::container_allocator<anb::object<AllocatorT>, AllocatorT>>;
+
+  list(AllocatorT& handle)
+      : heap_object<AllocatorT>(handle), objects_(handle) {}
 
   template <typename... Args>
   void set(Args&&... args) {
@@ -21,6 +48,28 @@ struct list : public heap_object<AllocatorT> {
     (objects_.push_back(std::forward<Args>(args)), ...);
   }
 
+  // Appends every element of range, boxing fixed values and strings.
+  // Sized ranges grow the list once and are boxed in a single pass
+  template <std::ranges::input_range RangeT>
+    requires detail::boxable<std::ranges::range_reference_t<RangeT>,
+                             AllocatorT>
+  void append_range(RangeT&& range) {
+    if constexpr (std::ranges::sized_range<RangeT>) {
+      const std::size_t offset = objects_.size();
+      objects_.resize(offset + std::ranges::size(range));
+      auto out = objects_.begin() + offset;
+      for (auto&& value : range) {
+        *out++ = detail::box(this->allocator_handle,
+                             std::forward<decltype(value)>(value));
+      }
+    } else {
+      for (auto&& value : range) {
+        objects_.push_back(detail::box(this->allocator_handle,
+                                       std::forward<decltype(value)>(value)));
+      }
+    }
+  }
+
   void reset() { objects_.clear(); }
 
   template <typename... Args>
@@ -31,21 +80,23 @@ struct list : public heap_object<AllocatorT> {
 
   heap_object_type type() const override { return heap_object_type::list; }
 
-  std::vector<anb::object<AllocatorT>> objects_;
+  container_type objects_;
 };
 
 }  // namespace anb
 
-template <typename AllocatorT>
-struct std::hash<std::vector<anb::object<AllocatorT>>> {
+template <typename AllocatorT, std::size_t N, typename AllocT>
+struct std::hash<
+    anb::detail::small_vector<anb::object<AllocatorT>, N, AllocT>> {
   std::size_t operator()(
       const AllocatorT& allocator,
-      const std::vector<anb::object<AllocatorT>>& objects) const {
-    std::size_t seed = objects.size();
+      const anb::detail::small_vector<anb::object<AllocatorT>, N, AllocT>&
+          objects) const {
+    anb::detail::sequence_hash hash;
     for (const auto& obj : objects) {
-      seed ^= anb::detail::magic_hash(obj.hash());
+      hash.add(obj.hash());
     }
-    return seed;
+    return hash.finish(objects.size());
   }
 };
 
@@ -53,7 +104,7 @@ template <typename AllocatorT>
 struct std::hash<anb::list<AllocatorT>> {
   std::size_t operator()(const AllocatorT& allocator,
                          const anb::list<AllocatorT>& list) const {
-    return std::hash<std::vector<anb::object<AllocatorT>>>{}(allocator,
-                                                             list.objects_);
+    return std::hash<typename anb::list<AllocatorT>::container_type>{}(
+        allocator, list.objects_);
   }
 };
@@ -1,91 +1,96 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <compare>
 #include <cstdint>
 #include <functional>
 #include <memory>
 #include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "allocator.hpp"
+#include "detail/hash.hpp"
 #include "detail/nanbox.hpp"
 #include "detail/polyfill.hpp"
+#include "detail/traverse.hpp"
 #include "dictionary.hpp"
+#include "instrumentation.hpp"
 #include "list.hpp"
+#include "persistent_dictionary.hpp"
+#include "persistent_list.hpp"
 #include "string.hpp"
+#include "tuple.hpp"
 
 namespace anb {
 
-// TODO: make an allocator concept that captures current specified API
 // TODO: make specifying allocator optional (default to a null allocator).
 // creating heap based objects will fail
 template <typename AllocatorT>
 class object {
  public:
+  // Fixed types (qnan, nothing, boolean, int32, float64 and SSO strings)
+  // are boxed and unboxed with std::bit_cast, so they can be built and
+  // inspected in constant expressions, e.g. in constexpr/constinit tables
+
   // TODO: default ctor should be the 'nothing' type
-  object() : value_(0.0) {}
+  constexpr object() : value_(0.0) {}
 
-  static object make_qnan() {
-    object o;
-    o.value_ = *reinterpret_cast<const double*>(
-        &detail::nanbox::fixed_type_qnan_value);
-    return o;
+  static constexpr object make_qnan() {
+    return from_nb(detail::nanbox::fixed_type_qnan_value);
   }
 
-  static object make_nothing() {
-    object o;
-    o.value_ = *reinterpret_cast<const double*>(
-        &detail::nanbox::fixed_type_null_value);
-    return o;
+  static constexpr object make_nothing() {
+    return from_nb(detail::nanbox::fixed_type_null_value);
   }
 
-  explicit object(const bool bool_val) {
-    value_ = *reinterpret_cast<const double*>(
-        &(bool_val ? detail::nanbox::fixed_type_true_value
-                   : detail::nanbox::fixed_type_false_value));
-  }
+  constexpr explicit object(const bool bool_val)
+      : value_(std::bit_cast<double>(
+            bool_val ? detail::nanbox::fixed_type_true_value
+                     : detail::nanbox::fixed_type_false_value)) {}
 
-  explicit object(const std::int32_t int32_val) {
-    const std::uint64_t nb_int_data =
-        (*reinterpret_cast<const std::uint64_t*>(&int32_val) &
-         detail::nanbox::fixed_type_int32_data_mask);
-    const std::uint64_t nb_int =
-        detail::nanbox::fixed_type_int32_value | nb_int_data;
-    value_ = *reinterpret_cast<const double*>(&nb_int);
-  }
+  constexpr explicit object(const std::int32_t int32_val)
+      : value_(std::bit_cast<double>(
+            detail::nanbox::fixed_type_int32_value |
+            static_cast<std::uint32_t>(int32_val))) {}
 
-  explicit object(const double fp64_val) { value_ = fp64_val; }
+  constexpr explicit object(const double fp64_val) : value_(fp64_val) {}
 
-  explicit object(const std::string_view str_val) {
+  constexpr explicit object(const std::string_view str_val)
+      : value_(make_string_sso(str_val)) {
     ANB_ASSERT(str_val.size() <= max_sso_len,
                "String size too large for non-heap allocated nanbox");
-    value_ = make_string_sso(str_val);
   }
 
   template <template <class> typename HeapObjT>
   static object alloc_heap(AllocatorT& allocator) {
-    object o;
-
+    static_assert(heap_allocator<AllocatorT>,
+                  "AllocatorT doesn't meet the allocator requirements, see "
+                  "anb/allocator.hpp");
+    ANB_INSTRUMENT_OP(alloc_heap);
     HeapObjT<AllocatorT>* heap_ptr = allocator.template alloc<HeapObjT>();
-
-    const std::uint64_t nb_heap_ptr = detail::nanbox::heap_type_value |
-                                      reinterpret_cast<std::uint64_t>(heap_ptr);
-    return object{*reinterpret_cast<const double*>(&nb_heap_ptr)};
+    return from_heap_ptr(heap_ptr);
   }
 
   void dealloc_heap(AllocatorT& allocator) {
-    const std::uint64_t nb_heap =
-        *reinterpret_cast<const std::uint64_t*>(&value_);
-    const std::uint64_t nb_data_pointer =
-        nb_heap & detail::nanbox::heap_type_data_mask;
+    ANB_INSTRUMENT_OP(dealloc_heap);
     if (auto heap_ptr = get_heap_ptr<heap_object>()) {
-      allocator.template dealloc<heap_object>(heap_ptr);
+      if (heap_ptr->type() == heap_object_type::tuple) {
+        tuple<AllocatorT>::destroy(allocator,
+                                   static_cast<tuple<AllocatorT>*>(heap_ptr));
+      } else {
+        allocator.template dealloc<heap_object>(heap_ptr);
+      }
 
       // TODO: add proper handling for nullptr heap objects
-      value_ =
-          *reinterpret_cast<const double*>(&detail::nanbox::heap_type_value);
+      value_ = std::bit_cast<double>(detail::nanbox::heap_type_value);
     }
   }
 
@@ -101,84 +106,171 @@ class object {
     return alloc_heap<dictionary>(allocator);
   }
 
+  // Empty version, see persistent_dictionary.hpp
+  static object make_persistent_dictionary(AllocatorT& allocator) {
+    return alloc_heap<persistent_dictionary>(allocator);
+  }
+
+  // Empty version, see persistent_list.hpp
+  static object make_persistent_list(AllocatorT& allocator) {
+    return alloc_heap<persistent_list>(allocator);
+  }
+
+  // List holding the elements of range, see list::append_range()
+  template <std::ranges::input_range RangeT>
+  static object make_list(AllocatorT& allocator, RangeT&& range) {
+    object list_obj = make_list(allocator);
+    list_obj.as_list(allocator).append_range(std::forward<RangeT>(range));
+    return list_obj;
+  }
+
+  // Dictionary mapping keys[i] to values[i], see
+  // dictionary::insert_range()
+  template <std::ranges::input_range KeysT, std::ranges::input_range ValuesT>
+  static object make_dictionary(AllocatorT& allocator, KeysT&& keys,
+                                ValuesT&& values) {
+    object dict_obj = make_dictionary(allocator);
+    dict_obj.as_dictionary(allocator).insert_range(
+        std::forward<KeysT>(keys), std::forward<ValuesT>(values));
+    return dict_obj;
+  }
+
+  // Persistent list holding the elements of range, appended in place like
+  // a transient would, see persistent_list::transient
+  template <std::ranges::input_range RangeT>
+  static object make_persistent_list(AllocatorT& allocator, RangeT&& range) {
+    typename persistent_list<AllocatorT>::transient batch(allocator);
+    batch.append_range(std::forward<RangeT>(range));
+    return batch.persist();
+  }
+
+  // Persistent dictionary mapping keys[i] to values[i], built in place
+  // like a transient would, see persistent_dictionary::transient
+  template <std::ranges::input_range KeysT, std::ranges::input_range ValuesT>
+  static object make_persistent_dictionary(AllocatorT& allocator,
+                                           KeysT&& keys, ValuesT&& values) {
+    typename persistent_dictionary<AllocatorT>::transient batch(allocator);
+    batch.insert_range(std::forward<KeysT>(keys),
+                       std::forward<ValuesT>(values));
+    return batch.persist();
+  }
+
+  // Substring [pos, pos + count) of a SSO or heap string. Slices short
+  // enough for SSO are SSO strings, longer ones are heap strings sharing
+  // the buffer of parent without copying it
+  static object make_slice(AllocatorT& allocator, const object& parent,
+                           const std::size_t pos,
+                           const std::size_t count = std::string_view::npos) {
+    std::string sso_storage;
+    const auto str = parent.string_view_of(sso_storage);
+    ANB_ASSERT(str.has_value(), "Underlying object is not a string");
+    if (pos > str->size()) {
+      throw std::out_of_range("anb::object::make_slice");
+    }
+    const std::string_view sub = str->substr(pos, count);
+    if (sub.size() <= max_sso_len) {
+      return object(sub);
+    }
+    object heap_str = make_string_heap(allocator);
+    heap_str.as_string_heap(allocator).set_slice(
+        parent.as_string_heap(allocator), pos, count);
+    return heap_str;
+  }
+
+  template <typename... Args>
+    requires(std::is_constructible_v<object, Args&&> && ...)
+  static object make_tuple(AllocatorT& allocator, Args&&... args) {
+    const object elements[] = {object(std::forward<Args>(args))...,
+                               object()};
+    return make_tuple(allocator,
+                      std::span<const object>(elements, sizeof...(Args)));
+  }
+
+  static object make_tuple(AllocatorT& allocator,
+                           const std::span<const object> elements) {
+    ANB_INSTRUMENT_OP(alloc_heap);
+    return from_heap_ptr(tuple<AllocatorT>::create(allocator, elements));
+  }
+
   // TODO: make_tree()
   // TODO: make_graph()
 
   // TODO: impl to_<type> conversions
 
-  bool is_qnan() const {
+  constexpr bool is_qnan() const {
     return ((as_nb() & detail::nanbox::signature_mask) ==
             detail::nanbox::fixed_type_qnan_value);
   }
 
-  double as_qnan() const {
+  constexpr double as_qnan() const {
     ANB_ASSERT(is_qnan(), "Underlying object is not a qnan");
     return value_;
   }
 
-  bool is_boolean() const {
+  constexpr bool is_boolean() const {
     return ((as_nb() & detail::nanbox::signature_mask) ==
             detail::nanbox::fixed_type_false_value) ||
            ((as_nb() & detail::nanbox::signature_mask) ==
             detail::nanbox::fixed_type_true_value);
   }
 
-  bool as_boolean() const {
+  constexpr bool as_boolean() const {
     ANB_ASSERT(is_boolean(), "Underlying object is not a boolean");
     return !(as_nb() & detail::nanbox::fixed_type_false_mask);
   }
 
-  bool is_nothing() const {
+  constexpr bool is_nothing() const {
     return ((as_nb() & detail::nanbox::signature_mask) ==
             detail::nanbox::fixed_type_null_value);
   }
 
-  bool is_int32() const {
+  constexpr bool is_int32() const {
     return ((as_nb() & detail::nanbox::signature_mask) ==
             detail::nanbox::fixed_type_int32_value);
   }
 
-  std::int32_t as_int32() const {
+  constexpr std::int32_t as_int32() const {
     ANB_ASSERT(is_int32(), "Underlying object is not an int32");
 
-    return *reinterpret_cast<const std::uint64_t*>(&value_) &
-           detail::nanbox::fixed_type_int32_data_mask;
+    return static_cast<std::int32_t>(static_cast<std::uint32_t>(
+        as_nb() & detail::nanbox::fixed_type_int32_data_mask));
   }
 
-  bool is_float64() const {
-    const std::uint64_t exp_value =
-        as_nb() & ~detail::nanbox::sign_mask & ~(0xFFFFFFFFFFFFF);
-
-    return (exp_value != detail::nanbox::nan_exponent_mask);
+  constexpr bool is_float64() const {
+    // Every double that isn't a quiet NaN (which the boxed types are
+    // encoded in), including the infinities
+    constexpr std::uint64_t quiet_nan_bits =
+        detail::nanbox::nan_exponent_mask | detail::nanbox::nan_quiet_mask;
+    return ((as_nb() & quiet_nan_bits) != quiet_nan_bits);
   }
 
-  double as_float64() const {
+  constexpr double as_float64() const {
     ANB_ASSERT(is_float64(), "Underlying object is not a float64");
     return value_;
   }
 
-  bool is_sso_string() const {
-    return ((as_nb() & detail::nanbox::fixed_type_packed_string_mask) ==
-            detail::nanbox::fixed_type_packed_string_mask) ||
-           ((as_nb() & detail::nanbox::fixed_type_nonpacked_string_mask) ==
-            detail::nanbox::fixed_type_nonpacked_string_mask);
+  constexpr bool is_sso_string() const {
+    return ((as_nb() & detail::nanbox::signature_mask) ==
+            detail::nanbox::fixed_type_packed_string_value) ||
+           ((as_nb() & detail::nanbox::signature_mask) ==
+            detail::nanbox::fixed_type_nonpacked_string_value);
   }
 
-  std::string as_string_sso() const {
+  constexpr std::string as_string_sso() const {
     ANB_ASSERT(is_sso_string(), "Underlying object is not fixed size string");
 
     const std::uint64_t nb_val = as_nb();
 
     const bool is_sso_packed =
-        ((nb_val & detail::nanbox::fixed_type_packed_string_mask) ==
-         detail::nanbox::fixed_type_packed_string_mask);
+        ((nb_val & detail::nanbox::signature_mask) ==
+         detail::nanbox::fixed_type_packed_string_value);
     if (is_sso_packed) {
       return as_string_packed_sso(nb_val);
     }
 
     const bool is_sso_nonpacked =
-        ((nb_val & detail::nanbox::fixed_type_nonpacked_string_mask) ==
-         detail::nanbox::fixed_type_nonpacked_string_mask);
+        ((nb_val & detail::nanbox::signature_mask) ==
+         detail::nanbox::fixed_type_nonpacked_string_value);
     if (is_sso_nonpacked) {
       return as_string_nonpacked_sso(nb_val);
     }
@@ -186,12 +278,12 @@ class object {
     detail::unreachable();
   }
 
-  bool is_heap_nullptr() const {
+  constexpr bool is_heap_nullptr() const {
     return (is_heap() && get_heap_ptr<heap_object>() == nullptr);
   }
 
   bool is_heap_string(const AllocatorT& allocator) const {
-    if (const auto heap_ptr = get_heap_ptr<string>()) {
+    if (const auto heap_ptr = get_heap_ptr<heap_object>()) {
       return (heap_ptr->type() == heap_object_type::string);
     }
     return false;
@@ -205,7 +297,7 @@ class object {
   }
 
   bool is_list(const AllocatorT& allocator) const {
-    if (const auto heap_ptr = get_heap_ptr<list>()) {
+    if (const auto heap_ptr = get_heap_ptr<heap_object>()) {
       return (heap_ptr->type() == heap_object_type::list);
     }
     return false;
@@ -218,7 +310,7 @@ class object {
   }
 
   bool is_dictionary(const AllocatorT& allocator) const {
-    if (const auto heap_ptr = get_heap_ptr<dictionary>()) {
+    if (const auto heap_ptr = get_heap_ptr<heap_object>()) {
       return (heap_ptr->type() == heap_object_type::dictionary);
     }
     return false;
@@ -230,15 +322,154 @@ class object {
     return deref_heap_obj<dictionary<AllocatorT>>();
   }
 
+  bool is_persistent_dictionary(const AllocatorT& allocator) const {
+    if (const auto heap_ptr = get_heap_ptr<heap_object>()) {
+      return (heap_ptr->type() == heap_object_type::persistent_dictionary);
+    }
+    return false;
+  }
+
+  persistent_dictionary<AllocatorT>& as_persistent_dictionary(
+      const AllocatorT& allocator) const {
+    ANB_ASSERT(is_persistent_dictionary(allocator),
+               "Underlying object is not a heap allocated persistent "
+               "dictionary");
+    return deref_heap_obj<persistent_dictionary<AllocatorT>>();
+  }
+
+  bool is_persistent_list(const AllocatorT& allocator) const {
+    if (const auto heap_ptr = get_heap_ptr<heap_object>()) {
+      return (heap_ptr->type() == heap_object_type::persistent_list);
+    }
+    return false;
+  }
+
+  persistent_list<AllocatorT>& as_persistent_list(
+      const AllocatorT& allocator) const {
+    ANB_ASSERT(is_persistent_list(allocator),
+               "Underlying object is not a heap allocated persistent list");
+    return deref_heap_obj<persistent_list<AllocatorT>>();
+  }
+
+  bool is_tuple(const AllocatorT& allocator) const {
+    if (const auto heap_ptr = get_heap_ptr<heap_object>()) {
+      return (heap_ptr->type() == heap_object_type::tuple);
+    }
+    return false;
+  }
+
+  tuple<AllocatorT>& as_tuple(const AllocatorT& allocator) const {
+    ANB_ASSERT(is_tuple(allocator),
+               "Underlying object is not a heap allocated tuple");
+    return deref_heap_obj<tuple<AllocatorT>>();
+  }
+
   // TODO: is_tree()
   // TODO: as_tree()
 
   // TODO: is_graph()
   // TODO: as_graph()
 
-  // TODO: implement all types assignments
+  //===================================================================
+  // In place assignments
+  //
+  // A heap object held before is released, unless it has the type of the
+  // new value: heap strings then keep their buffer, lists their element
+  // buffer and dictionaries their table, so reassigning a slot over and
+  // over doesn't allocate once the storage is large enough.
+
+  // Constrained so string literals don't convert to bool
+  template <std::same_as<bool> BoolT>
+  object& assign(AllocatorT& allocator, const BoolT bool_val) {
+    return assign_fixed(allocator, object(bool_val));
+  }
+
+  object& assign(AllocatorT& allocator, const std::int32_t int32_val) {
+    return assign_fixed(allocator, object(int32_val));
+  }
+
+  object& assign(AllocatorT& allocator, const double fp64_val) {
+    return assign_fixed(allocator, object(fp64_val));
+  }
+
+  // Takes the value of other. Lists and dictionaries copy the references
+  // to their elements, like copying an object does. Tuples are immutable,
+  // a new one is created, and persistent dictionaries and lists share the
+  // nodes of other in O(1).
+  object& assign(AllocatorT& allocator, const object& other) {
+    if (as_nb() == other.as_nb()) {
+      return *this;
+    }
+    if (other.is_heap_string(allocator)) {
+      return assign(allocator, other.as_string_heap(allocator).view());
+    } else if (other.is_list(allocator)) {
+      const auto& objects = other.as_list(allocator).objects_;
+      return assign_list(allocator, std::span<const object>(objects));
+    } else if (other.is_dictionary(allocator)) {
+      ANB_INSTRUMENT_OP(assign);
+      const auto& other_dict = other.as_dictionary(allocator).object_dict_;
+      auto& dict =
+          reuse_or_alloc<dictionary>(allocator, is_dictionary(allocator))
+              .object_dict_;
+      dict.clear();
+      dict.reserve(other_dict.size());
+      for (const auto& entry : other_dict) {
+        dict.insert(entry);
+      }
+      return *this;
+    } else if (other.is_persistent_dictionary(allocator)) {
+      ANB_INSTRUMENT_OP(assign);
+      const auto& other_trie = other.as_persistent_dictionary(allocator).trie_;
+      reuse_or_alloc<persistent_dictionary>(
+          allocator, is_persistent_dictionary(allocator))
+          .trie_ = other_trie;
+      return *this;
+    } else if (other.is_persistent_list(allocator)) {
+      ANB_INSTRUMENT_OP(assign);
+      const auto& other_tree = other.as_persistent_list(allocator).tree_;
+      reuse_or_alloc<persistent_list>(allocator,
+                                      is_persistent_list(allocator))
+          .tree_ = other_tree;
+      return *this;
+    } else if (other.is_tuple(allocator)) {
+      ANB_INSTRUMENT_OP(assign);
+      const object copy = make_tuple(allocator,
+                                     other.as_tuple(allocator).elements());
+      if (is_heap()) {
+        dealloc_heap(allocator);
+      }
+      value_ = copy.value_;
+      return *this;
+    }
+    return assign_fixed(allocator, other);
+  }
+
+  // Elements of range, see list::append_range()
+  template <std::ranges::input_range RangeT>
+  object& assign_list(AllocatorT& allocator, RangeT&& range) {
+    ANB_INSTRUMENT_OP(assign);
+    list<AllocatorT>& target =
+        reuse_or_alloc<list>(allocator, is_list(allocator));
+    target.objects_.clear();
+    target.append_range(std::forward<RangeT>(range));
+    return *this;
+  }
+
+  // keys[i] mapped to values[i], see dictionary::insert_range()
+  template <std::ranges::input_range KeysT, std::ranges::input_range ValuesT>
+  object& assign_dictionary(AllocatorT& allocator, KeysT&& keys,
+                            ValuesT&& values) {
+    ANB_INSTRUMENT_OP(assign);
+    dictionary<AllocatorT>& target =
+        reuse_or_alloc<dictionary>(allocator, is_dictionary(allocator));
+    target.object_dict_.clear();
+    target.insert_range(std::forward<KeysT>(keys),
+                        std::forward<ValuesT>(values));
+    return *this;
+  }
 
   object& assign(AllocatorT& allocator, const std::string_view str) {
+    ANB_INSTRUMENT_OP(assign);
     if (is_heap_string(allocator) && str.size() > max_sso_len) {
       as_string_heap(allocator).set(str);
     } else {
@@ -256,17 +487,218 @@ class object {
     return *this;
   }
 
+  // Fixed values other than strings hash their whole nanbox word in a
+  // single mixing step, equal values have equal words. Strings hash their
+  // bytes so SSO and heap strings agree, and containers combine the hashes
+  // of their elements (see detail/hash.hpp).
   std::size_t hash() const {
-    if (is_heap()) {
+    ANB_INSTRUMENT_OP(hash);
+    if (is_heap() && !is_heap_nullptr()) {
       return heap_hash();
     }
     return fixed_hash();
   }
 
+  // Hash of a string with the given contents, whether it's stored as a
+  // SSO or a heap string
+  static std::size_t hash_string(const std::string_view str) {
+    return std::hash<std::string_view>{}(str);
+  }
+
+  // True for SSO and heap strings holding exactly `str`
+  bool string_equals(const std::string_view str) const {
+    if (is_sso_string()) {
+      return (str.size() <= max_sso_len) &&
+             (as_nb() == object(str).as_nb());
+    }
+    if (const auto heap_ptr = get_heap_ptr<heap_object>()) {
+      return (heap_ptr->type() == heap_object_type::string) &&
+             (static_cast<const string<AllocatorT>*>(heap_ptr)->view() == str);
+    }
+    return false;
+  }
+
+  //===================================================================
+  // Total order across all types
+  //
+  //   nothing < boolean < number < qnan < string < list < tuple < dictionary
+  //     < persistent dictionary
+  //
+  // - int32 and float64 are ordered by value as numbers, an int32 comes
+  //   before the float64 of the same value, and float64 values follow the
+  //   IEEE 754 totalOrder (-0.0 < 0.0)
+  // - SSO and heap strings are ordered by their bytes, regardless of how
+  //   they're stored
+  // - lists and tuples are ordered lexicographically, dictionaries and
+  //   persistent dictionaries by size then by their entries sorted by key
+  // - persistent lists are lists here, and equal lists holding the same
+  //   elements
+  //
+  // Containers are walked without recursion (see detail/traverse.hpp) and
+  // may be cyclic. Equal objects always have equal hashes.
+  constexpr std::strong_ordering compare(const object& other) const {
+    if (as_nb() == other.as_nb()) {
+      return std::strong_ordering::equal;
+    }
+
+    const order_rank lhs_rank = rank();
+    const order_rank rhs_rank = other.rank();
+    if (lhs_rank != rhs_rank) {
+      return lhs_rank <=> rhs_rank;
+    }
+
+    switch (lhs_rank) {
+      case order_rank::boolean:
+        return as_boolean() <=> other.as_boolean();
+      case order_rank::number:
+        return compare_numbers(other);
+      case order_rank::string: {
+        std::string lhs_sso;
+        std::string rhs_sso;
+        return string_view_of(lhs_sso)->compare(
+                   *other.string_view_of(rhs_sso)) <=> 0;
+      }
+      case order_rank::list:
+      case order_rank::tuple:
+      case order_rank::dictionary:
+      case order_rank::persistent_dictionary:
+        return detail::deep_compare(*this, other);
+      default:
+        // nothing, qnan and heap nullptr have a single value
+        return std::strong_ordering::equal;
+    }
+  }
+
+  // Same as compare() == 0, but dictionaries look their keys up instead of
+  // being sorted
+  constexpr bool equals(const object& other) const {
+    if (as_nb() == other.as_nb()) {
+      return true;
+    }
+    const order_rank lhs_rank = rank();
+    if (lhs_rank != other.rank()) {
+      return false;
+    }
+    if (lhs_rank == order_rank::list || lhs_rank == order_rank::tuple ||
+        lhs_rank == order_rank::dictionary ||
+        lhs_rank == order_rank::persistent_dictionary) {
+      return detail::deep_equal(*this, other);
+    }
+    return compare(other) == 0;
+  }
+
+  // 64 bit key that is monotonic with compare(), for radix sorting. Objects
+  // with different keys are ordered by their keys, objects with the same key
+  // (int32/float64 of the same value, strings sharing their first 6 bytes
+  // and all containers of a type) still have to be ordered with compare()
+  //
+  //   nothing/false/true   0, 1, 2
+  //   numbers              IEEE 754 totalOrder key of the value, which never
+  //                        falls below 0x0008000000000000 or above
+  //                        0xFFF7FFFFFFFFFFFF in here
+  //   qnan                 0xFFF8000000000000
+  //   strings              0xFFF9 followed by the first 6 bytes
+  //   list/tuple/dict      0xFFFA/0xFFFB/0xFFFC
+  //   persistent dict      0xFFFD
+  //   heap nullptr         0xFFFE
+  constexpr std::uint64_t sort_key() const {
+    switch (rank()) {
+      case order_rank::nothing:
+        return 0;
+      case order_rank::boolean:
+        return as_boolean() ? 2 : 1;
+      case order_rank::number: {
+        const double num = is_int32() ? as_int32() : as_float64();
+        const auto bits = std::bit_cast<std::uint64_t>(num);
+        constexpr std::uint64_t sign = detail::nanbox::sign_mask;
+        return (bits & sign) ? ~bits : (bits | sign);
+      }
+      case order_rank::qnan:
+        return sort_key_prefix(0xFFF8);
+      case order_rank::string: {
+        std::string sso_storage;
+        const std::string_view str = *string_view_of(sso_storage);
+        std::uint64_t prefix = 0;
+        for (std::size_t i = 0; i < 6; ++i) {
+          prefix <<= 8;
+          if (i < str.size()) {
+            prefix |= static_cast<unsigned char>(str[i]);
+          }
+        }
+        return sort_key_prefix(0xFFF9) | prefix;
+      }
+      case order_rank::list:
+        return sort_key_prefix(0xFFFA);
+      case order_rank::tuple:
+        return sort_key_prefix(0xFFFB);
+      case order_rank::dictionary:
+        return sort_key_prefix(0xFFFC);
+      case order_rank::persistent_dictionary:
+        return sort_key_prefix(0xFFFD);
+      case order_rank::heap_nullptr:
+        return sort_key_prefix(0xFFFE);
+    }
+    detail::unreachable();
+  }
+
+  // Contents of a SSO or heap string, SSO strings are decoded into
+  // sso_storage. Empty for every other type
+  constexpr std::optional<std::string_view> string_view_of(
+      std::string& sso_storage) const {
+    if (is_sso_string()) {
+      sso_storage = as_string_sso();
+      return std::string_view{sso_storage};
+    }
+    if (!is_heap()) {
+      return std::nullopt;
+    }
+    if (const auto heap_ptr = get_heap_ptr<heap_object>()) {
+      if (heap_ptr->type() == heap_object_type::string) {
+        return static_cast<const string<AllocatorT>*>(heap_ptr)->view();
+      }
+    }
+    return std::nullopt;
+  }
+
   // TODO: this shouldn't be exposed
-  std::uint64_t nanbox_value() const { return as_nb(); }
+  constexpr std::uint64_t nanbox_value() const { return as_nb(); }
+
+  // Fixed types don't reference an allocator, so they can be moved between
+  // allocator types by copying the raw nanbox word
+  template <typename SrcAllocatorT>
+  static constexpr object from_fixed(const object<SrcAllocatorT>& src) {
+    ANB_ASSERT(!src.is_heap(), "Heap objects can't be copied as raw values");
+    object o;
+    o.value_ = src.value_;
+    return o;
+  }
 
  private:
+  template <typename>
+  friend class object;
+
+  object& assign_fixed(AllocatorT& allocator, const object fixed) {
+    ANB_INSTRUMENT_OP(assign);
+    if (is_heap()) {
+      dealloc_heap(allocator);
+    }
+    value_ = fixed.value_;
+    return *this;
+  }
+
+  // The heap object held when it has the wanted type, a new one otherwise
+  template <template <class> typename HeapObjT>
+  HeapObjT<AllocatorT>& reuse_or_alloc(AllocatorT& allocator,
+                                       const bool same_type) {
+    if (!same_type) {
+      if (is_heap()) {
+        dealloc_heap(allocator);
+      }
+      value_ = alloc_heap<HeapObjT>(allocator).value_;
+    }
+    return deref_heap_obj<HeapObjT<AllocatorT>>();
+  }
+
   template <template <class> typename HeapObjT>
   HeapObjT<AllocatorT>* get_heap_ptr() const {
     const std::uint64_t nb_val = as_nb();
@@ -279,27 +711,98 @@ class object {
     return nullptr;
   }
 
-  std::uint64_t as_nb() const {
-    return *reinterpret_cast<const std::uint64_t*>(&value_);
+  enum class order_rank {
+    nothing,
+    boolean,
+    number,
+    qnan,
+    string,
+    list,
+    tuple,
+    dictionary,
+    persistent_dictionary,
+    heap_nullptr
+  };
+
+  constexpr order_rank rank() const {
+    if (is_heap()) {
+      const auto heap_ptr = get_heap_ptr<heap_object>();
+      if (heap_ptr == nullptr) {
+        return order_rank::heap_nullptr;
+      }
+      switch (heap_ptr->type()) {
+        case heap_object_type::string:
+          return order_rank::string;
+        case heap_object_type::list:
+        case heap_object_type::persistent_list:
+          return order_rank::list;
+        case heap_object_type::tuple:
+          return order_rank::tuple;
+        case heap_object_type::dictionary:
+          return order_rank::dictionary;
+        case heap_object_type::persistent_dictionary:
+          return order_rank::persistent_dictionary;
+      }
+      detail::unreachable();
+    }
+    if (is_float64() || is_int32()) {
+      return order_rank::number;
+    } else if (is_sso_string()) {
+      return order_rank::string;
+    } else if (is_boolean()) {
+      return order_rank::boolean;
+    } else if (is_nothing()) {
+      return order_rank::nothing;
+    }
+    return order_rank::qnan;
+  }
+
+  static constexpr std::uint64_t sort_key_prefix(const std::uint64_t tag) {
+    return tag << 48;
   }
 
-  bool is_heap() const {
+  constexpr std::strong_ordering compare_numbers(const object& other) const {
+    if (is_int32() && other.is_int32()) {
+      return as_int32() <=> other.as_int32();
+    }
+    const double lhs_val = is_int32() ? as_int32() : as_float64();
+    const double rhs_val =
+        other.is_int32() ? other.as_int32() : other.as_float64();
+    if (const auto order = std::strong_order(lhs_val, rhs_val); order != 0) {
+      return order;
+    }
+    // Same value, the int32 goes first
+    return other.is_int32() <=> is_int32();
+  }
+
+  static object from_heap_ptr(const heap_object<AllocatorT>* heap_ptr) {
+    return from_nb(detail::nanbox::heap_type_value |
+                   reinterpret_cast<std::uint64_t>(heap_ptr));
+  }
+
+  static constexpr object from_nb(const std::uint64_t nb_val) {
+    return object{std::bit_cast<double>(nb_val)};
+  }
+
+  constexpr std::uint64_t as_nb() const {
+    return std::bit_cast<std::uint64_t>(value_);
+  }
+
+  constexpr bool is_heap() const {
     const std::uint64_t nb_val = as_nb();
     const std::uint64_t heap_val = nb_val & detail::nanbox::signature_mask &
                                    ~detail::nanbox::heap_type_data_mask;
     return (heap_val == detail::nanbox::heap_type_value);
   }
 
-  static std::uint64_t to_sso_nb_val(const std::string_view str_val,
+  static constexpr std::uint64_t to_sso_nb_val(const std::string_view str_val,
                                      const std::size_t str_index,
                                      const std::size_t shift_amount) {
     return detail::lshift(static_cast<unsigned char>(str_val[str_index]),
                           shift_amount);
   }
 
-  static double make_string_sso(const std::string_view str_val) {
-    object o;
-
+  static constexpr double make_string_sso(const std::string_view str_val) {
     const std::size_t str_len = str_val.size();
     if (str_len == max_sso_len) {
       const std::uint64_t nb_p_str =
@@ -307,7 +810,7 @@ class object {
           to_sso_nb_val(str_val, 5, 40) | to_sso_nb_val(str_val, 4, 32) |
           to_sso_nb_val(str_val, 3, 24) | to_sso_nb_val(str_val, 2, 16) |
           to_sso_nb_val(str_val, 1, 8) | to_sso_nb_val(str_val, 0, 0);
-      return *reinterpret_cast<const double*>(&nb_p_str);
+      return std::bit_cast<double>(nb_p_str);
     } else {
       std::uint64_t nb_np_str =
           detail::nanbox::fixed_type_nonpacked_string_value;
@@ -343,11 +846,11 @@ class object {
         default:
           break;
       }
-      return *reinterpret_cast<const double*>(&nb_np_str);
+      return std::bit_cast<double>(nb_np_str);
     }
   }
 
-  static char to_sso_char(const std::uint64_t nb_val,
+  static constexpr char to_sso_char(const std::uint64_t nb_val,
                           const std::size_t shift_amount) {
     return static_cast<char>(
         ((nb_val & detail::nanbox::fixed_type_sso_string_data_mask) >>
@@ -355,13 +858,15 @@ class object {
         0xFF);
   };
 
-  static std::string as_string_packed_sso(const std::uint64_t nb_val) {
+  static constexpr std::string as_string_packed_sso(
+      const std::uint64_t nb_val) {
     return std::string{to_sso_char(nb_val, 0),  to_sso_char(nb_val, 8),
                        to_sso_char(nb_val, 16), to_sso_char(nb_val, 24),
                        to_sso_char(nb_val, 32), to_sso_char(nb_val, 40)};
   }
 
-  static std::string as_string_nonpacked_sso(const std::uint64_t nb_val) {
+  static constexpr std::string as_string_nonpacked_sso(
+      const std::uint64_t nb_val) {
     const std::size_t str_len =
         ((nb_val & detail::nanbox::fixed_type_sso_string_data_mask) >> 40) &
         0xFF;
@@ -369,10 +874,6 @@ class object {
     std::string str;
     str.reserve(str_len);
 
-    auto to_char = [&nb_val](const std::size_t shift_amount) {
-
-    };
-
     switch (str_len) {
       case 5:
         str.push_back(to_sso_char(nb_val, 0));
@@ -409,8 +910,7 @@ class object {
 
   template <typename HeapObjT>
   HeapObjT& deref_heap_obj() const {
-    const std::uint64_t nb_heap =
-        *reinterpret_cast<const std::uint64_t*>(&value_);
+    const std::uint64_t nb_heap = as_nb();
     const std::uint64_t nb_data_pointer =
         nb_heap & detail::nanbox::heap_type_data_mask;
 
@@ -422,29 +922,23 @@ class object {
   }
 
   std::size_t fixed_hash() const {
-    if (is_qnan() || is_nothing() || is_float64()) {
-      return std::hash<double>{}(value_);
-    } else if (is_boolean()) {
-      return std::hash<bool>{}(as_boolean());
-    } else if (is_int32()) {
-      return std::hash<std::int32_t>{}(as_int32());
-    } else if (is_sso_string()) {
-      return std::hash<std::string>{}(as_string_sso());
+    if (is_sso_string()) {
+      return hash_string(as_string_sso());
     }
-
-    detail::unreachable();
+    return detail::magic_hash(as_nb());
   }
 
   std::size_t heap_hash() const {
     const AllocatorT& allocator =
         deref_heap_obj<heap_object<AllocatorT>>().allocator_handle;
     if (is_heap_string(allocator)) {
-      return std::hash<std::string_view>{}(as_string_heap(allocator).view());
-    } else if (is_list(allocator)) {
-      return std::hash<list<AllocatorT>>{}(allocator, as_list(allocator));
-    } else if (is_dictionary(allocator)) {
-      return std::hash<dictionary<AllocatorT>>{}(allocator,
-                                                 as_dictionary(allocator));
+      return hash_string(as_string_heap(allocator).view());
+    } else if (is_tuple(allocator) && as_tuple(allocator).keeps_hash()) {
+      return as_tuple(allocator).hash();
+    } else if (is_list(allocator) || is_dictionary(allocator) ||
+               is_persistent_dictionary(allocator) ||
+               is_persistent_list(allocator) || is_tuple(allocator)) {
+      return detail::deep_hash(*this);
     }
     detail::unreachable();
   }
@@ -454,17 +948,21 @@ class object {
   double value_;
 };
 
-// TODO: implement less than comparison for sorting
+template <typename AllocatorT>
+constexpr std::strong_ordering operator<=>(
+    const anb::object<AllocatorT>& lhs, const anb::object<AllocatorT>& rhs) {
+  return lhs.compare(rhs);
+}
 
 template <typename AllocatorT>
-inline bool operator==(const anb::object<AllocatorT>& lhs,
-                       const anb::object<AllocatorT>& rhs) {
-  return (lhs.hash() == rhs.hash());
+constexpr bool operator==(const anb::object<AllocatorT>& lhs,
+                          const anb::object<AllocatorT>& rhs) {
+  return lhs.equals(rhs);
 }
 
 template <typename AllocatorT>
-inline bool operator!=(const anb::object<AllocatorT>& lhs,
-                       const anb::object<AllocatorT>& rhs) {
+constexpr bool operator!=(const anb::object<AllocatorT>& lhs,
+                          const anb::object<AllocatorT>& rhs) {
   return !(lhs == rhs);
 }
 
@@ -0,0 +1,536 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "clone.hpp"
+#include "object.hpp"
+#include "task_pool.hpp"
+
+namespace anb {
+
+//=====================================================================
+// Parallel deep operations over object graphs
+//
+// Large lists and dictionaries are split into chunks of `grain_size`
+// elements (entries for dictionaries) that are forked onto a task_pool,
+// and nested containers larger than a chunk fork again on their own, down
+// to max_fork_depth levels. Everything else is walked by the chunk's task
+// with the serial engine of detail/traverse.hpp, so deep nesting doesn't
+// grow the call stack. Partial results are combined in chunk order and
+// the path of heap objects is handed down to every task, so cycles close
+// at the same distances and parallel_hash() always matches the serial
+// object::hash().
+//
+// parallel_hash() and parallel_equal() flatten the ropes of the graph
+// (see string.hpp) in a serial pass before forking, so their workers only
+// read and never allocate. parallel_clone() allocates from several threads
+// at once, the allocator passed to it must be safe to use concurrently.
+// Like deep_clone() without deduplicate_shared, it throws
+// std::invalid_argument for cyclic graphs, and deallocates the copies
+// made so far when copying throws part way.
+//=====================================================================
+inline constexpr std::size_t default_grain_size = 4096;
+inline constexpr std::size_t max_fork_depth = 16;
+
+namespace detail {
+
+// Runs func(begin, end, chunk_index) over [0, count) in chunks of at most
+// grain_size, inline when a single chunk is enough.
+template <typename FuncT>
+void for_each_chunk(task_pool& pool, const std::size_t count,
+                    const std::size_t grain_size, FuncT&& func) {
+  const std::size_t grain = (grain_size == 0) ? 1 : grain_size;
+  if (count <= grain) {
+    func(std::size_t{0}, count, std::size_t{0});
+    return;
+  }
+
+  task_pool::task_group group(pool);
+  const std::size_t chunk_count = (count + grain - 1) / grain;
+  for (std::size_t chunk = 1; chunk < chunk_count; ++chunk) {
+    group.run([&func, chunk, grain, count]() {
+      func(chunk * grain, std::min(count, (chunk + 1) * grain), chunk);
+    });
+  }
+  // The forking thread takes the first chunk itself
+  func(std::size_t{0}, grain, std::size_t{0});
+  group.wait();
+}
+
+// Iterators to the entries of a dictionary, which can be split into
+// chunks by position
+template <typename DictT>
+std::vector<typename DictT::const_iterator> entry_iterators(
+    const DictT& dict) {
+  std::vector<typename DictT::const_iterator> entries;
+  entries.reserve(dict.size());
+  for (auto it = dict.begin(); it != dict.end(); ++it) {
+    entries.push_back(it);
+  }
+  return entries;
+}
+
+inline std::size_t chunk_count(const std::size_t count,
+                               const std::size_t grain_size) {
+  const std::size_t grain = (grain_size == 0) ? 1 : grain_size;
+  return (count <= grain) ? 1 : (count + grain - 1) / grain;
+}
+
+// Flattens every rope of a graph, each container is walked once
+template <typename AllocatorT>
+class rope_flattener {
+ public:
+  struct state_type {};
+
+  bool enter(const object<AllocatorT>& obj, const node_kind kind,
+             state_type*, state_type&) {
+    if (kind == node_kind::string) {
+      heap_cast<string>(obj).view();
+    }
+    return is_container(kind) && seen_.insert(heap_of(obj)).second;
+  }
+
+  void leave(const object<AllocatorT>&, state_type&, state_type*) {}
+
+  void cycle(const object<AllocatorT>&, std::size_t, state_type*) {}
+
+ private:
+  std::unordered_set<const void*> seen_;
+};
+
+template <typename AllocatorT>
+void flatten_ropes(const object<AllocatorT>& obj) {
+  rope_flattener<AllocatorT> flattener;
+  depth_first(obj, flattener);
+}
+
+// Elements (entries for dictionaries) of a list or dictionary, which fork
+// over their chunks, 0 for anything else
+template <typename AllocatorT>
+std::size_t fork_width(const AllocatorT& allocator,
+                       const object<AllocatorT>& obj) {
+  if (obj.is_list(allocator)) {
+    return obj.as_list(allocator).objects_.size();
+  }
+  if (obj.is_dictionary(allocator)) {
+    return obj.as_dictionary(allocator).object_dict_.size();
+  }
+  return 0;
+}
+
+// Same for parallel_clone(), which forks over every container
+template <typename AllocatorT>
+std::size_t clone_width(const AllocatorT& allocator,
+                        const object<AllocatorT>& obj) {
+  if (obj.is_persistent_list(allocator)) {
+    return obj.as_persistent_list(allocator).tree_.size();
+  }
+  if (obj.is_persistent_dictionary(allocator)) {
+    return obj.as_persistent_dictionary(allocator).trie_.size();
+  }
+  if (obj.is_tuple(allocator)) {
+    return obj.as_tuple(allocator).size();
+  }
+  return fork_width(allocator, obj);
+}
+
+template <typename AllocatorT>
+std::size_t hash_forked(task_pool& pool, const AllocatorT& allocator,
+                        const object<AllocatorT>& obj, std::size_t grain_size,
+                        const traversal_path& path, std::size_t depth);
+
+// Hash of obj reached from the objects on path, forked when obj is large
+// enough and not on path already
+template <typename AllocatorT>
+std::size_t hash_child(task_pool& pool, const AllocatorT& allocator,
+                       const object<AllocatorT>& obj,
+                       const std::size_t grain_size, traversal_path& path,
+                       const std::size_t depth) {
+  if (depth < max_fork_depth &&
+      chunk_count(fork_width(allocator, obj), grain_size) > 1 &&
+      path.distance(heap_of(obj)) == 0) {
+    traversal_path child_path = path;
+    child_path.push(heap_of(obj));
+    return hash_forked(pool, allocator, obj, grain_size, child_path,
+                       depth + 1);
+  }
+  return deep_hash(obj, path);
+}
+
+// Hash of a list or dictionary, the last object on path
+template <typename AllocatorT>
+std::size_t hash_forked(task_pool& pool, const AllocatorT& allocator,
+                        const object<AllocatorT>& obj,
+                        const std::size_t grain_size,
+                        const traversal_path& path, const std::size_t depth) {
+  if (obj.is_list(allocator)) {
+    const auto& objects = obj.as_list(allocator).objects_;
+    std::vector<sequence_hash> partials(
+        chunk_count(objects.size(), grain_size));
+    for_each_chunk(pool, objects.size(), grain_size,
+                   [&](const std::size_t begin, const std::size_t end,
+                       const std::size_t chunk) {
+                     traversal_path chunk_path = path;
+                     sequence_hash partial;
+                     for (std::size_t i = begin; i < end; ++i) {
+                       partial.add(hash_child(pool, allocator, objects[i],
+                                              grain_size, chunk_path, depth));
+                     }
+                     partials[chunk] = partial;
+                   });
+
+    sequence_hash hash;
+    for (const auto& partial : partials) {
+      hash.append(partial);
+    }
+    return hash.finish(objects.size());
+  }
+
+  const auto& dict = obj.as_dictionary(allocator).object_dict_;
+  const auto entries = entry_iterators(dict);
+  std::vector<std::size_t> partials(chunk_count(dict.size(), grain_size), 0);
+  for_each_chunk(pool, dict.size(), grain_size,
+                 [&](const std::size_t begin, const std::size_t end,
+                     const std::size_t chunk) {
+                   traversal_path chunk_path = path;
+                   std::size_t partial = 0;
+                   for (std::size_t i = begin; i < end; ++i) {
+                     const auto& it = entries[i];
+                     partial += entry_hash(
+                         it.hash(), hash_child(pool, allocator, it->second,
+                                               grain_size, chunk_path, depth));
+                   }
+                   partials[chunk] = partial;
+                 });
+
+  std::size_t sum = 0;
+  for (const std::size_t partial : partials) {
+    sum += partial;
+  }
+  return unordered_hash_finish(sum, dict.size());
+}
+
+template <typename AllocatorT>
+bool equal_forked(task_pool& pool, const AllocatorT& allocator,
+                  const object<AllocatorT>& lhs, const object<AllocatorT>& rhs,
+                  std::size_t grain_size, const traversal_path& lhs_path,
+                  const traversal_path& rhs_path, std::size_t depth);
+
+// Equality of lhs and rhs reached from the objects on the paths, forked
+// for two large lists or dictionaries which aren't on the paths already
+template <typename AllocatorT>
+bool equal_child(task_pool& pool, const AllocatorT& allocator,
+                 const object<AllocatorT>& lhs, const object<AllocatorT>& rhs,
+                 const std::size_t grain_size, traversal_path& lhs_path,
+                 traversal_path& rhs_path, const std::size_t depth) {
+  const bool same_type =
+      (lhs.is_list(allocator) && rhs.is_list(allocator)) ||
+      (lhs.is_dictionary(allocator) && rhs.is_dictionary(allocator));
+  if (same_type && depth < max_fork_depth &&
+      lhs.nanbox_value() != rhs.nanbox_value() &&
+      chunk_count(fork_width(allocator, lhs), grain_size) > 1 &&
+      lhs_path.distance(heap_of(lhs)) == 0 &&
+      rhs_path.distance(heap_of(rhs)) == 0) {
+    if (fork_width(allocator, lhs) != fork_width(allocator, rhs)) {
+      return false;
+    }
+    traversal_path lhs_child_path = lhs_path;
+    traversal_path rhs_child_path = rhs_path;
+    lhs_child_path.push(heap_of(lhs));
+    rhs_child_path.push(heap_of(rhs));
+    return equal_forked(pool, allocator, lhs, rhs, grain_size, lhs_child_path,
+                        rhs_child_path, depth + 1);
+  }
+  return deep_equal(lhs, rhs, lhs_path, rhs_path);
+}
+
+// Equality of two lists or two dictionaries of the same size, the last
+// objects on the paths
+template <typename AllocatorT>
+bool equal_forked(task_pool& pool, const AllocatorT& allocator,
+                  const object<AllocatorT>& lhs, const object<AllocatorT>& rhs,
+                  const std::size_t grain_size,
+                  const traversal_path& lhs_path,
+                  const traversal_path& rhs_path, const std::size_t depth) {
+  std::atomic<bool> mismatch = false;
+  if (lhs.is_list(allocator)) {
+    const auto& lhs_objects = lhs.as_list(allocator).objects_;
+    const auto& rhs_objects = rhs.as_list(allocator).objects_;
+    for_each_chunk(
+        pool, lhs_objects.size(), grain_size,
+        [&](const std::size_t begin, const std::size_t end, std::size_t) {
+          traversal_path lhs_chunk_path = lhs_path;
+          traversal_path rhs_chunk_path = rhs_path;
+          for (std::size_t i = begin;
+               i < end && !mismatch.load(std::memory_order_relaxed); ++i) {
+            if (!equal_child(pool, allocator, lhs_objects[i], rhs_objects[i],
+                             grain_size, lhs_chunk_path, rhs_chunk_path,
+                             depth)) {
+              mismatch.store(true, std::memory_order_relaxed);
+            }
+          }
+        });
+    return !mismatch.load();
+  }
+
+  const auto& lhs_dict = lhs.as_dictionary(allocator).object_dict_;
+  const auto& rhs_dict = rhs.as_dictionary(allocator).object_dict_;
+  const auto lhs_entries = entry_iterators(lhs_dict);
+  for_each_chunk(
+      pool, lhs_dict.size(), grain_size,
+      [&](const std::size_t begin, const std::size_t end, std::size_t) {
+        traversal_path lhs_chunk_path = lhs_path;
+        traversal_path rhs_chunk_path = rhs_path;
+        for (std::size_t i = begin;
+             i < end && !mismatch.load(std::memory_order_relaxed); ++i) {
+          const auto& it = lhs_entries[i];
+          const auto found = rhs_dict.find(it->first);
+          if (found == rhs_dict.end() ||
+              !equal_child(pool, allocator, it->second, found->second,
+                           grain_size, lhs_chunk_path, rhs_chunk_path,
+                           depth)) {
+            mismatch.store(true, std::memory_order_relaxed);
+          }
+        }
+      });
+  return !mismatch.load();
+}
+
+// Copies made by the tasks of parallel_clone(), deallocated together when
+// one of them throws
+template <typename AllocatorT>
+class clone_copies {
+ public:
+  // Tracks copy, which is deallocated right away when that fails
+  void add(const object<AllocatorT>& copy, AllocatorT& allocator) {
+    try {
+      std::lock_guard lock(mutex_);
+      copies_.push_back(copy);
+    } catch (...) {
+      object<AllocatorT> untracked = copy;
+      untracked.dealloc_heap(allocator);
+      throw;
+    }
+  }
+
+  // Takes over the copies a cloner made, they're discarded by the
+  // cloner when that fails
+  void add(const std::vector<object<AllocatorT>>& copies) {
+    std::lock_guard lock(mutex_);
+    copies_.insert(copies_.end(), copies.begin(), copies.end());
+  }
+
+  void discard(AllocatorT& allocator) {
+    for (auto& copy : copies_) {
+      copy.dealloc_heap(allocator);
+    }
+    copies_.clear();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<object<AllocatorT>> copies_;
+};
+
+template <typename AllocatorT>
+object<AllocatorT> clone_forked(task_pool& pool, AllocatorT& allocator,
+                                const object<AllocatorT>& obj,
+                                std::size_t grain_size, std::size_t depth,
+                                clone_copies<AllocatorT>& copies);
+
+// Copy of obj, forked when obj is large enough. The graph is acyclic
+template <typename AllocatorT>
+object<AllocatorT> clone_child(task_pool& pool, AllocatorT& allocator,
+                               const object<AllocatorT>& obj,
+                               const std::size_t grain_size,
+                               const std::size_t depth,
+                               clone_copies<AllocatorT>& copies) {
+  if (depth < max_fork_depth &&
+      chunk_count(clone_width(allocator, obj), grain_size) > 1) {
+    return clone_forked(pool, allocator, obj, grain_size, depth + 1,
+                        copies);
+  }
+  graph_cloner<AllocatorT, AllocatorT> cloner(allocator, allocator,
+                                              clone_options{});
+  try {
+    const object<AllocatorT> copy = cloner.clone(obj);
+    copies.add(cloner.copies());
+    return copy;
+  } catch (...) {
+    cloner.discard();
+    throw;
+  }
+}
+
+// Copy of a container
+template <typename AllocatorT>
+object<AllocatorT> clone_forked(task_pool& pool, AllocatorT& allocator,
+                                const object<AllocatorT>& obj,
+                                const std::size_t grain_size,
+                                const std::size_t depth,
+                                clone_copies<AllocatorT>& copies) {
+  if (obj.is_list(allocator)) {
+    const auto& src_objects = obj.as_list(allocator).objects_;
+
+    auto copy = object<AllocatorT>::make_list(allocator);
+    copies.add(copy, allocator);
+    auto& dst_objects = copy.as_list(allocator).objects_;
+    dst_objects.resize(src_objects.size());
+    for_each_chunk(
+        pool, src_objects.size(), grain_size,
+        [&](const std::size_t begin, const std::size_t end, std::size_t) {
+          for (std::size_t i = begin; i < end; ++i) {
+            dst_objects[i] =
+                clone_child(pool, allocator, src_objects[i], grain_size,
+                            depth, copies);
+          }
+        });
+    return copy;
+  }
+
+  if (obj.is_dictionary(allocator)) {
+    using entry = std::pair<object<AllocatorT>, object<AllocatorT>>;
+    const auto& src_dict = obj.as_dictionary(allocator).object_dict_;
+    const auto src_entries = entry_iterators(src_dict);
+
+    std::vector<entry> entries(src_dict.size());
+    for_each_chunk(
+        pool, src_dict.size(), grain_size,
+        [&](const std::size_t begin, const std::size_t end, std::size_t) {
+          for (std::size_t i = begin; i < end; ++i) {
+            const auto& [key_obj, val_obj] = *src_entries[i];
+            entries[i] = {clone_child(pool, allocator, key_obj, grain_size,
+                                      depth, copies),
+                          clone_child(pool, allocator, val_obj, grain_size,
+                                      depth, copies)};
+          }
+        });
+
+    // Inserted from a single thread, in the source insertion order
+    auto copy = object<AllocatorT>::make_dictionary(allocator);
+    copies.add(copy, allocator);
+    auto& dst_dict = copy.as_dictionary(allocator).object_dict_;
+    dst_dict.reserve(entries.size());
+    for (auto& kv : entries) {
+      dst_dict.insert(std::move(kv));
+    }
+    return copy;
+  }
+
+  if (obj.is_persistent_list(allocator)) {
+    const auto& src_tree = obj.as_persistent_list(allocator).tree_;
+    std::vector<object<AllocatorT>> elements(src_tree.begin(),
+                                             src_tree.end());
+    for_each_chunk(
+        pool, elements.size(), grain_size,
+        [&](const std::size_t begin, const std::size_t end, std::size_t) {
+          for (std::size_t i = begin; i < end; ++i) {
+            elements[i] = clone_child(pool, allocator, elements[i],
+                                      grain_size, depth, copies);
+          }
+        });
+    auto copy = object<AllocatorT>::make_persistent_list(allocator, elements);
+    copies.add(copy, allocator);
+    return copy;
+  }
+
+  if (obj.is_persistent_dictionary(allocator)) {
+    const auto& src_trie = obj.as_persistent_dictionary(allocator).trie_;
+    // Tries are only walked forward, the entries are gathered first
+    std::vector<const hamt_entry<AllocatorT>*> src_entries;
+    src_entries.reserve(src_trie.size());
+    for (const auto& e : src_trie) {
+      src_entries.push_back(&e);
+    }
+
+    using entry = std::pair<object<AllocatorT>, object<AllocatorT>>;
+    std::vector<entry> entries(src_entries.size());
+    for_each_chunk(
+        pool, src_entries.size(), grain_size,
+        [&](const std::size_t begin, const std::size_t end, std::size_t) {
+          for (std::size_t i = begin; i < end; ++i) {
+            entries[i] = {clone_child(pool, allocator, src_entries[i]->key,
+                                      grain_size, depth, copies),
+                          clone_child(pool, allocator, src_entries[i]->value,
+                                      grain_size, depth, copies)};
+          }
+        });
+
+    auto copy = object<AllocatorT>::make_persistent_dictionary(allocator);
+    copies.add(copy, allocator);
+    auto& dst_trie = copy.as_persistent_dictionary(allocator).trie_;
+    for (const auto& [key_obj, val_obj] : entries) {
+      dst_trie.set(key_obj, val_obj);
+    }
+    return copy;
+  }
+
+  // Only tuples are left
+  if constexpr (raw_allocator<AllocatorT>) {
+    const auto& src_tuple = obj.as_tuple(allocator);
+    std::vector<object<AllocatorT>> elements(src_tuple.size());
+    for_each_chunk(
+        pool, src_tuple.size(), grain_size,
+        [&](const std::size_t begin, const std::size_t end, std::size_t) {
+          for (std::size_t i = begin; i < end; ++i) {
+            elements[i] = clone_child(pool, allocator, src_tuple[i],
+                                      grain_size, depth, copies);
+          }
+        });
+    auto copy = object<AllocatorT>::make_tuple(allocator, elements);
+    copies.add(copy, allocator);
+    return copy;
+  } else {
+    // Tuples can't be created without raw allocation
+    unreachable();
+  }
+}
+
+}  // namespace detail
+
+template <typename AllocatorT>
+std::size_t parallel_hash(task_pool& pool, const AllocatorT& allocator,
+                          const object<AllocatorT>& obj,
+                          const std::size_t grain_size = default_grain_size) {
+  detail::flatten_ropes(obj);
+  detail::traversal_path path;
+  return detail::hash_child(pool, allocator, obj, grain_size, path, 0);
+}
+
+template <typename AllocatorT>
+bool parallel_equal(task_pool& pool, const AllocatorT& allocator,
+                    const object<AllocatorT>& lhs,
+                    const object<AllocatorT>& rhs,
+                    const std::size_t grain_size = default_grain_size) {
+  detail::flatten_ropes(lhs);
+  detail::flatten_ropes(rhs);
+  detail::traversal_path lhs_path;
+  detail::traversal_path rhs_path;
+  return detail::equal_child(pool, allocator, lhs, rhs, grain_size, lhs_path,
+                             rhs_path, 0);
+}
+
+// Throws std::invalid_argument for cyclic graphs, before copying anything
+template <typename AllocatorT>
+object<AllocatorT> parallel_clone(
+    task_pool& pool, AllocatorT& allocator, const object<AllocatorT>& obj,
+    const std::size_t grain_size = default_grain_size) {
+  if (measure_graph(allocator, obj).cycles != 0) {
+    throw std::invalid_argument("anb::parallel_clone: cyclic graph");
+  }
+  detail::clone_copies<AllocatorT> copies;
+  try {
+    return detail::clone_child(pool, allocator, obj, grain_size, 0, copies);
+  } catch (...) {
+    copies.discard(allocator);
+    throw;
+  }
+}
+
+}  // namespace anb
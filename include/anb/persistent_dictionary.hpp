@@ -0,0 +1,226 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <ranges>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#include "allocator.hpp"
+#include "heap_object.hpp"
+#include "detail/box.hpp"
+#include "detail/hamt.hpp"
+
+namespace anb {
+
+template <typename AllocatorT>
+class object;
+
+//=====================================================================
+// Immutable dictionary with structural sharing
+//
+//   auto v1 = anb::object<A>::make_persistent_dictionary(allocator);
+//   auto v2 = v1.as_persistent_dictionary(allocator).set(key, value);
+//
+// Every version is a heap object of its own, released with
+// dealloc_heap() like any other, and the versions share the nodes of
+// their hash array mapped trie (see detail/hamt.hpp). set() and erase()
+// return a new version in O(log n) and leave the one they're called on
+// unchanged, copying or assigning a version is O(1). Keys are hashed with
+// object::hash(), and iteration follows the trie, not insertion order.
+//
+// Bulk loads go through a transient, which updates the nodes it owns in
+// place and hands out versions with persist():
+//
+//   anb::persistent_dictionary<A>::transient batch(allocator);
+//   for (...) batch.set(key, value);
+//   auto version = batch.persist();
+//=====================================================================
+template <typename AllocatorT>
+struct persistent_dictionary : public heap_object<AllocatorT> {
+  using trie_type = detail::hamt<AllocatorT>;
+  using const_iterator = typename trie_type::const_iterator;
+  class transient;
+
+  persistent_dictionary(AllocatorT& handle)
+      : heap_object<AllocatorT>(handle), trie_(handle) {}
+
+  std::size_t size() const { return trie_.size(); }
+  bool empty() const { return trie_.empty(); }
+
+  const_iterator begin() const { return trie_.begin(); }
+  const_iterator end() const { return trie_.end(); }
+
+  // Value mapped to key, nullptr when there is none. Like
+  // dictionary::find(), strings are looked up without boxing them
+  const anb::object<AllocatorT>* find(
+      const anb::object<AllocatorT>& key) const {
+    return value_of(trie_.find(key));
+  }
+
+  const anb::object<AllocatorT>* find(const std::string_view key) const {
+    return value_of(trie_.find_hashed(
+        anb::object<AllocatorT>::hash_string(key),
+        [key](const anb::object<AllocatorT>& stored) {
+          return stored.string_equals(key);
+        }));
+  }
+
+  const anb::object<AllocatorT>* find(const std::int32_t key) const {
+    return find(anb::object<AllocatorT>(key));
+  }
+
+  const anb::object<AllocatorT>* find(const double key) const {
+    return find(anb::object<AllocatorT>(key));
+  }
+
+  // Constrained so string literals don't convert to bool
+  template <std::same_as<bool> BoolT>
+  const anb::object<AllocatorT>* find(const BoolT key) const {
+    return find(anb::object<AllocatorT>(key));
+  }
+
+  template <typename KeyT>
+  bool contains(const KeyT& key) const {
+    return find(key) != nullptr;
+  }
+
+  template <typename KeyT>
+  const anb::object<AllocatorT>& at(const KeyT& key) const {
+    const anb::object<AllocatorT>* value = find(key);
+    if (value == nullptr) {
+      throw std::out_of_range("anb::persistent_dictionary::at");
+    }
+    return *value;
+  }
+
+  // New version mapping key to value
+  anb::object<AllocatorT> set(const anb::object<AllocatorT>& key,
+                              const anb::object<AllocatorT>& value) const {
+    trie_type next(trie_);
+    next.set(key, value);
+    return make_version(std::move(next));
+  }
+
+  // New version without key
+  anb::object<AllocatorT> erase(const anb::object<AllocatorT>& key) const {
+    trie_type next(trie_);
+    next.erase(key);
+    return make_version(std::move(next));
+  }
+
+  heap_object_type type() const override {
+    return heap_object_type::persistent_dictionary;
+  }
+
+  // Changing the trie in place only changes this version, the nodes it
+  // shares with other versions are copied first
+  trie_type trie_;
+
+ private:
+  static const anb::object<AllocatorT>* value_of(
+      const typename trie_type::entry* found) {
+    return (found != nullptr) ? &found->value : nullptr;
+  }
+
+  static anb::object<AllocatorT> make_version(trie_type trie) {
+    AllocatorT& allocator = trie.allocator();
+    auto version =
+        anb::object<AllocatorT>::make_persistent_dictionary(allocator);
+    version.as_persistent_dictionary(allocator).trie_ = std::move(trie);
+    return version;
+  }
+};
+
+// Batch-mutable builder of persistent dictionary versions
+template <typename AllocatorT>
+class persistent_dictionary<AllocatorT>::transient {
+ public:
+  explicit transient(AllocatorT& allocator) : trie_(allocator) {}
+
+  // Starts from version, sharing its nodes until they're changed
+  explicit transient(const persistent_dictionary& version)
+      : trie_(version.trie_) {}
+
+  // True when key wasn't mapped yet
+  bool set(const anb::object<AllocatorT>& key,
+           const anb::object<AllocatorT>& value) {
+    return trie_.set(key, value);
+  }
+
+  // True when key was mapped
+  bool erase(const anb::object<AllocatorT>& key) { return trie_.erase(key); }
+
+  // Maps keys[i] to values[i], boxing fixed values and strings
+  template <std::ranges::input_range KeysT, std::ranges::input_range ValuesT>
+    requires detail::boxable<std::ranges::range_reference_t<KeysT>,
+                             AllocatorT> &&
+             detail::boxable<std::ranges::range_reference_t<ValuesT>,
+                             AllocatorT>
+  void insert_range(KeysT&& keys, ValuesT&& values) {
+    if constexpr (std::ranges::sized_range<KeysT> &&
+                  std::ranges::sized_range<ValuesT>) {
+      if (std::ranges::size(keys) != std::ranges::size(values)) {
+        throw std::invalid_argument(
+            "anb::persistent_dictionary::transient::insert_range: keys and "
+            "values sizes differ");
+      }
+    }
+    AllocatorT& allocator = trie_.allocator();
+    auto value_it = std::ranges::begin(values);
+    const auto value_end = std::ranges::end(values);
+    for (auto&& key : keys) {
+      if (value_it == value_end) {
+        throw std::invalid_argument(
+            "anb::persistent_dictionary::transient::insert_range: keys and "
+            "values sizes differ");
+      }
+      trie_.set(box_key(allocator, std::forward<decltype(key)>(key)),
+                detail::box(allocator, *value_it));
+      ++value_it;
+    }
+    if (value_it != value_end) {
+      throw std::invalid_argument(
+          "anb::persistent_dictionary::transient::insert_range: keys and "
+          "values sizes differ");
+    }
+  }
+
+  const anb::object<AllocatorT>* find(
+      const anb::object<AllocatorT>& key) const {
+    return value_of(trie_.find(key));
+  }
+
+  std::size_t size() const { return trie_.size(); }
+
+  // Version holding the entries so far, in O(1). The transient stays
+  // usable, and copies the nodes it shares with the version before
+  // changing them
+  anb::object<AllocatorT> persist() const { return make_version(trie_); }
+
+ private:
+  // String keys already mapped reuse the stored key, so replacing their
+  // value doesn't allocate a heap string for the key
+  template <typename KeyT>
+  anb::object<AllocatorT> box_key(AllocatorT& allocator, KeyT&& key) const {
+    if constexpr (std::convertible_to<KeyT, std::string_view>) {
+      const std::string_view str(key);
+      if (const auto* found = trie_.find_hashed(
+              anb::object<AllocatorT>::hash_string(str),
+              [str](const anb::object<AllocatorT>& stored) {
+                return stored.string_equals(str);
+              })) {
+        return found->key;
+      }
+      return detail::box(allocator, str);
+    } else {
+      return anb::object<AllocatorT>(std::forward<KeyT>(key));
+    }
+  }
+
+  trie_type trie_;
+};
+
+}  // namespace anb
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <ranges>
+#include <stdexcept>
+#include <utility>
+
+#include "allocator.hpp"
+#include "heap_object.hpp"
+#include "detail/box.hpp"
+#include "detail/rrb.hpp"
+
+namespace anb {
+
+template <typename AllocatorT>
+class object;
+
+//=====================================================================
+// Immutable list with structural sharing
+//
+//   auto v1 = anb::object<A>::make_persistent_list(allocator, range);
+//   auto v2 = v1.as_persistent_list(allocator).set(0, value);
+//
+// Every version is a heap object of its own, released with
+// dealloc_heap() like any other, and the versions share the nodes of
+// their relaxed radix balanced tree (see detail/rrb.hpp). Indexing is
+// O(log n) with a tree 32 wide, set(), push_back(), concat() and slice()
+// return a new version in O(log n) and leave the ones they're called on
+// unchanged, copying or assigning a version is O(1).
+//
+// A persistent list is a list for ordering, hashing and equality: it
+// equals a list holding the same elements, and hashes like it.
+//
+// Bulk appends go through a transient, which updates the nodes it owns
+// in place and hands out versions with persist():
+//
+//   anb::persistent_list<A>::transient batch(allocator);
+//   for (...) batch.push_back(value);
+//   auto version = batch.persist();
+//=====================================================================
+template <typename AllocatorT>
+struct persistent_list : public heap_object<AllocatorT> {
+  using tree_type = detail::rrb<AllocatorT>;
+  using const_iterator = typename tree_type::const_iterator;
+  class transient;
+
+  persistent_list(AllocatorT& handle)
+      : heap_object<AllocatorT>(handle), tree_(handle) {}
+
+  std::size_t size() const { return tree_.size(); }
+  bool empty() const { return tree_.empty(); }
+
+  const_iterator begin() const { return tree_.begin(); }
+  const_iterator end() const { return tree_.end(); }
+
+  const anb::object<AllocatorT>& operator[](const std::size_t index) const {
+    return tree_[index];
+  }
+
+  const anb::object<AllocatorT>& at(const std::size_t index) const {
+    check_index(index, "anb::persistent_list::at");
+    return tree_[index];
+  }
+
+  // New version with value at index
+  anb::object<AllocatorT> set(const std::size_t index,
+                              const anb::object<AllocatorT>& value) const {
+    check_index(index, "anb::persistent_list::set");
+    tree_type next(tree_);
+    next.set(index, value);
+    return make_version(std::move(next));
+  }
+
+  // New version with value appended
+  anb::object<AllocatorT> push_back(
+      const anb::object<AllocatorT>& value) const {
+    tree_type next(tree_);
+    next.push_back(value);
+    return make_version(std::move(next));
+  }
+
+  // New version holding the elements of this one followed by those of
+  // other, which must come from the same allocator
+  anb::object<AllocatorT> concat(const persistent_list& other) const {
+    return make_version(tree_.concat(other.tree_));
+  }
+
+  // New version holding elements [first, last)
+  anb::object<AllocatorT> slice(const std::size_t first,
+                                const std::size_t last) const {
+    if (first > last || last > size()) {
+      throw std::out_of_range("anb::persistent_list::slice");
+    }
+    return make_version(tree_.slice(first, last));
+  }
+
+  heap_object_type type() const override {
+    return heap_object_type::persistent_list;
+  }
+
+  // Changing the tree in place only changes this version, the nodes it
+  // shares with other versions are copied first
+  tree_type tree_;
+
+ private:
+  void check_index(const std::size_t index, const char* what) const {
+    if (index >= size()) {
+      throw std::out_of_range(what);
+    }
+  }
+
+  static anb::object<AllocatorT> make_version(tree_type tree) {
+    AllocatorT& allocator = tree.allocator();
+    auto version = anb::object<AllocatorT>::make_persistent_list(allocator);
+    version.as_persistent_list(allocator).tree_ = std::move(tree);
+    return version;
+  }
+};
+
+// Batch-mutable builder of persistent list versions
+template <typename AllocatorT>
+class persistent_list<AllocatorT>::transient {
+ public:
+  explicit transient(AllocatorT& allocator) : tree_(allocator) {}
+
+  // Starts from version, sharing its nodes until they're changed
+  explicit transient(const persistent_list& version)
+      : tree_(version.tree_) {}
+
+  void push_back(const anb::object<AllocatorT>& value) {
+    tree_.push_back(value);
+  }
+
+  // Unchecked, index < size()
+  void set(const std::size_t index, const anb::object<AllocatorT>& value) {
+    tree_.set(index, value);
+  }
+
+  // Appends every element of range, boxing fixed values and strings
+  template <std::ranges::input_range RangeT>
+    requires detail::boxable<std::ranges::range_reference_t<RangeT>,
+                             AllocatorT>
+  void append_range(RangeT&& range) {
+    AllocatorT& allocator = tree_.allocator();
+    for (auto&& value : range) {
+      tree_.push_back(
+          detail::box(allocator, std::forward<decltype(value)>(value)));
+    }
+  }
+
+  const anb::object<AllocatorT>& operator[](const std::size_t index) const {
+    return tree_[index];
+  }
+
+  std::size_t size() const { return tree_.size(); }
+
+  // Version holding the elements so far, in O(1). The transient stays
+  // usable, and copies the nodes it shares with the version before
+  // changing them
+  anb::object<AllocatorT> persist() const { return make_version(tree_); }
+
+ private:
+  tree_type tree_;
+};
+
+}  // namespace anb
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "object.hpp"
+
+namespace anb {
+
+//=====================================================================
+// Sorting by the total order of anb::object
+//
+// Each object is reduced to its 64 bit object::sort_key() and the
+// (key, object) pairs are LSD radix sorted a byte at a time, skipping the
+// bytes every key agrees on. The keys only approximate the order, so runs
+// of equal keys are finished off with object::compare(), which mostly
+// happens for containers and for strings sharing a prefix.
+//
+// Small inputs aren't worth the extra buffers and go through std::sort.
+//=====================================================================
+inline constexpr std::size_t radix_sort_threshold = 256;
+
+namespace detail {
+
+template <typename AllocatorT>
+struct keyed_object {
+  std::uint64_t key;
+  object<AllocatorT> obj;
+};
+
+template <typename AllocatorT>
+void radix_sort_keys(std::vector<keyed_object<AllocatorT>>& items) {
+  constexpr std::size_t digit_count = sizeof(std::uint64_t);
+  constexpr std::size_t bucket_count = 256;
+
+  // Every histogram in a single pass over the keys
+  std::vector<std::array<std::size_t, bucket_count>> histograms(digit_count);
+  for (const auto& item : items) {
+    for (std::size_t digit = 0; digit < digit_count; ++digit) {
+      ++histograms[digit][(item.key >> (digit * 8)) & 0xFF];
+    }
+  }
+
+  std::vector<keyed_object<AllocatorT>> scratch(items.size());
+  for (std::size_t digit = 0; digit < digit_count; ++digit) {
+    auto& histogram = histograms[digit];
+    const std::size_t first_digit = (items.front().key >> (digit * 8)) & 0xFF;
+    if (histogram[first_digit] == items.size()) {
+      // All keys have the same byte here
+      continue;
+    }
+
+    std::size_t offset = 0;
+    for (auto& bucket : histogram) {
+      offset += std::exchange(bucket, offset);
+    }
+    for (const auto& item : items) {
+      scratch[histogram[(item.key >> (digit * 8)) & 0xFF]++] = item;
+    }
+    items.swap(scratch);
+  }
+}
+
+}  // namespace detail
+
+template <typename AllocatorT>
+void sort(const std::span<object<AllocatorT>> objects) {
+  const auto less = [](const object<AllocatorT>& lhs,
+                       const object<AllocatorT>& rhs) {
+    return lhs.compare(rhs) < 0;
+  };
+
+  if (objects.size() < radix_sort_threshold) {
+    std::sort(objects.begin(), objects.end(), less);
+    return;
+  }
+
+  std::vector<detail::keyed_object<AllocatorT>> items;
+  items.reserve(objects.size());
+  for (const auto& obj : objects) {
+    items.push_back({obj.sort_key(), obj});
+  }
+  detail::radix_sort_keys(items);
+
+  for (std::size_t i = 0; i < items.size(); ++i) {
+    objects[i] = items[i].obj;
+  }
+
+  // Resolve the runs of equal keys
+  std::size_t run_begin = 0;
+  while (run_begin < items.size()) {
+    std::size_t run_end = run_begin + 1;
+    bool identical = true;
+    while (run_end < items.size() &&
+           items[run_end].key == items[run_begin].key) {
+      identical = identical && (items[run_end].obj.nanbox_value() ==
+                                items[run_begin].obj.nanbox_value());
+      ++run_end;
+    }
+    if (!identical) {
+      std::sort(objects.begin() + run_begin, objects.begin() + run_end, less);
+    }
+    run_begin = run_end;
+  }
+}
+
+template <typename AllocatorT>
+void sort(list<AllocatorT>& objects) {
+  sort(std::span<object<AllocatorT>>(objects.objects_));
+}
+
+}  // namespace anb
@@ -0,0 +1,388 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "object.hpp"
+
+namespace anb {
+
+//=====================================================================
+// Read only dictionary built at compile time
+//
+//   constexpr auto methods = anb::make_static_dictionary<A>({
+//       {"GET", anb::object<A>(std::int32_t{1})},
+//       {"DELETE", anb::object<A>(std::int32_t{2})},
+//   });
+//   const anb::object<A>* id = methods.find(request_method);
+//
+// The keys get a minimal perfect hash (CHD, "hash, displace and
+// compress"): every key hashes to a bucket, and each bucket stores the
+// displacement that sends its keys to free slots of a table with exactly
+// one slot per key. A lookup is a hash, one displacement read and a single
+// key comparison, with no probing and no allocation.
+//
+// Keys are fixed objects or strings of any length. Strings are matched by
+// their contents, so SSO and heap string objects find string keys alike.
+// Longer string keys reference their characters, which have to outlive
+// the dictionary (string literals do).
+//
+// The table is built during constant evaluation, whose budget bounds its
+// size: with GCC's default -fconstexpr-ops-limit tables of up to about
+// 3000 keys build, larger ones need a higher limit.
+//
+// The table isn't a heap object, to_dictionary() copies it into a regular
+// anb::dictionary when it has to be referenced from an object graph.
+//=====================================================================
+template <typename AllocatorT>
+class static_key {
+ public:
+  constexpr static_key() = default;
+
+  constexpr static_key(const std::string_view str)
+      : str_data_(str.data()), str_size_(str.size()), is_string_(true) {}
+
+  constexpr static_key(const char* str) : static_key(std::string_view{str}) {}
+
+  // SSO strings are copied in as string keys, other fixed objects are
+  // matched by their nanbox word
+  constexpr static_key(const object<AllocatorT>& obj) {
+    if (obj.is_sso_string()) {
+      const std::string str = obj.as_string_sso();
+      std::copy(str.begin(), str.end(), sso_.begin());
+      str_size_ = str.size();
+      is_string_ = true;
+    } else {
+      ANB_ASSERT(!obj.is_heap_nullptr() && is_fixed(obj),
+                 "Static dictionary keys must be fixed objects or strings");
+      fixed_ = obj;
+    }
+  }
+
+  constexpr bool is_string() const { return is_string_; }
+
+  constexpr std::string_view string() const {
+    return {str_data_ != nullptr ? str_data_ : sso_.data(), str_size_};
+  }
+
+  constexpr object<AllocatorT> fixed() const { return fixed_; }
+
+  friend constexpr bool operator==(const static_key& lhs,
+                                   const static_key& rhs) {
+    return (lhs.is_string_ == rhs.is_string_) &&
+           (lhs.is_string_ ? lhs.string() == rhs.string()
+                           : lhs.fixed_.nanbox_value() ==
+                                 rhs.fixed_.nanbox_value());
+  }
+
+ private:
+  static constexpr bool is_fixed(const object<AllocatorT>& obj) {
+    return obj.is_qnan() || obj.is_nothing() || obj.is_boolean() ||
+           obj.is_int32() || obj.is_float64();
+  }
+
+  const char* str_data_ = nullptr;
+  std::size_t str_size_ = 0;
+  std::array<char, 8> sso_{};
+  object<AllocatorT> fixed_;
+  bool is_string_ = false;
+};
+
+namespace detail {
+
+constexpr std::uint64_t static_mix(std::uint64_t x) {
+  // splitmix64 finalizer
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+constexpr std::uint64_t static_hash(const std::string_view str,
+                                    const std::uint64_t seed) {
+  // FNV-1a
+  std::uint64_t hash = 0xcbf29ce484222325ULL ^ static_mix(seed);
+  for (const char c : str) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+  }
+  return static_mix(hash);
+}
+
+constexpr std::uint64_t static_hash(const std::uint64_t word,
+                                    const std::uint64_t seed) {
+  return static_mix(word ^ static_mix(seed + 0x9e3779b97f4a7c15ULL));
+}
+
+template <typename AllocatorT>
+constexpr std::uint64_t static_hash(const static_key<AllocatorT>& key,
+                                    const std::uint64_t seed) {
+  return key.is_string() ? static_hash(key.string(), seed)
+                         : static_hash(key.fixed().nanbox_value(), seed);
+}
+
+// Average number of keys per displacement bucket
+inline constexpr std::size_t static_bucket_load = 2;
+
+constexpr std::size_t static_bucket_count(const std::size_t size) {
+  return (size + static_bucket_load - 1) / static_bucket_load;
+}
+
+// Displacements tried for a bucket of several keys before changing the
+// seed. Buckets are placed largest first, so the ones of several keys
+// still find enough free slots within a few hundred tries
+inline constexpr std::size_t static_max_displacement_tries = 4096;
+
+struct static_slots {
+  std::size_t bucket;
+  std::uint64_t f1;
+  std::uint64_t f2;
+};
+
+template <std::size_t N>
+constexpr static_slots split_hash(const std::uint64_t hash) {
+  return {static_cast<std::size_t>((hash >> 32) % static_bucket_count(N)),
+          (hash & 0xFFFFFFFF) % N, static_mix(hash) % N};
+}
+
+struct displacement {
+  std::uint32_t d1 = 0;
+  std::uint32_t d2 = 0;
+};
+
+template <std::size_t N>
+constexpr std::size_t displaced_slot(const static_slots& slots,
+                                     const displacement disp) {
+  return static_cast<std::size_t>((disp.d2 + slots.f1 * disp.d1 + slots.f2) %
+                                  N);
+}
+
+}  // namespace detail
+
+template <typename AllocatorT, std::size_t N>
+class static_dictionary {
+  static constexpr std::size_t bucket_count = detail::static_bucket_count(N);
+
+ public:
+  using key_type = static_key<AllocatorT>;
+  using mapped_type = object<AllocatorT>;
+  using value_type = std::pair<key_type, mapped_type>;
+  using const_iterator = const value_type*;
+
+  constexpr explicit static_dictionary(
+      const std::array<value_type, N>& entries) {
+    if (has_duplicate_keys(entries)) {
+      throw std::invalid_argument("anb::static_dictionary: duplicate key");
+    }
+    // Virtually always found with the first seed, a few more make the
+    // rare unlucky key set work too
+    for (std::uint64_t seed = 0; seed < 64; ++seed) {
+      if (build(entries, seed)) {
+        return;
+      }
+    }
+    throw std::invalid_argument(
+        "anb::static_dictionary: no perfect hash found");
+  }
+
+  constexpr std::size_t size() const { return N; }
+  constexpr bool empty() const { return N == 0; }
+
+  // Entries in slot order
+  constexpr const_iterator begin() const { return entries_.data(); }
+  constexpr const_iterator end() const { return entries_.data() + N; }
+
+  constexpr const mapped_type* find(const std::string_view key) const {
+    if constexpr (N == 0) {
+      return nullptr;
+    } else {
+      const value_type& entry = slot_for(detail::static_hash(key, seed_));
+      return (entry.first.is_string() && entry.first.string() == key)
+                 ? &entry.second
+                 : nullptr;
+    }
+  }
+
+  constexpr const mapped_type* find(const object<AllocatorT>& key) const {
+    std::string sso_storage;
+    if (const auto str = key.string_view_of(sso_storage)) {
+      return find(*str);
+    }
+    if constexpr (N == 0) {
+      return nullptr;
+    } else {
+      const std::uint64_t word = key.nanbox_value();
+      const value_type& entry = slot_for(detail::static_hash(word, seed_));
+      return (!entry.first.is_string() &&
+              entry.first.fixed().nanbox_value() == word)
+                 ? &entry.second
+                 : nullptr;
+    }
+  }
+
+  template <typename KeyT>
+  constexpr bool contains(const KeyT& key) const {
+    return find(key) != nullptr;
+  }
+
+  template <typename KeyT>
+  constexpr const mapped_type& at(const KeyT& key) const {
+    if (const mapped_type* value = find(key)) {
+      return *value;
+    }
+    throw std::out_of_range("anb::static_dictionary::at");
+  }
+
+  // Copy into a regular dictionary object, string keys longer than the SSO
+  // limit become heap strings
+  object<AllocatorT> to_dictionary(AllocatorT& allocator) const {
+    auto dict = object<AllocatorT>::make_dictionary(allocator);
+    auto& object_dict = dict.as_dictionary(allocator).object_dict_;
+    object_dict.reserve(N);
+    for (const auto& [key, value] : entries_) {
+      object<AllocatorT> key_obj = key.fixed();
+      if (key.is_string()) {
+        key_obj.assign(allocator, key.string());
+      }
+      object_dict.insert({key_obj, value});
+    }
+    return dict;
+  }
+
+ private:
+  // Sorts the keys by hash, equal keys end up next to each other
+  static constexpr bool has_duplicate_keys(
+      const std::array<value_type, N>& entries) {
+    std::array<std::pair<std::uint64_t, std::size_t>, N> hashed{};
+    for (std::size_t i = 0; i < N; ++i) {
+      hashed[i] = {detail::static_hash(entries[i].first, 0), i};
+    }
+    std::sort(hashed.begin(), hashed.end());
+    for (std::size_t i = 0; i < N; ++i) {
+      for (std::size_t j = i + 1; j < N && hashed[j].first == hashed[i].first;
+           ++j) {
+        if (entries[hashed[i].second].first ==
+            entries[hashed[j].second].first) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  constexpr const value_type& slot_for(const std::uint64_t hash) const {
+    const detail::static_slots slots = detail::split_hash<N>(hash);
+    return entries_[detail::displaced_slot<N>(slots,
+                                              displacements_[slots.bucket])];
+  }
+
+  constexpr bool build(const std::array<value_type, N>& entries,
+                       const std::uint64_t seed) {
+    if constexpr (N == 0) {
+      return true;
+    }
+    std::array<detail::static_slots, N> slots{};
+    std::array<std::size_t, bucket_count> bucket_sizes{};
+    for (std::size_t i = 0; i < N; ++i) {
+      slots[i] = detail::split_hash<N>(detail::static_hash(entries[i].first,
+                                                           seed));
+      ++bucket_sizes[slots[i].bucket];
+    }
+
+    // Entries grouped by bucket, the largest buckets are placed first
+    // while most slots are still free
+    std::array<std::size_t, N> order{};
+    for (std::size_t i = 0; i < N; ++i) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(),
+              [&](const std::size_t lhs, const std::size_t rhs) {
+                const std::size_t lhs_bucket = slots[lhs].bucket;
+                const std::size_t rhs_bucket = slots[rhs].bucket;
+                if (bucket_sizes[lhs_bucket] != bucket_sizes[rhs_bucket]) {
+                  return bucket_sizes[lhs_bucket] > bucket_sizes[rhs_bucket];
+                }
+                return lhs_bucket < rhs_bucket;
+              });
+
+    constexpr std::size_t unused = N;
+    std::array<std::size_t, N> slot_entry{};
+    slot_entry.fill(unused);
+    // Slots claimed by the displacement being tried, tagged with the try
+    std::array<std::size_t, N> tried{};
+    std::size_t attempt = 0;
+    // Buckets of several keys try a bounded number of displacements, the
+    // seed is changed when one runs out of them
+    constexpr std::size_t max_tries =
+        std::min(N * N, detail::static_max_displacement_tries);
+    std::size_t free_slot = 0;
+
+    std::size_t begin = 0;
+    while (begin < N) {
+      const std::size_t bucket = slots[order[begin]].bucket;
+      const std::size_t end = begin + bucket_sizes[bucket];
+
+      if (end - begin == 1) {
+        // A single key goes straight to the next free slot
+        while (slot_entry[free_slot] != unused) {
+          ++free_slot;
+        }
+        const detail::static_slots& single = slots[order[begin]];
+        displacements_[bucket] = {
+            0, static_cast<std::uint32_t>((free_slot + N - single.f2) % N)};
+        slot_entry[free_slot] = order[begin];
+        begin = end;
+        continue;
+      }
+
+      bool placed = false;
+      for (std::size_t t = 0; t < max_tries && !placed; ++t) {
+        const detail::displacement disp{static_cast<std::uint32_t>(t / N),
+                                        static_cast<std::uint32_t>(t % N)};
+        ++attempt;
+        placed = true;
+        for (std::size_t i = begin; i < end && placed; ++i) {
+          const std::size_t slot =
+              detail::displaced_slot<N>(slots[order[i]], disp);
+          placed = (slot_entry[slot] == unused) && (tried[slot] != attempt);
+          tried[slot] = attempt;
+        }
+        if (placed) {
+          displacements_[bucket] = disp;
+          for (std::size_t i = begin; i < end; ++i) {
+            slot_entry[detail::displaced_slot<N>(slots[order[i]], disp)] =
+                order[i];
+          }
+        }
+      }
+      if (!placed) {
+        return false;
+      }
+      begin = end;
+    }
+
+    for (std::size_t slot = 0; slot < N; ++slot) {
+      entries_[slot] = entries[slot_entry[slot]];
+    }
+    seed_ = seed;
+    return true;
+  }
+
+  std::array<value_type, N> entries_{};
+  std::array<detail::displacement, bucket_count> displacements_{};
+  std::uint64_t seed_ = 0;
+};
+
+template <typename AllocatorT, std::size_t N>
+constexpr static_dictionary<AllocatorT, N> make_static_dictionary(
+    const std::pair<static_key<AllocatorT>, object<AllocatorT>> (&entries)[N]) {
+  std::array<std::pair<static_key<AllocatorT>, object<AllocatorT>>, N> copy{};
+  std::copy(entries, entries + N, copy.begin());
+  return static_dictionary<AllocatorT, N>(copy);
+}
+
+}  // namespace anb
@@ -1,18 +1,183 @@
 #pragma once
 
-#include <string>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include "allocator.hpp"
 #include "heap_object.hpp"
 
 namespace anb {
 
+// Result of a UTF-8 validation cached on a heap string
+enum class utf8_validity : std::uint8_t { unknown, valid, invalid };
+
+//=====================================================================
+// Heap string, a flat buffer that turns into a rope of pieces when other
+// strings are appended to it
+//
+// set() and append(string_view) write to a single flat buffer, which
+// append() grows in place (doubling it when full) while no other string
+// shares it, so building a string is amortized O(1) per appended byte.
+// Appending another heap string shares its buffer instead of copying it,
+// and makes this string a rope of pieces.
+//
+// view() flattens the pieces into a single contiguous buffer the first
+// time it's called after a concatenation, hashing and comparisons go
+// through it and see the same value as a string built with set(). Pieces
+// are immutable once shared, and readers racing on the flattening wait
+// for the first one to finish it.
+//
+// set_slice() makes the string a zero copy slice of another heap string:
+// it shares the other string's buffer and views a range of it. The buffer
+// stays alive as long as any slice references it, and either side copies
+// it before writing to it.
+//
+// The buffers and pieces come from the allocator of the string, see
+// allocator.hpp. Buffers shared across allocators go back to the one they
+// were allocated from.
+//=====================================================================
 template <typename AllocatorT>
 struct string : public heap_object<AllocatorT> {
-  string(AllocatorT& handle) : heap_object<AllocatorT>(handle) {}
+  string(AllocatorT& handle)
+      : heap_object<AllocatorT>(handle), pieces_(handle) {}
+
+  std::string_view view() const {
+    if ((state_.load(std::memory_order_acquire) & rope_bit) != 0) {
+      flatten();
+    }
+    return flat_.view();
+  }
+
+  void set(std::string_view str) {
+    release_pieces();
+    if (flat_.is_unique() && flat_.buffer->capacity >= str.size()) {
+      // Reuses the buffer, str may be a part of it
+      std::memmove(flat_.buffer->data(), str.data(), str.size());
+      flat_.offset = 0;
+      flat_.length = str.size();
+    } else {
+      flat_ = make_piece(str, str.size());
+    }
+    size_ = str.size();
+    state_.store(0, std::memory_order_relaxed);
+  }
+
+  // View of [pos, pos + count) of parent sharing its buffer, count is
+  // clamped to the end of parent like std::string::substr
+  void set_slice(const string& parent, const std::size_t pos,
+                 const std::size_t count = std::string_view::npos) {
+    const std::string_view parent_view = parent.view();
+    if (pos > parent_view.size()) {
+      throw std::out_of_range("anb::string::set_slice");
+    }
+    const std::size_t length = std::min(count, parent_view.size() - pos);
+    // Copied first, parent may be this string
+    piece slice = parent.flat_;
+    slice.offset += pos;
+    slice.length = length;
+    release_pieces();
+    flat_ = std::move(slice);
+    size_ = length;
+    state_.store(0, std::memory_order_relaxed);
+  }
+
+  // UTF-8 validation result kept by is_valid_utf8(), reset by every write
+  utf8_validity cached_utf8_validity() const {
+    return static_cast<utf8_validity>(
+        (state_.load(std::memory_order_relaxed) & utf8_mask) >> utf8_shift);
+  }
+
+  void cache_utf8_validity(const utf8_validity validity) const {
+    std::uint8_t state = state_.load(std::memory_order_relaxed);
+    while (!state_.compare_exchange_weak(
+        state,
+        static_cast<std::uint8_t>(
+            (state & ~utf8_mask) |
+            (static_cast<std::uint8_t>(validity) << utf8_shift)),
+        std::memory_order_relaxed)) {
+    }
+  }
+
+  // True when this string views part of a buffer it shares with others
+  bool is_slice() const {
+    return pieces_.empty() && flat_.buffer != nullptr && !flat_.is_unique();
+  }
+
+  void append(std::string_view str) {
+    if (str.empty()) {
+      return;
+    }
+    // The flat buffer, or the last piece of a rope, grows in place while
+    // no other string shares it
+    piece& last = pieces_.empty() ? flat_ : pieces_.back();
+    if (last.buffer == nullptr || last.is_unique()) {
+      grow(last, str);
+    } else if (size_ == 0) {
+      flat_ = make_piece(str, str.size());
+    } else {
+      if (pieces_.empty()) {
+        pieces_.push_back(std::move(flat_));
+        flat_ = piece{};
+      }
+      pieces_.push_back(make_piece(str, str.size()));
+      mark_rope();
+    }
+    size_ += str.size();
+    clear_utf8();
+  }
 
-  std::string_view view() const { return d_; }
+  // Concatenation, shares the buffer of other without copying it
+  void append(const string& other) {
+    if (other.empty()) {
+      return;
+    }
+    other.view();
+    // Copied first, other may be this string
+    piece shared = other.flat_;
+    if (size_ == 0) {
+      release_pieces();
+      flat_ = std::move(shared);
+    } else {
+      if (pieces_.empty()) {
+        pieces_.push_back(std::move(flat_));
+        flat_ = piece{};
+      }
+      pieces_.push_back(std::move(shared));
+      mark_rope();
+    }
+    size_ += other.size_;
+    clear_utf8();
+  }
 
-  void set(std::string_view str) { d_ = str; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Number of pieces view() would join, a flat string is a single one
+  std::size_t piece_count() const {
+    return pieces_.empty() ? 1 : pieces_.size();
+  }
+
+  // Bytes of the character buffers outside of the object. With seen,
+  // buffers already in it are skipped and the others are added, so
+  // buffers shared between slices and ropes count once
+  std::size_t buffer_bytes(
+      std::unordered_set<const void*>* seen = nullptr) const {
+    std::size_t bytes =
+        pieces_.capacity() * sizeof(piece) + flat_.bytes(seen);
+    for (const auto& p : pieces_) {
+      bytes += p.bytes(seen);
+    }
+    return bytes;
+  }
 
   void reset() { set(""); }
 
@@ -21,7 +186,194 @@ struct string : public heap_object<AllocatorT> {
   heap_object_type type() const override { return heap_object_type::string; }
 
  private:
-  std::string d_;
+  // Reference counted character buffer, allocated in a single block with
+  // its characters following it
+  struct shared_buffer {
+    using block_allocator =
+        detail::container_allocator<shared_buffer, AllocatorT>;
+
+    std::atomic<std::size_t> refs;
+    std::size_t capacity;
+    block_allocator alloc;
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+
+    // Whole blocks, so the header of the next one stays aligned
+    static std::size_t block_count(const std::size_t capacity) {
+      return 1 + (capacity + sizeof(shared_buffer) - 1) / sizeof(shared_buffer);
+    }
+
+    static shared_buffer* make(const block_allocator& alloc,
+                               const std::size_t capacity) {
+      block_allocator block_alloc = alloc;
+      shared_buffer* block = block_alloc.allocate(block_count(capacity));
+      return ::new (block) shared_buffer{{1}, capacity, alloc};
+    }
+
+    void release() {
+      if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        block_allocator block_alloc = alloc;
+        const std::size_t count = block_count(capacity);
+        this->~shared_buffer();
+        block_alloc.deallocate(this, count);
+      }
+    }
+  };
+
+  // A range of a buffer, which slices and concatenations share
+  struct piece {
+    shared_buffer* buffer = nullptr;
+    std::size_t offset = 0;
+    std::size_t length = 0;
+
+    piece() = default;
+    piece(shared_buffer* b, const std::size_t off, const std::size_t len)
+        : buffer(b), offset(off), length(len) {}
+    piece(const piece& other)
+        : buffer(other.buffer), offset(other.offset), length(other.length) {
+      if (buffer != nullptr) {
+        buffer->refs.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    piece(piece&& other) noexcept
+        : buffer(std::exchange(other.buffer, nullptr)),
+          offset(other.offset),
+          length(other.length) {}
+    piece& operator=(piece other) noexcept {
+      std::swap(buffer, other.buffer);
+      offset = other.offset;
+      length = other.length;
+      return *this;
+    }
+    ~piece() {
+      if (buffer != nullptr) {
+        buffer->release();
+      }
+    }
+
+    std::string_view view() const {
+      return (buffer == nullptr)
+                 ? std::string_view{}
+                 : std::string_view(buffer->data() + offset, length);
+    }
+
+    bool is_unique() const {
+      return buffer != nullptr &&
+             buffer->refs.load(std::memory_order_acquire) == 1;
+    }
+
+    std::size_t bytes(std::unordered_set<const void*>* seen) const {
+      if (buffer == nullptr || (seen && !seen->insert(buffer).second)) {
+        return 0;
+      }
+      return sizeof(shared_buffer) *
+             shared_buffer::block_count(buffer->capacity);
+    }
+  };
+
+  // The string is a rope whose pieces view() joins
+  inline static constexpr std::uint8_t rope_bit = 1;
+  // A reader is joining the pieces
+  inline static constexpr std::uint8_t flattening_bit = 2;
+  inline static constexpr std::uint8_t utf8_shift = 2;
+  inline static constexpr std::uint8_t utf8_mask = 3 << utf8_shift;
+
+  piece make_piece(const std::string_view str,
+                   const std::size_t capacity) const {
+    if (capacity == 0) {
+      return piece{};
+    }
+    shared_buffer* b = shared_buffer::make(
+        typename shared_buffer::block_allocator(this->allocator_handle),
+        capacity);
+    if (!str.empty()) {
+      std::memcpy(b->data(), str.data(), str.size());
+    }
+    return piece{b, 0, str.size()};
+  }
+
+  // Appends to a piece no other string shares, doubling its buffer when
+  // it's full. str may be a part of the piece
+  void grow(piece& p, const std::string_view str) {
+    const std::size_t end = p.offset + p.length;
+    if (p.buffer == nullptr || p.buffer->capacity - end < str.size()) {
+      const std::size_t capacity =
+          std::max(p.length + str.size(), 2 * p.length);
+      piece grown = make_piece(p.view(), capacity);
+      // Before the old buffer is released
+      std::memcpy(grown.buffer->data() + grown.length, str.data(),
+                  str.size());
+      grown.length += str.size();
+      p = std::move(grown);
+      return;
+    }
+    std::memcpy(p.buffer->data() + end, str.data(), str.size());
+    p.length += str.size();
+  }
+
+  void mark_rope() {
+    state_.store(rope_bit, std::memory_order_relaxed);
+  }
+
+  void clear_utf8() {
+    state_.store(state_.load(std::memory_order_relaxed) & rope_bit,
+                 std::memory_order_relaxed);
+  }
+
+  void release_pieces() {
+    if (!pieces_.empty()) {
+      decltype(pieces_)(pieces_.get_allocator()).swap(pieces_);
+    }
+  }
+
+  // Joins the pieces into the flat buffer, readers racing on the same
+  // string wait for the first one to finish
+  void flatten() const {
+    std::uint8_t state = state_.load(std::memory_order_acquire);
+    while (true) {
+      if ((state & rope_bit) == 0) {
+        return;
+      }
+      if ((state & flattening_bit) != 0) {
+        state_.wait(state, std::memory_order_acquire);
+        state = state_.load(std::memory_order_acquire);
+      } else if (state_.compare_exchange_weak(
+                     state, static_cast<std::uint8_t>(state | flattening_bit),
+                     std::memory_order_acquire)) {
+        break;
+      }
+    }
+
+    piece flat;
+    try {
+      flat = make_piece({}, size_);
+    } catch (...) {
+      // Still a rope, the next reader tries again
+      state_.fetch_and(static_cast<std::uint8_t>(~flattening_bit),
+                       std::memory_order_release);
+      state_.notify_all();
+      throw;
+    }
+    for (const auto& p : pieces_) {
+      std::memcpy(flat.buffer->data() + flat.length, p.view().data(),
+                  p.length);
+      flat.length += p.length;
+    }
+    flat_ = std::move(flat);
+    decltype(pieces_)(pieces_.get_allocator()).swap(pieces_);
+
+    state_.fetch_and(static_cast<std::uint8_t>(~(rope_bit | flattening_bit)),
+                     std::memory_order_release);
+    state_.notify_all();
+  }
+
+  // Contents of the string, unless it's a rope of pieces_
+  mutable piece flat_;
+  mutable std::vector<piece, detail::container_allocator<piece, AllocatorT>>
+      pieces_;
+  std::size_t size_ = 0;
+  // rope_bit, flattening_bit and the cached utf8_validity
+  mutable std::atomic<std::uint8_t> state_ = 0;
 };
 
 }  // namespace anb
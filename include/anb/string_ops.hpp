@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ANB_STRING_OPS_SSE2 1
+#endif
+
+#include "object.hpp"
+
+namespace anb {
+
+//=====================================================================
+// String kernels for SSO and heap string objects
+//
+//   string_find(allocator, obj, needle, pos)
+//   string_starts_with(allocator, obj, prefix)
+//   string_icompare(allocator, lhs, rhs)   ASCII case insensitive
+//   is_valid_utf8(allocator, obj)
+//
+// SSO strings never get decoded into a std::string, the kernels work on
+// their 48 bit payload directly: the characters are normalized into the
+// low bytes of a word, then matched, case folded and checked for non
+// ASCII bytes with a few word wide bit operations (SWAR).
+//
+// Heap strings are scanned 16 bytes at a time with SSE2 where available
+// and 8 bytes at a time with SWAR otherwise. is_valid_utf8() caches its
+// result on the heap string until the string is modified.
+//=====================================================================
+
+namespace detail {
+
+inline constexpr std::uint64_t swar_ones = 0x0101010101010101ULL;
+inline constexpr std::uint64_t swar_highs = 0x8080808080808080ULL;
+
+constexpr std::uint64_t swar_broadcast(const char c) {
+  return swar_ones * static_cast<unsigned char>(c);
+}
+
+// High bit set in the first zero byte of x (bytes above it may be false
+// positives)
+constexpr std::uint64_t swar_zero_bytes(const std::uint64_t x) {
+  return (x - swar_ones) & ~x & swar_highs;
+}
+
+// Adds 0x20 to every byte in 'A'..'Z', leaves the others untouched
+constexpr std::uint64_t swar_to_lower(const std::uint64_t x) {
+  const std::uint64_t heptets = x & ~swar_highs;
+  const std::uint64_t above_z = heptets + swar_ones * (0x80 - 'Z' - 1);
+  const std::uint64_t from_a = heptets + swar_ones * (0x80 - 'A');
+  const std::uint64_t upper = (from_a ^ above_z) & ~x & swar_highs;
+  return x | (upper >> 2);
+}
+
+constexpr char ascii_to_lower(const char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+// Little endian load of up to 8 bytes, compiles to a single load for 8
+inline std::uint64_t load_word(const char* data, const std::size_t size = 8) {
+  std::uint64_t word = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    word |= std::uint64_t{static_cast<unsigned char>(data[i])} << (i * 8);
+  }
+  return word;
+}
+
+constexpr std::uint64_t low_bytes_mask(const std::size_t count) {
+  return count >= 8 ? ~std::uint64_t{0} : (std::uint64_t{1} << (count * 8)) - 1;
+}
+
+// Characters of a SSO string, character i in byte i of word
+struct sso_chars {
+  std::uint64_t word = 0;
+  std::size_t size = 0;
+
+  constexpr char operator[](const std::size_t i) const {
+    return static_cast<char>((word >> (i * 8)) & 0xFF);
+  }
+};
+
+constexpr sso_chars sso_chars_of(const std::uint64_t nb_val) {
+  const std::uint64_t payload =
+      nb_val & nanbox::fixed_type_sso_string_data_mask;
+  if ((nb_val & nanbox::signature_mask) ==
+      nanbox::fixed_type_packed_string_value) {
+    return {payload, 6};
+  }
+  // Non packed strings end at byte 4, their length is in byte 5
+  const std::size_t size = (payload >> 40) & 0xFF;
+  return {(payload & low_bytes_mask(5)) >> ((5 - size) * 8), size};
+}
+
+//=====================================================================
+// find
+
+inline std::size_t find_sso(const sso_chars chars,
+                            const std::string_view needle,
+                            const std::size_t pos) {
+  if (pos > chars.size || needle.size() > chars.size - pos) {
+    return std::string_view::npos;
+  }
+  const std::uint64_t mask = low_bytes_mask(needle.size());
+  const std::uint64_t needle_word = load_word(needle.data(), needle.size());
+  for (std::size_t i = pos; i + needle.size() <= chars.size; ++i) {
+    if (((chars.word >> (i * 8)) & mask) == needle_word) {
+      return i;
+    }
+  }
+  return std::string_view::npos;
+}
+
+// Candidates are blocks where both the first and the last byte of the
+// needle match, only those are compared in full
+inline std::size_t find_view(const std::string_view str,
+                             const std::string_view needle,
+                             const std::size_t pos) {
+  if (pos > str.size() || needle.size() > str.size() - pos) {
+    return std::string_view::npos;
+  }
+  if (needle.empty()) {
+    return pos;
+  }
+  const char* data = str.data();
+  const std::size_t last = needle.size() - 1;
+  const std::size_t end = str.size() - last;  // One past the last start
+  const auto matches_at = [&](const std::size_t i) {
+    return std::memcmp(data + i, needle.data(), needle.size()) == 0;
+  };
+
+  std::size_t i = pos;
+#ifdef ANB_STRING_OPS_SSE2
+  const __m128i first_16 = _mm_set1_epi8(needle.front());
+  const __m128i last_16 = _mm_set1_epi8(needle.back());
+  for (; i + 16 <= end; i += 16) {
+    const __m128i block_first =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    const __m128i block_last =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + last));
+    auto candidates = static_cast<std::uint32_t>(
+        _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first_16),
+                                        _mm_cmpeq_epi8(block_last, last_16))));
+    while (candidates != 0) {
+      const std::size_t candidate = i + std::countr_zero(candidates);
+      if (matches_at(candidate)) {
+        return candidate;
+      }
+      candidates &= candidates - 1;
+    }
+  }
+#endif
+  const std::uint64_t first_8 = swar_broadcast(needle.front());
+  const std::uint64_t last_8 = swar_broadcast(needle.back());
+  for (; i + 8 <= end; i += 8) {
+    std::uint64_t candidates =
+        swar_zero_bytes(load_word(data + i) ^ first_8) &
+        swar_zero_bytes(load_word(data + i + last) ^ last_8);
+    while (candidates != 0) {
+      const std::size_t candidate = i + std::countr_zero(candidates) / 8;
+      if (matches_at(candidate)) {
+        return candidate;
+      }
+      candidates &= candidates - 1;
+    }
+  }
+  for (; i < end; ++i) {
+    if (data[i] == needle.front() && matches_at(i)) {
+      return i;
+    }
+  }
+  return std::string_view::npos;
+}
+
+//=====================================================================
+// Case insensitive compare
+
+inline std::strong_ordering icompare_sso(const sso_chars lhs,
+                                         const sso_chars rhs) {
+  // The first differing folded byte decides, the zero padding past the
+  // shorter string makes prefixes compare first
+  const std::uint64_t lhs_folded = swar_to_lower(lhs.word);
+  const std::uint64_t rhs_folded = swar_to_lower(rhs.word);
+  if (lhs_folded != rhs_folded) {
+    const int shift = std::countr_zero(lhs_folded ^ rhs_folded) & ~7;
+    return ((lhs_folded >> shift) & 0xFF) <=> ((rhs_folded >> shift) & 0xFF);
+  }
+  return lhs.size <=> rhs.size;
+}
+
+inline std::strong_ordering icompare_view(const std::string_view lhs,
+                                          const std::string_view rhs) {
+  const std::size_t common = std::min(lhs.size(), rhs.size());
+  std::size_t i = 0;
+  for (; i + 8 <= common; i += 8) {
+    const std::uint64_t lhs_folded = swar_to_lower(load_word(lhs.data() + i));
+    const std::uint64_t rhs_folded = swar_to_lower(load_word(rhs.data() + i));
+    if (lhs_folded != rhs_folded) {
+      const int shift = std::countr_zero(lhs_folded ^ rhs_folded) & ~7;
+      return ((lhs_folded >> shift) & 0xFF) <=> ((rhs_folded >> shift) & 0xFF);
+    }
+  }
+  for (; i < common; ++i) {
+    const auto lhs_c = static_cast<unsigned char>(ascii_to_lower(lhs[i]));
+    const auto rhs_c = static_cast<unsigned char>(ascii_to_lower(rhs[i]));
+    if (lhs_c != rhs_c) {
+      return lhs_c <=> rhs_c;
+    }
+  }
+  return lhs.size() <=> rhs.size();
+}
+
+// A SSO string against a string of any size. The SSO string fits in a
+// word, so the first word of the other one decides
+inline std::strong_ordering icompare_sso_view(const sso_chars lhs,
+                                              const std::string_view rhs) {
+  return icompare_sso(
+      lhs, {load_word(rhs.data(), std::min<std::size_t>(rhs.size(), 8)),
+            rhs.size()});
+}
+
+//=====================================================================
+// UTF-8 validation
+
+// Length of the well formed sequence starting at data[i] (rejecting
+// overlong encodings, surrogates and code points above U+10FFFF), 0 if
+// there is none
+inline std::size_t utf8_sequence_length(const unsigned char* data,
+                                        const std::size_t size,
+                                        const std::size_t i) {
+  const unsigned char lead = data[i];
+  std::size_t length = 0;
+  unsigned char second_min = 0x80;
+  unsigned char second_max = 0xBF;
+  if (lead < 0x80) {
+    return 1;
+  } else if (lead >= 0xC2 && lead <= 0xDF) {
+    length = 2;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    length = 3;
+    second_min = (lead == 0xE0) ? 0xA0 : 0x80;
+    second_max = (lead == 0xED) ? 0x9F : 0xBF;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    length = 4;
+    second_min = (lead == 0xF0) ? 0x90 : 0x80;
+    second_max = (lead == 0xF4) ? 0x8F : 0xBF;
+  } else {
+    return 0;
+  }
+  if (length > size - i || data[i + 1] < second_min ||
+      data[i + 1] > second_max) {
+    return 0;
+  }
+  for (std::size_t j = 2; j < length; ++j) {
+    if ((data[i + j] & 0xC0) != 0x80) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+inline bool is_valid_utf8_view(const std::string_view str) {
+  const auto* data = reinterpret_cast<const unsigned char*>(str.data());
+  const std::size_t size = str.size();
+  std::size_t i = 0;
+  while (i < size) {
+    // Skips ASCII runs a block at a time
+#ifdef ANB_STRING_OPS_SSE2
+    while (i + 16 <= size &&
+           _mm_movemask_epi8(_mm_loadu_si128(
+               reinterpret_cast<const __m128i*>(data + i))) == 0) {
+      i += 16;
+    }
+#endif
+    while (i + 8 <= size && (load_word(str.data() + i) & swar_highs) == 0) {
+      i += 8;
+    }
+    if (i == size) {
+      break;
+    }
+    const std::size_t length = utf8_sequence_length(data, size, i);
+    if (length == 0) {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+inline bool is_valid_utf8_sso(const sso_chars chars) {
+  if ((chars.word & swar_highs) == 0) {
+    return true;
+  }
+  // At most 6 bytes, checked sequence by sequence without the wide loops
+  std::array<unsigned char, 8> bytes{};
+  for (std::size_t i = 0; i < chars.size; ++i) {
+    bytes[i] = static_cast<unsigned char>(chars[i]);
+  }
+  for (std::size_t i = 0; i < chars.size;) {
+    const std::size_t length =
+        utf8_sequence_length(bytes.data(), chars.size, i);
+    if (length == 0) {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+}  // namespace detail
+
+template <typename AllocatorT>
+std::size_t string_find(const AllocatorT& allocator,
+                        const object<AllocatorT>& obj,
+                        const std::string_view needle,
+                        const std::size_t pos = 0) {
+  if (obj.is_sso_string()) {
+    return detail::find_sso(detail::sso_chars_of(obj.nanbox_value()), needle,
+                            pos);
+  }
+  ANB_ASSERT(obj.is_heap_string(allocator),
+             "Underlying object is not a string");
+  return detail::find_view(obj.as_string_heap(allocator).view(), needle, pos);
+}
+
+template <typename AllocatorT>
+bool string_starts_with(const AllocatorT& allocator,
+                        const object<AllocatorT>& obj,
+                        const std::string_view prefix) {
+  if (obj.is_sso_string()) {
+    const detail::sso_chars chars = detail::sso_chars_of(obj.nanbox_value());
+    return (prefix.size() <= chars.size) &&
+           ((chars.word & detail::low_bytes_mask(prefix.size())) ==
+            detail::load_word(prefix.data(), prefix.size()));
+  }
+  ANB_ASSERT(obj.is_heap_string(allocator),
+             "Underlying object is not a string");
+  return obj.as_string_heap(allocator).view().starts_with(prefix);
+}
+
+// ASCII case insensitive three way comparison, bytes outside of 'A'..'Z'
+// compare as unsigned values
+template <typename AllocatorT>
+std::strong_ordering string_icompare(const AllocatorT& allocator,
+                                     const object<AllocatorT>& lhs,
+                                     const object<AllocatorT>& rhs) {
+  if (lhs.is_sso_string() && rhs.is_sso_string()) {
+    return detail::icompare_sso(detail::sso_chars_of(lhs.nanbox_value()),
+                                detail::sso_chars_of(rhs.nanbox_value()));
+  }
+  if (lhs.is_sso_string()) {
+    ANB_ASSERT(rhs.is_heap_string(allocator),
+               "Underlying object is not a string");
+    return detail::icompare_sso_view(detail::sso_chars_of(lhs.nanbox_value()),
+                                     rhs.as_string_heap(allocator).view());
+  }
+  ANB_ASSERT(lhs.is_heap_string(allocator),
+             "Underlying object is not a string");
+  if (rhs.is_sso_string()) {
+    return 0 <=> detail::icompare_sso_view(
+                     detail::sso_chars_of(rhs.nanbox_value()),
+                     lhs.as_string_heap(allocator).view());
+  }
+  ANB_ASSERT(rhs.is_heap_string(allocator),
+             "Underlying object is not a string");
+  return detail::icompare_view(lhs.as_string_heap(allocator).view(),
+                               rhs.as_string_heap(allocator).view());
+}
+
+template <typename AllocatorT>
+bool is_valid_utf8(const AllocatorT& allocator,
+                   const object<AllocatorT>& obj) {
+  if (obj.is_sso_string()) {
+    return detail::is_valid_utf8_sso(detail::sso_chars_of(obj.nanbox_value()));
+  }
+  ANB_ASSERT(obj.is_heap_string(allocator),
+             "Underlying object is not a string");
+  const string<AllocatorT>& str = obj.as_string_heap(allocator);
+  const utf8_validity cached = str.cached_utf8_validity();
+  if (cached != utf8_validity::unknown) {
+    return cached == utf8_validity::valid;
+  }
+  const bool valid = detail::is_valid_utf8_view(str.view());
+  str.cache_utf8_validity(valid ? utf8_validity::valid
+                                : utf8_validity::invalid);
+  return valid;
+}
+
+}  // namespace anb
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace anb {
+
+//=====================================================================
+// Work-stealing fork/join pool
+//
+// Every worker owns a deque: forked tasks are pushed to and popped from
+// the back of the owner's deque (LIFO keeps the working set hot), while
+// idle workers steal from the front of other deques (FIFO hands out the
+// oldest, and usually largest, pieces of work first).
+//
+// Threads waiting on a task_group keep executing queued tasks instead of
+// blocking, so arbitrarily nested fork/join never deadlocks.
+//=====================================================================
+class task_pool {
+ public:
+  class task_group;
+
+  explicit task_pool(
+      const std::size_t thread_count = std::thread::hardware_concurrency())
+      : queues_(std::max<std::size_t>(thread_count, 1) + 1) {
+    for (auto& queue : queues_) {
+      queue = std::make_unique<task_queue>();
+    }
+    // Workers own queues [1, N], queue 0 receives tasks forked by threads
+    // that are not part of the pool
+    for (std::size_t i = 1; i < queues_.size(); ++i) {
+      workers_.emplace_back([this, i]() { worker_loop(i); });
+    }
+  }
+
+  ~task_pool() {
+    {
+      std::lock_guard lock(sleep_mutex_);
+      stopping_ = true;
+    }
+    sleep_cv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  task_pool(const task_pool&) = delete;
+  task_pool& operator=(const task_pool&) = delete;
+
+  std::size_t thread_count() const { return workers_.size(); }
+
+ private:
+  using task = std::function<void()>;
+
+  struct task_queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+  };
+
+  struct worker_identity {
+    const task_pool* pool = nullptr;
+    std::size_t queue_index = 0;
+  };
+
+  static worker_identity& current_worker() {
+    thread_local worker_identity identity;
+    return identity;
+  }
+
+  std::size_t local_queue_index() const {
+    const worker_identity& identity = current_worker();
+    return (identity.pool == this) ? identity.queue_index : 0;
+  }
+
+  void push(task t) {
+    task_queue& queue = *queues_[local_queue_index()];
+    {
+      // Counted under the queue lock, before a thief can pop and
+      // uncount it
+      std::lock_guard lock(queue.mutex);
+      queue.tasks.push_back(std::move(t));
+      queued_.fetch_add(1, std::memory_order_release);
+    }
+    {
+      // Serialize with sleeping workers so the wakeup can't be missed
+      // between their predicate check and the wait
+      std::lock_guard lock(sleep_mutex_);
+    }
+    sleep_cv_.notify_one();
+  }
+
+  std::optional<task> try_pop(const std::size_t index, const bool owner) {
+    task_queue& queue = *queues_[index];
+    std::lock_guard lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      return std::nullopt;
+    }
+    task t;
+    if (owner) {
+      t = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      t = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    return t;
+  }
+
+  std::optional<task> try_take() {
+    if (queued_.load(std::memory_order_acquire) == 0) {
+      return std::nullopt;
+    }
+    const std::size_t home = local_queue_index();
+    if (auto t = try_pop(home, true)) {
+      return t;
+    }
+    for (std::size_t i = 1; i <= queues_.size(); ++i) {
+      const std::size_t victim = (home + i) % queues_.size();
+      if (auto t = try_pop(victim, false)) {
+        return t;
+      }
+    }
+    return std::nullopt;
+  }
+
+  void worker_loop(const std::size_t index) {
+    current_worker() = worker_identity{this, index};
+    while (true) {
+      if (auto t = try_take()) {
+        (*t)();
+        continue;
+      }
+      std::unique_lock lock(sleep_mutex_);
+      sleep_cv_.wait(lock, [this]() {
+        return stopping_ || queued_.load(std::memory_order_acquire) > 0;
+      });
+      if (stopping_) {
+        return;
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<task_queue>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<std::size_t> queued_ = 0;
+
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cv_;
+  bool stopping_ = false;
+};
+
+//=====================================================================
+// A set of forked tasks that can be joined together. The first exception
+// thrown by any task is rethrown from wait().
+class task_pool::task_group {
+ public:
+  explicit task_group(task_pool& pool) : pool_(pool) {}
+
+  ~task_group() { join(); }
+
+  task_group(const task_group&) = delete;
+  task_group& operator=(const task_group&) = delete;
+
+  template <typename FuncT>
+  void run(FuncT&& func) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    pool_.push([this, f = std::forward<FuncT>(func)]() mutable {
+      try {
+        f();
+      } catch (...) {
+        std::lock_guard lock(error_mutex_);
+        if (!error_) {
+          error_ = std::current_exception();
+        }
+      }
+      pending_.fetch_sub(1, std::memory_order_acq_rel);
+    });
+  }
+
+  void wait() {
+    join();
+    if (error_) {
+      std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+  }
+
+ private:
+  void join() {
+    while (pending_.load(std::memory_order_acquire) != 0) {
+      if (auto t = pool_.try_take()) {
+        (*t)();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  task_pool& pool_;
+  std::atomic<std::size_t> pending_ = 0;
+  std::mutex error_mutex_;
+  std::exception_ptr error_;
+};
+
+}  // namespace anb
@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "heap_object.hpp"
+
+namespace anb {
+
+namespace detail {
+
+// Small blocks are 16 byte steps up to 256 bytes, then powers of two up
+// to 4 KiB. Anything larger or more aligned goes to the global heap.
+inline constexpr std::size_t small_block_limit = 4096;
+inline constexpr std::size_t small_block_alignment = 16;
+inline constexpr std::size_t size_class_count = 20;
+
+constexpr std::size_t size_class_of(const std::size_t bytes) {
+  if (bytes <= 256) {
+    return (bytes > 0) ? (bytes - 1) / 16 : 0;
+  }
+  return 16 + std::bit_width(bytes - 1) - 9;
+}
+
+constexpr std::size_t size_class_bytes(const std::size_t size_class) {
+  return (size_class < 16) ? (size_class + 1) * 16
+                           : std::size_t{256} << (size_class - 15);
+}
+
+constexpr bool is_small_block(const std::size_t bytes,
+                              const std::size_t alignment) {
+  return bytes <= small_block_limit && alignment <= small_block_alignment;
+}
+
+struct free_block {
+  free_block* next;
+};
+
+class thread_heap;
+
+// Spans are aligned to their size, so the header of the span a block was
+// carved from is found by masking the block address
+inline constexpr std::size_t span_bytes = std::size_t{1} << 16;
+inline constexpr std::size_t span_header_bytes = 64;
+
+struct span_header {
+  thread_heap* owner;
+  std::size_t size_class;
+};
+
+inline span_header* span_of(const void* block) {
+  const auto address = reinterpret_cast<std::uintptr_t>(block);
+  return reinterpret_cast<span_header*>(address & ~(span_bytes - 1));
+}
+
+// Blocks of one allocator owned by one thread at a time. Only the owner
+// touches the local free lists, other threads hand blocks back through
+// the per size class remote queues, lock-free stacks the owner takes
+// whole once its local list of that class runs dry.
+class thread_heap {
+ public:
+  thread_heap() = default;
+  thread_heap(const thread_heap&) = delete;
+  thread_heap& operator=(const thread_heap&) = delete;
+
+  ~thread_heap() { release_spans(); }
+
+  void* allocate(const std::size_t size_class) {
+    size_class_cache& cache = classes_[size_class];
+    if (cache.free == nullptr) {
+      cache.free =
+          remote_[size_class].head.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (cache.free != nullptr) {
+      free_block* block = cache.free;
+      cache.free = block->next;
+      return block;
+    }
+    if (cache.bump == cache.end) {
+      refill(size_class);
+    }
+    void* block = cache.bump;
+    cache.bump += size_class_bytes(size_class);
+    return block;
+  }
+
+  void free_local(const std::size_t size_class, void* ptr) {
+    auto* block = static_cast<free_block*>(ptr);
+    block->next = classes_[size_class].free;
+    classes_[size_class].free = block;
+  }
+
+  void free_remote(const std::size_t size_class, void* ptr) {
+    auto* block = static_cast<free_block*>(ptr);
+    std::atomic<free_block*>& head = remote_[size_class].head;
+    block->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(block->next, block,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+
+  bool try_attach() {
+    bool expected = false;
+    return attached_.compare_exchange_strong(expected, true,
+                                             std::memory_order_acquire);
+  }
+
+  void detach() { attached_.store(false, std::memory_order_release); }
+
+  // The allocator is gone, every block went with it
+  void orphan() {
+    release_spans();
+    orphaned_.store(true, std::memory_order_release);
+  }
+
+  bool orphaned() const { return orphaned_.load(std::memory_order_acquire); }
+
+ private:
+  struct size_class_cache {
+    free_block* free = nullptr;
+    unsigned char* bump = nullptr;
+    unsigned char* end = nullptr;
+  };
+
+  // Each queue on its own cache line, frees of different size classes
+  // from different threads don't contend
+  struct alignas(64) remote_queue {
+    std::atomic<free_block*> head = nullptr;
+  };
+
+  void refill(const std::size_t size_class) {
+    void* span = ::operator new(span_bytes, std::align_val_t{span_bytes});
+    spans_.push_back(span);
+    ::new (span) span_header{this, size_class};
+
+    const std::size_t block_bytes = size_class_bytes(size_class);
+    auto* first = static_cast<unsigned char*>(span) + span_header_bytes;
+    size_class_cache& cache = classes_[size_class];
+    cache.bump = first;
+    cache.end =
+        first + (span_bytes - span_header_bytes) / block_bytes * block_bytes;
+  }
+
+  void release_spans() {
+    for (void* span : spans_) {
+      ::operator delete(span, std::align_val_t{span_bytes});
+    }
+    spans_.clear();
+    classes_ = {};
+    for (remote_queue& queue : remote_) {
+      queue.head.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  std::array<size_class_cache, size_class_count> classes_{};
+  std::array<remote_queue, size_class_count> remote_{};
+  std::vector<void*> spans_;
+  std::atomic<bool> attached_ = false;
+  std::atomic<bool> orphaned_ = false;
+};
+
+// The heaps the calling thread holds, one per allocator it used. Handed
+// back to their allocators when the thread exits, for the next new thread
+// to adopt.
+class thread_heap_bindings {
+ public:
+  thread_heap_bindings() = default;
+  thread_heap_bindings(const thread_heap_bindings&) = delete;
+  thread_heap_bindings& operator=(const thread_heap_bindings&) = delete;
+
+  ~thread_heap_bindings() {
+    for (const binding& bound : bindings_) {
+      bound.heap->detach();
+    }
+  }
+
+  thread_heap* find(const std::uint64_t allocator_id) {
+    if (last_id_ == allocator_id) {
+      return last_heap_;
+    }
+    std::erase_if(bindings_,
+                  [](const binding& bound) { return bound.heap->orphaned(); });
+    for (const binding& bound : bindings_) {
+      if (bound.allocator_id == allocator_id) {
+        last_id_ = allocator_id;
+        last_heap_ = bound.heap.get();
+        return last_heap_;
+      }
+    }
+    return nullptr;
+  }
+
+  void bind(const std::uint64_t allocator_id,
+            std::shared_ptr<thread_heap> heap) {
+    last_id_ = allocator_id;
+    last_heap_ = heap.get();
+    bindings_.push_back({allocator_id, std::move(heap)});
+  }
+
+ private:
+  struct binding {
+    std::uint64_t allocator_id;
+    std::shared_ptr<thread_heap> heap;
+  };
+
+  // Allocator ids start at 1
+  std::uint64_t last_id_ = 0;
+  thread_heap* last_heap_ = nullptr;
+  std::vector<binding> bindings_;
+};
+
+inline thread_heap_bindings& local_heap_bindings() {
+  thread_local thread_heap_bindings bindings;
+  return bindings;
+}
+
+}  // namespace detail
+
+//=====================================================================
+// Allocator for object graphs built on one thread and freed on another
+//
+//   anb::thread_caching_allocator allocator;
+//   auto list = anb::object<anb::thread_caching_allocator>::make_list(
+//       allocator);
+//
+// Every thread allocates from its own heap of size classed blocks, carved
+// from 64 KiB spans, with no locking. A block freed by the thread that
+// allocated it goes straight back to that thread's free list, a block
+// freed by any other thread is pushed onto a lock-free queue of its
+// owning heap, which the owner takes as one batch when its local free
+// list runs out. The mutex is only taken the first time a thread uses the
+// allocator.
+//
+// The heap of an exited thread is adopted by the next thread that starts
+// using the allocator, blocks freed in the meantime are waiting in its
+// queues. Memory is only returned to the system when the allocator is
+// destroyed, which has to outlive the objects and can't race with other
+// threads using it.
+//=====================================================================
+class thread_caching_allocator {
+ public:
+  thread_caching_allocator() : id_(next_id()) {}
+
+  ~thread_caching_allocator() {
+    for (const auto& heap : heaps_) {
+      heap->orphan();
+    }
+  }
+
+  thread_caching_allocator(const thread_caching_allocator&) = delete;
+  thread_caching_allocator& operator=(const thread_caching_allocator&) =
+      delete;
+
+  template <template <class> typename HeapObjT>
+  HeapObjT<thread_caching_allocator>* alloc() {
+    using heap_t = HeapObjT<thread_caching_allocator>;
+    static_assert(detail::is_small_block(sizeof(heap_t), alignof(heap_t)));
+    void* block =
+        local_heap().allocate(detail::size_class_of(sizeof(heap_t)));
+    return ::new (block) heap_t(*this);
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<thread_caching_allocator>* obj_ptr) {
+    std::destroy_at(obj_ptr);
+    release(obj_ptr);
+  }
+
+  void* allocate(const std::size_t bytes, const std::size_t alignment) {
+    if (!detail::is_small_block(bytes, alignment)) {
+      return ::operator new(bytes, std::align_val_t{alignment});
+    }
+    return local_heap().allocate(detail::size_class_of(bytes));
+  }
+
+  void deallocate(void* ptr, const std::size_t bytes,
+                  const std::size_t alignment) {
+    if (!detail::is_small_block(bytes, alignment)) {
+      ::operator delete(ptr, std::align_val_t{alignment});
+      return;
+    }
+    release(ptr);
+  }
+
+  // Threads that allocated so far, minus the heaps adopted from exited
+  // threads
+  std::size_t heap_count() const {
+    std::lock_guard lock(mutex_);
+    return heaps_.size();
+  }
+
+ private:
+  static std::uint64_t next_id() {
+    static std::atomic<std::uint64_t> last_id = 0;
+    return last_id.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  detail::thread_heap& local_heap() {
+    detail::thread_heap_bindings& bindings = detail::local_heap_bindings();
+    if (detail::thread_heap* heap = bindings.find(id_)) {
+      return *heap;
+    }
+    return attach(bindings);
+  }
+
+  detail::thread_heap& attach(detail::thread_heap_bindings& bindings) {
+    std::lock_guard lock(mutex_);
+    auto adopted = std::find_if(heaps_.begin(), heaps_.end(),
+                                [](const auto& heap) {
+                                  return heap->try_attach();
+                                });
+    if (adopted == heaps_.end()) {
+      heaps_.push_back(std::make_shared<detail::thread_heap>());
+      heaps_.back()->try_attach();
+      adopted = std::prev(heaps_.end());
+    }
+    bindings.bind(id_, *adopted);
+    return **adopted;
+  }
+
+  // Threads that never allocated have no heap, all their frees are remote
+  void release(void* block) {
+    const detail::span_header* span = detail::span_of(block);
+    if (span->owner == detail::local_heap_bindings().find(id_)) {
+      span->owner->free_local(span->size_class, block);
+    } else {
+      span->owner->free_remote(span->size_class, block);
+    }
+  }
+
+  const std::uint64_t id_;
+  mutable std::mutex mutex_;
+  std::vector<std::shared_ptr<detail::thread_heap>> heaps_;
+};
+
+}  // namespace anb
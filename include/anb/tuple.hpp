@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+#include <stdexcept>
+
+#include "allocator.hpp"
+#include "heap_object.hpp"
+#include "detail/hash.hpp"
+#include "detail/polyfill.hpp"
+#include "detail/util.hpp"
+
+namespace anb {
+
+template <typename AllocatorT>
+class object;
+
+//=====================================================================
+// Immutable fixed size sequence, allocated as a single block
+//
+// [heap_object header|size|hash][object 0][object 1]...[object N-1]
+//
+// The elements are stored right after the header. Nested heap objects are
+// referenced, not copied, and can still change. A tuple whose elements
+// are all fixed values, or tuples like it, computes its hash once when
+// it's created (keeps_hash()), the others are hashed through their
+// elements as they are now, like lists.
+//
+// Tuples are variable sized, so they are carved out of raw memory from
+// the allocator's `allocate(bytes, alignment)` and returned through its
+// `deallocate(ptr, bytes, alignment)`.
+//=====================================================================
+template <typename AllocatorT>
+struct tuple : public heap_object<AllocatorT> {
+  using value_type = anb::object<AllocatorT>;
+
+  static tuple* create(AllocatorT& allocator,
+                       const std::span<const value_type> elements)
+    requires detail::raw_allocator<AllocatorT>
+  {
+    void* block = allocator.allocate(block_size(elements.size()),
+                                     alignof(tuple));
+    return ::new (block) tuple(allocator, elements);
+  }
+
+  static void destroy(AllocatorT& allocator, tuple* tuple_ptr) {
+    if constexpr (detail::raw_allocator<AllocatorT>) {
+      const std::size_t bytes = block_size(tuple_ptr->size_);
+      tuple_ptr->~tuple();
+      allocator.deallocate(tuple_ptr, bytes, alignof(tuple));
+    } else {
+      // Tuples can't be created without raw allocation
+      detail::unreachable();
+    }
+  }
+
+  ~tuple() override { std::destroy(begin(), end()); }
+
+  tuple(const tuple&) = delete;
+  tuple& operator=(const tuple&) = delete;
+
+  std::span<const value_type> elements() const { return {begin(), size_}; }
+
+  const value_type* begin() const { return data(); }
+  const value_type* end() const { return data() + size_; }
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const value_type& operator[](const std::size_t i) const { return data()[i]; }
+
+  const value_type& at(const std::size_t i) const {
+    if (i >= size_) {
+      throw std::out_of_range("anb::tuple::at");
+    }
+    return data()[i];
+  }
+
+  // True when no element can change, so the hash computed at creation
+  // stays valid
+  bool keeps_hash() const { return keeps_hash_; }
+
+  // Hash computed at creation, only meaningful when keeps_hash()
+  std::size_t hash() const { return hash_; }
+
+  heap_object_type type() const override { return heap_object_type::tuple; }
+
+  // Bytes of the single block holding a tuple of `size` elements
+  static std::size_t block_size(const std::size_t size) {
+    return elements_offset() + size * sizeof(value_type);
+  }
+
+ private:
+  tuple(AllocatorT& handle, const std::span<const value_type> elements)
+      : heap_object<AllocatorT>(handle), size_(elements.size()) {
+    std::uninitialized_copy(elements.begin(), elements.end(), data());
+
+    keeps_hash_ = std::all_of(
+        elements.begin(), elements.end(), [&handle](const value_type& obj) {
+          return keeps_hash_of(handle, obj);
+        });
+    if (keeps_hash_) {
+      // Seeded apart from lists holding the same elements
+      detail::sequence_hash hash;
+      for (const auto& obj : elements) {
+        hash.add(obj.hash());
+      }
+      hash_ = hash.finish(~size_);
+    }
+  }
+
+  // Every heap object but a tuple keeping its hash can change
+  static bool keeps_hash_of(const AllocatorT& allocator,
+                            const value_type& obj) {
+    if (obj.is_tuple(allocator)) {
+      return obj.as_tuple(allocator).keeps_hash();
+    }
+    return !obj.is_heap_string(allocator) && !obj.is_list(allocator) &&
+           !obj.is_dictionary(allocator) &&
+           !obj.is_persistent_dictionary(allocator) &&
+           !obj.is_persistent_list(allocator);
+  }
+
+  static constexpr std::size_t elements_offset() {
+    return (sizeof(tuple) + alignof(value_type) - 1) &
+           ~(alignof(value_type) - 1);
+  }
+
+  value_type* data() const {
+    auto* self = const_cast<unsigned char*>(
+        reinterpret_cast<const unsigned char*>(this));
+    return reinterpret_cast<value_type*>(self + elements_offset());
+  }
+
+  std::size_t size_;
+  std::size_t hash_ = 0;
+  bool keeps_hash_ = true;
+};
+
+}  // namespace anb
@@ -2,6 +2,8 @@
 
 #include <algorithm>
 #include <anb/heap_object.hpp>
+#include <cstddef>
+#include <new>
 #include <vector>
 
 class mock_allocator {
@@ -20,6 +22,16 @@ class mock_allocator {
     delete obj_ptr;
   }
 
+  void* allocate(std::size_t bytes, std::size_t alignment) {
+    allocated_bytes_ += bytes;
+    return ::operator new(bytes, std::align_val_t{alignment});
+  }
+
+  void deallocate(void* ptr, std::size_t bytes, std::size_t alignment) {
+    allocated_bytes_ -= bytes;
+    ::operator delete(ptr, std::align_val_t{alignment});
+  }
+
   void pop() {
     if (auto obj_ptr = static_cast<anb::heap_object<mock_allocator>*>(
             allocated_objects_.back())) {
@@ -28,6 +40,7 @@ class mock_allocator {
   }
 
   std::vector<void*> allocated_objects_;
+  std::size_t allocated_bytes_ = 0;
 };
 using ma = mock_allocator;
 
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include <anb/arithmetic.hpp>
+#include <limits>
+#include <stdexcept>
+
+#include "test_allocator.hpp"
+
+TEST(anb, object_arithmetic) {
+  using obj = anb::object<ma>;
+  const obj two(std::int32_t{2});
+  const obj three(std::int32_t{3});
+  const obj half(0.5);
+  const obj int_max(std::numeric_limits<std::int32_t>::max());
+  const obj int_min(std::numeric_limits<std::int32_t>::min());
+
+  EXPECT_EQ(5, (two + three).as_int32());
+  EXPECT_EQ(-1, (two - three).as_int32());
+  EXPECT_EQ(6, (two * three).as_int32());
+  EXPECT_EQ(2.5, (two + half).as_float64());
+  EXPECT_EQ(0.25, anb::mul(half, half).as_float64());
+
+  // Promoted to float64 instead of wrapping around
+  const auto overflow = int_max + two;
+  EXPECT_TRUE(overflow.is_float64());
+  EXPECT_EQ(2147483649.0, overflow.as_float64());
+  EXPECT_EQ(-4294967296.0, (int_min * two).as_float64());
+  EXPECT_EQ(-2147483648.0 * -2147483648.0, (int_min * int_min).as_float64());
+
+  // Division is always float64
+  EXPECT_EQ(1.5, (three / two).as_float64());
+  EXPECT_TRUE((three / three).is_float64());
+  EXPECT_EQ(std::numeric_limits<double>::infinity(),
+            (three / obj(std::int32_t{0})).as_float64());
+
+  // NaNs and non numeric operands are the canonical qnan
+  const obj inf(std::numeric_limits<double>::infinity());
+  EXPECT_TRUE((inf - inf).is_qnan());
+  EXPECT_TRUE((obj(0.0) / obj(0.0)).is_qnan());
+  EXPECT_TRUE((two + obj(true)).is_qnan());
+  EXPECT_TRUE((obj::make_nothing() * half).is_qnan());
+
+  EXPECT_EQ(std::partial_ordering::equivalent,
+            anb::compare_numbers(obj(std::int32_t{1}), obj(1.0)));
+  EXPECT_EQ(std::partial_ordering::less, anb::compare_numbers(half, two));
+  EXPECT_EQ(std::partial_ordering::greater,
+            anb::compare_numbers(int_max, int_min));
+  EXPECT_EQ(std::partial_ordering::unordered,
+            anb::compare_numbers(two, obj::make_qnan()));
+  EXPECT_EQ(std::partial_ordering::unordered,
+            anb::compare_numbers(two, obj(std::string_view{"2"})));
+}
+
+TEST(anb, list_arithmetic_kernels) {
+  using obj = anb::object<ma>;
+
+  auto ints = obj::make_list(allocator);
+  anb::list<ma>& il = ints.as_list(allocator);
+  for (std::int32_t i = 1; i <= 100; ++i) {
+    il.objects_.push_back(obj(i));
+  }
+  EXPECT_EQ(5050, anb::sum(il).as_int32());
+  EXPECT_EQ(1, anb::min_of(il).as_int32());
+  EXPECT_EQ(100, anb::max_of(il).as_int32());
+
+  il.objects_.push_back(obj(std::numeric_limits<std::int32_t>::max()));
+  EXPECT_EQ(5050.0 + std::numeric_limits<std::int32_t>::max(),
+            anb::sum(il).as_float64());
+
+  auto mixed = obj::make_list(allocator);
+  anb::list<ma>& ml = mixed.as_list(allocator);
+  ml.set(obj(std::int32_t{4}), obj(-1.5), obj(std::int32_t{-7}), obj(2.25),
+         obj(0.25));
+  EXPECT_EQ(-2.0, anb::sum(ml).as_float64());
+  EXPECT_EQ(-7, anb::min_of(ml).as_int32());
+  EXPECT_EQ(4, anb::max_of(ml).as_int32());
+
+  auto floats = obj::make_list(allocator);
+  anb::list<ma>& fl = floats.as_list(allocator);
+  fl.set(obj(1.0), obj(2.0), obj(3.0), obj(4.0), obj(0.0));
+
+  anb::add(fl, fl, ml);
+  EXPECT_EQ(5.0, fl.objects_.at(0).as_float64());
+  EXPECT_EQ(0.5, fl.objects_.at(1).as_float64());
+  EXPECT_EQ(-4.0, fl.objects_.at(2).as_float64());
+  EXPECT_EQ(6.25, fl.objects_.at(3).as_float64());
+  EXPECT_EQ(0.25, fl.objects_.at(4).as_float64());
+
+  auto quotients = obj::make_list(allocator);
+  anb::list<ma>& ql = quotients.as_list(allocator);
+  anb::div(ql, fl, fl);
+  EXPECT_EQ(5, ql.objects_.size());
+  EXPECT_EQ(1.0, ql.objects_.at(0).as_float64());
+
+  fl.objects_.at(4) = obj(0.0);
+  anb::div(ql, fl, fl);
+  EXPECT_TRUE(ql.objects_.at(4).is_qnan());
+
+  // Operands of different sizes leave out untouched
+  il.objects_.resize(3);
+  EXPECT_THROW(anb::mul(ql, fl, il), std::invalid_argument);
+  EXPECT_THROW(anb::sub(fl, il, fl), std::invalid_argument);
+  EXPECT_EQ(5, ql.objects_.size());
+  EXPECT_EQ(5, fl.objects_.size());
+
+  auto empty = obj::make_list(allocator);
+  EXPECT_EQ(0, anb::sum(empty.as_list(allocator)).as_int32());
+  EXPECT_TRUE(anb::min_of(empty.as_list(allocator)).is_nothing());
+
+  ml.objects_.push_back(obj(std::string_view{"x"}));
+  EXPECT_TRUE(anb::sum(ml).is_qnan());
+  EXPECT_TRUE(anb::max_of(ml).is_qnan());
+
+  while (!allocator.allocated_objects_.empty()) {
+    allocator.pop();
+  }
+}
@@ -4,6 +4,8 @@
 
 #include "test_allocator.hpp"
 
+#include <ranges>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -179,3 +181,80 @@ TEST(anb, object_assign_to_string) {
   }
   EXPECT_EQ(0, assign_alloc.allocated_objects_.size());
 }
+
+TEST(anb, object_assign_all_types) {
+  ma assign_alloc;
+  using obj = anb::object<ma>;
+
+  obj slot;
+  slot.assign(assign_alloc, true);
+  EXPECT_TRUE(slot.as_boolean());
+  slot.assign(assign_alloc, std::int32_t{42});
+  EXPECT_EQ(42, slot.as_int32());
+  slot.assign(assign_alloc, 2.5);
+  EXPECT_EQ(2.5, slot.as_float64());
+  // String literals aren't booleans
+  slot.assign(assign_alloc, "ok");
+  EXPECT_EQ("ok", slot.as_string_sso());
+
+  // A list slot refilled from ranges keeps its allocation and buffer
+  const std::vector<std::int32_t> many(100, 7);
+  slot.assign_list(assign_alloc, many);
+  ASSERT_TRUE(slot.is_list(assign_alloc));
+  const anb::list<ma>* list_ptr = &slot.as_list(assign_alloc);
+  const obj* buffer = list_ptr->objects_.data();
+  slot.assign_list(assign_alloc, std::vector<double>{0.5, 1.5});
+  EXPECT_EQ(list_ptr, &slot.as_list(assign_alloc));
+  EXPECT_EQ(buffer, slot.as_list(assign_alloc).objects_.data());
+  EXPECT_EQ(2, slot.as_list(assign_alloc).objects_.size());
+  EXPECT_EQ(1, assign_alloc.allocated_objects_.size());
+
+  // Assigning an object of the same heap type reuses it too
+  auto other_list = obj::make_list(assign_alloc, many);
+  slot.assign(assign_alloc, other_list);
+  EXPECT_EQ(list_ptr, &slot.as_list(assign_alloc));
+  EXPECT_EQ(slot, other_list);
+  EXPECT_NE(slot.nanbox_value(), other_list.nanbox_value());
+
+  // Switching types releases the old heap object
+  const std::vector<std::string> keys = {"a", "b"};
+  slot.assign_dictionary(assign_alloc, keys, many | std::views::take(2));
+  ASSERT_TRUE(slot.is_dictionary(assign_alloc));
+  EXPECT_EQ(2, assign_alloc.allocated_objects_.size());
+  const anb::dictionary<ma>* dict_ptr = &slot.as_dictionary(assign_alloc);
+
+  EXPECT_THROW(slot.assign_dictionary(assign_alloc, keys, many),
+               std::invalid_argument);
+  auto other_dict = obj::make_dictionary(
+      assign_alloc, std::vector<std::string>{"x", "y", "z"},
+      many | std::views::take(3));
+  slot.assign(assign_alloc, other_dict);
+  EXPECT_EQ(dict_ptr, &slot.as_dictionary(assign_alloc));
+  EXPECT_EQ(slot, other_dict);
+
+  auto heap_str = obj::make_string_heap(assign_alloc);
+  heap_str.as_string_heap(assign_alloc).set("a long heap string");
+  slot.assign(assign_alloc, heap_str);
+  EXPECT_EQ(slot, heap_str);
+  EXPECT_NE(slot.nanbox_value(), heap_str.nanbox_value());
+
+  auto tuple = obj::make_tuple(assign_alloc, std::int32_t{1}, 2.0);
+  slot.assign(assign_alloc, tuple);
+  EXPECT_EQ(slot, tuple);
+  EXPECT_NE(slot.nanbox_value(), tuple.nanbox_value());
+
+  // Self assignment is a no op
+  slot.assign(assign_alloc, slot);
+  EXPECT_EQ(slot, tuple);
+
+  slot.assign(assign_alloc, obj::make_nothing());
+  EXPECT_TRUE(slot.is_nothing());
+  // other_list, other_dict, heap_str and tuple are left
+  EXPECT_EQ(3, assign_alloc.allocated_objects_.size());
+
+  tuple.dealloc_heap(assign_alloc);
+  while (!assign_alloc.allocated_objects_.empty()) {
+    assign_alloc.pop();
+  }
+  EXPECT_EQ(0, assign_alloc.allocated_bytes_);
+}
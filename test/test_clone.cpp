@@ -0,0 +1,229 @@
+#include <gtest/gtest.h>
+
+#include <anb/clone.hpp>
+
+#include "test_allocator.hpp"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+// Destination allocator of a different type, records what was reserved
+class pool_allocator {
+ public:
+  ~pool_allocator() {
+    for (auto obj_ptr : allocated_objects_) {
+      delete obj_ptr;
+    }
+  }
+
+  template <template <class> typename HeapObjT>
+  HeapObjT<pool_allocator>* alloc() {
+    auto ptr = new HeapObjT<pool_allocator>(*this);
+    allocated_objects_.push_back(ptr);
+    return ptr;
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<pool_allocator>* obj_ptr) {
+    allocated_objects_.erase(std::remove(allocated_objects_.begin(),
+                                         allocated_objects_.end(), obj_ptr));
+    delete obj_ptr;
+  }
+
+  template <template <class> typename HeapObjT>
+  void reserve(const std::size_t count) {
+    reserved_ += count;
+  }
+
+  std::size_t reserved_ = 0;
+  std::vector<anb::heap_object<pool_allocator>*> allocated_objects_;
+};
+using pa = pool_allocator;
+
+// Throws std::bad_alloc once its budget of heap objects is used up
+class limited_allocator {
+ public:
+  ~limited_allocator() {
+    for (auto obj_ptr : live_) {
+      delete obj_ptr;
+    }
+  }
+
+  template <template <class> typename HeapObjT>
+  HeapObjT<limited_allocator>* alloc() {
+    if (budget_ == 0) {
+      throw std::bad_alloc();
+    }
+    --budget_;
+    auto ptr = new HeapObjT<limited_allocator>(*this);
+    live_.push_back(ptr);
+    return ptr;
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<limited_allocator>* obj_ptr) {
+    live_.erase(std::remove(live_.begin(), live_.end(), obj_ptr));
+    delete obj_ptr;
+  }
+
+  std::size_t budget_ = 1000;
+  std::vector<anb::heap_object<limited_allocator>*> live_;
+};
+
+TEST(anb, object_deep_clone_between_allocators) {
+  ma scratch;
+
+  auto shared = anb::object<ma>::make_string_heap(scratch);
+  shared.as_string_heap(scratch).set("shared between two parents");
+
+  auto inner = anb::object<ma>::make_list(scratch);
+  inner.as_list(scratch).set(anb::object<ma>(1), shared,
+                             anb::object<ma>(std::string_view{"sso"}));
+
+  auto dict = anb::object<ma>::make_dictionary(scratch);
+  dict.as_dictionary(scratch).set<std::pair>({anb::object<ma>(true), shared});
+
+  auto root = anb::object<ma>::make_list(scratch);
+  root.as_list(scratch).set(inner, dict, anb::object<ma>(2.5),
+                            anb::object<ma>::make_nothing());
+
+  const anb::graph_measure measured = anb::measure_graph(scratch, root);
+  EXPECT_EQ(2, measured.strings);
+  EXPECT_EQ(2, measured.lists);
+  EXPECT_EQ(1, measured.dictionaries);
+  EXPECT_EQ(7, measured.list_elements);
+  EXPECT_EQ(1, measured.dictionary_entries);
+  EXPECT_EQ(1, anb::measure_graph(scratch, root, true).strings);
+
+  {
+    pa pool;
+    const auto copy = anb::deep_clone(pool, scratch, root);
+    EXPECT_EQ(5, pool.reserved_);
+    EXPECT_EQ(5, pool.allocated_objects_.size());
+    EXPECT_EQ(root.hash(), copy.hash());
+
+    const auto& objects = copy.as_list(pool).objects_;
+    EXPECT_EQ(4, objects.size());
+    EXPECT_EQ(2.5, objects.at(2).as_float64());
+    EXPECT_TRUE(objects.at(3).is_nothing());
+
+    const auto& inner_copy = objects.at(0).as_list(pool).objects_;
+    EXPECT_EQ(1, inner_copy.at(0).as_int32());
+    EXPECT_EQ("shared between two parents",
+              inner_copy.at(1).as_string_heap(pool).view());
+    EXPECT_EQ("sso", inner_copy.at(2).as_string_sso());
+
+    const auto& dict_copy = objects.at(1).as_dictionary(pool).object_dict_;
+    EXPECT_NE(inner_copy.at(1).nanbox_value(),
+              dict_copy.at(anb::object<pa>(true)).nanbox_value());
+  }
+  {
+    pa pool;
+    const auto copy = anb::deep_clone(pool, scratch, root, {true});
+    EXPECT_EQ(4, pool.reserved_);
+    EXPECT_EQ(4, pool.allocated_objects_.size());
+    EXPECT_EQ(root.hash(), copy.hash());
+
+    const auto& objects = copy.as_list(pool).objects_;
+    const auto& inner_copy = objects.at(0).as_list(pool).objects_;
+    const auto& dict_copy = objects.at(1).as_dictionary(pool).object_dict_;
+    EXPECT_EQ(inner_copy.at(1).nanbox_value(),
+              dict_copy.at(anb::object<pa>(true)).nanbox_value());
+  }
+
+  while (!scratch.allocated_objects_.empty()) {
+    scratch.pop();
+  }
+}
+
+TEST(anb, object_deep_clone_tuples_need_raw_allocation) {
+  ma scratch;
+
+  auto record = anb::object<ma>::make_tuple(scratch, 1, 2.5);
+  auto root = anb::object<ma>::make_list(scratch);
+  root.as_list(scratch).set(anb::object<ma>(std::string_view{"row"}), record);
+
+  // Nothing is copied to an allocator that can't hold the tuple
+  pa pool;
+  EXPECT_THROW(anb::deep_clone(pool, scratch, root), std::invalid_argument);
+  EXPECT_EQ(0, pool.allocated_objects_.size());
+
+  // Raw allocation is enough
+  ma other;
+  const auto copy = anb::deep_clone(other, scratch, root);
+  EXPECT_EQ(root, copy);
+
+  while (!other.allocated_objects_.empty()) {
+    other.pop();
+  }
+  while (!scratch.allocated_objects_.empty()) {
+    scratch.pop();
+  }
+}
+
+TEST(anb, object_deep_clone_tuple_in_cycle) {
+  ma scratch;
+  using obj = anb::object<ma>;
+
+  // l = [t], t = (1, l)
+  auto l = obj::make_list(scratch);
+  auto t = obj::make_tuple(scratch, obj(std::int32_t{1}), l);
+  l.as_list(scratch).objects_.push_back(t);
+  EXPECT_EQ(1, anb::measure_graph(scratch, t).tuple_cycles);
+  EXPECT_EQ(0, anb::measure_graph(scratch, l).tuple_cycles);
+
+  // The copy of t would be needed before its elements are copied
+  ma other;
+  EXPECT_THROW(anb::deep_clone(other, scratch, t,
+                               anb::clone_options{.deduplicate_shared = true}),
+               std::invalid_argument);
+  EXPECT_EQ(0, other.allocated_objects_.size());
+
+  // Closing on the list instead, the tuple is made once the list copy is
+  const auto copy = anb::deep_clone(
+      other, scratch, l, anb::clone_options{.deduplicate_shared = true});
+  EXPECT_EQ(l, copy);
+  const auto& copy_tuple = copy.as_list(other).objects_[0].as_tuple(other);
+  EXPECT_EQ(&copy.as_list(other), &copy_tuple[1].as_list(other));
+
+  while (!other.allocated_objects_.empty()) {
+    other.pop();
+  }
+  while (!scratch.allocated_objects_.empty()) {
+    scratch.pop();
+  }
+}
+
+TEST(anb, object_deep_clone_failure_frees_copies) {
+  ma scratch;
+  using obj = anb::object<ma>;
+  auto root = obj::make_list(scratch);
+  for (std::int32_t i = 0; i < 4; ++i) {
+    auto element = obj::make_list(scratch);
+    element.as_list(scratch).set(obj(i), obj(std::string_view{"x"}));
+    root.as_list(scratch).objects_.push_back(element);
+  }
+
+  // Runs out part way, with and without tracking what's shared
+  limited_allocator pool;
+  for (const bool deduplicate_shared : {false, true}) {
+    pool.budget_ = 3;
+    EXPECT_THROW(
+        anb::deep_clone(pool, scratch, root,
+                        anb::clone_options{.deduplicate_shared =
+                                               deduplicate_shared}),
+        std::bad_alloc);
+    EXPECT_TRUE(pool.live_.empty());
+  }
+
+  pool.budget_ = 5;
+  const auto copy = anb::deep_clone(pool, scratch, root);
+  EXPECT_EQ(5, pool.live_.size());
+  EXPECT_EQ(4, copy.as_list(pool).objects_.size());
+
+  while (!scratch.allocated_objects_.empty()) {
+    scratch.pop();
+  }
+}
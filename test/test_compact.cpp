@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+
+#include <anb/compact.hpp>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+using obj = anb::object<ma>;
+
+// Throws std::bad_alloc once its budget of heap objects is used up
+class limited_allocator {
+ public:
+  ~limited_allocator() {
+    for (auto* obj_ptr : live_) {
+      delete obj_ptr;
+    }
+  }
+
+  template <template <class> typename HeapObjT>
+  HeapObjT<limited_allocator>* alloc() {
+    if (budget_ == 0) {
+      throw std::bad_alloc();
+    }
+    --budget_;
+    auto ptr = new HeapObjT<limited_allocator>(*this);
+    live_.insert(ptr);
+    return ptr;
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<limited_allocator>* obj_ptr) {
+    live_.erase(obj_ptr);
+    delete obj_ptr;
+  }
+
+  std::size_t budget_ = 1000;
+  std::unordered_set<anb::heap_object<limited_allocator>*> live_;
+};
+
+}  // namespace
+
+TEST(anb, compact_relocates_graph) {
+  ma pool;
+  // A list that grew to 1000 elements and shrank back to 10, a shared
+  // heap string and a list containing itself
+  auto shrunk = obj::make_list(pool);
+  auto& shrunk_objects = shrunk.as_list(pool).objects_;
+  for (std::int32_t i = 0; i < 1000; ++i) {
+    shrunk_objects.push_back(obj(i));
+  }
+  shrunk_objects.resize(10);
+
+  auto shared = obj::make_string_heap(pool);
+  shared.as_string_heap(pool).set(std::string(100, 's'));
+  shrunk_objects.push_back(shared);
+
+  auto dict = obj::make_dictionary(pool);
+  auto& entries = dict.as_dictionary(pool).object_dict_;
+  for (std::int32_t i = 0; i < 100; ++i) {
+    entries.insert({obj(i), obj(i * 2)});
+  }
+  for (std::int32_t i = 1; i < 100; ++i) {
+    entries.erase(obj(i));
+  }
+  entries.insert({obj(std::string_view{"shared"}), shared});
+
+  auto cyclic = obj::make_list(pool);
+  cyclic.as_list(pool).set(obj(std::int32_t{1}), cyclic);
+
+  std::vector<obj> roots = {shrunk, dict, cyclic, obj(2.5)};
+  const std::vector<obj> expected = {
+      anb::deep_clone(pool, pool, shrunk), anb::deep_clone(pool, pool, dict),
+      obj(2.5)};
+  const std::size_t live_before = pool.allocated_objects_.size();
+
+  const anb::compaction_report report = anb::compact(pool, roots);
+  EXPECT_EQ(4, report.objects);
+  EXPECT_EQ(live_before, pool.allocated_objects_.size());
+  EXPECT_GT(report.bytes_reclaimed(), 990 * sizeof(obj));
+  EXPECT_EQ(report.bytes_after,
+            report.bytes_before - report.bytes_reclaimed());
+
+  EXPECT_EQ(expected[0], roots[0]);
+  EXPECT_EQ(expected[1], roots[1]);
+  EXPECT_EQ(expected[2], roots[3]);
+  EXPECT_EQ(11, roots[0].as_list(pool).objects_.capacity());
+
+  // Sharing between roots and cycles survive relocation
+  const auto shared_value = [&pool](const obj& graph) {
+    return graph.as_dictionary(pool).find(std::string_view{"shared"})->second;
+  };
+  auto relocated_shared = roots[0].as_list(pool).objects_.back();
+  EXPECT_EQ(&relocated_shared.as_string_heap(pool),
+            &shared_value(roots[1]).as_string_heap(pool));
+  const auto& relocated_cyclic = roots[2].as_list(pool).objects_;
+  EXPECT_EQ(&roots[2].as_list(pool), &relocated_cyclic[1].as_list(pool));
+
+  // Each expected graph has its own copy of the string
+  auto expected_strings = {expected[0].as_list(pool).objects_.back(),
+                           shared_value(expected[1])};
+  for (auto heap_obj : expected_strings) {
+    heap_obj.dealloc_heap(pool);
+  }
+  for (auto heap_obj : {expected[0], expected[1], relocated_shared, roots[0],
+                        roots[1], roots[2]}) {
+    heap_obj.dealloc_heap(pool);
+  }
+  EXPECT_TRUE(pool.allocated_objects_.empty());
+}
+
+TEST(anb, compact_into_other_allocator) {
+  ma from;
+  ma to;
+  std::vector<obj> roots = {obj::make_list(from)};
+  for (std::int32_t i = 0; i < 10; ++i) {
+    auto element = obj::make_string_heap(from);
+    element.as_string_heap(from).set(std::to_string(i));
+    roots[0].as_list(from).objects_.push_back(element);
+  }
+
+  const anb::compaction_report report = anb::compact(to, from, roots);
+  EXPECT_EQ(11, report.objects);
+  EXPECT_TRUE(from.allocated_objects_.empty());
+  EXPECT_EQ(11, to.allocated_objects_.size());
+  EXPECT_EQ("9", roots[0].as_list(to).objects_[9].as_string_heap(to).view());
+
+  for (auto element : roots[0].as_list(to).objects_) {
+    element.dealloc_heap(to);
+  }
+  roots[0].dealloc_heap(to);
+}
+
+TEST(anb, compact_failure_keeps_graph) {
+  using lobj = anb::object<limited_allocator>;
+  limited_allocator pool;
+  auto shared = lobj::make_string_heap(pool);
+  shared.as_string_heap(pool).set(std::string(20, 's'));
+  std::vector<lobj> roots = {lobj::make_list(pool), lobj::make_list(pool)};
+  for (auto& root : roots) {
+    for (std::int32_t i = 0; i < 3; ++i) {
+      auto element = lobj::make_list(pool);
+      element.as_list(pool).set(lobj(i), shared);
+      root.as_list(pool).objects_.push_back(element);
+    }
+  }
+  const std::vector<lobj> before = roots;
+  const auto live_before = pool.live_;
+
+  // Runs out part way through the second root
+  pool.budget_ = 6;
+  EXPECT_THROW(anb::compact(pool, roots), std::bad_alloc);
+  EXPECT_EQ(live_before, pool.live_);
+  EXPECT_EQ(before[0].nanbox_value(), roots[0].nanbox_value());
+  EXPECT_EQ(before[1].nanbox_value(), roots[1].nanbox_value());
+  EXPECT_EQ(roots[0], roots[1]);
+
+  pool.budget_ = 1000;
+  EXPECT_EQ(9, anb::compact(pool, roots).objects);
+  EXPECT_EQ(9, pool.live_.size());
+  EXPECT_EQ("ssssssssssssssssssss", roots[1]
+                                        .as_list(pool)
+                                        .objects_[2]
+                                        .as_list(pool)
+                                        .objects_[1]
+                                        .as_string_heap(pool)
+                                        .view());
+}
+
+TEST(anb, compact_rejects_cycle_closing_on_tuple) {
+  ma pool;
+  // t = (1, l), l = [t], reached from t first
+  auto l = obj::make_list(pool);
+  auto t = obj::make_tuple(pool, obj(std::int32_t{1}), l);
+  l.as_list(pool).objects_.push_back(t);
+  std::vector<obj> roots = {t, l};
+  const std::size_t live_before = pool.allocated_objects_.size();
+
+  EXPECT_THROW(anb::compact(pool, roots), std::invalid_argument);
+  EXPECT_EQ(live_before, pool.allocated_objects_.size());
+  EXPECT_EQ(t.nanbox_value(), roots[0].nanbox_value());
+
+  // From the list, the cycle closes on the list
+  roots = {l};
+  EXPECT_EQ(2, anb::compact(pool, roots).objects);
+  const auto& relocated = roots[0].as_list(pool);
+  EXPECT_EQ(&relocated,
+            &relocated.objects_[0].as_tuple(pool)[1].as_list(pool));
+
+  while (!pool.allocated_objects_.empty()) {
+    pool.pop();
+  }
+}
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+
+#include <anb/object.hpp>
+#include <array>
+#include <limits>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+using obj = anb::object<ma>;
+
+// Built at compile time, no static initialization at startup
+constexpr std::array<obj, 6> opcode_table{
+    obj(std::string_view{"add"}), obj(std::int32_t{-7}), obj(2.5),
+    obj(true), obj::make_nothing(), obj(std::string_view{"return"})};
+
+constexpr int classify(const obj& o) {
+  if (o.is_int32()) {
+    return 1;
+  } else if (o.is_float64()) {
+    return 2;
+  } else if (o.is_sso_string()) {
+    return 3;
+  }
+  return 0;
+}
+
+}  // namespace
+
+TEST(anb, object_constexpr) {
+  static_assert(obj::make_qnan().is_qnan());
+  static_assert(obj::make_nothing().is_nothing());
+  static_assert(obj(true).as_boolean());
+  static_assert(!obj(false).as_boolean());
+  static_assert(obj(std::int32_t{-7}).as_int32() == -7);
+  static_assert(obj(std::numeric_limits<std::int32_t>::min()).as_int32() ==
+                std::numeric_limits<std::int32_t>::min());
+  static_assert(obj(2.5).as_float64() == 2.5);
+  static_assert(obj(-std::numeric_limits<double>::infinity()).is_float64());
+  static_assert(obj(std::string_view{"abc"}).as_string_sso() == "abc");
+  static_assert(obj(std::string_view{"return"}).as_string_sso() == "return");
+  static_assert(obj(std::string_view{""}).is_sso_string());
+
+  // Comparisons of fixed values fold
+  static_assert(obj(std::int32_t{3}) == obj(std::int32_t{3}));
+  static_assert(obj(std::int32_t{3}) < obj(3.5));
+  static_assert(obj(std::string_view{"ab"}) < obj(std::string_view{"b"}));
+  static_assert(obj(true) != obj(false));
+
+  static_assert(classify(opcode_table[0]) == 3);
+  static_assert(classify(opcode_table[1]) == 1);
+  static_assert(classify(opcode_table[2]) == 2);
+  static_assert(classify(opcode_table[4]) == 0);
+
+  // Same words as the runtime construction
+  const std::int32_t runtime_int = -7;
+  EXPECT_EQ(obj(runtime_int).nanbox_value(), opcode_table[1].nanbox_value());
+  EXPECT_EQ("add", opcode_table[0].as_string_sso());
+  EXPECT_EQ("return", opcode_table[5].as_string_sso());
+}
@@ -1,6 +1,12 @@
 #include <gtest/gtest.h>
 
 #include <anb/object.hpp>
+#include <iterator>
+#include <map>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "test_allocator.hpp"
 
@@ -36,3 +42,222 @@ TEST(anb, object_dictionary) {
   dict.dealloc_heap(allocator);
   large_dict.dealloc_heap(allocator);
 }
+
+TEST(anb, object_dictionary_insertion_order) {
+  auto dict = anb::object<ma>::make_dictionary(allocator);
+  anb::dictionary<ma>& d = dict.as_dictionary(allocator);
+
+  // Crosses the 1, 2 and 4 byte index table widths
+  constexpr std::int32_t count = 70000;
+  for (std::int32_t i = count - 1; i >= 0; --i) {
+    d.set<std::pair>({anb::object<ma>(i), anb::object<ma>(i * 2)});
+  }
+  d.set<std::pair>({anb::object<ma>(7), anb::object<ma>(-1)});
+  EXPECT_EQ(count, d.object_dict_.size());
+
+  std::int32_t expected = count - 1;
+  for (const auto& [key_obj, val_obj] : d.object_dict_) {
+    EXPECT_EQ(expected, key_obj.as_int32());
+    EXPECT_EQ(expected * 2, val_obj.as_int32());
+    --expected;
+  }
+  for (std::int32_t i = 0; i < count; i += 997) {
+    EXPECT_EQ(i * 2, d.object_dict_.at(anb::object<ma>(i)).as_int32());
+  }
+  EXPECT_FALSE(d.object_dict_.contains(anb::object<ma>(count)));
+
+  EXPECT_EQ(1, d.object_dict_.erase(anb::object<ma>(count - 2)));
+  EXPECT_EQ(0, d.object_dict_.erase(anb::object<ma>(count - 2)));
+  EXPECT_EQ(count - 1, d.object_dict_.begin()->first.as_int32());
+  EXPECT_EQ(count - 3, std::next(d.object_dict_.begin())->first.as_int32());
+  EXPECT_EQ(8, d.object_dict_.at(anb::object<ma>(4)).as_int32());
+
+  d.object_dict_.insert_or_assign(anb::object<ma>(4), anb::object<ma>(true));
+  EXPECT_TRUE(d.object_dict_.at(anb::object<ma>(4)).as_boolean());
+
+  const std::size_t reserved = d.object_dict_.memory_usage();
+  d.reset();
+  EXPECT_TRUE(d.object_dict_.empty());
+  EXPECT_EQ(reserved, d.object_dict_.memory_usage());
+  EXPECT_FALSE(d.object_dict_.contains(anb::object<ma>(4)));
+
+  dict.dealloc_heap(allocator);
+}
+
+TEST(anb, object_dictionary_erase_many) {
+  auto dict = anb::object<ma>::make_dictionary(allocator);
+  anb::dictionary<ma>& d = dict.as_dictionary(allocator);
+
+  constexpr std::int32_t count = 40000;
+  for (std::int32_t i = 0; i < count; ++i) {
+    d.set<std::pair>({anb::object<ma>(i), anb::object<ma>(i * 2)});
+  }
+
+  // Every other key, then keys are re-added on top of the holes
+  for (std::int32_t i = 0; i < count; i += 2) {
+    EXPECT_EQ(1, d.object_dict_.erase(anb::object<ma>(i)));
+  }
+  EXPECT_EQ(count / 2, d.object_dict_.size());
+  EXPECT_FALSE(d.object_dict_.contains(anb::object<ma>(0)));
+  EXPECT_EQ(2, d.object_dict_.at(anb::object<ma>(1)).as_int32());
+  d.set<std::pair>({anb::object<ma>(0), anb::object<ma>(-1)});
+
+  std::int32_t expected = 1;
+  for (const auto& [key_obj, val_obj] : d.object_dict_) {
+    if (expected == count + 1) {
+      EXPECT_EQ(0, key_obj.as_int32());
+      EXPECT_EQ(-1, val_obj.as_int32());
+      break;
+    }
+    EXPECT_EQ(expected, key_obj.as_int32());
+    expected += 2;
+  }
+  EXPECT_EQ(-1, std::prev(d.object_dict_.end())->second.as_int32());
+
+  // Erasing everything else leaves an empty, reusable table
+  for (std::int32_t i = 0; i < count; ++i) {
+    d.object_dict_.erase(anb::object<ma>(i));
+  }
+  EXPECT_TRUE(d.object_dict_.empty());
+  EXPECT_EQ(d.object_dict_.begin(), d.object_dict_.end());
+  d.set<std::pair>({anb::object<ma>(5), anb::object<ma>(6)});
+  EXPECT_EQ(6, d.object_dict_.begin()->second.as_int32());
+
+  auto fresh = anb::object<ma>::make_dictionary(allocator);
+  fresh.as_dictionary(allocator).set<std::pair>(
+      {anb::object<ma>(5), anb::object<ma>(6)});
+  EXPECT_EQ(fresh.hash(), dict.hash());
+  EXPECT_EQ(fresh, dict);
+
+  fresh.dealloc_heap(allocator);
+  dict.dealloc_heap(allocator);
+}
+
+TEST(anb, object_dictionary_small_footprint) {
+  auto dict = anb::object<ma>::make_dictionary(allocator);
+  anb::dictionary<ma>& d = dict.as_dictionary(allocator);
+  d.set<std::pair>({anb::object<ma>(1), anb::object<ma>(2)});
+  d.set<std::pair>({anb::object<ma>(3), anb::object<ma>(4)});
+
+  // Two dense entries plus an eight slot table of single byte indices
+  EXPECT_GE(d.object_dict_.memory_usage(),
+            2 * (sizeof(std::size_t) + 2 * sizeof(anb::object<ma>)) + 8);
+  EXPECT_LE(d.object_dict_.memory_usage(), 128);
+
+  dict.dealloc_heap(allocator);
+}
+
+TEST(anb, object_dictionary_heterogeneous_lookup) {
+  ma lookup_alloc;
+
+  auto long_key = anb::object<ma>::make_string_heap(lookup_alloc);
+  long_key.as_string_heap(lookup_alloc).set("FAVOURITE_MOVIE");
+  auto short_heap_key = anb::object<ma>::make_string_heap(lookup_alloc);
+  short_heap_key.as_string_heap(lookup_alloc).set("tiny");
+
+  auto dict = anb::object<ma>::make_dictionary(lookup_alloc);
+  anb::dictionary<ma>& d = dict.as_dictionary(lookup_alloc);
+  d.set<std::pair>({long_key, anb::object<ma>(1)});
+  d.set<std::pair>({short_heap_key, anb::object<ma>(2)});
+  d.set<std::pair>({anb::object<ma>(std::string_view{"id"}),
+                    anb::object<ma>(3)});
+  d.set<std::pair>({anb::object<ma>(42), anb::object<ma>(4)});
+  d.set<std::pair>({anb::object<ma>(1.5), anb::object<ma>(5)});
+  d.set<std::pair>({anb::object<ma>(true), anb::object<ma>(6)});
+
+  const std::size_t allocated = lookup_alloc.allocated_objects_.size();
+
+  EXPECT_EQ(1, d.at("FAVOURITE_MOVIE").as_int32());
+  EXPECT_EQ(1, d.at(std::string{"FAVOURITE_MOVIE"}).as_int32());
+  EXPECT_EQ(2, d.at("tiny").as_int32());
+  EXPECT_EQ(3, d.at("id").as_int32());
+  EXPECT_EQ(4, d.at(42).as_int32());
+  EXPECT_EQ(5, d.at(1.5).as_int32());
+  EXPECT_EQ(6, d.at(true).as_int32());
+  EXPECT_EQ(1, d.at(long_key).as_int32());
+
+  EXPECT_FALSE(d.contains("FAVOURITE_MOVIES"));
+  EXPECT_FALSE(d.contains("FAVOURITE_MOVI"));
+  EXPECT_FALSE(d.contains("i"));
+  EXPECT_FALSE(d.contains(43));
+  EXPECT_FALSE(d.contains(42.0));
+  EXPECT_FALSE(d.contains(false));
+  EXPECT_THROW(d.at("missing key"), std::out_of_range);
+
+  // Same results as the boxed lookups
+  EXPECT_EQ(d.find(anb::object<ma>(std::string_view{"id"})), d.find("id"));
+  EXPECT_EQ(d.find(anb::object<ma>(42)), d.find(42));
+
+  EXPECT_EQ(allocated, lookup_alloc.allocated_objects_.size());
+
+  d.at("id") = anb::object<ma>(-3);
+  EXPECT_EQ(-3, d.object_dict_.at(anb::object<ma>(std::string_view{"id"}))
+                    .as_int32());
+
+  while (!lookup_alloc.allocated_objects_.empty()) {
+    lookup_alloc.pop();
+  }
+}
+
+TEST(anb, object_dictionary_from_ranges) {
+  const std::vector<std::string> keys = {"id", "name", "a rather long key"};
+  const std::vector<std::int32_t> values = {1, 2, 3};
+
+  auto dict = anb::object<ma>::make_dictionary(allocator, keys, values);
+  anb::dictionary<ma>& d = dict.as_dictionary(allocator);
+  ASSERT_EQ(3, d.object_dict_.size());
+  EXPECT_EQ(1, d.at("id").as_int32());
+  EXPECT_EQ(3, d.at("a rather long key").as_int32());
+  // Insertion order is the order of the ranges
+  EXPECT_EQ("name", std::next(d.object_dict_.begin())->first.as_string_sso());
+
+  // Like set(), present keys keep their value
+  const std::map<std::int32_t, double> more = {{7, 0.5}, {8, 1.5}};
+  d.insert_range(more);
+  d.insert_range(std::vector<std::string>{"id"}, std::vector<double>{9.5});
+  EXPECT_EQ(5, d.object_dict_.size());
+  EXPECT_EQ(1.5, d.at(8).as_float64());
+  EXPECT_EQ(1, d.at("id").as_int32());
+
+  EXPECT_THROW(d.insert_range(keys, std::vector<std::int32_t>{1}),
+               std::invalid_argument);
+  // Unsized ranges are checked as they are walked, extra values included
+  const std::vector<std::int32_t> unsized_keys = {10, 11};
+  auto filtered =
+      unsized_keys | std::views::filter([](std::int32_t) { return true; });
+  EXPECT_THROW(d.insert_range(filtered, std::vector<std::int32_t>{1, 2, 3}),
+               std::invalid_argument);
+
+  for (auto& [key, value] : d.object_dict_) {
+    if (key.is_heap_string(allocator)) {
+      anb::object<ma>(key).dealloc_heap(allocator);
+    }
+  }
+  dict.dealloc_heap(allocator);
+}
+
+TEST(anb, object_dictionary_from_ranges_present_keys) {
+  ma pool;
+  const std::vector<std::string> keys = {"a rather long key"};
+  const std::vector<std::string> values = {"a rather long value"};
+
+  auto dict = anb::object<ma>::make_dictionary(pool);
+  anb::dictionary<ma>& d = dict.as_dictionary(pool);
+  d.insert_range(keys, values);
+  ASSERT_EQ(3, pool.allocated_objects_.size());
+
+  // Present keys allocate neither a key nor a value
+  d.insert_range(keys, values);
+  const std::map<std::string, std::string> pairs = {
+      {"a rather long key", "another long value"}};
+  d.insert_range(pairs);
+  EXPECT_EQ(1, d.object_dict_.size());
+  EXPECT_EQ(3, pool.allocated_objects_.size());
+  EXPECT_EQ("a rather long value", d.at("a rather long key")
+                                       .as_string_heap(pool)
+                                       .view());
+
+  while (!pool.allocated_objects_.empty()) {
+    pool.pop();
+  }
+}
@@ -0,0 +1,295 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <anb/diff.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// Frees everything at once, the graphs are too large to dealloc one by one
+// from the mock allocator
+class arena {
+ public:
+  arena() = default;
+  arena(const arena&) = delete;
+  arena& operator=(const arena&) = delete;
+
+  ~arena() {
+    for (auto* obj_ptr : objects_) {
+      delete obj_ptr;
+    }
+  }
+
+  template <template <class> typename HeapObjT>
+  HeapObjT<arena>* alloc() {
+    auto ptr = new HeapObjT<arena>(*this);
+    objects_.push_back(ptr);
+    return ptr;
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<arena>*) {}
+
+  void* allocate(std::size_t bytes, std::size_t alignment) {
+    return ::operator new(bytes, std::align_val_t{alignment});
+  }
+
+  void deallocate(void* ptr, std::size_t, std::size_t alignment) {
+    ::operator delete(ptr, std::align_val_t{alignment});
+  }
+
+ private:
+  std::vector<anb::heap_object<arena>*> objects_;
+};
+
+using obj = anb::object<arena>;
+
+obj make_string(arena& heap, const std::string_view str) {
+  auto result = obj::make_string_heap(heap);
+  result.as_string_heap(heap).set(str);
+  return result;
+}
+
+// {"ver": 1, "owner": "...", "svc": [{"name": "...", "port": i,
+// "tags": [i, i + 1]}, ...]}
+obj make_config(arena& heap, const std::int32_t services) {
+  auto list = obj::make_list(heap);
+  for (std::int32_t i = 0; i < services; ++i) {
+    auto tags = obj::make_list(heap);
+    tags.as_list(heap).set(obj(i), obj(i + 1));
+    auto service = obj::make_dictionary(heap);
+    auto& entries = service.as_dictionary(heap).object_dict_;
+    entries.insert({obj(std::string_view{"name"}),
+                    make_string(heap, "service number " + std::to_string(i))});
+    entries.insert({obj(std::string_view{"port"}), obj(i)});
+    entries.insert({obj(std::string_view{"tags"}), tags});
+    list.as_list(heap).objects_.push_back(service);
+  }
+  auto root = obj::make_dictionary(heap);
+  auto& entries = root.as_dictionary(heap).object_dict_;
+  entries.insert({obj(std::string_view{"ver"}), obj(1)});
+  entries.insert(
+      {obj(std::string_view{"owner"}), make_string(heap, "operations team")});
+  entries.insert({obj(std::string_view{"svc"}), list});
+  return root;
+}
+
+// Dictionary of groups dictionaries, each mapping items keys to a list of
+// 8 numbers
+obj make_table(arena& heap, const std::int32_t groups,
+               const std::int32_t items) {
+  auto root = obj::make_dictionary(heap);
+  for (std::int32_t g = 0; g < groups; ++g) {
+    auto group = obj::make_dictionary(heap);
+    for (std::int32_t i = 0; i < items; ++i) {
+      auto row = obj::make_list(heap);
+      for (std::int32_t j = 0; j < 8; ++j) {
+        row.as_list(heap).objects_.push_back(obj(g * i + j));
+      }
+      group.as_dictionary(heap).object_dict_.insert({obj(i), row});
+    }
+    root.as_dictionary(heap).object_dict_.insert({obj(g), group});
+  }
+  return root;
+}
+
+obj& at(arena& heap, const obj& dict, const obj& key) {
+  return dict.as_dictionary(heap).object_dict_.at(key);
+}
+
+}  // namespace
+
+TEST(anb, diff_patch_applies) {
+  arena heap;
+  const auto before = make_config(heap, 40);
+  const auto after = anb::deep_clone(heap, heap, before);
+  auto& services =
+      at(heap, after, obj(std::string_view{"svc"})).as_list(heap);
+
+  auto& root = after.as_dictionary(heap).object_dict_;
+  root.insert_or_assign(obj(std::string_view{"ver"}), obj(2));
+  root.erase(obj(std::string_view{"owner"}));
+  root.insert(
+      {obj(std::string_view{"region"}), make_string(heap, "eu-west-1")});
+  at(heap, services.objects_[7], obj(std::string_view{"port"})) = obj(8080);
+  at(heap, services.objects_[12], obj(std::string_view{"tags"}))
+      .as_list(heap)
+      .objects_.push_back(obj(99));
+  services.objects_[3] = obj(42);
+  const auto inserted = make_config(heap, 1);
+  services.objects_.insert(services.objects_.begin() + 20, inserted);
+
+  const anb::merkle_index<arena> from(heap, before);
+  const anb::merkle_index<arena> to(heap, after);
+  EXPECT_EQ(before.hash(), from.hash(before));
+  EXPECT_EQ(after.hash(), to.hash(after));
+  const anb::patch<arena> changes = anb::diff(from, to);
+
+  // Only the changed leaves are in the patch, the services inserted
+  // and removed as a splice
+  const auto count = [&changes](const anb::edit_kind kind) {
+    return std::count_if(
+        changes.edits.begin(), changes.edits.end(),
+        [kind](const auto& edit) { return edit.kind == kind; });
+  };
+  EXPECT_EQ(1, count(anb::edit_kind::erase));
+  EXPECT_EQ(2, count(anb::edit_kind::splice));
+  EXPECT_EQ(4, count(anb::edit_kind::assign));
+  for (const auto& edit : changes.edits) {
+    if (edit.kind == anb::edit_kind::splice && edit.path.size() == 1) {
+      EXPECT_EQ(20, edit.index);
+      EXPECT_EQ(0, edit.count);
+      ASSERT_EQ(1, edit.values.size());
+      EXPECT_EQ(inserted, edit.values[0]);
+    }
+  }
+
+  // Applied to a copy of the old graph in another allocator
+  arena replica_heap;
+  auto replica = anb::deep_clone(replica_heap, heap, before);
+  const auto displaced = anb::apply(replica_heap, replica, changes);
+  EXPECT_EQ(after.hash(), replica.hash());
+  EXPECT_TRUE(after.compare(replica) == 0);
+  EXPECT_EQ(5, displaced.size());
+  const auto& region =
+      at(replica_heap, replica, obj(std::string_view{"region"}));
+  EXPECT_EQ("eu-west-1", region.as_string_heap(replica_heap).view());
+  EXPECT_EQ(&replica_heap,
+            &region.as_string_heap(replica_heap).allocator_handle);
+
+  EXPECT_TRUE(anb::diff(heap, before, anb::deep_clone(heap, heap, before))
+                  .empty());
+  EXPECT_TRUE(anb::diff(from, from).empty());
+
+  // Roots of another type are replaced whole
+  auto number = obj(1);
+  const auto replaced =
+      anb::apply(heap, number, anb::diff(heap, number, after));
+  ASSERT_EQ(1, replaced.size());
+  EXPECT_EQ(obj(1), replaced[0]);
+  EXPECT_EQ(after, number);
+}
+
+TEST(anb, diff_cost_follows_change) {
+  arena heap;
+  constexpr std::int32_t groups = 64;
+  constexpr std::int32_t items = 64;
+  const auto before = make_table(heap, groups, items);
+  const anb::merkle_index<arena> from(heap, before);
+
+  // Changes count leaves spread over the table
+  const auto changed = [&](const std::int32_t count) {
+    const auto after = anb::deep_clone(heap, heap, before);
+    for (std::int32_t i = 0; i < count; ++i) {
+      const obj& group = at(heap, after, obj((i * 7) % groups));
+      at(heap, group, obj((i * 13) % items)).as_list(heap).objects_[i % 8] =
+          obj(-1 - i);
+    }
+    return after;
+  };
+
+  anb::diff_stats unchanged;
+  const anb::merkle_index<arena> same(heap, changed(0));
+  EXPECT_TRUE(anb::diff(from, same, &unchanged).empty());
+  EXPECT_EQ(1, unchanged.hashes_compared);
+
+  anb::diff_stats few;
+  const anb::merkle_index<arena> two(heap, changed(2));
+  EXPECT_EQ(2, anb::diff(from, two, &few).edits.size());
+  EXPECT_GT(few.hashes_compared, 0);
+  EXPECT_LT(few.hashes_compared * 100, groups * items * 8);
+
+  anb::diff_stats many;
+  const anb::merkle_index<arena> twenty(heap, changed(20));
+  const anb::patch<arena> changes = anb::diff(from, twenty, &many);
+  EXPECT_EQ(20, changes.edits.size());
+  EXPECT_GT(many.hashes_compared, few.hashes_compared * 5);
+  EXPECT_LT(many.hashes_compared, few.hashes_compared * 15);
+
+  auto replica = anb::deep_clone(heap, heap, before);
+  EXPECT_EQ(20, anb::apply(heap, replica, changes).size());
+  EXPECT_EQ(twenty.root(), replica);
+
+  // An element inserted into a list is spliced in
+  auto longer = anb::deep_clone(heap, heap, before);
+  auto& row = at(heap, at(heap, longer, obj(3)), obj(5)).as_list(heap);
+  row.objects_.insert(row.objects_.begin() + 6, obj(0.5));
+  const anb::patch<arena> grown =
+      anb::diff(from, anb::merkle_index<arena>(heap, longer));
+  ASSERT_EQ(1, grown.edits.size());
+  EXPECT_EQ(anb::edit_kind::splice, grown.edits[0].kind);
+  EXPECT_EQ(6, grown.edits[0].index);
+  EXPECT_EQ(0, grown.edits[0].count);
+  EXPECT_EQ(std::vector<obj>{obj(0.5)}, grown.edits[0].values);
+}
+
+TEST(anb, diff_reaches_changed_entries_directly) {
+  arena heap;
+  // Every third entry erased, so positions and entry slots differ
+  auto before = obj::make_dictionary(heap);
+  auto& entries = before.as_dictionary(heap).object_dict_;
+  for (std::int32_t i = 0; i < 30000; ++i) {
+    entries.insert({obj(i), obj(i)});
+  }
+  for (std::int32_t i = 0; i < 30000; i += 3) {
+    entries.erase(obj(i));
+  }
+  const anb::merkle_index<arena> from(heap, before);
+
+  // The last entries changed, in a copy without erased entries
+  auto after = anb::deep_clone(heap, heap, before);
+  auto& changed = after.as_dictionary(heap).object_dict_;
+  changed.insert_or_assign(obj(29999), obj(-1));
+  changed.insert_or_assign(obj(29998), obj(-2));
+
+  anb::diff_stats stats;
+  const anb::patch<arena> changes =
+      anb::diff(from, anb::merkle_index<arena>(heap, after), &stats);
+  ASSERT_EQ(2, changes.edits.size());
+  EXPECT_EQ(obj(29998), changes.edits[0].path[0]);
+  EXPECT_EQ(obj(-2), changes.edits[0].values[0]);
+  EXPECT_EQ(obj(29999), changes.edits[1].path[0]);
+  // Each changed entry once on either side, however far in
+  EXPECT_EQ(4, stats.entries_reached);
+  EXPECT_LT(stats.hashes_compared, 100);
+
+  auto replica = anb::deep_clone(heap, heap, before);
+  anb::apply(heap, replica, changes);
+  EXPECT_EQ(after, replica);
+}
+
+TEST(anb, diff_errors) {
+  arena heap;
+  auto cyclic = obj::make_list(heap);
+  cyclic.as_list(heap).objects_.push_back(cyclic);
+  EXPECT_THROW(anb::merkle_index<arena>(heap, cyclic), std::invalid_argument);
+
+  // Shared subtrees are indexed once and hash as object::hash() does
+  auto shared = make_config(heap, 3);
+  auto graph = obj::make_list(heap);
+  graph.as_list(heap).set(shared, shared,
+                          obj::make_persistent_list(heap, std::vector{1, 2}));
+  const anb::merkle_index<arena> index(heap, graph);
+  EXPECT_EQ(graph.hash(), index.hash(graph));
+  EXPECT_EQ(shared.hash(), index.hash(shared));
+
+  // A patch only applies to graphs shaped like the one it came from
+  auto after = anb::deep_clone(heap, heap, shared);
+  at(heap, after, obj(std::string_view{"ver"})) = obj(3);
+  const anb::patch<arena> changes = anb::diff(heap, shared, after);
+  auto list = obj::make_list(heap);
+  EXPECT_THROW(anb::apply(heap, list, changes), std::invalid_argument);
+  auto empty = obj::make_dictionary(heap);
+  EXPECT_NO_THROW(anb::apply(heap, empty, changes));
+
+  anb::patch<arena> erase = changes;
+  erase.edits[0].kind = anb::edit_kind::erase;
+  erase.edits[0].path[0] = obj(std::string_view{"none"});
+  EXPECT_THROW(anb::apply(heap, shared, erase), std::invalid_argument);
+}
@@ -0,0 +1,190 @@
+#include <gtest/gtest.h>
+
+#include <anb/footprint.hpp>
+#include <cstdint>
+#include <istream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <utility>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+// Reads from a string without seeking, like a pipe
+class unseekable_buffer : public std::streambuf {
+ public:
+  explicit unseekable_buffer(std::string bytes) : bytes_(std::move(bytes)) {
+    setg(bytes_.data(), bytes_.data(), bytes_.data() + bytes_.size());
+  }
+
+ private:
+  std::string bytes_;
+};
+
+}  // namespace
+
+TEST(anb, object_deep_size) {
+  using obj = anb::object<ma>;
+
+  EXPECT_EQ(0, anb::deep_size(allocator, obj(42.0)).total_bytes());
+
+  const std::string long_text(200, 'x');
+  auto str = obj::make_string_heap(allocator);
+  str.as_string_heap(allocator).set(long_text);
+
+  auto list = obj::make_list(allocator);
+  anb::list<ma>& l = list.as_list(allocator);
+  l.set(str, str, obj(std::int32_t{1}));
+
+  auto big_list = obj::make_list(allocator);
+  anb::list<ma>& bl = big_list.as_list(allocator);
+  for (std::int32_t i = 0; i < 100; ++i) {
+    bl.objects_.push_back(obj(i));
+  }
+  bl.objects_.push_back(list);
+
+  auto dict = obj::make_dictionary(allocator);
+  anb::dictionary<ma>& d = dict.as_dictionary(allocator);
+  d.set<std::pair>({obj(std::string_view{"small"}), list});
+  d.set<std::pair>({obj(std::string_view{"big"}), big_list});
+
+  const anb::footprint fp = anb::deep_size(allocator, dict);
+  EXPECT_EQ(1, fp[anb::heap_object_type::string].count);
+  EXPECT_EQ(2, fp[anb::heap_object_type::list].count);
+  EXPECT_EQ(1, fp[anb::heap_object_type::dictionary].count);
+  // str twice in the small list, the small list again in the big one
+  EXPECT_EQ(2, fp.shared_references);
+
+  EXPECT_EQ(sizeof(anb::string<ma>),
+            fp[anb::heap_object_type::string].object_bytes);
+  EXPECT_LT(long_text.size(), fp[anb::heap_object_type::string].buffer_bytes);
+  // Only the big list spilled out of its inline storage
+  EXPECT_EQ(bl.objects_.capacity() * sizeof(obj),
+            fp[anb::heap_object_type::list].buffer_bytes);
+  EXPECT_EQ(d.object_dict_.memory_usage(),
+            fp[anb::heap_object_type::dictionary].buffer_bytes);
+
+  const anb::footprint small_fp = anb::deep_size(allocator, list);
+  EXPECT_LT(small_fp.total_bytes(), fp.total_bytes());
+  EXPECT_EQ(sizeof(anb::string<ma>) + sizeof(anb::list<ma>) +
+                small_fp[anb::heap_object_type::string].buffer_bytes,
+            small_fp.total_bytes());
+
+  // Cycles are only visited once
+  bl.objects_.push_back(big_list);
+  EXPECT_EQ(2, anb::deep_size(allocator, big_list)
+                   [anb::heap_object_type::list].count);
+  bl.objects_.pop_back();
+
+  while (!allocator.allocated_objects_.empty()) {
+    allocator.pop();
+  }
+}
+
+TEST(anb, object_deep_size_shared_string_buffers) {
+  using obj = anb::object<ma>;
+  constexpr std::size_t megabyte = 1 << 20;
+
+  // Two slices and a rope sharing the buffer of text
+  auto text = obj::make_string_heap(allocator);
+  text.as_string_heap(allocator).set(std::string(megabyte, 't'));
+  auto head = obj::make_slice(allocator, text, 0, 1000);
+  auto tail = obj::make_slice(allocator, text, 1000);
+  auto rope = obj::make_string_heap(allocator);
+  rope.as_string_heap(allocator).set("prefix");
+  rope.as_string_heap(allocator).append(text.as_string_heap(allocator));
+  auto list = obj::make_list(allocator);
+  list.as_list(allocator).set(text, head, tail, rope);
+
+  const anb::footprint fp = anb::deep_size(allocator, list);
+  EXPECT_EQ(4, fp[anb::heap_object_type::string].count);
+  EXPECT_LT(megabyte, fp[anb::heap_object_type::string].buffer_bytes);
+  EXPECT_GT(megabyte + 1000, fp[anb::heap_object_type::string].buffer_bytes);
+  // Each of them alone still retains the whole buffer
+  EXPECT_LT(megabyte, anb::deep_size(allocator, head)
+                          [anb::heap_object_type::string]
+                              .buffer_bytes);
+
+  while (!allocator.allocated_objects_.empty()) {
+    allocator.pop();
+  }
+}
+
+TEST(anb, object_heap_dump) {
+  using obj = anb::object<ma>;
+
+  auto str = obj::make_string_heap(allocator);
+  str.as_string_heap(allocator).set("Harvey the invisible rabbit");
+  auto list = obj::make_list(allocator);
+  list.as_list(allocator).set(str, obj(2.5), str);
+  auto tuple = obj::make_tuple(allocator, list, obj(true));
+  auto dict = obj::make_dictionary(allocator);
+  dict.as_dictionary(allocator).set<std::pair>(
+      {obj(std::string_view{"t"}), tuple});
+
+  std::stringstream stream;
+  anb::write_heap_dump(stream, allocator, dict);
+  const anb::heap_dump dump = anb::read_heap_dump(stream);
+
+  ASSERT_EQ(4, dump.nodes.size());
+  EXPECT_TRUE(dump.root.is_node);
+  EXPECT_EQ(0, dump.root.value);
+
+  const anb::heap_dump_node& dict_node = dump.nodes[0];
+  EXPECT_EQ(anb::heap_object_type::dictionary, dict_node.type);
+  ASSERT_EQ(2, dict_node.children.size());
+  EXPECT_FALSE(dict_node.children[0].is_node);
+  EXPECT_EQ(obj(std::string_view{"t"}).nanbox_value(),
+            dict_node.children[0].value);
+  EXPECT_EQ(1, dict_node.children[1].value);
+
+  const anb::heap_dump_node& tuple_node = dump.nodes[1];
+  EXPECT_EQ(anb::heap_object_type::tuple, tuple_node.type);
+  EXPECT_EQ(anb::tuple<ma>::block_size(2), tuple_node.object_bytes);
+
+  const anb::heap_dump_node& list_node = dump.nodes[2];
+  EXPECT_EQ(anb::heap_object_type::list, list_node.type);
+  ASSERT_EQ(3, list_node.children.size());
+  EXPECT_EQ(3, list_node.children[0].value);
+  EXPECT_EQ(obj(2.5).nanbox_value(), list_node.children[1].value);
+  EXPECT_EQ(3, list_node.children[2].value);
+
+  EXPECT_EQ(anb::heap_object_type::string, dump.nodes[3].type);
+  EXPECT_EQ("Harvey the invisible rabbit", dump.nodes[3].bytes);
+
+  std::stringstream garbage("not a dump");
+  EXPECT_THROW(anb::read_heap_dump(garbage), std::runtime_error);
+
+  // Counts that don't fit in the dump are rejected before allocating,
+  // whether or not the stream can tell its size
+  const std::string valid = stream.str();
+  const auto corrupted = [&valid](const std::size_t offset,
+                                  const std::uint64_t value) {
+    std::string bytes = valid;
+    for (std::size_t i = 0; i < sizeof(value); ++i) {
+      bytes[offset + i] = static_cast<char>((value >> (i * 8)) & 0xFF);
+    }
+    return bytes;
+  };
+  const std::size_t string_length_offset =
+      valid.find("Harvey") - sizeof(std::uint64_t);
+  for (const std::string& bytes :
+       {corrupted(8, std::uint64_t{1} << 62),
+        corrupted(string_length_offset, std::uint64_t{1} << 60),
+        corrupted(17, 99)}) {
+    std::stringstream seekable(bytes);
+    EXPECT_THROW(anb::read_heap_dump(seekable), std::runtime_error);
+    unseekable_buffer buffer(bytes);
+    std::istream unseekable(&buffer);
+    EXPECT_THROW(anb::read_heap_dump(unseekable), std::runtime_error);
+  }
+  std::stringstream truncated(valid.substr(0, valid.size() - 4));
+  EXPECT_THROW(anb::read_heap_dump(truncated), std::runtime_error);
+
+  tuple.dealloc_heap(allocator);
+  while (!allocator.allocated_objects_.empty()) {
+    allocator.pop();
+  }
+}
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <anb/hash.hpp>
+#include <cstdint>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+using obj = anb::object<ma>;
+
+}  // namespace
+
+TEST(anb, hash_fixed_distribution) {
+  // Consecutive values spread over the low bits hash tables index with
+  std::unordered_set<std::size_t> int_buckets;
+  std::unordered_set<std::size_t> double_buckets;
+  for (std::int32_t i = 0; i < 1024; ++i) {
+    int_buckets.insert(obj(i).hash() & 1023);
+    double_buckets.insert(obj(static_cast<double>(i)).hash() & 1023);
+  }
+  EXPECT_GT(int_buckets.size(), 600);
+  EXPECT_GT(double_buckets.size(), 600);
+
+  // Equal values hash equally, different encodings of a number don't have
+  // to
+  EXPECT_EQ(obj(std::int32_t{7}).hash(), obj(std::int32_t{7}).hash());
+  EXPECT_NE(obj(0.0).hash(), obj(-0.0).hash());
+  EXPECT_NE(obj(true).hash(), obj(false).hash());
+  EXPECT_NE(obj::make_nothing().hash(), obj::make_qnan().hash());
+}
+
+TEST(anb, hash_containers) {
+  const std::vector<std::int32_t> ints = {1, 2, 3};
+  const std::vector<std::int32_t> permuted = {3, 1, 2};
+  auto list = obj::make_list(allocator, ints);
+  auto permuted_list = obj::make_list(allocator, permuted);
+  // Order sensitive
+  EXPECT_NE(list.hash(), permuted_list.hash());
+
+  auto tuple = obj::make_tuple(allocator, std::int32_t{1}, std::int32_t{2},
+                               std::int32_t{3});
+  EXPECT_NE(list.hash(), tuple.hash());
+
+  // Insertion order doesn't matter for dictionaries, which compare equal
+  const std::vector<std::string> keys = {"a", "b"};
+  const std::vector<std::string> reversed_keys = {"b", "a"};
+  auto dict = obj::make_dictionary(allocator, keys, ints | std::views::take(2));
+  auto reversed = obj::make_dictionary(allocator, reversed_keys,
+                                       std::vector<std::int32_t>{2, 1});
+  EXPECT_EQ(dict, reversed);
+  EXPECT_EQ(dict.hash(), reversed.hash());
+  // but keys stay bound to their values
+  auto swapped = obj::make_dictionary(allocator, keys,
+                                      std::vector<std::int32_t>{2, 1});
+  EXPECT_NE(dict.hash(), swapped.hash());
+
+  for (auto* heap_obj :
+       {&list, &permuted_list, &tuple, &dict, &reversed, &swapped}) {
+    heap_obj->dealloc_heap(allocator);
+  }
+}
+
+TEST(anb, hash_batch) {
+  auto heap_str = obj::make_string_heap(allocator);
+  heap_str.as_string_heap(allocator).set("a heap allocated string");
+  auto list = obj::make_list(allocator, std::vector<double>{0.5, 1.5});
+
+  std::vector<obj> objects = {obj(std::int32_t{1}), obj(2.5),   obj(true),
+                              obj::make_nothing(),  obj::make_qnan(),
+                              obj(std::string_view{"sso"}), heap_str, list};
+  for (std::int32_t i = 0; i < 100; ++i) {
+    objects.push_back(obj(i));
+  }
+
+  std::vector<std::size_t> hashes(objects.size());
+  anb::hash_batch(std::span<const obj>(objects), std::span(hashes));
+  for (std::size_t i = 0; i < objects.size(); ++i) {
+    EXPECT_EQ(objects[i].hash(), hashes[i]) << i;
+  }
+
+  std::vector<std::size_t> too_small(1);
+  EXPECT_THROW(
+      anb::hash_batch(std::span<const obj>(objects), std::span(too_small)),
+      std::invalid_argument);
+
+  heap_str.dealloc_heap(allocator);
+  list.dealloc_heap(allocator);
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include <anb/object.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+// Bump allocator over a fixed buffer, releasing is a no op and reset()
+// drops everything at once
+class arena_allocator {
+ public:
+  template <template <class> typename HeapObjT>
+  HeapObjT<arena_allocator>* alloc() {
+    using heap_t = HeapObjT<arena_allocator>;
+    return ::new (allocate(sizeof(heap_t), alignof(heap_t))) heap_t(*this);
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<arena_allocator>* obj_ptr) {
+    std::destroy_at(obj_ptr);
+  }
+
+  void* allocate(const std::size_t bytes, const std::size_t alignment) {
+    used_ = (used_ + alignment - 1) & ~(alignment - 1);
+    if (used_ + bytes > buffer_.size()) {
+      throw std::bad_alloc();
+    }
+    void* ptr = buffer_.data() + used_;
+    used_ += bytes;
+    return ptr;
+  }
+
+  void deallocate(void*, std::size_t, std::size_t) {}
+
+  bool owns(const void* ptr) const {
+    const auto* byte = static_cast<const unsigned char*>(ptr);
+    return byte >= buffer_.data() && byte < buffer_.data() + buffer_.size();
+  }
+
+  std::size_t used() const { return used_; }
+
+  void reset() { used_ = 0; }
+
+ private:
+  alignas(std::max_align_t) std::array<unsigned char, 1 << 16> buffer_{};
+  std::size_t used_ = 0;
+};
+
+// Only the heap object interface, containers use the global heap
+class object_only_allocator {
+ public:
+  template <template <class> typename HeapObjT>
+  HeapObjT<object_only_allocator>* alloc() {
+    return new HeapObjT<object_only_allocator>(*this);
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<object_only_allocator>* obj_ptr) {
+    delete obj_ptr;
+  }
+};
+
+}  // namespace
+
+TEST(anb, heap_allocator_concept) {
+  static_assert(anb::heap_allocator<ma>);
+  static_assert(anb::heap_allocator<arena_allocator>);
+  static_assert(anb::heap_allocator<object_only_allocator>);
+  static_assert(!anb::heap_allocator<std::allocator<char>>);
+
+  static_assert(anb::detail::raw_allocator<arena_allocator>);
+  static_assert(!anb::detail::raw_allocator<object_only_allocator>);
+}
+
+TEST(anb, heap_allocator_containers) {
+  using obj = anb::object<arena_allocator>;
+  auto arena = std::make_unique<arena_allocator>();
+
+  auto str = obj::make_string_heap(*arena);
+  str.as_string_heap(*arena).set(std::string(100, 'x'));
+  str.as_string_heap(*arena).append(std::string(100, 'y'));
+
+  auto list = obj::make_list(*arena);
+  for (std::int32_t i = 0; i < 100; ++i) {
+    list.as_list(*arena).objects_.push_back(obj(i));
+  }
+
+  auto dict = obj::make_dictionary(*arena);
+  for (std::int32_t i = 0; i < 100; ++i) {
+    dict.as_dictionary(*arena).object_dict_.insert({obj(i), str});
+  }
+
+  // Every buffer came out of the arena
+  EXPECT_TRUE(arena->owns(str.as_string_heap(*arena).view().data()));
+  EXPECT_TRUE(arena->owns(list.as_list(*arena).objects_.data()));
+  EXPECT_TRUE(arena->owns(&*dict.as_dictionary(*arena).object_dict_.begin()));
+  EXPECT_EQ(std::string(100, 'x') + std::string(100, 'y'),
+            str.as_string_heap(*arena).view());
+  EXPECT_EQ(99, list.as_list(*arena).objects_.back().as_int32());
+  EXPECT_GT(arena->used(), 100 * sizeof(obj) * 3);
+
+  // Nothing is left on the global heap, dropping the arena frees it all
+  arena->reset();
+  EXPECT_EQ(0, arena->used());
+}
+
+TEST(anb, heap_allocator_global_fallback) {
+  using obj = anb::object<object_only_allocator>;
+  object_only_allocator allocator;
+
+  auto str = obj::make_string_heap(allocator);
+  str.as_string_heap(allocator).set("without raw allocation");
+  auto list = obj::make_list(allocator);
+  for (std::int32_t i = 0; i < 10; ++i) {
+    list.as_list(allocator).objects_.push_back(str);
+  }
+  EXPECT_EQ(10, list.as_list(allocator).objects_.size());
+  EXPECT_EQ("without raw allocation",
+            list.as_list(allocator).objects_[9].as_string_heap(allocator)
+                .view());
+
+  str.dealloc_heap(allocator);
+  list.dealloc_heap(allocator);
+}
@@ -0,0 +1,106 @@
+// The operation hooks are compiled in for this file only. Every object
+// type instantiated here is over local_ma, a type with internal linkage,
+// so none of them can clash with the uninstrumented ones of other files
+#ifndef ANB_INSTRUMENTATION
+#define ANB_INSTRUMENTATION
+#endif
+
+#include <gtest/gtest.h>
+
+#include <anb/instrumentation.hpp>
+#include <anb/object.hpp>
+#include <thread>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+// Only the raw allocate()/deallocate() of ma are used, by the decorator
+struct local_ma : ma {};
+using instrumented_ma = anb::instrumented_allocator<local_ma>;
+
+}  // namespace
+
+TEST(anb, instrumented_allocator) {
+  local_ma inner;
+  instrumented_ma counted(inner);
+  using obj = anb::object<instrumented_ma>;
+
+  const anb::instrumentation_report before = anb::instrumentation_snapshot();
+
+  auto str = obj::make_string_heap(counted);
+  str.as_string_heap(counted).set("Mr. Smith Goes to Washington");
+  auto list = obj::make_list(counted);
+  list.as_list(counted).set(str, obj(std::int32_t{1939}));
+  auto dict = obj::make_dictionary(counted);
+  const anb::instrumentation_report before_tuple =
+      anb::instrumentation_snapshot();
+  auto tuple = obj::make_tuple(counted, str, 7.9);
+  const anb::instrumentation_report after_tuple =
+      anb::instrumentation_snapshot();
+  list.hash();
+
+  // Allocations on another thread land in its own buffer, and survive it
+  std::thread([&counted]() {
+    auto other = obj::make_string_heap(counted);
+    other.dealloc_heap(counted);
+  }).join();
+
+  const anb::instrumentation_report during = anb::instrumentation_snapshot();
+  const auto delta = [&](const anb::instrumentation_report& report,
+                         const anb::instrumented_heap kind) {
+    return report.heap(kind).live_count() - before.heap(kind).live_count();
+  };
+  EXPECT_EQ(1, delta(during, anb::instrumented_heap::string));
+  EXPECT_EQ(1, delta(during, anb::instrumented_heap::list));
+  EXPECT_EQ(1, delta(during, anb::instrumented_heap::dictionary));
+  // The tuple block and the character buffer of the heap string
+  EXPECT_EQ(2, delta(during, anb::instrumented_heap::raw_block));
+  EXPECT_EQ(2, during.heap(anb::instrumented_heap::string).allocations -
+                   before.heap(anb::instrumented_heap::string).allocations);
+  EXPECT_EQ(
+      static_cast<std::int64_t>(anb::tuple<instrumented_ma>::block_size(2)),
+      after_tuple.heap(anb::instrumented_heap::raw_block).live_bytes() -
+          before_tuple.heap(anb::instrumented_heap::raw_block).live_bytes());
+  EXPECT_EQ(static_cast<std::int64_t>(sizeof(anb::list<instrumented_ma>)),
+            during.heap(anb::instrumented_heap::list).live_bytes() -
+                before.heap(anb::instrumented_heap::list).live_bytes());
+
+  const auto histogram_total = [](const anb::heap_stats& stats) {
+    std::uint64_t total = 0;
+    for (const auto count : stats.size_histogram) {
+      total += count;
+    }
+    return total;
+  };
+  EXPECT_EQ(during.heap(anb::instrumented_heap::string).allocations,
+            histogram_total(during.heap(anb::instrumented_heap::string)));
+
+  // 4 allocations here, 1 on the other thread
+  EXPECT_EQ(5, during.operation(anb::instrumented_op::alloc_heap) -
+                   before.operation(anb::instrumented_op::alloc_heap));
+  // The list, the heap string and the int32 in it. The tuple holds a heap
+  // string, so it isn't hashed when created
+  EXPECT_EQ(3, during.operation(anb::instrumented_op::hash) -
+                   before.operation(anb::instrumented_op::hash));
+
+  obj sso;
+  sso.assign(counted, "ok");
+  const anb::instrumentation_report assigned = anb::instrumentation_snapshot();
+  EXPECT_EQ(1, assigned.operation(anb::instrumented_op::assign) -
+                   during.operation(anb::instrumented_op::assign));
+
+  str.dealloc_heap(counted);
+  list.dealloc_heap(counted);
+  dict.dealloc_heap(counted);
+  tuple.dealloc_heap(counted);
+
+  const anb::instrumentation_report after = anb::instrumentation_snapshot();
+  for (const auto kind :
+       {anb::instrumented_heap::string, anb::instrumented_heap::list,
+        anb::instrumented_heap::dictionary,
+        anb::instrumented_heap::raw_block}) {
+    EXPECT_EQ(0, delta(after, kind));
+  }
+  EXPECT_EQ(0, inner.allocated_bytes_);
+}
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 
 #include <anb/object.hpp>
+#include <list>
+#include <numeric>
+#include <ranges>
+#include <string>
+#include <vector>
 
 #include "test_allocator.hpp"
 
@@ -44,3 +49,103 @@ TEST(anb, object_list) {
   list.dealloc_heap(allocator);
   smaller_list.dealloc_heap(allocator);
 }
+
+TEST(anb, object_list_inline_storage) {
+  auto list = anb::object<ma>::make_list(allocator);
+  anb::list<ma>& l = list.as_list(allocator);
+  EXPECT_TRUE(l.objects_.is_inline());
+  EXPECT_EQ(4, l.objects_.capacity());
+
+  l.set(anb::object<ma>(1), anb::object<ma>(2), anb::object<ma>(3),
+        anb::object<ma>(4));
+  EXPECT_TRUE(l.objects_.is_inline());
+  const std::size_t inline_hash = list.hash();
+
+  l.objects_.push_back(l.objects_.front());
+  EXPECT_FALSE(l.objects_.is_inline());
+  EXPECT_EQ(5, l.objects_.size());
+  EXPECT_EQ(1, l.objects_.back().as_int32());
+
+  l.objects_.pop_back();
+  EXPECT_EQ(inline_hash, list.hash());
+  l.objects_.shrink_to_fit();
+  EXPECT_TRUE(l.objects_.is_inline());
+  for (std::int32_t i = 0; i < 4; ++i) {
+    EXPECT_EQ(i + 1, l.objects_.at(i).as_int32());
+  }
+
+  const anb::object<ma> tail[] = {anb::object<ma>(5), anb::object<ma>(6)};
+  l.objects_.insert(l.objects_.begin() + 1, std::begin(tail), std::end(tail));
+  EXPECT_EQ(6, l.objects_.size());
+  EXPECT_EQ(5, l.objects_.at(1).as_int32());
+  EXPECT_EQ(6, l.objects_.at(2).as_int32());
+  EXPECT_EQ(2, l.objects_.at(3).as_int32());
+
+  l.objects_.erase(l.objects_.begin(), l.objects_.begin() + 3);
+  EXPECT_EQ(3, l.objects_.size());
+  EXPECT_EQ(2, l.objects_.front().as_int32());
+
+  list.dealloc_heap(allocator);
+}
+
+namespace {
+
+class wide_inline_allocator : public mock_allocator {
+ public:
+  inline static constexpr std::size_t list_inline_capacity = 8;
+};
+
+}  // namespace
+
+TEST(anb, object_list_inline_capacity_from_allocator) {
+  static_assert(anb::list<wide_inline_allocator>::container_type::
+                    inline_capacity == 8);
+  static_assert(anb::list<ma>::container_type::inline_capacity == 4);
+}
+
+TEST(anb, object_list_from_range) {
+  std::vector<std::int32_t> ints(1000);
+  std::iota(ints.begin(), ints.end(), -500);
+
+  auto list = anb::object<ma>::make_list(allocator, ints);
+  anb::list<ma>& l = list.as_list(allocator);
+  ASSERT_EQ(1000, l.objects_.size());
+  // Reserved exactly once
+  EXPECT_EQ(1000, l.objects_.capacity());
+  for (std::size_t i = 0; i < ints.size(); ++i) {
+    EXPECT_EQ(ints[i], l.objects_[i].as_int32());
+  }
+
+  // Unsized ranges, strings of any length and objects
+  l.append_range(std::views::iota(0, 3) |
+                 std::views::filter([](int i) { return i != 1; }) |
+                 std::views::transform([](int i) { return i * 0.5; }));
+  const std::list<std::string> strs = {"sso", "longer than sso"};
+  l.append_range(strs);
+  const anb::object<ma> items[] = {anb::object<ma>(true),
+                                   anb::object<ma>::make_nothing()};
+  l.append_range(items);
+
+  ASSERT_EQ(1006, l.objects_.size());
+  EXPECT_EQ(0.0, l.objects_[1000].as_float64());
+  EXPECT_EQ(1.0, l.objects_[1001].as_float64());
+  EXPECT_EQ("sso", l.objects_[1002].as_string_sso());
+  EXPECT_EQ("longer than sso",
+            l.objects_[1003].as_string_heap(allocator).view());
+  EXPECT_TRUE(l.objects_[1004].as_boolean());
+  EXPECT_TRUE(l.objects_[1005].is_nothing());
+
+  // Same value as pushing the elements one by one
+  auto pushed = anb::object<ma>::make_list(allocator);
+  for (const auto i : ints) {
+    pushed.as_list(allocator).objects_.push_back(anb::object<ma>(i));
+  }
+  auto from_range = anb::object<ma>::make_list(allocator, ints);
+  EXPECT_EQ(pushed, from_range);
+  EXPECT_EQ(pushed.hash(), from_range.hash());
+
+  l.objects_[1003].dealloc_heap(allocator);
+  list.dealloc_heap(allocator);
+  pushed.dealloc_heap(allocator);
+  from_range.dealloc_heap(allocator);
+}
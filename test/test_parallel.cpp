@@ -0,0 +1,259 @@
+#include <gtest/gtest.h>
+
+#include <anb/parallel.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// parallel_clone allocates from the pool threads, so the allocator has to
+// be thread safe
+class locked_allocator {
+ public:
+  ~locked_allocator() {
+    for (auto obj_ptr : allocated_objects_) {
+      delete obj_ptr;
+    }
+  }
+
+  template <template <class> typename HeapObjT>
+  HeapObjT<locked_allocator>* alloc() {
+    std::size_t budget = budget_.load();
+    do {
+      if (budget == 0) {
+        throw std::bad_alloc();
+      }
+    } while (!budget_.compare_exchange_weak(budget, budget - 1));
+    auto ptr = new HeapObjT<locked_allocator>(*this);
+    std::lock_guard lock(mutex_);
+    allocated_objects_.push_back(ptr);
+    return ptr;
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<locked_allocator>* obj_ptr) {
+    {
+      std::lock_guard lock(mutex_);
+      allocated_objects_.erase(std::remove(allocated_objects_.begin(),
+                                           allocated_objects_.end(), obj_ptr));
+    }
+    delete obj_ptr;
+  }
+
+  void* allocate(std::size_t bytes, std::size_t alignment) {
+    if (std::this_thread::get_id() != owner_) {
+      ++foreign_allocations_;
+    }
+    return ::operator new(bytes, std::align_val_t{alignment});
+  }
+
+  void deallocate(void* ptr, std::size_t, std::size_t alignment) {
+    ::operator delete(ptr, std::align_val_t{alignment});
+  }
+
+  std::size_t size() {
+    std::lock_guard lock(mutex_);
+    return allocated_objects_.size();
+  }
+
+  // Raw allocations from threads other than the one that made the
+  // allocator
+  std::atomic<std::size_t> foreign_allocations_ = 0;
+  // Heap objects left to allocate before throwing std::bad_alloc
+  std::atomic<std::size_t> budget_ = SIZE_MAX;
+
+ private:
+  const std::thread::id owner_ = std::this_thread::get_id();
+  std::mutex mutex_;
+  std::vector<anb::heap_object<locked_allocator>*> allocated_objects_;
+};
+using la = locked_allocator;
+
+namespace {
+
+anb::object<la> make_graph(la& allocator, const std::int32_t n) {
+  auto root = anb::object<la>::make_list(allocator);
+  auto& objects = root.as_list(allocator).objects_;
+  for (std::int32_t i = 0; i < n; ++i) {
+    if (i % 97 == 0) {
+      auto nested = anb::object<la>::make_list(allocator);
+      for (std::int32_t j = 0; j < 50; ++j) {
+        nested.as_list(allocator).objects_.emplace_back(i * j);
+      }
+      objects.push_back(nested);
+    } else if (i % 101 == 0) {
+      auto dict = anb::object<la>::make_dictionary(allocator);
+      auto key = anb::object<la>::make_string_heap(allocator);
+      key.as_string_heap(allocator).set("key number " + std::to_string(i));
+      dict.as_dictionary(allocator).set<std::pair>(
+          {key, anb::object<la>(static_cast<double>(i) / 3.0)});
+      dict.as_dictionary(allocator).set<std::pair>(
+          {anb::object<la>(i), anb::object<la>(std::string_view{"v"})});
+      objects.push_back(dict);
+    } else if (i % 2 == 0) {
+      objects.emplace_back(static_cast<double>(i) * 1.5);
+    } else {
+      objects.emplace_back(i);
+    }
+  }
+  return root;
+}
+
+}  // namespace
+
+TEST(anb, parallel_hash_matches_serial) {
+  la allocator;
+  anb::task_pool pool(4);
+
+  const auto graph = make_graph(allocator, 20000);
+  EXPECT_EQ(graph.hash(), anb::parallel_hash(pool, allocator, graph));
+  EXPECT_EQ(graph.hash(), anb::parallel_hash(pool, allocator, graph, 64));
+  EXPECT_EQ(graph.hash(), anb::parallel_hash(pool, allocator, graph, 1));
+
+  const anb::object<la> i32(42);
+  EXPECT_EQ(i32.hash(), anb::parallel_hash(pool, allocator, i32));
+}
+
+TEST(anb, parallel_hash_flattens_ropes_first) {
+  la allocator;
+  anb::task_pool pool(4);
+
+  // Ropes in every chunk, each built from two pieces
+  const auto make_ropes = [&allocator] {
+    auto root = anb::object<la>::make_list(allocator);
+    for (std::int32_t i = 0; i < 1000; ++i) {
+      auto rope = anb::object<la>::make_string_heap(allocator);
+      auto tail = anb::object<la>::make_string_heap(allocator);
+      rope.as_string_heap(allocator).set("rope number ");
+      tail.as_string_heap(allocator).set(std::to_string(i) + " and more");
+      rope.as_string_heap(allocator).append(tail.as_string_heap(allocator));
+      root.as_list(allocator).objects_.push_back(rope);
+    }
+    return root;
+  };
+  const auto lhs = make_ropes();
+  const auto rhs = make_ropes();
+  const std::size_t foreign_before = allocator.foreign_allocations_;
+
+  const std::size_t hash = anb::parallel_hash(pool, allocator, lhs, 16);
+  EXPECT_TRUE(anb::parallel_equal(pool, allocator, lhs, rhs, 16));
+  EXPECT_EQ(foreign_before, allocator.foreign_allocations_);
+  EXPECT_EQ(lhs.hash(), hash);
+  EXPECT_EQ(1, lhs.as_list(allocator)
+                   .objects_[999]
+                   .as_string_heap(allocator)
+                   .piece_count());
+}
+
+TEST(anb, parallel_clone_and_equal) {
+  la allocator;
+  anb::task_pool pool(4);
+
+  const auto graph = make_graph(allocator, 20000);
+  const std::size_t allocated = allocator.size();
+
+  auto copy = anb::parallel_clone(pool, allocator, graph, 128);
+  EXPECT_EQ(2 * allocated, allocator.size());
+  EXPECT_NE(graph.nanbox_value(), copy.nanbox_value());
+  EXPECT_EQ(graph.hash(), copy.hash());
+  EXPECT_TRUE(anb::parallel_equal(pool, allocator, graph, copy, 128));
+
+  auto& objects = copy.as_list(allocator).objects_;
+  objects[97].as_list(allocator).objects_.back() = anb::object<la>(-1);
+  EXPECT_FALSE(anb::parallel_equal(pool, allocator, graph, copy, 128));
+
+  objects.pop_back();
+  EXPECT_FALSE(anb::parallel_equal(pool, allocator, graph, copy, 128));
+
+  EXPECT_FALSE(anb::parallel_equal(pool, allocator, graph, anb::object<la>(1)));
+  EXPECT_TRUE(anb::parallel_equal(pool, allocator, anb::object<la>(1),
+                                  anb::object<la>(1)));
+}
+
+TEST(anb, parallel_clone_failure_frees_copies) {
+  la allocator;
+  anb::task_pool pool(4);
+
+  const auto graph = make_graph(allocator, 20000);
+  const std::size_t allocated = allocator.size();
+
+  // Runs out with copies made on several threads
+  allocator.budget_ = allocated / 2;
+  EXPECT_THROW(anb::parallel_clone(pool, allocator, graph, 128),
+               std::bad_alloc);
+  EXPECT_EQ(allocated, allocator.size());
+
+  allocator.budget_ = SIZE_MAX;
+  const auto copy = anb::parallel_clone(pool, allocator, graph, 128);
+  EXPECT_EQ(2 * allocated, allocator.size());
+  EXPECT_EQ(graph, copy);
+}
+
+TEST(anb, parallel_cycles_and_deep_nesting) {
+  la allocator;
+  anb::task_pool pool(4);
+
+  // a = [0, ..., 99, a] and b alike, large enough to fork
+  const auto make_cyclic = [&allocator]() {
+    auto cyclic = anb::object<la>::make_list(allocator);
+    auto& objects = cyclic.as_list(allocator).objects_;
+    for (std::int32_t i = 0; i < 100; ++i) {
+      objects.emplace_back(i);
+    }
+    objects.push_back(cyclic);
+    return cyclic;
+  };
+  const auto a = make_cyclic();
+  auto b = make_cyclic();
+  EXPECT_EQ(a.hash(), anb::parallel_hash(pool, allocator, a, 8));
+  EXPECT_TRUE(anb::parallel_equal(pool, allocator, a, b, 8));
+  b.as_list(allocator).objects_.front() = anb::object<la>(-1);
+  EXPECT_FALSE(anb::parallel_equal(pool, allocator, a, b, 8));
+
+  const std::size_t allocated = allocator.size();
+  EXPECT_THROW(anb::parallel_clone(pool, allocator, a, 8),
+               std::invalid_argument);
+  EXPECT_EQ(allocated, allocator.size());
+
+  // [0, [1, [2, ...]]] forks down to max_fork_depth, then each task walks
+  // the rest on its own
+  constexpr std::int32_t depth = 100000;
+  auto nested = anb::object<la>::make_list(allocator);
+  auto current = nested;
+  for (std::int32_t i = 0; i < depth; ++i) {
+    auto child = anb::object<la>::make_list(allocator);
+    current.as_list(allocator).set(anb::object<la>(i), child);
+    current = child;
+  }
+  EXPECT_EQ(nested.hash(), anb::parallel_hash(pool, allocator, nested, 1));
+  const auto copy = anb::parallel_clone(pool, allocator, nested, 1);
+  EXPECT_EQ(nested.hash(), copy.hash());
+  EXPECT_TRUE(anb::parallel_equal(pool, allocator, nested, copy, 1));
+  EXPECT_EQ(std::strong_ordering::equal, nested.compare(copy));
+}
+
+TEST(anb, task_pool_nested_fork_join) {
+  anb::task_pool pool(3);
+  std::atomic<int> count = 0;
+
+  anb::task_pool::task_group outer(pool);
+  for (int i = 0; i < 16; ++i) {
+    outer.run([&pool, &count]() {
+      anb::task_pool::task_group inner(pool);
+      for (int j = 0; j < 16; ++j) {
+        inner.run([&count]() { count.fetch_add(1); });
+      }
+      inner.wait();
+    });
+  }
+  outer.wait();
+  EXPECT_EQ(256, count.load());
+}
@@ -0,0 +1,340 @@
+#include <gtest/gtest.h>
+
+#include <anb/clone.hpp>
+#include <anb/footprint.hpp>
+#include <anb/object.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <new>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+using obj = anb::object<ma>;
+using pdict = anb::persistent_dictionary<ma>;
+
+// Hands out the nodes of tries whose keys collide, see the hamt_key_hash
+// specialization below
+class collision_allocator {
+ public:
+  void* allocate(std::size_t bytes, std::size_t alignment) {
+    live_bytes_ += bytes;
+    return ::operator new(bytes, std::align_val_t{alignment});
+  }
+
+  void deallocate(void* ptr, std::size_t bytes, std::size_t alignment) {
+    live_bytes_ -= bytes;
+    ::operator delete(ptr, std::align_val_t{alignment});
+  }
+
+  std::size_t live_bytes_ = 0;
+};
+
+}  // namespace
+
+// Integer keys 4k to 4k+3 share the full hash k
+template <>
+struct anb::detail::hamt_key_hash<collision_allocator> {
+  static std::size_t of(const anb::object<collision_allocator>& key) {
+    return static_cast<std::size_t>(key.as_int32() / 4);
+  }
+};
+
+TEST(anb, persistent_dictionary_versions) {
+  ma pool;
+  std::vector<obj> versions = {obj::make_persistent_dictionary(pool)};
+  EXPECT_TRUE(versions[0].is_persistent_dictionary(pool));
+  EXPECT_FALSE(versions[0].is_dictionary(pool));
+  EXPECT_EQ(sizeof(double), sizeof(versions[0]));
+
+  // Version i maps 0..i-1 to their squares
+  constexpr std::int32_t count = 2000;
+  for (std::int32_t i = 0; i < count; ++i) {
+    const pdict& previous = versions.back().as_persistent_dictionary(pool);
+    versions.push_back(previous.set(obj(i), obj(i * i)));
+  }
+  for (std::int32_t i = 0; i <= count; i += 97) {
+    const pdict& version = versions[i].as_persistent_dictionary(pool);
+    EXPECT_EQ(static_cast<std::size_t>(i), version.size());
+    EXPECT_EQ(nullptr, version.find(i));
+    if (i > 0) {
+      EXPECT_EQ((i - 1) * (i - 1), version.at(i - 1).as_int32());
+    }
+  }
+  EXPECT_THROW(versions[0].as_persistent_dictionary(pool).at(0),
+               std::out_of_range);
+
+  // A new version shares everything but the path to the key it changed
+  const pdict& last = versions.back().as_persistent_dictionary(pool);
+  auto changed = last.set(obj(5), obj(-5));
+  const pdict& next = changed.as_persistent_dictionary(pool);
+  EXPECT_EQ(25, last.at(5).as_int32());
+  EXPECT_EQ(-5, next.at(5).as_int32());
+  std::unordered_set<const void*> seen;
+  const std::size_t last_bytes = last.trie_.memory_usage(&seen);
+  const std::size_t added_bytes = next.trie_.memory_usage(&seen);
+  EXPECT_GT(added_bytes, 0);
+  EXPECT_LT(added_bytes * 10, last_bytes);
+
+  // Strings are found without boxing them
+  auto name = obj::make_string_heap(pool);
+  name.as_string_heap(pool).set("a key longer than sso");
+  auto named = next.set(name, obj(true));
+  const pdict& with_name = named.as_persistent_dictionary(pool);
+  EXPECT_TRUE(with_name.contains(std::string_view{"a key longer than sso"}));
+  EXPECT_FALSE(next.contains(std::string_view{"a key longer than sso"}));
+
+  auto erased = with_name.erase(obj(5));
+  const pdict& without = erased.as_persistent_dictionary(pool);
+  EXPECT_EQ(with_name.size() - 1, without.size());
+  EXPECT_FALSE(without.contains(5));
+  EXPECT_EQ(-5, with_name.at(5).as_int32());
+
+  for (auto version : versions) {
+    version.dealloc_heap(pool);
+  }
+  for (auto version : {changed, named, erased, name}) {
+    version.dealloc_heap(pool);
+  }
+  EXPECT_TRUE(pool.allocated_objects_.empty());
+  EXPECT_EQ(0, pool.allocated_bytes_);
+}
+
+TEST(anb, persistent_dictionary_transient) {
+  ma pool;
+  constexpr std::int32_t count = 5000;
+  std::vector<std::int32_t> keys;
+  std::vector<std::string> values;
+  for (std::int32_t i = 0; i < count; ++i) {
+    keys.push_back(i);
+    values.push_back("value " + std::to_string(i));
+  }
+
+  pdict::transient batch(pool);
+  batch.insert_range(keys, values);
+  EXPECT_EQ(count, batch.size());
+  auto loaded = batch.persist();
+  EXPECT_THROW(batch.insert_range(keys, std::vector<std::int32_t>{1}),
+               std::invalid_argument);
+  // Unsized ranges are checked as they are walked, extra values included
+  pdict::transient extra(pool);
+  const std::vector<std::int32_t> few = {1, 2};
+  auto unsized_keys =
+      few | std::views::filter([](std::int32_t) { return true; });
+  EXPECT_THROW(
+      extra.insert_range(unsized_keys, std::vector<std::int32_t>{1, 2, 3}),
+      std::invalid_argument);
+
+  // The transient keeps going without touching the persisted version
+  EXPECT_FALSE(batch.set(obj(7), obj(-7)));
+  EXPECT_TRUE(batch.set(obj(count), obj(count)));
+  const pdict& version = loaded.as_persistent_dictionary(pool);
+  EXPECT_EQ(count, version.size());
+  EXPECT_EQ("value 7", version.at(7).as_string_heap(pool).view());
+  EXPECT_EQ(-7, batch.find(obj(7))->as_int32());
+
+  // Replacing the value of a string key reuses the stored key
+  pdict::transient named(pool);
+  const std::vector<std::string> name = {"a rather long key"};
+  named.insert_range(name, std::vector<std::int32_t>{1});
+  const std::size_t allocated = pool.allocated_objects_.size();
+  named.insert_range(name, std::vector<std::int32_t>{2});
+  EXPECT_EQ(allocated, pool.allocated_objects_.size());
+  EXPECT_EQ(1, named.size());
+  auto named_version = named.persist();
+  EXPECT_EQ(2, named_version.as_persistent_dictionary(pool)
+                   .at("a rather long key")
+                   .as_int32());
+  for (const auto& e : named_version.as_persistent_dictionary(pool)) {
+    obj key = e.key;
+    key.dealloc_heap(pool);
+  }
+  named_version.dealloc_heap(pool);
+
+  // Erasing every key folds the trie back down to nothing
+  pdict::transient emptied(version);
+  for (std::int32_t i = 0; i < count; ++i) {
+    ASSERT_TRUE(emptied.erase(obj(i)));
+    if (i % 500 == 0) {
+      ASSERT_EQ(nullptr, emptied.find(obj(i)));
+      ASSERT_NE(nullptr, emptied.find(obj(count - 1)));
+    }
+  }
+  EXPECT_EQ(0, emptied.size());
+  EXPECT_FALSE(emptied.erase(obj(0)));
+  auto empty = emptied.persist();
+  EXPECT_EQ(0, empty.as_persistent_dictionary(pool).trie_.memory_usage());
+
+  auto built = obj::make_persistent_dictionary(pool, keys, values);
+  EXPECT_EQ(loaded, built);
+
+  for (const obj& strings : {loaded, built}) {
+    for (const auto& e : strings.as_persistent_dictionary(pool)) {
+      obj value = e.value;
+      value.dealloc_heap(pool);
+    }
+  }
+  for (auto heap_obj : {loaded, empty, built}) {
+    heap_obj.dealloc_heap(pool);
+  }
+  EXPECT_TRUE(pool.allocated_objects_.empty());
+}
+
+TEST(anb, persistent_dictionary_deep_operations) {
+  ma pool;
+  auto list = obj::make_list(pool);
+  list.as_list(pool).objects_.push_back(obj(2.5));
+
+  // The same entries set in opposite orders
+  pdict::transient forward(pool);
+  pdict::transient backward(pool);
+  for (std::int32_t i = 0; i < 100; ++i) {
+    forward.set(obj(i), obj(-i));
+    backward.set(obj(99 - i), obj(i - 99));
+  }
+  forward.set(obj(std::string_view{"list"}), list);
+  backward.set(obj(std::string_view{"list"}), list);
+  auto lhs = forward.persist();
+  auto rhs = backward.persist();
+  EXPECT_EQ(lhs, rhs);
+  EXPECT_EQ(lhs.hash(), rhs.hash());
+  EXPECT_TRUE(lhs.compare(rhs) == 0);
+
+  // A dictionary with the same entries has another type
+  auto dict = obj::make_dictionary(pool);
+  for (const auto& e : lhs.as_persistent_dictionary(pool)) {
+    dict.as_dictionary(pool).object_dict_.insert({e.key, e.value});
+  }
+  EXPECT_NE(lhs, dict);
+  EXPECT_NE(lhs.hash(), dict.hash());
+  EXPECT_GT(lhs, dict);
+  EXPECT_LT(dict.sort_key(), lhs.sort_key());
+
+  auto smaller = lhs.as_persistent_dictionary(pool).set(obj(3), obj(-4));
+  EXPECT_GT(lhs, smaller);
+  EXPECT_NE(lhs, smaller);
+
+  // Assigning a version shares its trie
+  auto target = obj(1);
+  target.assign(pool, lhs);
+  EXPECT_TRUE(target.as_persistent_dictionary(pool).trie_.shares_root(
+      lhs.as_persistent_dictionary(pool).trie_));
+  EXPECT_EQ(lhs, target);
+
+  auto copy = anb::deep_clone(pool, pool, lhs);
+  EXPECT_EQ(lhs, copy);
+  auto copied_list =
+      copy.as_persistent_dictionary(pool).at(std::string_view{"list"});
+  EXPECT_NE(&list.as_list(pool), &copied_list.as_list(pool));
+
+  // Versions sharing their trie retain its nodes once
+  const std::size_t trie_bytes =
+      lhs.as_persistent_dictionary(pool).trie_.memory_usage();
+  auto both = obj::make_list(pool);
+  both.as_list(pool).objects_.push_back(lhs);
+  both.as_list(pool).objects_.push_back(target);
+  const anb::footprint size = anb::deep_size(pool, both);
+  const auto& tries = size[anb::heap_object_type::persistent_dictionary];
+  EXPECT_EQ(2, tries.count);
+  EXPECT_EQ(trie_bytes, tries.buffer_bytes);
+
+  copied_list.dealloc_heap(pool);
+  for (auto heap_obj : {lhs, rhs, dict, smaller, target, copy, both, list}) {
+    heap_obj.dealloc_heap(pool);
+  }
+  EXPECT_TRUE(pool.allocated_objects_.empty());
+}
+
+TEST(anb, persistent_dictionary_hash_collisions) {
+  using cobj = anb::object<collision_allocator>;
+  using trie = anb::detail::hamt<collision_allocator>;
+  collision_allocator pool;
+  const auto value_of = [](const trie& t, const std::int32_t key) {
+    const auto* e = t.find(cobj(key));
+    return e == nullptr ? -1 : e->value.as_int32();
+  };
+  const auto keys_of = [](const trie& t) {
+    std::vector<std::int32_t> keys;
+    for (const auto& e : t) {
+      keys.push_back(e.key.as_int32());
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+  };
+  const auto usage_of = [&pool](std::initializer_list<std::int32_t> keys) {
+    trie fresh(pool);
+    for (const std::int32_t key : keys) {
+      fresh.set(cobj(key), cobj(key));
+    }
+    return fresh.memory_usage();
+  };
+
+  {
+    // 0 and 1 merge all the way down into a collision node, which grows
+    // and is changed in place while the trie is the only one using it
+    trie t(pool);
+    EXPECT_TRUE(t.set(cobj(0), cobj(0)));
+    EXPECT_TRUE(t.set(cobj(1), cobj(1)));
+    EXPECT_TRUE(t.set(cobj(2), cobj(2)));
+    EXPECT_FALSE(t.set(cobj(1), cobj(10)));
+    EXPECT_TRUE(t.set(cobj(4), cobj(4)));
+    EXPECT_EQ(4, t.size());
+    EXPECT_EQ(10, value_of(t, 1));
+    EXPECT_EQ(2, value_of(t, 2));
+    EXPECT_EQ(-1, value_of(t, 3));
+    EXPECT_EQ(-1, value_of(t, 5));
+    EXPECT_EQ(-1, value_of(t, 8));
+
+    // Versions sharing the collision node copy it instead
+    const trie before = t;
+    EXPECT_TRUE(t.set(cobj(3), cobj(3)));
+    EXPECT_FALSE(t.set(cobj(0), cobj(20)));
+    const trie same = t;
+    EXPECT_FALSE(t.set(cobj(2), cobj(2)));
+    EXPECT_TRUE(t.shares_root(same));
+    // An entry of the shared root merges with a colliding key
+    EXPECT_TRUE(t.set(cobj(5), cobj(5)));
+
+    EXPECT_EQ((std::vector<std::int32_t>{0, 1, 2, 4}), keys_of(before));
+    EXPECT_EQ(0, value_of(before, 0));
+    EXPECT_EQ(-1, value_of(before, 3));
+    EXPECT_EQ((std::vector<std::int32_t>{0, 1, 2, 3, 4, 5}), keys_of(t));
+    EXPECT_EQ(20, value_of(t, 0));
+    EXPECT_EQ(3, value_of(t, 3));
+    EXPECT_EQ(5, value_of(t, 5));
+
+    // Erasing down to one key folds it up to where it would be without
+    // the collisions
+    EXPECT_FALSE(t.erase(cobj(6)));
+    EXPECT_TRUE(t.erase(cobj(0)));
+    EXPECT_TRUE(t.erase(cobj(2)));
+    EXPECT_TRUE(t.erase(cobj(1)));
+    EXPECT_FALSE(t.erase(cobj(1)));
+    EXPECT_EQ(-1, value_of(t, 1));
+    EXPECT_EQ(3, value_of(t, 3));
+    EXPECT_EQ(usage_of({3, 4, 5}), t.memory_usage());
+    EXPECT_TRUE(t.erase(cobj(4)));
+    EXPECT_EQ(usage_of({3, 5}), t.memory_usage());
+    EXPECT_TRUE(t.erase(cobj(3)));
+    EXPECT_EQ(usage_of({5}), t.memory_usage());
+    EXPECT_EQ((std::vector<std::int32_t>{5}), keys_of(t));
+    EXPECT_TRUE(t.erase(cobj(5)));
+    EXPECT_TRUE(t.empty());
+    EXPECT_EQ(nullptr, t.find(cobj(5)));
+
+    EXPECT_EQ(4, before.size());
+    EXPECT_EQ(10, value_of(before, 1));
+    EXPECT_EQ((std::vector<std::int32_t>{0, 1, 2, 3, 4}), keys_of(same));
+    EXPECT_EQ(20, value_of(same, 0));
+  }
+  EXPECT_EQ(0, pool.live_bytes_);
+}
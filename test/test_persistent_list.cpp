@@ -0,0 +1,265 @@
+#include <gtest/gtest.h>
+
+#include <anb/clone.hpp>
+#include <anb/footprint.hpp>
+#include <anb/object.hpp>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+using obj = anb::object<ma>;
+using plist = anb::persistent_list<ma>;
+
+std::vector<std::int32_t> elements_of(const plist& list) {
+  std::vector<std::int32_t> elements;
+  for (const obj& element : list) {
+    elements.push_back(element.as_int32());
+  }
+  return elements;
+}
+
+}  // namespace
+
+TEST(anb, persistent_list_versions) {
+  ma pool;
+  std::vector<obj> versions = {obj::make_persistent_list(pool)};
+  EXPECT_TRUE(versions[0].is_persistent_list(pool));
+  EXPECT_FALSE(versions[0].is_list(pool));
+  EXPECT_EQ(sizeof(double), sizeof(versions[0]));
+
+  // Version i holds 0..i-1
+  constexpr std::int32_t count = 2000;
+  for (std::int32_t i = 0; i < count; ++i) {
+    const plist& previous = versions.back().as_persistent_list(pool);
+    versions.push_back(previous.push_back(obj(i)));
+  }
+  for (std::int32_t i = 0; i <= count; i += 97) {
+    const plist& version = versions[i].as_persistent_list(pool);
+    ASSERT_EQ(static_cast<std::size_t>(i), version.size());
+    for (std::int32_t j = 0; j < i; j += 13) {
+      ASSERT_EQ(j, version[j].as_int32());
+    }
+  }
+  const plist& empty = versions[0].as_persistent_list(pool);
+  EXPECT_THROW(empty.at(0), std::out_of_range);
+  EXPECT_THROW(empty.set(0, obj(1)), std::out_of_range);
+  EXPECT_THROW(empty.slice(0, 1), std::out_of_range);
+
+  // A new version shares everything but the path to the element it
+  // changed
+  const plist& last = versions.back().as_persistent_list(pool);
+  EXPECT_THROW(last.slice(2, 1), std::out_of_range);
+  auto changed = last.set(5, obj(-5));
+  const plist& next = changed.as_persistent_list(pool);
+  EXPECT_EQ(5, last.at(5).as_int32());
+  EXPECT_EQ(-5, next.at(5).as_int32());
+  EXPECT_EQ(last.size(), next.size());
+  std::unordered_set<const void*> seen;
+  const std::size_t last_bytes = last.tree_.memory_usage(&seen);
+  const std::size_t added_bytes = next.tree_.memory_usage(&seen);
+  EXPECT_GT(added_bytes, 0);
+  EXPECT_LT(added_bytes * 10, last_bytes);
+
+  // Versions appended to one after the other share every full leaf
+  std::vector<std::int32_t> expected(count);
+  for (std::int32_t i = 0; i < count; ++i) {
+    expected[i] = i;
+  }
+  EXPECT_EQ(expected, elements_of(last));
+  const std::size_t shared_bytes =
+      versions[count - 1].as_persistent_list(pool).tree_.memory_usage(&seen);
+  EXPECT_LT(shared_bytes * 10, last_bytes);
+
+  for (auto version : versions) {
+    version.dealloc_heap(pool);
+  }
+  changed.dealloc_heap(pool);
+  EXPECT_TRUE(pool.allocated_objects_.empty());
+  EXPECT_EQ(0, pool.allocated_bytes_);
+}
+
+TEST(anb, persistent_list_transient) {
+  ma pool;
+  constexpr std::int32_t count = 5000;
+  std::vector<std::int32_t> elements;
+  for (std::int32_t i = 0; i < count; ++i) {
+    elements.push_back(i);
+  }
+
+  plist::transient batch(pool);
+  batch.append_range(elements);
+  EXPECT_EQ(count, batch.size());
+  auto loaded = batch.persist();
+
+  // The transient keeps going without touching the persisted version
+  batch.set(7, obj(-7));
+  batch.push_back(obj(count));
+  const plist& version = loaded.as_persistent_list(pool);
+  EXPECT_EQ(elements, elements_of(version));
+  EXPECT_EQ(-7, batch[7].as_int32());
+  EXPECT_EQ(count + 1, batch.size());
+
+  plist::transient reversed(version);
+  for (std::int32_t i = 0; i < count; ++i) {
+    reversed.set(i, obj(count - 1 - i));
+  }
+  auto backward = reversed.persist();
+  EXPECT_EQ(count - 1, backward.as_persistent_list(pool)[0].as_int32());
+  EXPECT_EQ(0, version[0].as_int32());
+
+  auto built = obj::make_persistent_list(pool, elements);
+  EXPECT_EQ(loaded, built);
+  EXPECT_LT(built, backward);
+
+  // Strings are boxed on the way in
+  const std::vector<std::string> names = {"a", "a string longer than sso"};
+  auto strings = obj::make_persistent_list(pool, names);
+  const plist& boxed = strings.as_persistent_list(pool);
+  EXPECT_EQ("a", boxed[0].as_string_sso());
+  EXPECT_EQ(names[1], boxed[1].as_string_heap(pool).view());
+  obj heap_string = boxed[1];
+  heap_string.dealloc_heap(pool);
+
+  for (auto heap_obj : {loaded, backward, built, strings}) {
+    heap_obj.dealloc_heap(pool);
+  }
+  EXPECT_TRUE(pool.allocated_objects_.empty());
+}
+
+TEST(anb, persistent_list_concat_slice) {
+  ma pool;
+  std::mt19937 rng(49);
+  std::vector<obj> versions = {obj::make_persistent_list(pool)};
+
+  // Lists of every shape concatenated onto each other, checked against a
+  // vector holding the same elements
+  std::vector<std::int32_t> model;
+  for (std::int32_t round = 0; round < 60; ++round) {
+    const std::size_t length = std::uniform_int_distribution<std::size_t>(
+        0, (round % 3 == 0) ? 1500 : 70)(rng);
+    std::vector<std::int32_t> part;
+    for (std::size_t i = 0; i < length; ++i) {
+      part.push_back(static_cast<std::int32_t>(model.size() + i));
+    }
+    auto right = obj::make_persistent_list(pool, part);
+    const plist& left = versions.back().as_persistent_list(pool);
+    versions.push_back(left.concat(right.as_persistent_list(pool)));
+    right.dealloc_heap(pool);
+    model.insert(model.end(), part.begin(), part.end());
+
+    const plist& joined = versions.back().as_persistent_list(pool);
+    ASSERT_EQ(model.size(), joined.size());
+    for (std::size_t i = 0; i < model.size(); i += 7) {
+      ASSERT_EQ(model[i], joined[i].as_int32());
+    }
+    ASSERT_EQ(model, elements_of(joined));
+  }
+  const plist& all = versions.back().as_persistent_list(pool);
+
+  // Slices at random bounds, joined back together
+  std::uniform_int_distribution<std::size_t> bound(0, model.size());
+  for (std::int32_t round = 0; round < 40; ++round) {
+    std::size_t first = bound(rng);
+    std::size_t last = bound(rng);
+    if (first > last) {
+      std::swap(first, last);
+    }
+    auto head = all.slice(0, first);
+    auto middle = all.slice(first, last);
+    auto tail = all.slice(last, model.size());
+    ASSERT_EQ(std::vector<std::int32_t>(model.begin() + first,
+                                        model.begin() + last),
+              elements_of(middle.as_persistent_list(pool)));
+    auto front = head.as_persistent_list(pool).concat(
+        middle.as_persistent_list(pool));
+    auto rejoined =
+        front.as_persistent_list(pool).concat(tail.as_persistent_list(pool));
+    ASSERT_EQ(model, elements_of(rejoined.as_persistent_list(pool)));
+    for (auto version : {head, middle, tail, front, rejoined}) {
+      version.dealloc_heap(pool);
+    }
+  }
+
+  // A slice shares the nodes fully inside it
+  std::unordered_set<const void*> seen;
+  const std::size_t all_bytes = all.tree_.memory_usage(&seen);
+  auto inside = all.slice(1000, model.size() - 1000);
+  EXPECT_GT(all_bytes, 0);
+  EXPECT_LT(inside.as_persistent_list(pool).tree_.memory_usage(&seen) * 10,
+            all_bytes);
+
+  inside.dealloc_heap(pool);
+  for (auto version : versions) {
+    version.dealloc_heap(pool);
+  }
+  EXPECT_TRUE(pool.allocated_objects_.empty());
+  EXPECT_EQ(0, pool.allocated_bytes_);
+}
+
+TEST(anb, persistent_list_deep_operations) {
+  ma pool;
+  auto inner = obj::make_list(pool);
+  inner.as_list(pool).objects_.push_back(obj(2.5));
+
+  // A persistent list is equal to, and hashes like, a list with the same
+  // elements
+  auto list = obj::make_list(pool);
+  plist::transient batch(pool);
+  for (std::int32_t i = 0; i < 100; ++i) {
+    list.as_list(pool).objects_.push_back(obj(i));
+    batch.push_back(obj(i));
+  }
+  list.as_list(pool).objects_.push_back(inner);
+  batch.push_back(inner);
+  auto persistent = batch.persist();
+  EXPECT_EQ(persistent, list);
+  EXPECT_EQ(list, persistent);
+  EXPECT_EQ(persistent.hash(), list.hash());
+  EXPECT_TRUE(persistent.compare(list) == 0);
+  EXPECT_EQ(list.sort_key(), persistent.sort_key());
+
+  auto smaller = persistent.as_persistent_list(pool).set(3, obj(-4));
+  EXPECT_GT(persistent, smaller);
+  EXPECT_GT(list, smaller);
+  EXPECT_NE(list, smaller);
+  auto shorter = persistent.as_persistent_list(pool).slice(0, 50);
+  EXPECT_LT(shorter, list);
+
+  // Assigning a version shares its tree
+  auto target = obj(1);
+  target.assign(pool, persistent);
+  EXPECT_TRUE(target.as_persistent_list(pool).tree_.shares_root(
+      persistent.as_persistent_list(pool).tree_));
+  EXPECT_EQ(persistent, target);
+
+  auto copy = anb::deep_clone(pool, pool, persistent);
+  EXPECT_TRUE(copy.is_persistent_list(pool));
+  EXPECT_EQ(persistent, copy);
+  auto copied_inner = copy.as_persistent_list(pool)[100];
+  EXPECT_NE(&inner.as_list(pool), &copied_inner.as_list(pool));
+
+  // Versions sharing their tree retain its nodes once
+  const std::size_t tree_bytes =
+      persistent.as_persistent_list(pool).tree_.memory_usage();
+  auto both = obj::make_list(pool);
+  both.as_list(pool).objects_.push_back(persistent);
+  both.as_list(pool).objects_.push_back(target);
+  const anb::footprint size = anb::deep_size(pool, both);
+  const auto& trees = size[anb::heap_object_type::persistent_list];
+  EXPECT_EQ(2, trees.count);
+  EXPECT_EQ(tree_bytes, trees.buffer_bytes);
+
+  copied_inner.dealloc_heap(pool);
+  for (auto heap_obj :
+       {persistent, list, smaller, shorter, target, copy, both, inner}) {
+    heap_obj.dealloc_heap(pool);
+  }
+  EXPECT_TRUE(pool.allocated_objects_.empty());
+}
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <anb/sort.hpp>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "test_allocator.hpp"
+
+TEST(anb, object_total_order) {
+  const auto nothing = anb::object<ma>::make_nothing();
+  const anb::object<ma> bool_f(false);
+  const anb::object<ma> bool_t(true);
+  const anb::object<ma> neg_inf(-std::numeric_limits<double>::infinity());
+  const anb::object<ma> neg_zero(-0.0);
+  const anb::object<ma> zero(0.0);
+  const anb::object<ma> one_i32(std::int32_t{1});
+  const anb::object<ma> one_fp64(1.0);
+  const anb::object<ma> pos_inf(std::numeric_limits<double>::infinity());
+  const auto qnan = anb::object<ma>::make_qnan();
+  const anb::object<ma> str_sso(std::string_view{"abc"});
+
+  auto str_heap = anb::object<ma>::make_string_heap(allocator);
+  str_heap.as_string_heap(allocator).set("abcdefghijk");
+  auto same_heap = anb::object<ma>::make_string_heap(allocator);
+  same_heap.as_string_heap(allocator).set("abc");
+
+  auto list = anb::object<ma>::make_list(allocator);
+  list.as_list(allocator).set(one_i32, str_sso);
+  auto longer_list = anb::object<ma>::make_list(allocator);
+  longer_list.as_list(allocator).set(one_i32, str_sso, nothing);
+  auto tuple = anb::object<ma>::make_tuple(allocator, one_i32);
+  auto dict = anb::object<ma>::make_dictionary(allocator);
+
+  EXPECT_TRUE(pos_inf.is_float64());
+  EXPECT_TRUE(neg_inf.is_float64());
+
+  const std::vector<anb::object<ma>> ascending{
+      nothing,  bool_f,   bool_t,  neg_inf, neg_zero,    zero,
+      one_i32,  one_fp64, pos_inf, qnan,    str_sso,     str_heap,
+      list,     longer_list,       tuple,   dict};
+  for (std::size_t i = 0; i < ascending.size(); ++i) {
+    for (std::size_t j = 0; j < ascending.size(); ++j) {
+      EXPECT_EQ(i <=> j, ascending[i] <=> ascending[j]) << i << " " << j;
+      if (i < j) {
+        EXPECT_LE(ascending[i].sort_key(), ascending[j].sort_key())
+            << i << " " << j;
+      }
+    }
+  }
+
+  // Equality is structural, wherever a string is stored
+  EXPECT_EQ(str_sso, same_heap);
+  EXPECT_EQ(str_sso.hash(), same_heap.hash());
+  EXPECT_NE(one_i32, one_fp64);
+
+  auto same_list = anb::object<ma>::make_list(allocator);
+  same_list.as_list(allocator).set(one_i32, same_heap);
+  EXPECT_EQ(list, same_list);
+  EXPECT_EQ(list.hash(), same_list.hash());
+
+  auto other_dict = anb::object<ma>::make_dictionary(allocator);
+  dict.as_dictionary(allocator).set<std::pair>({str_sso, one_i32});
+  dict.as_dictionary(allocator).set<std::pair>({bool_t, list});
+  other_dict.as_dictionary(allocator).set<std::pair>({bool_t, same_list});
+  other_dict.as_dictionary(allocator).set<std::pair>({same_heap, one_i32});
+  EXPECT_EQ(dict, other_dict);
+  other_dict.as_dictionary(allocator).object_dict_.insert_or_assign(same_heap,
+                                                                   one_fp64);
+  EXPECT_NE(dict, other_dict);
+  EXPECT_LT(dict, other_dict);
+
+  tuple.dealloc_heap(allocator);
+  while (!allocator.allocated_objects_.empty()) {
+    allocator.pop();
+  }
+}
+
+TEST(anb, object_sort) {
+  std::mt19937 rng(1946);
+  std::vector<anb::object<ma>> objects;
+  for (std::int32_t i = 0; i < 2000; ++i) {
+    switch (rng() % 6) {
+      case 0:
+        objects.emplace_back(static_cast<std::int32_t>(rng() % 100) - 50);
+        break;
+      case 1:
+        objects.emplace_back(static_cast<double>(rng() % 100) / 2 - 25);
+        break;
+      case 2:
+        objects.emplace_back(std::string(rng() % 4, 'a' + rng() % 3));
+        break;
+      case 3: {
+        auto str = anb::object<ma>::make_string_heap(allocator);
+        str.as_string_heap(allocator).set(std::string(7 + rng() % 3, 'a'));
+        objects.push_back(str);
+        break;
+      }
+      case 4: {
+        auto list = anb::object<ma>::make_list(allocator);
+        list.as_list(allocator).set(
+            anb::object<ma>(static_cast<std::int32_t>(rng() % 10)));
+        objects.push_back(list);
+        break;
+      }
+      default:
+        objects.emplace_back(static_cast<bool>(rng() % 2));
+        break;
+    }
+  }
+  ASSERT_GT(objects.size(), anb::radix_sort_threshold);
+
+  auto expected = objects;
+  std::sort(expected.begin(), expected.end());
+
+  anb::sort(std::span<anb::object<ma>>(objects));
+  ASSERT_EQ(expected.size(), objects.size());
+  for (std::size_t i = 0; i < objects.size(); ++i) {
+    EXPECT_EQ(expected[i], objects[i]) << i;
+  }
+
+  auto list = anb::object<ma>::make_list(allocator);
+  anb::list<ma>& l = list.as_list(allocator);
+  l.set(anb::object<ma>(2.5), anb::object<ma>(std::int32_t{-3}),
+        anb::object<ma>::make_nothing());
+  anb::sort(l);
+  EXPECT_TRUE(l.objects_.at(0).is_nothing());
+  EXPECT_EQ(-3, l.objects_.at(1).as_int32());
+  EXPECT_EQ(2.5, l.objects_.at(2).as_float64());
+
+  while (!allocator.allocated_objects_.empty()) {
+    allocator.pop();
+  }
+}
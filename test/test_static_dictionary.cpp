@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include <anb/static_dictionary.hpp>
+#include <string>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+using obj = anb::object<ma>;
+
+constexpr auto http_methods = anb::make_static_dictionary<ma>({
+    {"GET", obj(std::int32_t{1})},
+    {"HEAD", obj(std::int32_t{2})},
+    {"POST", obj(std::int32_t{3})},
+    {"PUT", obj(std::int32_t{4})},
+    {"DELETE", obj(std::int32_t{5})},
+    {"CONNECT", obj(std::int32_t{6})},
+    {"OPTIONS", obj(std::int32_t{7})},
+    {"TRACE", obj(std::int32_t{8})},
+    {"PATCH", obj(std::int32_t{9})},
+    {obj(std::int32_t{404}), obj(std::string_view{"nf"})},
+    {obj(true), obj(2.5)},
+});
+
+}  // namespace
+
+TEST(anb, static_dictionary) {
+  static_assert(http_methods.size() == 11);
+  static_assert(http_methods.at("DELETE").as_int32() == 5);
+  static_assert(http_methods.at(obj(std::string_view{"PATCH"})).as_int32() ==
+                9);
+  static_assert(http_methods.at(obj(std::int32_t{404})).as_string_sso() ==
+                "nf");
+  static_assert(!http_methods.contains("PURGE"));
+  static_assert(!http_methods.contains(obj(404.0)));
+
+  // Every key lands in its own slot
+  for (const auto& [key, value] : http_methods) {
+    if (key.is_string()) {
+      ASSERT_NE(nullptr, http_methods.find(key.string()));
+      EXPECT_EQ(value, *http_methods.find(key.string()));
+    } else {
+      ASSERT_NE(nullptr, http_methods.find(key.fixed()));
+      EXPECT_EQ(value, *http_methods.find(key.fixed()));
+    }
+  }
+
+  // Heap strings are matched by their contents
+  auto heap_key = obj::make_string_heap(allocator);
+  heap_key.as_string_heap(allocator).set("CONNECT");
+  ASSERT_TRUE(http_methods.contains(heap_key));
+  EXPECT_EQ(6, http_methods.at(heap_key).as_int32());
+  EXPECT_EQ(2.5, http_methods.at(obj(true)).as_float64());
+  EXPECT_EQ(nullptr, http_methods.find(obj(false)));
+  EXPECT_THROW(http_methods.at("PURGE"), std::out_of_range);
+
+  auto dict = http_methods.to_dictionary(allocator);
+  const anb::dictionary<ma>& d = dict.as_dictionary(allocator);
+  EXPECT_EQ(11, d.object_dict_.size());
+  EXPECT_EQ(7, d.at("OPTIONS").as_int32());
+  EXPECT_EQ(4, d.at("PUT").as_int32());
+  EXPECT_EQ("nf", d.at(std::int32_t{404}).as_string_sso());
+
+  EXPECT_THROW(anb::make_static_dictionary<ma>({
+                   {"same", obj(std::int32_t{1})},
+                   {obj(std::string_view{"same"}), obj(std::int32_t{2})},
+               }),
+               std::invalid_argument);
+
+  while (!allocator.allocated_objects_.empty()) {
+    allocator.pop();
+  }
+}
+
+TEST(anb, static_dictionary_many_keys) {
+  constexpr auto numbers = [] {
+    std::array<std::pair<anb::static_key<ma>, obj>, 300> entries{};
+    for (std::int32_t i = 0; i < 300; ++i) {
+      entries[i] = {obj(i * 7), obj(i)};
+    }
+    return anb::static_dictionary<ma, 300>(entries);
+  }();
+
+  for (std::int32_t i = 0; i < 300; ++i) {
+    ASSERT_TRUE(numbers.contains(obj(i * 7))) << i;
+    EXPECT_EQ(i, numbers.at(obj(i * 7)).as_int32());
+  }
+  EXPECT_FALSE(numbers.contains(obj(std::int32_t{1})));
+}
+
+namespace {
+
+constexpr std::size_t word_count = 1000;
+
+// "k00000", "k00001", ... as one block the string keys point into
+constexpr auto word_chars = [] {
+  std::array<char, word_count * 6> chars{};
+  for (std::size_t i = 0; i < word_count; ++i) {
+    chars[i * 6] = 'k';
+    for (std::size_t d = 0, n = i; d < 5; ++d, n /= 10) {
+      chars[i * 6 + 5 - d] = static_cast<char>('0' + n % 10);
+    }
+  }
+  return chars;
+}();
+
+constexpr std::string_view word(const std::size_t i) {
+  return {word_chars.data() + i * 6, 6};
+}
+
+constexpr auto words = [] {
+  std::array<std::pair<anb::static_key<ma>, obj>, word_count> entries{};
+  for (std::size_t i = 0; i < word_count; ++i) {
+    entries[i] = {word(i), obj(static_cast<std::int32_t>(i))};
+  }
+  return anb::static_dictionary<ma, word_count>(entries);
+}();
+
+}  // namespace
+
+TEST(anb, static_dictionary_many_string_keys) {
+  static_assert(words.at("k00999").as_int32() == 999);
+
+  for (std::size_t i = 0; i < word_count; ++i) {
+    ASSERT_TRUE(words.contains(word(i))) << i;
+    EXPECT_EQ(static_cast<std::int32_t>(i), words.at(word(i)).as_int32());
+  }
+  EXPECT_FALSE(words.contains("k01000"));
+  EXPECT_FALSE(words.contains("k0000"));
+}
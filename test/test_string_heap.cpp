@@ -1,9 +1,44 @@
 #include <gtest/gtest.h>
 
 #include <anb/object.hpp>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <string_view>
 
 #include "test_allocator.hpp"
 
+namespace {
+
+// Runs out of raw memory while fail_ is set
+class failing_allocator {
+ public:
+  template <template <class> typename HeapObjT>
+  HeapObjT<failing_allocator>* alloc() {
+    return new HeapObjT<failing_allocator>(*this);
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<failing_allocator>* obj_ptr) {
+    delete obj_ptr;
+  }
+
+  void* allocate(std::size_t bytes, std::size_t alignment) {
+    if (fail_) {
+      throw std::bad_alloc();
+    }
+    return ::operator new(bytes, std::align_val_t{alignment});
+  }
+
+  void deallocate(void* ptr, std::size_t, std::size_t alignment) {
+    ::operator delete(ptr, std::align_val_t{alignment});
+  }
+
+  bool fail_ = false;
+};
+
+}  // namespace
+
 auto validate_string_roundtrip_heap = [](ma& allocator,
                                          const std::string_view& s) {
   auto heap_str = anb::object<ma>::make_string_heap(allocator);
@@ -53,3 +88,129 @@ TEST(anb, object_string_heap) {
   lorem_str.dealloc_heap(allocator);
   hw_str.dealloc_heap(allocator);
 }
+
+TEST(anb, object_string_heap_append) {
+  auto log_str = anb::object<ma>::make_string_heap(allocator);
+  anb::string<ma>& log = log_str.as_string_heap(allocator);
+
+  std::string expected;
+  for (int i = 0; i < 1000; ++i) {
+    const std::string line = "line " + std::to_string(i) + "\n";
+    log.append(line);
+    expected += line;
+  }
+  // Appended in place, nothing to flatten
+  EXPECT_EQ(1, log.piece_count());
+  EXPECT_EQ(expected.size(), log.size());
+  EXPECT_EQ(expected, log.view());
+
+  auto header_str = anb::object<ma>::make_string_heap(allocator);
+  anb::string<ma>& header = header_str.as_string_heap(allocator);
+  header.set("== header ==\n");
+
+  // Shares the pieces of log, flattened on the first view()
+  header.append(log);
+  header.append("== footer ==");
+  EXPECT_EQ(3, header.piece_count());
+  EXPECT_EQ(13 + expected.size() + 12, header.size());
+
+  auto flat_str = anb::object<ma>::make_string_heap(allocator);
+  flat_str.as_string_heap(allocator).set("== header ==\n" + expected +
+                                         "== footer ==");
+  // Same hash and equality as the flat string
+  EXPECT_EQ(flat_str.hash(), header_str.hash());
+  EXPECT_EQ(flat_str, header_str);
+  EXPECT_EQ(1, header.piece_count());
+
+  // The shared piece is copied on write
+  log.append("more");
+  EXPECT_EQ(expected + "more", log.view());
+  EXPECT_EQ(flat_str.as_string_heap(allocator).view(), header.view());
+
+  // Appending to itself
+  header.set("ab");
+  header.append(header);
+  EXPECT_EQ("abab", header.view());
+  // A view of itself, through the buffer growing under it
+  header.set("abcdefgh");
+  std::string doubled = "abcdefgh";
+  for (int i = 0; i < 4; ++i) {
+    header.append(header.view());
+    doubled += doubled;
+  }
+  EXPECT_EQ(doubled, header.view());
+  // Overlapping the buffer it's written to
+  header.set(header.view().substr(1, 10));
+  EXPECT_EQ("bcdefghabc", header.view());
+
+  log_str.dealloc_heap(allocator);
+  header_str.dealloc_heap(allocator);
+  flat_str.dealloc_heap(allocator);
+}
+
+TEST(anb, object_string_heap_slice) {
+  auto text = anb::object<ma>::make_string_heap(allocator);
+  text.as_string_heap(allocator).set("tokenize this rather long line");
+
+  auto word = anb::object<ma>::make_slice(allocator, text, 0, 8);
+  ASSERT_TRUE(word.is_heap_string(allocator));
+  EXPECT_TRUE(word.as_string_heap(allocator).is_slice());
+  EXPECT_EQ("tokenize", word.as_string_heap(allocator).view());
+  // Shares the characters of text
+  EXPECT_EQ(text.as_string_heap(allocator).view().data(),
+            word.as_string_heap(allocator).view().data());
+
+  auto copy = anb::object<ma>::make_string_heap(allocator);
+  copy.as_string_heap(allocator).set("tokenize");
+  EXPECT_EQ(copy.hash(), word.hash());
+  EXPECT_EQ(copy, word);
+
+  // Short slices are SSO, of heap and SSO strings alike
+  auto this_str = anb::object<ma>::make_slice(allocator, text, 9, 4);
+  ASSERT_TRUE(this_str.is_sso_string());
+  EXPECT_EQ("this", this_str.as_string_sso());
+  auto sso_slice = anb::object<ma>::make_slice(
+      allocator, anb::object<ma>(std::string_view{"abcdef"}), 2);
+  EXPECT_EQ("cdef", sso_slice.as_string_sso());
+
+  // Count is clamped to the end
+  auto tail = anb::object<ma>::make_slice(allocator, text, 14);
+  EXPECT_EQ("rather long line", tail.as_string_heap(allocator).view());
+  EXPECT_THROW(anb::object<ma>::make_slice(allocator, text, 31),
+               std::out_of_range);
+
+  // Slices keep the buffer alive and writes on either side copy it
+  text.as_string_heap(allocator).append(" and more");
+  EXPECT_EQ("tokenize", word.as_string_heap(allocator).view());
+  text.dealloc_heap(allocator);
+  EXPECT_EQ("rather long line", tail.as_string_heap(allocator).view());
+  tail.as_string_heap(allocator).append("s");
+  EXPECT_EQ("rather long lines", tail.as_string_heap(allocator).view());
+  EXPECT_EQ("tokenize", word.as_string_heap(allocator).view());
+
+  word.dealloc_heap(allocator);
+  copy.dealloc_heap(allocator);
+  tail.dealloc_heap(allocator);
+}
+
+TEST(anb, object_string_heap_flatten_failure) {
+  using fobj = anb::object<failing_allocator>;
+  failing_allocator pool;
+  auto left_str = fobj::make_string_heap(pool);
+  auto right_str = fobj::make_string_heap(pool);
+  anb::string<failing_allocator>& left = left_str.as_string_heap(pool);
+  left.set("left ");
+  right_str.as_string_heap(pool).set("right");
+  left.append(right_str.as_string_heap(pool));
+
+  // Stays a rope the next view() flattens
+  pool.fail_ = true;
+  EXPECT_THROW(left.view(), std::bad_alloc);
+  EXPECT_EQ(2, left.piece_count());
+  pool.fail_ = false;
+  EXPECT_EQ("left right", left.view());
+  EXPECT_EQ(1, left.piece_count());
+
+  left_str.dealloc_heap(pool);
+  right_str.dealloc_heap(pool);
+}
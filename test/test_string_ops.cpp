@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+
+#include <anb/string_ops.hpp>
+#include <compare>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+using obj = anb::object<ma>;
+
+obj make_str(const std::string_view str) {
+  obj result;
+  result.assign(allocator, str);
+  return result;
+}
+
+std::strong_ordering reference_icompare(std::string lhs, std::string rhs) {
+  for (auto* str : {&lhs, &rhs}) {
+    for (char& c : *str) {
+      c = anb::detail::ascii_to_lower(c);
+    }
+  }
+  return lhs.compare(rhs) <=> 0;
+}
+
+}  // namespace
+
+TEST(anb, string_ops_sso) {
+  const std::vector<std::string> strs = {"", "a", "Ab", "abc", "ABCD",
+                                         "aBcDe", "abcdef", "abcabc",
+                                         std::string("a\0b", 3)};
+  for (const auto& str : strs) {
+    const obj sso = make_str(str);
+    ASSERT_TRUE(sso.is_sso_string());
+    for (const auto& needle : strs) {
+      for (std::size_t pos = 0; pos <= str.size() + 1; ++pos) {
+        EXPECT_EQ(str.find(needle, pos),
+                  anb::string_find(allocator, sso, needle, pos))
+            << str << " / " << needle << " @ " << pos;
+      }
+      EXPECT_EQ(str.starts_with(needle),
+                anb::string_starts_with(allocator, sso, needle));
+      EXPECT_EQ(reference_icompare(str, needle),
+                anb::string_icompare(allocator, sso, make_str(needle)))
+          << str << " / " << needle;
+    }
+    EXPECT_TRUE(anb::is_valid_utf8(allocator, sso));
+  }
+
+  EXPECT_EQ(std::strong_ordering::equal,
+            anb::string_icompare(allocator, make_str("HeLLo"),
+                                 make_str("hello")));
+
+  // Against heap strings, short ones included, either way round
+  for (const std::string heap_contents :
+       {"", "AB", "abcdeF", "ABCDEFG", "abcabcabcabc", "b"}) {
+    obj heap_str = obj::make_string_heap(allocator);
+    heap_str.as_string_heap(allocator).set(heap_contents);
+    for (const auto& str : strs) {
+      EXPECT_EQ(reference_icompare(str, heap_contents),
+                anb::string_icompare(allocator, make_str(str), heap_str))
+          << str << " / " << heap_contents;
+      EXPECT_EQ(reference_icompare(heap_contents, str),
+                anb::string_icompare(allocator, heap_str, make_str(str)))
+          << heap_contents << " / " << str;
+    }
+    heap_str.dealloc_heap(allocator);
+  }
+  EXPECT_TRUE(anb::is_valid_utf8(allocator, make_str("\xC3\xA9t\xC3\xA9")));
+  EXPECT_FALSE(anb::is_valid_utf8(allocator, make_str("ab\xC3")));
+  EXPECT_FALSE(anb::is_valid_utf8(allocator, make_str("\xC0\xAF")));
+}
+
+TEST(anb, string_ops_heap) {
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> letter(0, 5);
+  const auto random_str = [&](const std::size_t size) {
+    std::string str;
+    for (std::size_t i = 0; i < size; ++i) {
+      str.push_back("abAB-x"[letter(rng)]);
+    }
+    return str;
+  };
+
+  for (const std::size_t size : {7u, 15u, 16u, 17u, 33u, 100u, 1000u}) {
+    const std::string str = random_str(size);
+    obj heap_str = make_str(str);
+    ASSERT_TRUE(heap_str.is_heap_string(allocator));
+
+    for (const std::size_t needle_size : {1u, 2u, 3u, 5u, 9u, 20u}) {
+      for (int i = 0; i < 20; ++i) {
+        const std::string needle = random_str(needle_size);
+        for (const std::size_t pos : {std::size_t{0}, size / 3}) {
+          EXPECT_EQ(str.find(needle, pos),
+                    anb::string_find(allocator, heap_str, needle, pos));
+        }
+      }
+    }
+    EXPECT_EQ(size - 4,
+              anb::string_find(allocator, heap_str, str.substr(size - 4)));
+    EXPECT_TRUE(anb::string_starts_with(allocator, heap_str, str.substr(0, 9)));
+    EXPECT_FALSE(anb::string_starts_with(allocator, heap_str, str + "a"));
+
+    for (int i = 0; i < 20; ++i) {
+      const std::string other = random_str(size - i % 3);
+      EXPECT_EQ(reference_icompare(str, other),
+                anb::string_icompare(allocator, heap_str, make_str(other)));
+    }
+    heap_str.dealloc_heap(allocator);
+  }
+}
+
+TEST(anb, string_ops_utf8) {
+  const std::string ascii(40, 'a');
+  const std::vector<std::pair<std::string, bool>> cases = {
+      {ascii, true},
+      {ascii + "\xC3\xA9", true},                    // U+00E9
+      {ascii + "\xE2\x82\xAC" + ascii, true},        // U+20AC
+      {ascii + "\xF0\x9F\x98\x80", true},            // U+1F600
+      {ascii + "\xF4\x8F\xBF\xBF", true},            // U+10FFFF
+      {ascii + "\xF4\x90\x80\x80", false},           // above U+10FFFF
+      {ascii + "\xED\xA0\x80", false},               // surrogate
+      {ascii + "\xE0\x80\xAF", false},               // overlong
+      {ascii + "\x80", false},                       // lone continuation
+      {ascii + "\xE2\x82", false},                   // truncated
+      {"\xE2\x82\xAC" + ascii + "\xFF" + ascii, false},
+  };
+  for (const auto& [str, valid] : cases) {
+    obj heap_str = make_str(str);
+    EXPECT_EQ(valid, anb::is_valid_utf8(allocator, heap_str));
+    // Cached on the heap string until it's written to
+    auto& heap = heap_str.as_string_heap(allocator);
+    EXPECT_EQ(valid ? anb::utf8_validity::valid : anb::utf8_validity::invalid,
+              heap.cached_utf8_validity());
+    EXPECT_EQ(valid, anb::is_valid_utf8(allocator, heap_str));
+    heap.append("\xC3");
+    EXPECT_EQ(anb::utf8_validity::unknown, heap.cached_utf8_validity());
+    EXPECT_FALSE(anb::is_valid_utf8(allocator, heap_str));
+    heap_str.dealloc_heap(allocator);
+  }
+}
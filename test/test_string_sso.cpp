@@ -34,6 +34,8 @@ TEST(anb, object_string_sso_packed) {
   EXPECT_FALSE(anb::object<ma>::make_nothing().is_sso_string());
   EXPECT_FALSE(anb::object<ma>(42).is_sso_string());
   EXPECT_FALSE(anb::object<ma>(100.24).is_sso_string());
+  // Shares the type ID bits of a packed string
+  EXPECT_FALSE(anb::object<ma>(2.625).is_sso_string());
 
   EXPECT_EQ(anb::object<ma>{std::string{"jon316"}}.hash(),
             anb::object<ma>{std::string{"jon316"}}.hash());
@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include <anb/allocator.hpp>
+#include <anb/object.hpp>
+#include <anb/thread_caching_allocator.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using tca = anb::thread_caching_allocator;
+using obj = anb::object<tca>;
+
+obj make_record(tca& allocator, const std::int32_t i) {
+  auto name = obj::make_string_heap(allocator);
+  name.as_string_heap(allocator).set("record " + std::to_string(i));
+  auto record = obj::make_dictionary(allocator);
+  record.as_dictionary(allocator).object_dict_.insert({obj(i), name});
+  return record;
+}
+
+// The record and the name it holds
+void free_record(tca& allocator, obj& record) {
+  for (auto& [key, value] : record.as_dictionary(allocator).object_dict_) {
+    value.dealloc_heap(allocator);
+  }
+  record.dealloc_heap(allocator);
+}
+
+}  // namespace
+
+TEST(anb, thread_caching_allocator_concept) {
+  static_assert(anb::heap_allocator<tca>);
+  static_assert(anb::detail::raw_allocator<tca>);
+
+  for (std::size_t bytes = 1; bytes <= anb::detail::small_block_limit;
+       ++bytes) {
+    const std::size_t size_class = anb::detail::size_class_of(bytes);
+    ASSERT_LT(size_class, anb::detail::size_class_count);
+    ASSERT_GE(anb::detail::size_class_bytes(size_class), bytes);
+  }
+}
+
+TEST(anb, thread_caching_allocator_local) {
+  tca allocator;
+  auto list = obj::make_list(allocator);
+  for (std::int32_t i = 0; i < 1000; ++i) {
+    list.as_list(allocator).objects_.push_back(obj(i));
+  }
+  auto tuple = obj::make_tuple(allocator, list, 2.5);
+  EXPECT_EQ(999, tuple.as_tuple(allocator)[0]
+                     .as_list(allocator)
+                     .objects_.back()
+                     .as_int32());
+  EXPECT_EQ(1, allocator.heap_count());
+
+  // Freed blocks are reused by the thread that freed them
+  auto* block = &list.as_list(allocator);
+  list.dealloc_heap(allocator);
+  auto reused = obj::make_list(allocator);
+  EXPECT_EQ(block, &reused.as_list(allocator));
+
+  // Blocks too large for the size classes come from the global heap
+  void* large = allocator.allocate(1 << 20, 64);
+  allocator.deallocate(large, 1 << 20, 64);
+
+  tuple.dealloc_heap(allocator);
+  reused.dealloc_heap(allocator);
+}
+
+TEST(anb, thread_caching_allocator_remote_free) {
+  constexpr std::int32_t count = 1000;
+  tca allocator;
+  std::vector<obj> records;
+  std::set<const void*> first_blocks;
+  std::set<const void*> second_blocks;
+
+  std::thread producer([&]() {
+    for (std::int32_t i = 0; i < count; ++i) {
+      records.push_back(make_record(allocator, i));
+      first_blocks.insert(&records.back().as_dictionary(allocator));
+    }
+    std::thread consumer([&]() {
+      for (auto& record : records) {
+        free_record(allocator, record);
+      }
+    });
+    consumer.join();
+
+    // The consumer handed the blocks back, the producer takes them again
+    records.clear();
+    for (std::int32_t i = 0; i < count; ++i) {
+      records.push_back(make_record(allocator, i));
+      second_blocks.insert(&records.back().as_dictionary(allocator));
+    }
+  });
+  producer.join();
+
+  EXPECT_EQ(first_blocks, second_blocks);
+  // Only the producer allocated, the consumer heap was never created
+  EXPECT_EQ(1, allocator.heap_count());
+
+  // The producer exited, its heap and the records' blocks are adopted
+  for (auto& record : records) {
+    free_record(allocator, record);
+  }
+  auto adopted = make_record(allocator, 0);
+  EXPECT_EQ(1, allocator.heap_count());
+  EXPECT_EQ(1, first_blocks.count(&adopted.as_dictionary(allocator)));
+  free_record(allocator, adopted);
+}
+
+TEST(anb, thread_caching_allocator_producers_consumers) {
+  static constexpr std::size_t pairs = 4;
+  static constexpr std::int32_t count = 2000;
+  tca allocator;
+
+  struct channel {
+    std::mutex mutex;
+    std::vector<obj> records;
+    bool done = false;
+  };
+  std::vector<channel> channels(pairs);
+
+  std::vector<std::thread> threads;
+  for (std::size_t pair = 0; pair < pairs; ++pair) {
+    threads.emplace_back([&allocator, &chan = channels[pair]]() {
+      for (std::int32_t i = 0; i < count; ++i) {
+        auto record = make_record(allocator, i);
+        std::lock_guard lock(chan.mutex);
+        chan.records.push_back(record);
+      }
+      std::lock_guard lock(chan.mutex);
+      chan.done = true;
+    });
+    threads.emplace_back([&allocator, &chan = channels[pair]]() {
+      std::int32_t consumed = 0;
+      while (true) {
+        std::vector<obj> batch;
+        bool done = false;
+        {
+          std::lock_guard lock(chan.mutex);
+          batch.swap(chan.records);
+          done = chan.done;
+        }
+        for (auto& record : batch) {
+          EXPECT_EQ(consumed, record.as_dictionary(allocator)
+                                  .object_dict_.begin()
+                                  ->first.as_int32());
+          free_record(allocator, record);
+          ++consumed;
+        }
+        if (done && batch.empty()) {
+          break;
+        }
+        std::this_thread::yield();
+      }
+      EXPECT_EQ(count, consumed);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // Consumers only free, they never needed a heap
+  EXPECT_LE(allocator.heap_count(), pairs);
+}
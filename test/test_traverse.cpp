@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+
+#include <anb/clone.hpp>
+#include <anb/footprint.hpp>
+#include <compare>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "test_allocator.hpp"
+
+namespace {
+
+// Frees everything at once, deep graphs are too large to dealloc one by one
+// from the mock allocator
+class graph_allocator {
+ public:
+  graph_allocator() = default;
+  graph_allocator(const graph_allocator&) = delete;
+  graph_allocator& operator=(const graph_allocator&) = delete;
+
+  ~graph_allocator() {
+    for (auto* obj_ptr : objects_) {
+      delete obj_ptr;
+    }
+  }
+
+  template <template <class> typename HeapObjT>
+  HeapObjT<graph_allocator>* alloc() {
+    auto ptr = new HeapObjT<graph_allocator>(*this);
+    objects_.push_back(ptr);
+    return ptr;
+  }
+
+  template <template <class> typename HeapObjT>
+  void dealloc(HeapObjT<graph_allocator>*) {}
+
+  void* allocate(std::size_t bytes, std::size_t alignment) {
+    return ::operator new(bytes, std::align_val_t{alignment});
+  }
+
+  void deallocate(void* ptr, std::size_t, std::size_t alignment) {
+    ::operator delete(ptr, std::align_val_t{alignment});
+  }
+
+ private:
+  std::vector<anb::heap_object<graph_allocator>*> objects_;
+};
+using ga = graph_allocator;
+
+// [[[...[leaf]...]]] nested depth lists deep
+anb::object<ga> make_nested(ga& graph, const std::size_t depth,
+                            const anb::object<ga>& leaf) {
+  auto root = anb::object<ga>::make_list(graph);
+  auto current = root;
+  for (std::size_t i = 1; i < depth; ++i) {
+    auto child = anb::object<ga>::make_list(graph);
+    current.as_list(graph).objects_.push_back(child);
+    current = child;
+  }
+  current.as_list(graph).objects_.push_back(leaf);
+  return root;
+}
+
+}  // namespace
+
+TEST(anb, traverse_deeply_nested) {
+  constexpr std::size_t depth = 100000;
+  ga graph;
+  const auto nested = make_nested(graph, depth, anb::object<ga>(1));
+  const auto same = make_nested(graph, depth, anb::object<ga>(1));
+  const auto different = make_nested(graph, depth, anb::object<ga>(2));
+
+  EXPECT_EQ(nested.hash(), same.hash());
+  EXPECT_NE(nested.hash(), different.hash());
+  EXPECT_EQ(nested, same);
+  EXPECT_NE(nested, different);
+  EXPECT_EQ(std::strong_ordering::equal, nested.compare(same));
+  EXPECT_LT(nested, different);
+
+  EXPECT_EQ(depth, anb::deep_size(graph, nested)[anb::heap_object_type::list]
+                       .count);
+  EXPECT_EQ(depth, anb::measure_graph(graph, nested).lists);
+
+  const auto copy = anb::deep_clone(graph, graph, nested);
+  EXPECT_EQ(nested, copy);
+
+  std::stringstream dump_stream;
+  anb::write_heap_dump(dump_stream, graph, nested);
+  EXPECT_EQ(depth, anb::read_heap_dump(dump_stream).nodes.size());
+}
+
+TEST(anb, traverse_cycles) {
+  // a = [1, a], b = [1, b], c = [1, [1, c]]
+  const anb::object<ma> one(1);
+  auto a = anb::object<ma>::make_list(allocator);
+  a.as_list(allocator).set(one, a);
+  auto b = anb::object<ma>::make_list(allocator);
+  b.as_list(allocator).set(one, b);
+  auto c = anb::object<ma>::make_list(allocator);
+  auto c_inner = anb::object<ma>::make_list(allocator);
+  c_inner.as_list(allocator).set(one, c);
+  c.as_list(allocator).set(one, c_inner);
+
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(a.hash(), b.hash());
+  // Equal once unrolled, but cycles closing at different distances differ
+  EXPECT_NE(a, c);
+  EXPECT_EQ(std::strong_ordering::equal, a.compare(b));
+  EXPECT_LT(a, c);
+  EXPECT_GT(c, a);
+
+  // d = {"self": d}
+  auto d = anb::object<ma>::make_dictionary(allocator);
+  d.as_dictionary(allocator).object_dict_.insert(
+      {anb::object<ma>(std::string_view{"self"}), d});
+  EXPECT_EQ(d, d);
+  d.hash();
+  auto e = anb::object<ma>::make_dictionary(allocator);
+  e.as_dictionary(allocator).object_dict_.insert(
+      {anb::object<ma>(std::string_view{"self"}), e});
+  EXPECT_EQ(std::strong_ordering::equal, d.compare(e));
+
+  const auto size = anb::deep_size(allocator, a);
+  EXPECT_EQ(1, size[anb::heap_object_type::list].count);
+  EXPECT_EQ(1, size.shared_references);
+  EXPECT_EQ(1, anb::measure_graph(allocator, c).cycles);
+
+  EXPECT_THROW(anb::deep_clone(allocator, allocator, a),
+               std::invalid_argument);
+  auto copy = anb::deep_clone(allocator, allocator, a,
+                              anb::clone_options{.deduplicate_shared = true});
+  const auto& copy_objects = copy.as_list(allocator).objects_;
+  ASSERT_EQ(2, copy_objects.size());
+  EXPECT_EQ(&copy.as_list(allocator), &copy_objects[1].as_list(allocator));
+  EXPECT_EQ(a, copy);
+
+  for (auto* heap_obj : {&a, &b, &c, &c_inner, &d, &e, &copy}) {
+    heap_obj->dealloc_heap(allocator);
+  }
+}
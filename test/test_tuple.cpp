@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <anb/object.hpp>
+#include <compare>
+
+#include "test_allocator.hpp"
+
+TEST(anb, object_tuple) {
+  ma tuple_alloc;
+
+  auto name = anb::object<ma>::make_string_heap(tuple_alloc);
+  name.as_string_heap(tuple_alloc).set("Jimmy Stewart");
+
+  const std::size_t string_bytes = tuple_alloc.allocated_bytes_;
+  auto record = anb::object<ma>::make_tuple(
+      tuple_alloc, std::int32_t{1946}, name, 8.6, anb::object<ma>(true));
+  EXPECT_EQ(sizeof(double), sizeof(record));
+
+  // One block for the header and elements, next to the heap string
+  EXPECT_EQ(1, tuple_alloc.allocated_objects_.size());
+  EXPECT_EQ(anb::tuple<ma>::block_size(4),
+            tuple_alloc.allocated_bytes_ - string_bytes);
+
+  EXPECT_TRUE(record.is_tuple(tuple_alloc));
+  EXPECT_FALSE(record.is_list(tuple_alloc));
+  EXPECT_FALSE(name.is_tuple(tuple_alloc));
+  EXPECT_FALSE(anb::object<ma>(42).is_tuple(tuple_alloc));
+
+  const anb::tuple<ma>& t = record.as_tuple(tuple_alloc);
+  EXPECT_EQ(4, t.size());
+  EXPECT_EQ(1946, t[0].as_int32());
+  EXPECT_EQ("Jimmy Stewart", t[1].as_string_heap(tuple_alloc).view());
+  EXPECT_EQ(8.6, t.at(2).as_float64());
+  EXPECT_TRUE(t.at(3).as_boolean());
+
+  auto same_record = anb::object<ma>::make_tuple(
+      tuple_alloc, std::int32_t{1946}, name, 8.6, anb::object<ma>(true));
+  auto other_record = anb::object<ma>::make_tuple(
+      tuple_alloc, std::int32_t{1947}, name, 8.6, anb::object<ma>(true));
+  EXPECT_EQ(record.hash(), same_record.hash());
+  EXPECT_NE(record.hash(), other_record.hash());
+
+  auto same_list = anb::object<ma>::make_list(tuple_alloc);
+  same_list.as_list(tuple_alloc)
+      .set(anb::object<ma>(std::int32_t{1946}), name, anb::object<ma>(8.6),
+           anb::object<ma>(true));
+  EXPECT_NE(record.hash(), same_list.hash());
+
+  // Composite dictionary keys
+  auto dict = anb::object<ma>::make_dictionary(tuple_alloc);
+  anb::dictionary<ma>& d = dict.as_dictionary(tuple_alloc);
+  d.set<std::pair>({record, anb::object<ma>(std::string_view{"found"})});
+  EXPECT_EQ("found", d.object_dict_.at(same_record).as_string_sso());
+  EXPECT_FALSE(d.object_dict_.contains(other_record));
+
+  auto empty = anb::object<ma>::make_tuple(tuple_alloc);
+  EXPECT_TRUE(empty.as_tuple(tuple_alloc).empty());
+
+  record.dealloc_heap(tuple_alloc);
+  same_record.dealloc_heap(tuple_alloc);
+  other_record.dealloc_heap(tuple_alloc);
+  empty.dealloc_heap(tuple_alloc);
+
+  // The buffers of the other heap objects went back to the allocator too
+  while (!tuple_alloc.allocated_objects_.empty()) {
+    tuple_alloc.pop();
+  }
+  EXPECT_EQ(0, tuple_alloc.allocated_bytes_);
+}
+
+TEST(anb, object_tuple_of_changed_containers) {
+  ma tuple_alloc;
+  using obj = anb::object<ma>;
+
+  // Tuples of containers are hashed as their elements are now
+  auto full = obj::make_list(tuple_alloc);
+  full.as_list(tuple_alloc).set(obj(std::int32_t{1}));
+  auto filled_later = obj::make_list(tuple_alloc);
+  auto lhs = obj::make_tuple(tuple_alloc, full, obj(2.5));
+  auto rhs = obj::make_tuple(tuple_alloc, filled_later, obj(2.5));
+  EXPECT_FALSE(lhs.as_tuple(tuple_alloc).keeps_hash());
+  filled_later.as_list(tuple_alloc).set(obj(std::int32_t{1}));
+
+  EXPECT_EQ(lhs, rhs);
+  EXPECT_EQ(lhs.hash(), rhs.hash());
+  EXPECT_EQ(std::strong_ordering::equal, lhs.compare(rhs));
+
+  // Found as a dictionary key once equal
+  auto dict = obj::make_dictionary(tuple_alloc);
+  dict.as_dictionary(tuple_alloc).set<std::pair>({lhs, obj(true)});
+  EXPECT_TRUE(dict.as_dictionary(tuple_alloc).object_dict_.contains(rhs));
+
+  filled_later.as_list(tuple_alloc).objects_.push_back(obj(true));
+  EXPECT_NE(lhs, rhs);
+  EXPECT_NE(lhs.hash(), rhs.hash());
+  EXPECT_LT(lhs, rhs);
+
+  // And so are tuples of heap strings, and tuples holding such tuples
+  auto name = obj::make_string_heap(tuple_alloc);
+  name.as_string_heap(tuple_alloc).set("before the change");
+  auto inner = obj::make_tuple(tuple_alloc, name);
+  auto outer = obj::make_tuple(tuple_alloc, inner, obj(std::int32_t{3}));
+  name.as_string_heap(tuple_alloc).set("after the change");
+  auto same_name = obj::make_string_heap(tuple_alloc);
+  same_name.as_string_heap(tuple_alloc).set("after the change");
+  auto same_outer = obj::make_tuple(
+      tuple_alloc, obj::make_tuple(tuple_alloc, same_name),
+      obj(std::int32_t{3}));
+  EXPECT_FALSE(outer.as_tuple(tuple_alloc).keeps_hash());
+  EXPECT_EQ(outer, same_outer);
+  EXPECT_EQ(outer.hash(), same_outer.hash());
+
+  // Tuples of fixed values keep the hash they were created with, which
+  // agrees with the hash of equal tuples walked through their elements
+  auto fixed = obj::make_tuple(tuple_alloc, obj(std::int32_t{1}),
+                               obj(std::string_view{"sso"}));
+  auto nested = obj::make_tuple(tuple_alloc, fixed, obj::make_nothing());
+  EXPECT_TRUE(nested.as_tuple(tuple_alloc).keeps_hash());
+  auto heap_sso = obj::make_string_heap(tuple_alloc);
+  heap_sso.as_string_heap(tuple_alloc).set("sso");
+  auto walked = obj::make_tuple(
+      tuple_alloc, obj::make_tuple(tuple_alloc, obj(std::int32_t{1}), heap_sso),
+      obj::make_nothing());
+  EXPECT_EQ(nested, walked);
+  EXPECT_EQ(nested.hash(), walked.hash());
+
+  while (!tuple_alloc.allocated_objects_.empty()) {
+    tuple_alloc.pop();
+  }
+}